@@ -10,8 +10,28 @@
  *  AFSS_TX_PIN       -- pin to transmit on
  *  AFSS_RX_PIN       -- pin to receive on
  *  AFSS_DISABLE_READ -- removes read code & buffer, for transmit-only uses
- *  AFSS_MAX_RX_BUFF  -- size of RX buffer
+ *  AFSS_MAX_RX_BUFF  -- size of RX buffer, a power of two up to 128
+ *                       (defaults to 64)
  *  AFSS_EXTRA_PRINT_FUNCS -- extra printing functions, like Serial.print(...)
+ *  AFSS_BUSY_RX      -- receive a whole byte inside the pin change interrupt,
+ *                       busy waiting between bits, as the original did
+ *
+ * The pin change interrupt only catches the start bit.  It turns itself
+ * off and starts Timer2, whose compare interrupt samples the middle of
+ * each data bit and of the stop bit.  The pin change interrupt is back on
+ * from the last data bit, so a stop bit sample held up by some other
+ * interrupt doesn't miss the next start bit; the byte is then taken
+ * without its stop bit checked.  So interrupts are only held up for a few
+ * us a bit instead of a whole byte (~2ms at 4800 baud), and 19200 and
+ * 38400 baud work.  Bytes without a stop bit are counted in
+ * afss_framing_errors.  Uses Timer2, so no PWM on pins 3 and 11; with
+ * AFSS_BUSY_RX it doesn't.
+ *
+ * Received bytes go into a ring: the pin change interrupt only moves
+ * the head and AFSoftSerial_read() only the tail, so neither has to
+ * turn interrupts off and a read takes the same time however many bytes
+ * are waiting.  Bytes arriving with the ring full are dropped and
+ * counted in afss_overflows.
  *
  */
 /*
@@ -63,11 +83,22 @@
 #define _transmitPin AFSS_TX_PIN
 #define _receivePin  AFSS_RX_PIN
 
-static char _receive_buffer[AFSS_MAX_RX_BUFF]; 
-static uint8_t _receive_buffer_index;
+#ifndef AFSS_DISABLE_READ
+#ifndef AFSS_MAX_RX_BUFF
+#define AFSS_MAX_RX_BUFF 64
+#endif
+#if (AFSS_MAX_RX_BUFF & (AFSS_MAX_RX_BUFF - 1)) || AFSS_MAX_RX_BUFF > 128
+#error "AFSS_MAX_RX_BUFF must be a power of two up to 128"
+#endif
+
+static volatile char _receive_buffer[AFSS_MAX_RX_BUFF]; 
+static volatile uint8_t _receive_buffer_head;   // where the interrupt puts the next byte
+static volatile uint8_t _receive_buffer_tail;   // where read() takes the next one
+static volatile uint8_t afss_overflows;         // bytes dropped, the ring being full
+#endif
 
 
-#if (F_CPU == 16000000)
+#if (F_CPU == 16000000) && defined(__AVR__)
 static void afss_whackDelay(uint16_t delay) { 
   uint8_t tmp=0;
 
@@ -87,6 +118,20 @@ static void afss_whackDelay(uint16_t delay) {
  ****************************************************************************/
 #ifndef AFSS_DISABLE_READ
 
+// puts a received byte in the ring, or counts it if there's no room
+static void afss_store(uint8_t d)
+{
+    uint8_t head = _receive_buffer_head;
+    if ((uint8_t)(head - _receive_buffer_tail) == AFSS_MAX_RX_BUFF) {
+        afss_overflows++;
+        return;
+    }
+    _receive_buffer[head % AFSS_MAX_RX_BUFF] = d; // save data 
+    _receive_buffer_head = head + 1;  // got a byte, now read() may have it
+}
+
+#ifdef AFSS_BUSY_RX
+
 static void afss_recv(void)
 { 
     char i, d = 0; 
@@ -101,12 +146,88 @@ static void afss_recv(void)
             d |= (1 << i); 
     } 
     afss_whackDelay(_bitDelay*2);
-    if (_receive_buffer_index >=  AFSS_MAX_RX_BUFF)
-        return;
-    _receive_buffer[_receive_buffer_index] = d; // save data 
-    _receive_buffer_index++;  // got a byte 
+    afss_store(d);
 } 
 
+#else
+
+// the RX pin's pin change mask register and bit
+#if _receivePin < 8
+#define AFSS_PCMSK PCMSK2
+#define AFSS_PCIE  2
+#define AFSS_PCBIT _receivePin
+#else
+#define AFSS_PCMSK PCMSK0
+#define AFSS_PCIE  0
+#define AFSS_PCBIT (_receivePin - 8)
+#endif
+
+// Timer2 clock, so that 1.5 bit times fit its 8 bits
+#if AFSS_BAUD >= 19200
+#define AFSS_PRESCALE 8
+#define AFSS_TIMER_CS _BV(CS21)
+#elif AFSS_BAUD >= 4800
+#define AFSS_PRESCALE 32
+#define AFSS_TIMER_CS (_BV(CS21) | _BV(CS20))
+#else
+#define AFSS_PRESCALE 64
+#define AFSS_TIMER_CS _BV(CS22)
+#endif
+#define AFSS_BIT_TICKS ((F_CPU / AFSS_PRESCALE + AFSS_BAUD / 2) / AFSS_BAUD)
+// cycles from an interrupt's flag being set to its digitalRead() being
+// done, about: the pin change one clears TCNT2 that late after the start
+// bit's edge, and Timer2's samples that late after each match
+#define AFSS_ISR_CYCLES 100
+// from clearing TCNT2 to the match for the middle of the first data bit
+#define AFSS_FIRST_TICKS \
+    ((F_CPU * 3 / 2 / AFSS_BAUD - 2 * AFSS_ISR_CYCLES) / AFSS_PRESCALE)
+
+static volatile uint8_t afss_framing_errors;
+static uint8_t afss_rx_byte;      // the bits so far, coming in low first
+static uint8_t afss_rx_bits = 9;  // how many, 8 meaning the stop bit is next, 9 none
+
+static void afss_recv(void)
+{
+    if (digitalRead(_receivePin)) 
+        return;       // not a start bit
+    if (afss_rx_bits == 8)
+        afss_store(afss_rx_byte);     // the stop bit's sample was held up
+    TCNT2 = 0;
+    OCR2A = AFSS_FIRST_TICKS - 1;
+    TIFR2 = _BV(OCF2A);
+    TIMSK2 |= _BV(OCIE2A);
+    AFSS_PCMSK &= ~_BV(AFSS_PCBIT);   // the data bits' edges are Timer2's
+    afss_rx_bits = 0;
+}
+
+SIGNAL(SIG_OUTPUT_COMPARE2A)
+{
+    uint8_t level = digitalRead(_receivePin);
+    OCR2A = AFSS_BIT_TICKS - 1;       // the counter restarted at the match
+    if (afss_rx_bits < 8) {
+        afss_rx_byte >>= 1;
+        if (level)
+            afss_rx_byte |= 0x80;
+        if (++afss_rx_bits == 8) {
+            // only the stop bit's edge, if any, is left before the next
+            // start bit, and afss_recv() ignores a rising one
+            PCIFR = _BV(AFSS_PCIE);
+            AFSS_PCMSK |= _BV(AFSS_PCBIT);
+        }
+        return;
+    }
+    // middle of the stop bit
+    TIMSK2 &= ~_BV(OCIE2A);
+    afss_rx_bits = 9;
+    if (level)
+        afss_store(afss_rx_byte);
+    else
+        afss_framing_errors++;
+}
+
+#endif
+
+
 SIGNAL(SIG_PIN_CHANGE0)
 {
     if ((_receivePin >=8) && (_receivePin <= 13)) {
@@ -133,6 +254,23 @@ static void AFSoftSerial_begin()
 #ifndef AFSS_DISABLE_READ
   pinMode(_receivePin, INPUT); 
   digitalWrite(_receivePin, HIGH);  // pullup!
+  _receive_buffer_head = _receive_buffer_tail = 0;
+  afss_overflows = 0;
+#ifndef AFSS_BUSY_RX
+  afss_framing_errors = 0;
+  cli();
+  TCCR2A = _BV(WGM21);                // CTC on OCR2A
+  TCCR2B = AFSS_TIMER_CS;
+  TIMSK2 &= ~_BV(OCIE2A);
+  sei();
+#endif
+#if _receivePin < 8
+  PCMSK2 |= _BV(_receivePin);       // a PIND pin, PCINT16-23
+  PCICR |= _BV(2);
+#else
+  PCMSK0 |= _BV(_receivePin - 8);   // a PINB pin, PCINT0-5
+  PCICR |= _BV(0);
+#endif
 #endif
   afss_whackDelay(_bitDelay*2); // if we were low this establishes the end
 }
@@ -140,24 +278,20 @@ static void AFSoftSerial_begin()
 #ifndef AFSS_DISABLE_READ
 static int AFSoftSerial_read(void)
 {
-  uint8_t d,i;
+  uint8_t d;
+  uint8_t tail = _receive_buffer_tail;
 
-  if (! _receive_buffer_index)
+  if (tail == _receive_buffer_head)
     return -1;
 
-  d = _receive_buffer[0]; // grab first byte
-  // if we were awesome we would do some nifty queue action
-  // sadly, i dont care
-  for (i=0; i<_receive_buffer_index; i++) {
-    _receive_buffer[i] = _receive_buffer[i+1];
-  }
-  _receive_buffer_index--;
+  d = _receive_buffer[tail % AFSS_MAX_RX_BUFF]; // grab oldest byte
+  _receive_buffer_tail = tail + 1;  // only now may the interrupt reuse it
   return d;
 }
 
 static uint8_t AFSoftSerial_available(void)
 {
-  return _receive_buffer_index;
+  return (uint8_t)(_receive_buffer_head - _receive_buffer_tail);
 }
 #endif
 
@@ -3,6 +3,7 @@
 #include "fat16.h"
 #include "sd_raw.h"
 #include "partition.h"
+#include "WProgram.h"
 #include <string.h>
 
 
@@ -16,10 +17,13 @@
 
 
 AF_SDLog::AF_SDLog(void) {
-
+  sync_seconds = 0;
+  errors = 0;
+  state = 0;
 }
 
 uint8_t AF_SDLog::init_card(void) {
+  state = 0;
   return sd_raw_init();
 }
 
@@ -108,14 +112,161 @@ uint8_t AF_SDLog::create_file(char *name) {
   return fat16_create_file(dd, name, &file_entry);
 }
 
+// Look at every name in the directory once and return the highest
+// number n of the files named <prefix><n>.<ext>, or -1 if there are none.
+// The prefix may be fixed ("GPSL") or carry a date ("0908").
+int32_t AF_SDLog::last_numbered_file(const char *prefix) {
+  struct fat16_dir_entry_struct entry;
+  uint8_t len = strlen(prefix);
+  int32_t last = -1;
+
+  fat16_reset_dir(dd);
+  while(fat16_read_dir(dd, &entry)) {
+    if(strncmp(entry.long_name, prefix, len) != 0)
+      continue;
+
+    char *p = entry.long_name + len;
+    uint32_t n = 0;
+    uint8_t digits = 0;
+    while(*p >= '0' && *p <= '9') {
+      n = n * 10 + (*p++ - '0');
+      digits++;
+    }
+    if(digits && (*p == '.' || *p == 0) && (int32_t) n > last)
+      last = n;
+  }
+  return last;
+}
+
+// Build <prefix><number>.<ext>, the number zero-padded to fill the
+// 8 characters before the dot.  Returns 0 if the number does not fit.
+uint8_t AF_SDLog::numbered_name(char *name, const char *prefix, uint16_t number, const char *ext) {
+  uint8_t len = strlen(prefix);
+  if(len >= 8)
+    return 0;
+
+  strcpy(name, prefix);
+  uint8_t i;
+  for(i = 8; i > len; i--) {
+    name[i - 1] = '0' + number % 10;
+    number /= 10;
+  }
+  if(number)
+    return 0;
+
+  name[8] = '.';
+  strcpy(name + 9, ext);
+  return 1;
+}
+
 /*
 uint8_t AF_SDLog::seek_file(File fd, int32_t *offset, uint8_t whence) {
   return  fat16_seek_file(fd, offset, whence);
 }*/
 
 
-uint8_t AF_SDLog::write_file(File f, uint8_t *buff, uint8_t siz) {
-  return fat16_write_file(f, buff, siz);
+// Reads the next num bytes of the file, or fewer at its end.  Logs
+// read front to back come through multi-block reads, see sd_raw.
+int16_t AF_SDLog::read_file(File f, uint8_t *b, uint16_t num) {
+  return fat16_read_file(f, b, num);
+}
+
+// Counts a failed write and decides whether to try again: not if the
+// card is gone, in which case card_state() says so from now on and
+// writes give up right away.
+uint8_t AF_SDLog::write_failed(void) {
+  errors++;
+  if(!sd_raw_available())
+    state |= SDLOG_CARD_GONE;
+  return !state;
+}
+
+// Writes all of buff or returns how much got written.  The data the
+// card refused stays buffered in sd_raw, so trying again just picks up
+// where fat16_write_file() stopped.
+uint16_t AF_SDLog::write_file(File f, uint8_t *buff, uint16_t siz) {
+  uint16_t done = 0;
+  uint8_t tries = 0;
+
+  while(!state) {
+    int16_t r = fat16_write_file(f, buff + done, siz - done);
+    if(r > 0)
+      done += r;
+    if(done == siz)
+      break;
+    if(!write_failed())
+      break;
+    if(tries == SDLOG_WRITE_RETRIES) {
+      // only worth a look at the whole FAT when trying again didn't help
+      if(fat16_get_fs_free(fs) < fs->header.cluster_size)
+        state |= SDLOG_CARD_FULL;
+      break;
+    }
+    delay(SDLOG_RETRY_MILLIS << tries++);
+  }
+
+  if(!state && sync_seconds && millis() - sync_millis >= sync_seconds * 1000UL)
+    sync_file(f);
+  return done;
+}
+
+// Grow the (empty) file by runs of contiguous clusters; close_file()
+// gives back whatever was not used.
+uint8_t AF_SDLog::reserve_file(File f, uint16_t clusters) {
+  return fat16_reserve_file(f, clusters);
+}
+
+// Write the file size to the directory entry only every 'bytes' bytes
+// and/or every 'seconds' seconds (zero for never), plus on every cluster
+// boundary with FAT16_SYNC_CLUSTER in flags.  All zero writes it on
+// every write, as before.
+uint8_t AF_SDLog::set_sync_policy(File f, uint16_t bytes, uint16_t seconds, uint8_t flags) {
+  if(seconds)
+    flags |= FAT16_SYNC_DEFER;
+  sync_seconds = seconds;
+  sync_millis = millis();
+  return fat16_set_file_sync(f, bytes, flags);
+}
+
+// Get the file size and any buffered data onto the card now.
+// A sync that fails is tried again like a write, as until one gets
+// through, a power loss costs everything since the last one.
+uint8_t AF_SDLog::sync_file(File f) {
+  uint8_t tries = 0;
+
+  sync_millis = millis();
+  while(!state) {
+    if(fat16_sync_file(f) && sd_raw_sync())
+      return 1;
+    if(!write_failed() || tries == SDLOG_WRITE_RETRIES)
+      break;
+    delay(SDLOG_RETRY_MILLIS << tries++);
+  }
+  return 0;
+}
+
+// Run once at boot on the last log written: if the power or the card
+// went away while it was open, its size is cut back to what was last
+// synced and its unused reserved clusters are given back.  A file
+// closed properly is left as it is.
+uint8_t AF_SDLog::recover_file(char *name) {
+  File f = open_file(name);
+  if(!f)
+    return 0;
+  uint8_t r = fat16_recover_file(f);
+  close_file(f);
+  return r && sd_raw_sync();
+}
+
+// Writes that failed, whether or not trying again helped.
+uint16_t AF_SDLog::write_errors(void) {
+  return errors;
+}
+
+// Zero while the card takes writes, else SDLOG_CARD_GONE and/or
+// SDLOG_CARD_FULL.  Writing stays given up until init_card().
+uint8_t AF_SDLog::card_state(void) {
+  return state;
 }
 
 
@@ -123,3 +274,12 @@ uint8_t AF_SDLog::write_file(File f, uint8_t *buff, uint8_t siz) {
 void AF_SDLog::close_file(File f) {
    fat16_close_file(f);
 }
+
+// Send runs of consecutive blocks as one multi-block write from now on.
+uint8_t AF_SDLog::begin_stream(void) {
+  return sd_raw_stream_begin();
+}
+
+uint8_t AF_SDLog::end_stream(void) {
+  return sd_raw_stream_end();
+}
@@ -11,11 +11,26 @@
 
 typedef struct fat16_file_struct * File;
 
+// a failed write is tried again this many times, after waiting
+// SDLOG_RETRY_MILLIS, then twice that, and so on
+#define SDLOG_WRITE_RETRIES 3
+#define SDLOG_RETRY_MILLIS 10
+
+// what card_state() reports once writing has been given up
+#define SDLOG_CARD_GONE (1 << 0)
+#define SDLOG_CARD_FULL (1 << 1)
+
 class AF_SDLog {
   struct partition_struct *partition;
   struct fat16_fs_struct* fs;
   struct fat16_dir_struct* dd;
   struct fat16_dir_entry_struct file_entry;
+  uint16_t sync_seconds;
+  unsigned long sync_millis;
+  uint16_t errors;
+  uint8_t state;
+
+  uint8_t write_failed(void);
 
  public:
   AF_SDLog(void);
@@ -29,8 +44,19 @@ class AF_SDLog {
   File open_file(char *name);
   void close_file(File f);
   uint8_t create_file(char *name);
-  uint8_t write_file(File f, uint8_t *b, uint8_t num);
+  int32_t last_numbered_file(const char *prefix);
+  uint8_t numbered_name(char *name, const char *prefix, uint16_t number, const char *ext);
+  int16_t read_file(File f, uint8_t *b, uint16_t num);
+  uint16_t write_file(File f, uint8_t *b, uint16_t num);
+  uint8_t reserve_file(File f, uint16_t clusters);
+  uint8_t set_sync_policy(File f, uint16_t bytes, uint16_t seconds, uint8_t flags);
+  uint8_t sync_file(File f);
+  uint8_t recover_file(char *name);
+  uint16_t write_errors(void);
+  uint8_t card_state(void);
   uint8_t seek_file(File fd, int32_t *offset, uint8_t whence);
+  uint8_t begin_stream(void);
+  uint8_t end_stream(void);
 };
 
 #endif
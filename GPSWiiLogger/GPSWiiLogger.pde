@@ -18,6 +18,9 @@
 //#define LOG_RMC_FIXONLY 0  // turned off only logging on fix for John
 
 #include "AF_SDLog.h"
+#include "nmea_rx.h"
+#include "pod_link.h"
+#include "log_record.h"
 
 #include "util.h"
 #include <avr/pgmspace.h>
@@ -28,26 +31,65 @@
 #define led2Pin 3                // LED2 connected to digital pin 3
 #define powerPin 2               // GPS power control
 
-// this MUST match the same defines in GPSWiiUI
-// every this many millisecs, read sensors, should be even mult of 1000
-#define sensorUpdatesPerSec 10
-#define sensorUpdateMillis (1000/sensorUpdatesPerSec)
-#define sensorPacketSize 7   // "|xxyyzz" 7 bytes
-#define sensorBuffSize ((sensorPacketSize*sensorUpdatesPerSec)+5)
+// GPSWiiUI samples at whatever rate it is set to, and fits a second of
+// them into the number of 10 bit samples we ask for, delta coded (see
+// sample_delta.h): about 4.5 bytes a sample, so 14 of them leave some
+// room in an nmea_rx slot for a shaky ride, the pod leaving out what
+// does not fit.  A binary record holds 10.  Old pods send ten "|xxyyzz"
+// instead.
+#define sensorPacketSamples 14
+
+// the log grows by runs of this many contiguous clusters, so crossing
+// a cluster boundary mid-ride does not have to search the FAT
+#define logReserveClusters 32
+
+// logs are named GPSL0000.TXT, GPSL0001.TXT, ...
+#define logPrefix "GPSL"
+
+// the log's size is written to its directory entry this often and when
+// it grows into another cluster; a power loss costs at most that long
+#define logSyncSeconds 10
+
+// GPS and sensor pod lines are received by the interrupt in nmea_rx.cpp,
+// into NMEA_RX_SLOTS slots; the Makefile takes Arduino's RX handler and
+// buffer out of wiring_serial.c and sets NMEA_RX_ISR.  Built without it,
+// loop() passes on what Serial.read() has instead.
+
+// the sensor pod's reply (~200ms at 4800 baud) is waited for this long
+// before the request is sent again, up to podRetries times, but never
+// later than podWindowMillis after the fix so it can't run into the
+// next GPS sentence on the shared RX line
+#define podTimeoutMillis 300
+#define podRetries 1
+#define podWindowMillis 500
+
+// set to 1 to log each fix and its sensor samples as one 64 byte record
+// (see log_record.h) to GPSLnnnn.BIN instead of ~140 bytes of text;
+// host/logconv turns it back into the text log
+#define logBinary 0
+#if logBinary
+#define logExt "BIN"
+#else
+#define logExt "TXT"
+#endif
 
-// Reduce Arduino's Serial RAM footprint!
-// set RX_BUFFER_SIZE to 32 in ..../hardware/cores/arduino/wiring_serial.c
+// samples asked of the pod per fix, see sensorPacketSamples
+#if logBinary
+#define podPacketSamples LOG_RECORD_SAMPLES
+#else
+#define podPacketSamples sensorPacketSamples
+#endif
 
 
 AF_SDLog card;
 File f;
 
+char name[13];              // 8.3 name of the log
 
-// we buffer one NMEA sentense at a time, 
-// 83 bytes is longer than the max length
-#define BUFFSIZE 75 
-char buffer[BUFFSIZE];      // this is the double buffer
-uint8_t bufferidx = 0;
+#if logBinary
+struct log_record rec;      // the fix waiting for its sensor samples
+uint8_t rec_open = 0;
+#endif
 
 #define LOG_RMC_FIXONLY 1  // log only when we get RMC's with fix?
 #define RMC_ON   "$PSRF103,4,0,1,1*21\r\n"   // cmd to turn RMC on (1 hz rate)
@@ -62,16 +104,6 @@ uint8_t logging = 0; // 1 == log to disk, 0 = no
 uint8_t i;
 
 
-// read a Hex value and return the decimal equivalent
-uint8_t parseHex(char c) 
-{
-    if (c >= '0' && c <= '9') 
-        return (c - '0');
-    if (c >= 'A' && c <= 'F')
-        return (c - 'A')+10;
-    return 0;
-}
-
 // blink out an error code
 void error(uint8_t errno) {
     while(1) {
@@ -120,30 +152,31 @@ void setup()                    // run once, when the sketch starts
         error(4);
     }
   
-    strcpy(buffer, "GPSLOG00.TXT");
-    for (buffer[6] = '0'; buffer[6] <= '9'; buffer[6]++) {
-        for (buffer[7] = '0'; buffer[7] <= '9'; buffer[7]++) {
-            //putstring("\n\rtrying to open ");Serial.println(buffer);
-            f = card.open_file(buffer);
-            if (!f)
-                break;        // found a file!      
-            card.close_file(f);
-        }
-        if (!f) 
-            break;
+    // one pass over the directory finds the newest GPSLnnnn log; if the
+    // power or the card went away while it was written, it is cut back
+    // to its last sync and its unused clusters are given back
+    int32_t last = card.last_numbered_file(logPrefix);
+    if (last >= 0 && card.numbered_name(name, logPrefix, last, logExt))
+        card.recover_file(name);
+    if (!card.numbered_name(name, logPrefix, last + 1, logExt)) {
+        putstring_nl("Out of log names");
+        error(5);
     }
 
-    if(!card.create_file(buffer)) {
-        putstring("couldnt create "); Serial.println(buffer);
+    if(!card.create_file(name)) {
+        putstring("couldnt create "); Serial.println(name);
         error(5);
     }
-    f = card.open_file(buffer);
+    f = card.open_file(name);
     if (!f) {
-        putstring("error opening "); Serial.println(buffer);
+        putstring("error opening "); Serial.println(name);
         card.close_file(f);
         error(6);
     }
-    putstring("writing to "); Serial.println(buffer);
+    putstring("writing to "); Serial.println(name);
+    card.reserve_file(f, logReserveClusters);
+    card.set_sync_policy(f, 0, logSyncSeconds, FAT16_SYNC_CLUSTER);
+    card.begin_stream();   // log blocks go out as one multi-block write
 
     delay(1000);  // wait for everything to finish waking up
 
@@ -154,137 +187,170 @@ void setup()                    // run once, when the sketch starts
     putstring(WAAS_ON); // turn on WAAS
     putstring(RMC_ON);  // turn on RMC
 
+    pod_begin(podTimeoutMillis, podRetries, podWindowMillis, podPacketSamples);
+    nmea_rx_reset();    // forget whatever came in before the GPS was set up
     putstring_nl("ready!");
 }
 
+// append to the log, LED2 lit meanwhile; a failed write has been tried
+// again already (see AF_SDLog.h), and LED2 stays lit after it
+uint8_t log_write(uint8_t *data, uint16_t len)
+{
+    if( card.card_state() )
+        return 0;                         // card gone or full, logging is over
+    digitalWrite(led2Pin, HIGH);          // indicate we're writing
+    if( card.write_file(f, data, len) != len ) {
+        if( card.card_state() & SDLOG_CARD_GONE )
+            putstring_nl("card gone!");
+        else if( card.card_state() & SDLOG_CARD_FULL )
+            putstring_nl("card full!");
+        else
+            putstring_nl("can't write!");
+        return 0;
+    }
+    digitalWrite(led2Pin, LOW);           // writing done
+    return 1;
+}
+
+#if logBinary
+// write the record of the last fix, with whatever samples it got
+void flush_record()
+{
+    if( !rec_open )
+        return;
+    rec_open = 0;
+    if( logging ) {
+        log_record_seal(&rec);
+        Serial.print('#', BYTE);
+        log_write((uint8_t *)&rec, sizeof(rec));
+    }
+}
+#endif
+
+// send the pending sensor request when it is due
+void pod_service()
+{
+    switch( pod_poll(millis()) ) {
+    case POD_SEND:
+        Serial.println(pod_request_line());
+        break;
+    case POD_TIMEOUT:
+        Serial.print('?', BYTE);     // sensor pod never answered
+#if logBinary
+        flush_record();              // log the fix without samples
+#endif
+        break;
+    }
+}
+
+// handle a line from the sensor pod
+void sensor_line(struct nmea_rx_slot *line)
+{
+    // first char from sensor is potential command, so
+    // look at command from sensor pod
+    if( line->data[0] == 's' )        logging = 0;
+    else if( line->data[0] == 'r' )   logging = 1;
+    // else, could have other commands here too
+
+    // now write sensor line
+#if DEBUG
+    Serial.print(line->data+1);
+#endif
+#if logBinary
+    if( rec_open ) {
+        log_record_samples(&rec, line->data);
+        flush_record();
+    }
+#else
+    if( logging ) {
+        Serial.print('|', BYTE);
+        log_write((uint8_t *)line->data, line->len);
+    }
+#endif
+}
+
 //
 void loop()
 {
-    char c;
-    uint8_t sum;
-  
-    // read one 'line' from GPS
-    if (Serial.available()) {
-        c = Serial.read();
-        if (bufferidx == 0) {
-            while (c != '$')
-                c = Serial.read(); // wait till we get a $, start of GPS data
-        }
-        buffer[bufferidx] = c;
+    struct nmea_rx_slot *line;
+    unsigned long fix_at;
+    char hhmmss[7];
 
-        if (c == '\n') {
-            buffer[bufferidx+1] = 0; // terminate it
+#if !NMEA_RX_ISR
+    while (Serial.available())      // Arduino's RX interrupt has it
+        nmea_rx_byte(Serial.read());
+#endif
+    pod_service();
+
+    // wait for a complete line, its checksum was verified on the way in
+    line = nmea_rx_next();
+    if (!line)
+        return;
+    if (line->type != NMEA_RX_SENTENCE) {
+        if (pod_reply())            // the answer to our request
+            sensor_line(line);
+        nmea_rx_release();          // otherwise nobody asked for it
+        return;
+    }
+    fix_at = millis();
 #if DEBUG > 1
-            Serial.print(buffer);    // debug
+    Serial.print(line->data);    // debug
 #endif
-            if (buffer[bufferidx-4] != '*') {
-                // no checksum?
-                Serial.print('*', BYTE);
-                bufferidx = 0;
-                return;
-            }
-            // get checksum
-            sum = parseHex(buffer[bufferidx-3]) * 16;
-            sum += parseHex(buffer[bufferidx-2]);
-      
-            // check checksum 
-            for (i=1; i < (bufferidx-4); i++) {
-                sum ^= buffer[i];
-            }
-            if (sum != 0) {         // checksum mismatch
-                Serial.print('~', BYTE);
-                bufferidx = 0;
-                return;
-            }
-            // got good data!
-
-            if (strstr(buffer, "GPRMC")) {   // verify we have RMC line
-                // find out if we got a fix
-                char *p = buffer;
-                p = strchr(p, ',')+1;
-                p = strchr(p, ',')+1;       // skip to 3rd item
-        
-                if (p[0] == 'V') {                // 'V' == no valid fix
-                    digitalWrite(led1Pin, LOW);
-                    fix = 0;
-                } else {
-                    digitalWrite(led1Pin, HIGH);  // otherwise, gotta fix
-                    fix = 1;
-                }
-            }
+
+    if (strstr(line->data, "GPRMC")) {   // verify we have RMC line
+        // find out if we got a fix
+        char *p = line->data;
+        p = strchr(p, ',')+1;
+        p = strchr(p, ',')+1;       // skip to 3rd item
+
+        if (p[0] == 'V') {                // 'V' == no valid fix
+            digitalWrite(led1Pin, LOW);
+            fix = 0;
+        } else {
+            digitalWrite(led1Pin, HIGH);  // otherwise, gotta fix
+            fix = 1;
+        }
+    }
 #if LOG_RMC_FIXONLY 
-            if (!fix) {
-                Serial.print('_', BYTE);
-                //logging = 0; // bufferidx = 0;  // return;
-            } 
+    if (!fix) {
+        Serial.print('_', BYTE);
+        //logging = 0; // bufferidx = 0;  // return;
+    } 
 #endif
 
-            // rad, got good GPS data. lets log the GPS line
+    // rad, got good GPS data. lets log the GPS line, straight from its slot
 #if DEBUG
-            Serial.print(buffer);
+    Serial.print(line->data);
 #endif
-            if( logging ) {
-                Serial.print('#', BYTE);
-                digitalWrite(led2Pin, HIGH);      // indicate we're writing
-                if(card.write_file(f,(uint8_t *)buffer, bufferidx)!=bufferidx){
-                    putstring_nl("can't write!");
-                    return;
-                }
-                digitalWrite(led2Pin, LOW);       // writing done
-            }
-            bufferidx = 0;  // indicate we used up the buffer
-
-            // send request for data and get sensor line response
-            // request command to get sensor data format: "sHHMMSS\n" 
-            // s is ether 's' or 'S': 's' = recording, 'S' = stopped
-            // HHMMSS is hours,mins,secs from GPS
-            // response is a line of data where first character can be
-            // flag back to us, telling us to stop logging any data ('s')
-            // or to log both GPS and sensor data ('r')
-            buffer[7+6] = 0; // null-terminate GPS timestamp so we can send it
-            Serial.print( (logging) ? 's':'S');  
-            Serial.println(buffer+7); // send timestamp to sensor
-            while(1) {       // haha, while(1)!  but we'll escape... eventually
-                c = Serial.read();
-                if( c==-1 ) continue;  // nothing on serial port, try again
-                if( (c=='\n') || bufferidx==BUFFSIZE-1 ) { // we're done!
-                    buffer[bufferidx] = 0;  // gotta null-terminate strings
-                    break;
-                }
-                buffer[bufferidx++] = c;  // save data char from sensor
-            }
-
-            // first char from sensor is potential command, so
-            // look at command from sensor pod
-            if( buffer[0] == 's' )        logging = 0;
-            else if( buffer[0] == 'r' )   logging = 1;
-            // else, could have other commands here too
-            //bufferidx--; // eat that first command char
-
-            // now write sensor line
-#if DEBUG
-            Serial.print(buffer+1);
-#endif
-            if( logging ) {
-                Serial.print('|', BYTE);
-                digitalWrite(led2Pin, HIGH);      // indicate we're writing
-                if(card.write_file(f,(uint8_t *)buffer, bufferidx)!=bufferidx){
-                    putstring_nl("can't write!");
-                    return;
-                }
-                digitalWrite(led2Pin, LOW);       // writing done
-            }
-            bufferidx = 0;
-            return;
-        }
-        bufferidx++; 
-        if (bufferidx == BUFFSIZE-1) {  // oops, buffer overrun,
-            Serial.print('!', BYTE);    // not much we can do but say ouch
-            bufferidx = 0;              // and reset
-        }
-    } else {
-        // no serial available.  do nothing
+#if logBinary
+    // or keep it as a record until the sensor samples are in
+    flush_record();              // the last fix never got them
+    log_record_begin(&rec);
+    rec_open = log_record_gps(&rec, line->data);
+#else
+    if( logging ) {
+        Serial.print('#', BYTE);
+        log_write((uint8_t *)line->data, line->len);
     }
-  
+#endif
+    memcpy(hhmmss, line->data+7, 6);
+    hhmmss[6] = 0;
+    nmea_rx_release();            // done with the GPS line
+
+    // ask for sensor data, pod_service() sends it and the reply is taken
+    // above whenever it comes in
+    // request command to get sensor data format: "sHHMMSS\n" 
+    // s is ether 's' or 'S': 's' = recording, 'S' = stopped
+    // HHMMSS is hours,mins,secs from GPS
+    // response is a line of data where first character can be
+    // flag back to us, telling us to stop logging any data ('s')
+    // or to log both GPS and sensor data ('r')
+    // if the next fix is in already we're behind, skip this one
+    if( !nmea_rx_next() )
+        pod_request( (logging) ? 's':'S', hhmmss, fix_at );
+#if logBinary
+    else
+        flush_record();
+#endif
+    pod_service();
 }
-
@@ -24,6 +24,18 @@
 struct fat16_fs_struct fat16_fs_handlers[FAT16_FILE_COUNT];
   struct fat16_file_struct fat16_file_handlers[FAT16_FILE_COUNT];
   struct fat16_dir_struct fat16_dir_handlers[FAT16_DIR_COUNT];
+#if FAT16_FAT_CACHE_SIZE
+  /* part of the FAT kept in RAM */
+  static uint8_t fat_cache[FAT16_FAT_CACHE_SIZE];
+  /* offset where the data within fat_cache lies on the card */
+  static offset_t fat_cache_offset = (offset_t) -1;
+  /* flag to remember if fat_cache has to be written back to the card */
+  static uint8_t fat_cache_dirty;
+#endif
+#if FAT16_FAT32_SUPPORT && FAT16_WRITE_SUPPORT
+  /* FSInfo sector whose free cluster count still has to be invalidated */
+  static offset_t fsinfo_offset;
+#endif
   
 /**
  * \addtogroup fat16 FAT16 support
@@ -38,6 +50,7 @@ struct fat16_fs_struct fat16_fs_handlers[FAT16_FILE_COUNT];
  * - Reading and writing from and to files.
  * - File resizing.
  * - File sizes of up to 4 gigabytes.
+ * - FAT32 volumes, if FAT16_FAT32_SUPPORT is enabled.
  * 
  * @{
  */
@@ -72,6 +85,18 @@ struct fat16_fs_struct fat16_fs_handlers[FAT16_FILE_COUNT];
  * @}
  */
 
+#if FAT16_FAT32_SUPPORT
+/* FAT16 entries are widened to these when read, see fat16_read_fat() */
+#define FAT16_CLUSTER_FREE 0x00000000
+#define FAT16_CLUSTER_RESERVED_MIN 0x0ffffff0
+#define FAT16_CLUSTER_RESERVED_MAX 0x0ffffff6
+#define FAT16_CLUSTER_BAD 0x0ffffff7
+#define FAT16_CLUSTER_LAST_MIN 0x0ffffff8
+#define FAT16_CLUSTER_LAST_MAX 0x0fffffff
+
+/* number of bytes of a single FAT entry */
+#define FAT16_ENTRY_SIZE(fs) ((fs)->partition->type == PARTITION_TYPE_FAT32 ? 4 : 2)
+#else
 #define FAT16_CLUSTER_FREE 0x0000
 #define FAT16_CLUSTER_RESERVED_MIN 0xfff0
 #define FAT16_CLUSTER_RESERVED_MAX 0xfff6
@@ -79,6 +104,9 @@ struct fat16_fs_struct fat16_fs_handlers[FAT16_FILE_COUNT];
 #define FAT16_CLUSTER_LAST_MIN 0xfff8
 #define FAT16_CLUSTER_LAST_MAX 0xffff
 
+#define FAT16_ENTRY_SIZE(fs) 2
+#endif
+
 #define FAT16_DIRENTRY_DELETED 0xe5
 #define FAT16_DIRENTRY_LFNLAST (1 << 6)
 #define FAT16_DIRENTRY_LFNSEQMASK ((1 << 6) - 1)
@@ -135,18 +163,28 @@ struct fat16_fs_struct fat16_fs_handlers[FAT16_FILE_COUNT];
 
 
 static uint8_t fat16_read_header(struct fat16_fs_struct* fs);
-static uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, uint16_t entry_num, struct fat16_dir_entry_struct* dir_entry);
-static uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, uint16_t entry_num, const struct fat16_dir_entry_struct* parent, struct fat16_dir_entry_struct* dir_entry);
-static uint8_t fat16_dir_entry_seek_callback(uint8_t* buffer, uint32_t offset, void* p);
-static uint8_t fat16_dir_entry_read_callback(uint8_t* buffer, uint32_t offset, void* p);
+static uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, offset_t* entry_offset, struct fat16_dir_entry_struct* dir_entry);
+static uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, cluster_t* entry_cluster, offset_t* entry_offset, const struct fat16_dir_entry_struct* parent, struct fat16_dir_entry_struct* dir_entry);
+static uint8_t fat16_dir_entry_seek_callback(uint8_t* buffer, offset_t offset, void* p);
+static uint8_t fat16_dir_entry_read_callback(uint8_t* buffer, offset_t offset, void* p);
 static uint8_t fat16_interpret_dir_entry(struct fat16_dir_entry_struct* dir_entry, const uint8_t* raw_entry);
-static uint16_t fat16_get_next_cluster(const struct fat16_fs_struct* fs, uint16_t cluster_num);
-static uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num, uint16_t count);
-static uint8_t fat16_free_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num);
-static uint8_t fat16_terminate_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num);
-static uint8_t fat16_clear_cluster(const struct fat16_fs_struct* fs, uint16_t cluster_num);
-static uint16_t fat16_clear_cluster_callback(uint8_t* buffer, uint32_t offset, void* p);
-static uint32_t fat16_find_offset_for_dir_entry(const struct fat16_fs_struct* fs, const struct fat16_dir_struct* parent, const struct fat16_dir_entry_struct* dir_entry);
+static uint8_t fat16_read_fat(const struct fat16_fs_struct* fs, cluster_t cluster_num, cluster_t* entry);
+static uint8_t fat16_write_fat(const struct fat16_fs_struct* fs, cluster_t cluster_num, cluster_t entry);
+static uint8_t fat16_flush_fat();
+#if FAT16_FAT_CACHE_SIZE
+static uint8_t* fat16_cache_fat(offset_t offset);
+#endif
+static cluster_t fat16_get_next_cluster(const struct fat16_fs_struct* fs, cluster_t cluster_num);
+static cluster_t fat16_append_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num, uint16_t count);
+static cluster_t fat16_find_free_clusters(struct fat16_fs_struct* fs, cluster_t cluster_start, uint16_t count);
+static cluster_t fat16_reserve_clusters(struct fat16_file_struct* fd, cluster_t cluster_num);
+static cluster_t fat16_grow_file(struct fat16_file_struct* fd, cluster_t cluster_num);
+static uint8_t fat16_trim_file(struct fat16_file_struct* fd);
+static uint8_t fat16_free_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num);
+static uint8_t fat16_terminate_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num);
+static uint8_t fat16_clear_cluster(const struct fat16_fs_struct* fs, cluster_t cluster_num);
+static uint16_t fat16_clear_cluster_callback(uint8_t* buffer, offset_t offset, void* p);
+static offset_t fat16_find_offset_for_dir_entry(struct fat16_fs_struct* fs, const struct fat16_dir_struct* parent, const struct fat16_dir_entry_struct* dir_entry);
 static uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, struct fat16_dir_entry_struct* dir_entry);
 
 
@@ -184,6 +222,15 @@ struct fat16_fs_struct* fat16_open(struct partition_struct* partition)
 
     memset(fs, 0, sizeof(*fs));
 
+#if FAT16_FAT_CACHE_SIZE
+    /* the card may have changed, so forget what we know about its FAT */
+    fat_cache_offset = (offset_t) -1;
+    fat_cache_dirty = 0;
+#endif
+#if FAT16_FAT32_SUPPORT && FAT16_WRITE_SUPPORT
+    fsinfo_offset = 0;
+#endif
+
     fs->partition = partition;
     if(!fat16_read_header(fs))
     {
@@ -236,8 +283,12 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
         return 0;
 
     /* read fat parameters */
+#if FAT16_FAT32_SUPPORT
+    uint8_t buffer[39];
+#else
     uint8_t buffer[25];
-    uint32_t partition_offset = partition->offset * 512;
+#endif
+    offset_t partition_offset = (offset_t) partition->offset * 512;
 
     if(!sd_raw_read(partition_offset + 0x0b, buffer, sizeof(buffer)))
         return 0;
@@ -252,15 +303,28 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
                                 ((uint16_t) buffer[0x07] << 8);
     uint16_t sector_count_16 = ((uint16_t) buffer[0x08]) |
                                ((uint16_t) buffer[0x09] << 8);
-    uint16_t sectors_per_fat = ((uint16_t) buffer[0x0b]) |
+    uint32_t sectors_per_fat = ((uint16_t) buffer[0x0b]) |
                                ((uint16_t) buffer[0x0c] << 8);
     uint32_t sector_count = ((uint32_t) buffer[0x15]) |
                             ((uint32_t) buffer[0x16] << 8) |
                             ((uint32_t) buffer[0x17] << 16) |
                             ((uint32_t) buffer[0x18] << 24);
-    
+
+#if FAT16_FAT32_SUPPORT
     if(sectors_per_fat == 0)
-        /* this is not a FAT16 */
+        /* FAT32 keeps the size of its FAT in a field of its own */
+        sectors_per_fat = ((uint32_t) buffer[0x19]) |
+                          ((uint32_t) buffer[0x1a] << 8) |
+                          ((uint32_t) buffer[0x1b] << 16) |
+                          ((uint32_t) buffer[0x1c] << 24);
+#endif
+
+    if(sectors_per_fat == 0 || sectors_per_cluster == 0)
+        /* this is not a FAT */
+        return 0;
+
+    if((uint32_t) bytes_per_sector * sectors_per_cluster > UINT16_MAX)
+        /* we can not handle clusters of 64kB */
         return 0;
 
     if(sector_count == 0)
@@ -272,29 +336,37 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
             sector_count = sector_count_16;
     }
 
-    /* ensure we really have a FAT16 fs here */
+    /* the cluster count alone decides about the FAT type */
     uint32_t data_sector_count = sector_count
                                  - reserved_sectors
-                                 - (uint32_t) sectors_per_fat * fat_copies
+                                 - sectors_per_fat * fat_copies
                                  - ((max_root_entries * 32 + bytes_per_sector - 1) / bytes_per_sector);
     uint32_t data_cluster_count = data_sector_count / sectors_per_cluster;
-    if(data_cluster_count < 4085 || data_cluster_count >= 65525)
-        /* this is not a FAT16 */
+    if(data_cluster_count < 4085)
+        /* this is a FAT12 */
         return 0;
 
-    partition->type = PARTITION_TYPE_FAT16;
+    if(data_cluster_count < 65525)
+        partition->type = PARTITION_TYPE_FAT16;
+    else
+#if FAT16_FAT32_SUPPORT
+        partition->type = PARTITION_TYPE_FAT32;
+#else
+        /* this is a FAT32 */
+        return 0;
+#endif
 
     /* fill header information */
     struct fat16_header_struct* header = &fs->header;
     memset(header, 0, sizeof(*header));
     
-    header->size = sector_count * bytes_per_sector;
+    header->size = (offset_t) sector_count * bytes_per_sector;
 
     header->fat_offset = /* jump to partition */
                          partition_offset +
                          /* jump to fat */
-                         (uint32_t) reserved_sectors * bytes_per_sector;
-    header->fat_size = (data_cluster_count + 2) * 2;
+                         (offset_t) reserved_sectors * bytes_per_sector;
+    header->fat_size = (data_cluster_count + 2) * FAT16_ENTRY_SIZE(fs);
 
     header->sector_size = bytes_per_sector;
     header->cluster_size = (uint32_t) bytes_per_sector * sectors_per_cluster;
@@ -302,12 +374,44 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
     header->root_dir_offset = /* jump to fats */
                               header->fat_offset +
                               /* jump to root directory entries */
-                              (uint32_t) fat_copies * sectors_per_fat * bytes_per_sector;
+                              (offset_t) fat_copies * sectors_per_fat * bytes_per_sector;
 
     header->cluster_zero_offset = /* jump to root directory entries */
                                   header->root_dir_offset +
                                   /* skip root directory entries */
-                                  (uint32_t) max_root_entries * 32;
+                                  (offset_t) max_root_entries * 32;
+
+#if FAT16_FAT32_SUPPORT
+    if(partition->type == PARTITION_TYPE_FAT32)
+    {
+        /* the root directory is a cluster chain of its own */
+        header->root_dir_cluster = (((cluster_t) buffer[0x21]) |
+                                    ((cluster_t) buffer[0x22] << 8) |
+                                    ((cluster_t) buffer[0x23] << 16) |
+                                    ((cluster_t) buffer[0x24] << 24)) & 0x0fffffff;
+
+        /* pick up the allocation hint of the FSInfo sector */
+        uint16_t fsinfo_sector = ((uint16_t) buffer[0x25]) |
+                                 ((uint16_t) buffer[0x26] << 8);
+        if(fsinfo_sector > 0 && fsinfo_sector < reserved_sectors)
+        {
+            offset_t offset = partition_offset + (offset_t) fsinfo_sector * bytes_per_sector;
+            if(!sd_raw_read(offset + 0x1e4, buffer, 12))
+                return 0;
+
+            if(buffer[0] == 0x72 && buffer[1] == 0x72 && buffer[2] == 0x41 && buffer[3] == 0x61)
+            {
+                fs->cluster_free = ((cluster_t) buffer[8]) |
+                                   ((cluster_t) buffer[9] << 8) |
+                                   ((cluster_t) buffer[10] << 16) |
+                                   ((cluster_t) buffer[11] << 24);
+#if FAT16_WRITE_SUPPORT
+                fsinfo_offset = offset;
+#endif
+            }
+        }
+    }
+#endif
 
     return 1;
 }
@@ -316,14 +420,20 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
  * \ingroup fat16_fs
  * Reads a directory entry of the root directory.
  *
+ * Reads the first entry found at or behind the given offset, so
+ * reading all entries one after another takes a single pass over
+ * the root directory.
+ *
  * \param[in] fs Descriptor of file system to use.
- * \param[in] entry_num The index of the directory entry to read.
+ * \param[in,out] entry_offset The disk offset where to start looking, or zero
+ *                             for the start of the root directory. Receives
+ *                             the offset behind the entry read.
  * \param[out] dir_entry Directory entry descriptor which will get filled.
  * \returns 0 on failure, 1 on success
  * \see fat16_read_sub_dir_entry, fat16_read_dir_entry_by_path
  */
 
-uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, uint16_t entry_num, struct fat16_dir_entry_struct* dir_entry)
+uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, offset_t* entry_offset, struct fat16_dir_entry_struct* dir_entry)
 {
     if(!fs || !dir_entry)
         return 0;
@@ -332,14 +442,19 @@ uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, uint16_t ent
     const struct fat16_header_struct* header = &fs->header;
     uint8_t buffer[32];
 
-    /* seek to the n-th entry */
+    offset_t offset = *entry_offset;
+    if(offset < header->root_dir_offset)
+        offset = header->root_dir_offset;
+    if(offset >= header->cluster_zero_offset)
+        return 0;
+
+    /* seek to the next entry */
     struct fat16_read_callback_arg arg;
     memset(&arg, 0, sizeof(arg));
-    arg.entry_num = entry_num;
-    if(!sd_raw_read_interval(header->root_dir_offset,
+    if(!sd_raw_read_interval(offset,
                              buffer,
                              sizeof(buffer),
-                             header->cluster_zero_offset - header->root_dir_offset,
+                             header->cluster_zero_offset - offset,
                              fat16_dir_entry_seek_callback,
                              &arg) ||
        arg.entry_offset == 0
@@ -356,6 +471,7 @@ uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, uint16_t ent
                              dir_entry))
         return 0;
 
+    *entry_offset = arg.entry_offset + arg.byte_count;
     return dir_entry->long_name[0] != '\0' ? 1 : 0;
 }
 
@@ -363,14 +479,23 @@ uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, uint16_t ent
  * \ingroup fat16_fs
  * Reads a directory entry of a given parent directory.
  *
+ * Like fat16_read_root_dir_entry(), this reads the first entry found
+ * at or behind the given position, which here consists of the cluster
+ * and the disk offset within it. Reading all entries one after another
+ * follows the directory's cluster chain just once.
+ *
  * \param[in] fs Descriptor of file system to use.
- * \param[in] entry_num The index of the directory entry to read.
+ * \param[in,out] entry_cluster The cluster where to start looking, or zero
+ *                              for the start of the directory. Receives
+ *                              the cluster of the entry read.
+ * \param[in,out] entry_offset The disk offset where to start looking. Receives
+ *                             the offset behind the entry read.
  * \param[in] parent Directory entry descriptor in which to read directory entry.
  * \param[out] dir_entry Directory entry descriptor which will get filled.
  * \returns 0 on failure, 1 on success
  * \see fat16_read_root_dir_entry, fat16_read_dir_entry_by_path
  */
-uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, uint16_t entry_num, const struct fat16_dir_entry_struct* parent, struct fat16_dir_entry_struct* dir_entry)
+uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, cluster_t* entry_cluster, offset_t* entry_offset, const struct fat16_dir_entry_struct* parent, struct fat16_dir_entry_struct* dir_entry)
 {
     if(!fs || !parent || !dir_entry)
         return 0;
@@ -379,27 +504,36 @@ uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, uint16_t entr
     if(!(parent->attributes & FAT16_ATTRIB_DIR))
         return 0;
 
-    /* loop through all clusters of the directory */
+    /* loop through the remaining clusters of the directory */
     uint8_t buffer[32];
-    uint32_t cluster_offset;
+    offset_t cluster_offset;
     uint16_t cluster_size = fs->header.cluster_size;
-    uint16_t cluster_num = parent->cluster;
+    cluster_t cluster_num = *entry_cluster;
+    offset_t offset = *entry_offset;
     struct fat16_read_callback_arg arg;
 
+    if(cluster_num < 2)
+    {
+        cluster_num = parent->cluster;
+        offset = 0;
+    }
+
     while(1)
     {
         /* calculate new cluster offset */
-        cluster_offset = fs->header.cluster_zero_offset + (uint32_t) (cluster_num - 2) * cluster_size;
+        cluster_offset = fs->header.cluster_zero_offset + (offset_t) (cluster_num - 2) * cluster_size;
+        if(offset < cluster_offset)
+            offset = cluster_offset;
 
-        /* seek to the n-th entry */
+        /* seek to the next entry */
         memset(&arg, 0, sizeof(arg));
-        arg.entry_num = entry_num;
-        if(!sd_raw_read_interval(cluster_offset,
-                                                buffer,
-                                                sizeof(buffer),
-                                                cluster_size,
-                                                fat16_dir_entry_seek_callback,
-                                                &arg)
+        if(offset < cluster_offset + cluster_size &&
+           !sd_raw_read_interval(offset,
+                                 buffer,
+                                 sizeof(buffer),
+                                 cluster_offset + cluster_size - offset,
+                                 fat16_dir_entry_seek_callback,
+                                 &arg)
           )
             return 0;
 
@@ -423,6 +557,8 @@ uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, uint16_t entr
                                             dir_entry))
         return 0;
 
+    *entry_cluster = cluster_num;
+    *entry_offset = arg.entry_offset + arg.byte_count;
     return dir_entry->long_name[0] != '\0' ? 1 : 0;
 }
 
@@ -430,7 +566,7 @@ uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, uint16_t entr
  * \ingroup fat16_fs
  * Callback function for seeking through subdirectory entries.
  */
-uint8_t fat16_dir_entry_seek_callback(uint8_t* buffer, uint32_t offset, void* p)
+uint8_t fat16_dir_entry_seek_callback(uint8_t* buffer, offset_t offset, void* p)
 {
   struct fat16_read_callback_arg* arg = (struct fat16_read_callback_arg*)p;
 
@@ -458,7 +594,7 @@ uint8_t fat16_dir_entry_seek_callback(uint8_t* buffer, uint32_t offset, void* p)
  * \ingroup fat16_fs
  * Callback function for reading a directory entry.
  */
-uint8_t fat16_dir_entry_read_callback(uint8_t* buffer, uint32_t offset, void* p)
+uint8_t fat16_dir_entry_read_callback(uint8_t* buffer, offset_t offset, void* p)
 {
   struct fat16_dir_entry_struct* dir_entry = ( struct fat16_dir_entry_struct*)p;
 
@@ -508,7 +644,7 @@ uint8_t fat16_interpret_dir_entry(struct fat16_dir_entry_struct* dir_entry, cons
     {
         uint16_t char_offset = ((raw_entry[0] & 0x3f) - 1) * 13;
 
-        if(char_offset + 12 < sizeof(dir_entry->long_name))
+        if((uint16_t) (char_offset + 12) < sizeof(dir_entry->long_name))
         {
             /* Lfn supports unicode, but we do not, for now.
              * So we assume pure ascii and read only every
@@ -569,8 +705,13 @@ uint8_t fat16_interpret_dir_entry(struct fat16_dir_entry_struct* dir_entry, cons
         
         /* extract properties of file and store them within the structure */
         dir_entry->attributes = raw_entry[11];
-        dir_entry->cluster = ((uint16_t) raw_entry[26]) |
-                             ((uint16_t) raw_entry[27] << 8);
+        dir_entry->cluster = ((cluster_t) raw_entry[26]) |
+                             ((cluster_t) raw_entry[27] << 8);
+#if FAT16_FAT32_SUPPORT
+        /* FAT32 keeps the upper half of the cluster number in bytes 20 and 21 */
+        dir_entry->cluster |= ((cluster_t) raw_entry[20] << 16) |
+                              ((cluster_t) raw_entry[21] << 24);
+#endif
         dir_entry->file_size = ((uint32_t) raw_entry[28]) |
                                ((uint32_t) raw_entry[29] << 8) |
                                ((uint32_t) raw_entry[30] << 16) |
@@ -606,9 +747,161 @@ uint8_t fat16_get_dir_entry_of_root(struct fat16_fs_struct* fs, struct fat16_dir
     /* begin with the root directory */
     memset(dir_entry, 0, sizeof(*dir_entry));
     dir_entry->attributes = FAT16_ATTRIB_DIR;
+#if FAT16_FAT32_SUPPORT
+    /* zero for the fixed FAT16 root directory */
+    dir_entry->cluster = fs->header.root_dir_cluster;
+#endif
+    return 1;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Reads an entry of the file allocation table.
+ *
+ * \param[in] fs The filesystem whose FAT to read.
+ * \param[in] cluster_num The cluster whose entry to read.
+ * \param[out] entry Receives the FAT entry.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_write_fat
+ */
+uint8_t fat16_read_fat(const struct fat16_fs_struct* fs, cluster_t cluster_num, cluster_t* entry)
+{
+    uint8_t entry_size = FAT16_ENTRY_SIZE(fs);
+    offset_t offset = fs->header.fat_offset + (offset_t) cluster_num * entry_size;
+#if FAT16_FAT_CACHE_SIZE
+    uint8_t* fat_entry = fat16_cache_fat(offset);
+    if(!fat_entry)
+        return 0;
+#else
+    uint8_t fat_entry[4];
+    if(!sd_raw_read(offset, fat_entry, entry_size))
+        return 0;
+#endif
+
+    *entry = ((cluster_t) fat_entry[0]) |
+             ((cluster_t) fat_entry[1] << 8);
+#if FAT16_FAT32_SUPPORT
+    if(entry_size == 4)
+        /* the upper four bits are reserved */
+        *entry |= (((cluster_t) fat_entry[2] << 16) |
+                   ((cluster_t) fat_entry[3] << 24)) & 0x0fffffff;
+    else if(*entry >= 0xfff0)
+        /* widen special values to their FAT32 counterparts */
+        *entry |= 0x0fff0000;
+#endif
+    return 1;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Changes an entry of the file allocation table.
+ *
+ * \note With the FAT cache enabled, the change only reaches the card
+ *       with the next call to fat16_flush_fat().
+ *
+ * \param[in] fs The filesystem whose FAT to change.
+ * \param[in] cluster_num The cluster whose entry to change.
+ * \param[in] entry The new FAT entry.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_read_fat, fat16_flush_fat
+ */
+uint8_t fat16_write_fat(const struct fat16_fs_struct* fs, cluster_t cluster_num, cluster_t entry)
+{
+#if FAT16_WRITE_SUPPORT
+#if FAT16_FAT32_SUPPORT
+    if(fsinfo_offset)
+    {
+        /* We do not keep track of the free cluster count. Before
+         * the FAT changes for the first time, mark it as unknown.
+         */
+        uint8_t free_count[4];
+        memset(free_count, 0xff, sizeof(free_count));
+        if(!sd_raw_write(fsinfo_offset + 0x1e8, free_count, sizeof(free_count)))
+            return 0;
+        fsinfo_offset = 0;
+    }
+#endif
+
+    uint8_t entry_size = FAT16_ENTRY_SIZE(fs);
+    offset_t offset = fs->header.fat_offset + (offset_t) cluster_num * entry_size;
+#if FAT16_FAT_CACHE_SIZE
+    uint8_t* fat_entry = fat16_cache_fat(offset);
+    if(!fat_entry)
+        return 0;
+    fat_cache_dirty = 1;
+#else
+    uint8_t fat_entry[4] = { 0, 0, 0, 0 };
+#endif
+
+    fat_entry[0] = entry & 0xff;
+    fat_entry[1] = (entry >> 8) & 0xff;
+#if FAT16_FAT32_SUPPORT
+    if(entry_size == 4)
+    {
+        fat_entry[2] = (entry >> 16) & 0xff;
+        /* keep the reserved upper four bits */
+        fat_entry[3] = (fat_entry[3] & 0xf0) | ((entry >> 24) & 0x0f);
+    }
+#endif
+
+#if FAT16_FAT_CACHE_SIZE
+    return 1;
+#else
+    return sd_raw_write(offset, fat_entry, entry_size);
+#endif
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup fat16_fs
+ * Writes changed FAT entries back to the card.
+ *
+ * All entries changed within the cached part of the FAT go out
+ * with a single write.
+ *
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_write_fat
+ */
+uint8_t fat16_flush_fat()
+{
+#if FAT16_FAT_CACHE_SIZE && FAT16_WRITE_SUPPORT
+    if(fat_cache_dirty)
+    {
+        if(!sd_raw_write(fat_cache_offset, fat_cache, sizeof(fat_cache)))
+            return 0;
+        fat_cache_dirty = 0;
+    }
+#endif
     return 1;
 }
 
+#if FAT16_FAT_CACHE_SIZE
+/**
+ * \ingroup fat16_fs
+ * Makes the part of the FAT around the given card offset available in RAM.
+ *
+ * \param[in] offset The card offset of a FAT entry.
+ * \returns 0 on failure, a pointer to the cached FAT entry on success.
+ */
+uint8_t* fat16_cache_fat(offset_t offset)
+{
+    offset_t window = offset & ~((offset_t) FAT16_FAT_CACHE_SIZE - 1);
+    if(window != fat_cache_offset)
+    {
+        if(!fat16_flush_fat())
+            return 0;
+        fat_cache_offset = (offset_t) -1;
+        if(!sd_raw_read(window, fat_cache, sizeof(fat_cache)))
+            return 0;
+        fat_cache_offset = window;
+    }
+
+    return fat_cache + (uint16_t) (offset - window);
+}
+#endif
+
 /**
  * \ingroup fat16_fs
  * Retrieves the next following cluster of a given cluster.
@@ -621,20 +914,15 @@ uint8_t fat16_get_dir_entry_of_root(struct fat16_fs_struct* fs, struct fat16_dir
  * \param[in] cluster_num The number of the cluster for which to determine its successor.
  * \returns The wanted cluster number, or 0 on error.
  */
-uint16_t fat16_get_next_cluster(const struct fat16_fs_struct* fs, uint16_t cluster_num)
+cluster_t fat16_get_next_cluster(const struct fat16_fs_struct* fs, cluster_t cluster_num)
 {
     if(!fs || cluster_num < 2)
         return 0;
 
     /* read appropriate fat entry */
-    uint8_t fat_entry[2];
-    if(!sd_raw_read(fs->header.fat_offset + 2 * cluster_num, fat_entry, 2))
+    if(!fat16_read_fat(fs, cluster_num, &cluster_num))
         return 0;
 
-    /* determine next cluster from fat */
-    cluster_num = ((uint16_t) fat_entry[0]) |
-                  ((uint16_t) fat_entry[1] << 8);
-    
     if(cluster_num == FAT16_CLUSTER_FREE ||
        cluster_num == FAT16_CLUSTER_BAD ||
        (cluster_num >= FAT16_CLUSTER_RESERVED_MIN && cluster_num <= FAT16_CLUSTER_RESERVED_MAX) ||
@@ -650,51 +938,49 @@ uint16_t fat16_get_next_cluster(const struct fat16_fs_struct* fs, uint16_t clust
  *
  * Set cluster_num to zero to create a completely new one.
  *
+ * The search for free clusters starts where the previous allocation
+ * left off, so filling up a card does not mean scanning the whole
+ * used part of the FAT again for every new cluster.
+ *
  * \param[in] fs The file system on which to operate.
  * \param[in] cluster_num The cluster to which to append the new chain.
  * \param[in] count The number of clusters to allocate.
  * \returns 0 on failure, the number of the first new cluster on success.
  */
-uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num, uint16_t count)
+cluster_t fat16_append_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num, uint16_t count)
 {
 #if FAT16_WRITE_SUPPORT
     if(!fs)
         return 0;
 
-    uint32_t fat_offset = fs->header.fat_offset;
-    uint16_t cluster_max = fs->header.fat_size / 2;
-    uint16_t cluster_next = 0;
+    cluster_t cluster_max = fs->header.fat_size / FAT16_ENTRY_SIZE(fs);
+    cluster_t cluster_next = 0;
     uint16_t count_left = count;
-    uint8_t buffer[2];
-    uint16_t cluster_new;
-    for(cluster_new = 0; cluster_new < cluster_max; ++cluster_new)
+    cluster_t cluster_left;
+    cluster_t cluster_new = fs->cluster_free;
+    cluster_t entry;
+    if(cluster_new < 2 || cluster_new >= cluster_max)
+        cluster_new = 2;
+    for(cluster_left = cluster_max - 2; cluster_left > 0; --cluster_left)
     {
-        if(!sd_raw_read(fat_offset + 2 * cluster_new, buffer, sizeof(buffer)))
+        if(!fat16_read_fat(fs, cluster_new, &entry))
             return 0;
 
         /* check if this is a free cluster */
-        if(buffer[0] == (FAT16_CLUSTER_FREE & 0xff) &&
-           buffer[1] == ((FAT16_CLUSTER_FREE >> 8) & 0xff))
+        if(entry == FAT16_CLUSTER_FREE)
         {
             /* allocate cluster */
-            if(count_left == count)
-            {
-                buffer[0] = FAT16_CLUSTER_LAST_MAX & 0xff;
-                buffer[1] = (FAT16_CLUSTER_LAST_MAX >> 8) & 0xff;
-            }
-            else
-            {
-                buffer[0] = cluster_next & 0xff;
-                buffer[1] = (cluster_next >> 8) & 0xff;
-            }
-
-            if(!sd_raw_write(fat_offset + 2 * cluster_new, buffer, sizeof(buffer)))
+            if(!fat16_write_fat(fs, cluster_new, count_left == count ? FAT16_CLUSTER_LAST_MAX : cluster_next))
                 break;
 
             cluster_next = cluster_new;
+            fs->cluster_free = cluster_new + 1;
             if(--count_left == 0)
                 break;
         }
+
+        if(++cluster_new >= cluster_max)
+            cluster_new = 2;
     }
 
     do
@@ -707,12 +993,13 @@ uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluste
          */
         if(cluster_num >= 2)
         {
-            buffer[0] = cluster_next & 0xff;
-            buffer[1] = (cluster_next >> 8) & 0xff;
-            if(!sd_raw_write(fat_offset + 2 * cluster_num, buffer, sizeof(buffer)))
+            if(!fat16_write_fat(fs, cluster_num, cluster_next))
                 break;
         }
 
+        if(!fat16_flush_fat())
+            break;
+
         return cluster_next;
 
     } while(0);
@@ -720,7 +1007,66 @@ uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluste
     /* No space left on device or writing error.
      * Free up all clusters already allocated.
      */
-    fat16_free_clusters(fs, cluster_next);
+    if(cluster_next)
+        fat16_free_clusters(fs, cluster_next);
+
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup fat16_fs
+ * Searches for a run of consecutive free clusters.
+ *
+ * The search starts at the given cluster, so that a run right behind
+ * an existing cluster chain is found first, and wraps around to the
+ * start of the FAT if necessary.
+ *
+ * \param[in] fs The file system on which to operate.
+ * \param[in] cluster_start The cluster at which to start searching.
+ * \param[in] count The number of free clusters needed in a row.
+ * \returns 0 on failure, the number of the first cluster of the run on success.
+ */
+cluster_t fat16_find_free_clusters(struct fat16_fs_struct* fs, cluster_t cluster_start, uint16_t count)
+{
+#if FAT16_WRITE_SUPPORT
+    if(!fs || count < 1)
+        return 0;
+
+    cluster_t cluster_max = fs->header.fat_size / FAT16_ENTRY_SIZE(fs);
+    if(cluster_start < 2 || cluster_start >= cluster_max)
+        cluster_start = 2;
+
+    cluster_t cluster_num = cluster_start;
+    cluster_t cluster_run = 0;
+    uint16_t run_length = 0;
+    cluster_t entry;
+    do
+    {
+        if(!fat16_read_fat(fs, cluster_num, &entry))
+            return 0;
+
+        if(entry == FAT16_CLUSTER_FREE)
+        {
+            if(run_length++ == 0)
+                cluster_run = cluster_num;
+            if(run_length == count)
+                return cluster_run;
+        }
+        else
+        {
+            run_length = 0;
+        }
+
+        if(++cluster_num >= cluster_max)
+        {
+            /* a run can not wrap around the end of the FAT */
+            cluster_num = 2;
+            run_length = 0;
+        }
+    } while(cluster_num != cluster_start);
 
     return 0;
 #else
@@ -745,38 +1091,41 @@ uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluste
  * \returns 0 on failure, 1 on success.
  * \see fat16_terminate_clusters
  */
-uint8_t fat16_free_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num)
+uint8_t fat16_free_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num)
 {
 #if FAT16_WRITE_SUPPORT
     if(!fs || cluster_num < 2)
         return 0;
 
-    uint32_t fat_offset = fs->header.fat_offset;
-    uint8_t buffer[2];
+    uint8_t result = 1;
     while(cluster_num)
     {
-        if(!sd_raw_read(fat_offset + 2 * cluster_num, buffer, 2))
-            return 0;
-
         /* get next cluster of current cluster before freeing current cluster */
-        uint16_t cluster_num_next = ((uint16_t) buffer[0]) |
-                                    ((uint16_t) buffer[1] << 8);
+        cluster_t cluster_num_next;
+        if(!fat16_read_fat(fs, cluster_num, &cluster_num_next))
+        {
+            result = 0;
+            break;
+        }
 
         if(cluster_num_next == FAT16_CLUSTER_FREE)
-            return 1;
+            break;
         if(cluster_num_next == FAT16_CLUSTER_BAD ||
            (cluster_num_next >= FAT16_CLUSTER_RESERVED_MIN &&
             cluster_num_next <= FAT16_CLUSTER_RESERVED_MAX
            )
           )
-            return 0;
+        {
+            result = 0;
+            break;
+        }
         if(cluster_num_next >= FAT16_CLUSTER_LAST_MIN && cluster_num_next <= FAT16_CLUSTER_LAST_MAX)
             cluster_num_next = 0;
 
         /* free cluster */
-        buffer[0] = FAT16_CLUSTER_FREE & 0xff;
-        buffer[1] = (FAT16_CLUSTER_FREE >> 8) & 0xff;
-        sd_raw_write(fat_offset + 2 * cluster_num, buffer, 2);
+        fat16_write_fat(fs, cluster_num, FAT16_CLUSTER_FREE);
+        if(cluster_num < fs->cluster_free)
+            fs->cluster_free = cluster_num;
 
         /* We continue in any case here, even if freeing the cluster failed.
          * The cluster is lost, but maybe we can still free up some later ones.
@@ -785,7 +1134,9 @@ uint8_t fat16_free_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_n
         cluster_num = cluster_num_next;
     }
 
-    return 1;
+    if(!fat16_flush_fat())
+        return 0;
+    return result;
 #else
     return 0;
 #endif
@@ -803,27 +1154,24 @@ uint8_t fat16_free_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_n
  * \returns 0 on failure, 1 on success.
  * \see fat16_free_clusters
  */
-uint8_t fat16_terminate_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num)
+uint8_t fat16_terminate_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num)
 {
 #if FAT16_WRITE_SUPPORT
     if(!fs || cluster_num < 2)
         return 0;
 
     /* fetch next cluster before overwriting the cluster entry */
-    uint16_t cluster_num_next = fat16_get_next_cluster(fs, cluster_num);
+    cluster_t cluster_num_next = fat16_get_next_cluster(fs, cluster_num);
 
     /* mark cluster as the last one */
-    uint8_t buffer[2];
-    buffer[0] = FAT16_CLUSTER_LAST_MAX & 0xff;
-    buffer[1] = (FAT16_CLUSTER_LAST_MAX >> 8) & 0xff;
-    if(!sd_raw_write(fs->header.fat_offset + 2 * cluster_num, buffer, 2))
+    if(!fat16_write_fat(fs, cluster_num, FAT16_CLUSTER_LAST_MAX))
         return 0;
 
     /* free remaining clusters */
     if(cluster_num_next)
         return fat16_free_clusters(fs, cluster_num_next);
     else
-        return 1;
+        return fat16_flush_fat();
 #else
     return 0;
 #endif
@@ -839,14 +1187,14 @@ uint8_t fat16_terminate_clusters(const struct fat16_fs_struct* fs, uint16_t clus
  * \param[in] cluster_num The cluster to clear.
  * \returns 0 on failure, 1 on success.
  */
-uint8_t fat16_clear_cluster(const struct fat16_fs_struct* fs, uint16_t cluster_num)
+uint8_t fat16_clear_cluster(const struct fat16_fs_struct* fs, cluster_t cluster_num)
 {
 #if FAT16_WRITE_SUPPORT
     if(cluster_num < 2)
         return 0;
 
-    uint32_t cluster_offset = fs->header.cluster_zero_offset +
-                              (uint32_t) (cluster_num - 2) * fs->header.cluster_size;
+    offset_t cluster_offset = fs->header.cluster_zero_offset +
+                              (offset_t) (cluster_num - 2) * fs->header.cluster_size;
     uint8_t zero[16];
     return sd_raw_write_interval(cluster_offset,
                                                 zero,
@@ -863,7 +1211,7 @@ uint8_t fat16_clear_cluster(const struct fat16_fs_struct* fs, uint16_t cluster_n
  * \ingroup fat16_fs
  * Callback function for clearing a cluster.
  */
-uint16_t fat16_clear_cluster_callback(uint8_t* buffer, uint32_t offset, void* p)
+uint16_t fat16_clear_cluster_callback(uint8_t* buffer, offset_t offset, void* p)
 {
 #if FAT16_WRITE_SUPPORT
     memset(buffer, 0, 16);
@@ -911,6 +1259,11 @@ struct fat16_file_struct*  fat16_open_file(struct fat16_fs_struct* fs, const str
     fd->fs = fs;
     fd->pos = 0;
     fd->pos_cluster = dir_entry->cluster;
+    fd->reserve_count = 0;
+    fd->reserve_last = 0;
+    fd->size_synced = dir_entry->file_size;
+    fd->sync_bytes = 0;
+    fd->sync_flags = 0;
 
     return fd;
 }
@@ -919,25 +1272,124 @@ struct fat16_file_struct*  fat16_open_file(struct fat16_fs_struct* fs, const str
  * \ingroup fat16_file
  * Closes a file.
  *
+ * A file size not yet written to the directory entry is written now,
+ * and reserved clusters the file did not grow into are given back.
+ *
  * \param[in] fd The file handle of the file to close.
- * \see fat16_open_file
+ * \see fat16_open_file, fat16_reserve_file, fat16_sync_file
  */
 void fat16_close_file(struct fat16_file_struct* fd)
 {
-    if(fd)
+    if(!fd)
+        return;
+
+#if FAT16_WRITE_SUPPORT
+    fat16_sync_file(fd);
+    if(fd->reserve_count)
+        fat16_trim_file(fd);
+#endif
+
 #if USE_DYNAMIC_MEMORY
-        free(fd);
+    free(fd);
 #else
-        fd->fs = 0;
+    fd->fs = 0;
 #endif
 }
 
+/**
+ * \ingroup fat16_file
+ * Reads data from a file.
+ * 
+ * The data requested is read from the current file location.
+ *
+ * \param[in] fd The file handle of the file from which to read.
+ * \param[out] buffer The buffer into which to write.
+ * \param[in] buffer_len The amount of data to read.
+ * \returns The number of bytes read, 0 on end of file, or -1 on failure.
+ * \see fat16_write_file
+ */
+int16_t fat16_read_file(struct fat16_file_struct* fd, uint8_t* buffer, uint16_t buffer_len)
+{
+    /* check arguments */
+    if(!fd || !buffer || buffer_len < 1)
+        return -1;
+
+    /* determine number of bytes to read */
+    if(fd->pos >= fd->dir_entry.file_size)
+        return 0;
+    if(fd->pos + buffer_len > fd->dir_entry.file_size)
+        buffer_len = fd->dir_entry.file_size - fd->pos;
+
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    cluster_t cluster_num = fd->pos_cluster;
+    uint16_t buffer_left = buffer_len;
+    uint16_t first_cluster_offset = fd->pos % cluster_size;
+
+    /* find cluster in which to start reading */
+    if(!cluster_num)
+    {
+        cluster_num = fd->dir_entry.cluster;
+        
+        if(!cluster_num)
+            return -1;
+
+        uint32_t pos = fd->pos;
+        while(pos >= cluster_size)
+        {
+            pos -= cluster_size;
+            cluster_num = fat16_get_next_cluster(fd->fs, cluster_num);
+            if(!cluster_num)
+                return -1;
+        }
+    }
+    
+    /* read data */
+    do
+    {
+        /* calculate data size to copy from cluster */
+        offset_t cluster_offset = fd->fs->header.cluster_zero_offset +
+                                  (offset_t) (cluster_num - 2) * cluster_size + first_cluster_offset;
+        uint16_t copy_length = cluster_size - first_cluster_offset;
+        if(copy_length > buffer_left)
+            copy_length = buffer_left;
+
+        /* read data */
+        if(!sd_raw_read(cluster_offset, buffer, copy_length))
+            return buffer_len - buffer_left;
+
+        /* calculate new file position */
+        buffer += copy_length;
+        buffer_left -= copy_length;
+        fd->pos += copy_length;
+
+        if(first_cluster_offset + copy_length >= cluster_size)
+        {
+            /* we are on a cluster boundary, so get the next cluster */
+            cluster_num = fat16_get_next_cluster(fd->fs, cluster_num);
+            if(!cluster_num)
+            {
+                fd->pos_cluster = 0;
+                return buffer_len - buffer_left;
+            }
+            first_cluster_offset = 0;
+        }
+
+        fd->pos_cluster = cluster_num;
+
+    } while(buffer_left > 0); /* check if we are done */
+
+    return buffer_len;
+}
+
 /**
  * \ingroup fat16_file
  * Writes data to a file.
  * 
  * The data is written to the current file location.
  *
+ * If the file grows, the new size is written to its directory entry
+ * right away, unless deferred by fat16_set_file_sync().
+ *
  * \param[in] fd The file handle of the file to which to write.
  * \param[in] buffer The buffer from which to read the data to be written.
  * \param[in] buffer_len The amount of data to write.
@@ -954,9 +1406,10 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
         return -1;
 
     uint16_t cluster_size = fd->fs->header.cluster_size;
-    uint16_t cluster_num = fd->pos_cluster;
+    cluster_t cluster_num = fd->pos_cluster;
     uint16_t buffer_left = buffer_len;
     uint16_t first_cluster_offset = fd->pos % cluster_size;
+    uint8_t sync = !(fd->sync_flags & FAT16_SYNC_DEFER);
 
     /* find cluster in which to start writing */
     if(!cluster_num)
@@ -971,6 +1424,9 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
                 fd->dir_entry.cluster = cluster_num = fat16_append_clusters(fd->fs, 0, 1);
                 if(!cluster_num)
                     return -1;
+
+                /* the new chain is lost unless the directory entry points to it */
+                sync = 1;
             }
             else
             {
@@ -981,14 +1437,14 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
         if(fd->pos)
         {
             uint32_t pos = fd->pos;
-            uint16_t cluster_num_next;
+            cluster_t cluster_num_next;
             while(pos >= cluster_size)
             {
                 pos -= cluster_size;
                 cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
                 if(!cluster_num_next && pos == 0)
                     /* the file exactly ends on a cluster boundary, and we append to it */
-                    cluster_num_next = fat16_append_clusters(fd->fs, cluster_num, 1);
+                    cluster_num_next = fat16_grow_file(fd, cluster_num);
                 if(!cluster_num_next)
                     return -1;
 
@@ -1001,14 +1457,28 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
     do
     {
         /* calculate data size to write to cluster */
-        uint32_t cluster_offset = fd->fs->header.cluster_zero_offset +
-                                  (uint32_t) (cluster_num - 2) * cluster_size + first_cluster_offset;
+        offset_t cluster_offset = fd->fs->header.cluster_zero_offset +
+                                  (offset_t) (cluster_num - 2) * cluster_size + first_cluster_offset;
         uint16_t write_length = cluster_size - first_cluster_offset;
         if(write_length > buffer_left)
             write_length = buffer_left;
 
+        /* A block which starts at or behind the end of the file holds
+         * nothing worth reading in before writing into it. So write
+         * such a last block separately, starting out with a clear one.
+         */
+        offset_t block_last = (cluster_offset + write_length - 1) & ~(offset_t) 0x1ff;
+        uint16_t head_length = write_length;
+        if(block_last >= cluster_offset &&
+           fd->pos + (block_last - cluster_offset) >= fd->dir_entry.file_size)
+            head_length = block_last - cluster_offset;
+
         /* write data which fits into the current cluster */
-        if(!sd_raw_write(cluster_offset, buffer, write_length))
+        if(head_length && !sd_raw_write(cluster_offset, buffer, head_length))
+            break;
+        if(head_length < write_length &&
+           (!sd_raw_clear_block(block_last) ||
+            !sd_raw_write(block_last, buffer + head_length, write_length - head_length)))
             break;
 
         /* calculate new file position */
@@ -1019,10 +1489,16 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
         if(first_cluster_offset + write_length >= cluster_size)
         {
             /* we are on a cluster boundary, so get the next cluster */
-            uint16_t cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
+            cluster_t cluster_num_next;
+            if(cluster_num < fd->reserve_last &&
+               cluster_num > fd->reserve_last - fd->reserve_count)
+                /* within a reserved run the chain is known without asking the FAT */
+                cluster_num_next = cluster_num + 1;
+            else
+                cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
             if(!cluster_num_next && buffer_left > 0)
                 /* we reached the last cluster, append a new one */
-                cluster_num_next = fat16_append_clusters(fd->fs, cluster_num, 1);
+                cluster_num_next = fat16_grow_file(fd, cluster_num);
             if(!cluster_num_next)
             {
                 fd->pos_cluster = 0;
@@ -1031,6 +1507,9 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
 
             cluster_num = cluster_num_next;
             first_cluster_offset = 0;
+
+            if(fd->sync_flags & FAT16_SYNC_CLUSTER)
+                sync = 1;
         }
 
         fd->pos_cluster = cluster_num;
@@ -1044,8 +1523,23 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
 
         /* update file size */
         fd->dir_entry.file_size = fd->pos;
+        if(fd->sync_bytes && fd->pos - fd->size_synced >= fd->sync_bytes)
+            sync = 1;
+
+        if(fd->sync_flags & FAT16_SYNC_DEFER)
+        {
+            /* a deferred size which fails to get written is retried by
+             * the next write or fat16_sync_file()
+             */
+            if(sync)
+                fat16_sync_file(fd);
+        }
         /* write directory entry */
-        if(!fat16_write_dir_entry(fd->fs, &fd->dir_entry))
+        else if(fat16_write_dir_entry(fd->fs, &fd->dir_entry))
+        {
+            fd->size_synced = fd->pos;
+        }
+        else
         {
             /* We do not return an error here since we actually wrote
              * some data to disk. So we calculate the amount of data
@@ -1053,6 +1547,7 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
              */
             buffer_left = fd->pos - size_old;
             fd->pos = size_old;
+            fd->dir_entry.file_size = size_old;
         }
     }
 
@@ -1063,6 +1558,309 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
 #endif
 }
 
+/**
+ * \ingroup fat16_file
+ * Chooses when a growing file's size is written to its directory entry.
+ *
+ * By default, fat16_write_file() rewrites the directory entry every
+ * time the file grows, which for small appends costs a read and a
+ * write of the directory sector each. With FAT16_SYNC_DEFER in flags,
+ * the new size is only kept in RAM until
+ * - bytes more bytes have been written since it was last written out,
+ *   if bytes is not zero,
+ * - the file grows into another cluster, if FAT16_SYNC_CLUSTER is in flags,
+ * - fat16_sync_file() or fat16_close_file() is called.
+ *
+ * Data written in the meantime is on the card, but not covered by
+ * the size a card reader sees after a power loss.
+ *
+ * \param[in] fd The file handle of the file.
+ * \param[in] bytes The most bytes to leave outside the written size, or zero.
+ * \param[in] flags A mask of the FAT16_SYNC_* constants.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_sync_file
+ */
+uint8_t fat16_set_file_sync(struct fat16_file_struct* fd, uint16_t bytes, uint8_t flags)
+{
+    if(!fd)
+        return 0;
+
+    if(bytes)
+        flags |= FAT16_SYNC_DEFER;
+    fd->sync_bytes = bytes;
+    fd->sync_flags = flags;
+    return 1;
+}
+
+/**
+ * \ingroup fat16_file
+ * Writes the file size to the directory entry, if it has changed.
+ *
+ * \param[in] fd The file handle of the file.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_set_file_sync
+ */
+uint8_t fat16_sync_file(struct fat16_file_struct* fd)
+{
+#if FAT16_WRITE_SUPPORT
+    if(!fd)
+        return 0;
+    if(fd->size_synced == fd->dir_entry.file_size)
+        return 1;
+
+    if(!fat16_write_dir_entry(fd->fs, &fd->dir_entry))
+        return 0;
+    fd->size_synced = fd->dir_entry.file_size;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup fat16_file
+ * Reserves a run of contiguous clusters for an empty file.
+ *
+ * The file gets count clusters in a row up front, and whenever it
+ * grows beyond them, it gets another run of the same size. While
+ * writing within such a run, crossing a cluster boundary costs no
+ * FAT access at all, and the file's data lies on the card as one
+ * sequential stream of blocks.
+ *
+ * Clusters the file has not grown into when it is closed are freed
+ * again. Until then, they belong to the file's cluster chain while
+ * not being covered by its size.
+ *
+ * \param[in] fd The file handle of the empty file.
+ * \param[in] count The number of clusters to reserve at a time.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_close_file
+ */
+uint8_t fat16_reserve_file(struct fat16_file_struct* fd, uint16_t count)
+{
+#if FAT16_WRITE_SUPPORT
+    if(!fd || count < 1 || fd->dir_entry.file_size > 0 || fd->dir_entry.cluster)
+        return 0;
+
+    fd->reserve_count = count;
+    cluster_t cluster_num = fat16_reserve_clusters(fd, 0);
+    if(!cluster_num)
+    {
+        fd->reserve_count = 0;
+        return 0;
+    }
+
+    /* let the directory entry point to the chain, so it does not get lost */
+    fd->dir_entry.cluster = cluster_num;
+    fd->pos_cluster = cluster_num;
+    if(!fat16_write_dir_entry(fd->fs, &fd->dir_entry))
+    {
+        fd->dir_entry.cluster = 0;
+        fd->pos_cluster = 0;
+        fd->reserve_count = 0;
+        fd->reserve_last = 0;
+        fat16_free_clusters(fd->fs, cluster_num);
+        return 0;
+    }
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup fat16_file
+ * Allocates the next run of reserved clusters for a file.
+ *
+ * Looks for fd->reserve_count free clusters in a row, preferably
+ * right behind the given cluster, chains them up and appends them
+ * to the chain ending with the given cluster.
+ *
+ * \param[in] fd The file handle of the file to extend.
+ * \param[in] cluster_num The last cluster of the file, or zero if it has none.
+ * \returns 0 on failure, the number of the first new cluster on success.
+ */
+cluster_t fat16_reserve_clusters(struct fat16_file_struct* fd, cluster_t cluster_num)
+{
+#if FAT16_WRITE_SUPPORT
+    struct fat16_fs_struct* fs = fd->fs;
+    uint16_t count = fd->reserve_count;
+    cluster_t cluster_first = fat16_find_free_clusters(fs, cluster_num ? cluster_num + 1 : fs->cluster_free, count);
+    if(!cluster_first)
+        return 0;
+
+    /* chain up the run from its end, so a failure leaves a valid chain behind */
+    cluster_t cluster_cur = cluster_first + count - 1;
+    cluster_t cluster_next = FAT16_CLUSTER_LAST_MAX;
+    while(1)
+    {
+        if(!fat16_write_fat(fs, cluster_cur, cluster_next))
+        {
+            if(cluster_next != FAT16_CLUSTER_LAST_MAX)
+                fat16_free_clusters(fs, cluster_next);
+            return 0;
+        }
+
+        if(cluster_cur == cluster_first)
+            break;
+        cluster_next = cluster_cur--;
+    }
+
+    /* join the run with the existing chain */
+    if((cluster_num >= 2 && !fat16_write_fat(fs, cluster_num, cluster_first)) ||
+       !fat16_flush_fat())
+    {
+        fat16_free_clusters(fs, cluster_first);
+        return 0;
+    }
+
+    fd->reserve_last = cluster_first + count - 1;
+    return cluster_first;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup fat16_file
+ * Appends clusters to a file which has reached the end of its chain.
+ *
+ * A file with reserved clusters gets its next run, or, once the card
+ * has no run that long left, single clusters wherever they are free,
+ * so that a nearly full card still gets filled up.
+ *
+ * \param[in] fd The file handle of the file to extend.
+ * \param[in] cluster_num The last cluster of the file.
+ * \returns 0 on failure, the number of the first new cluster on success.
+ */
+cluster_t fat16_grow_file(struct fat16_file_struct* fd, cluster_t cluster_num)
+{
+#if FAT16_WRITE_SUPPORT
+    cluster_t cluster_next = 0;
+    if(fd->reserve_count)
+        cluster_next = fat16_reserve_clusters(fd, cluster_num);
+    if(!cluster_next)
+        cluster_next = fat16_append_clusters(fd->fs, cluster_num, 1);
+    return cluster_next;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup fat16_file
+ * Frees the reserved clusters behind the end of a file.
+ *
+ * \param[in] fd The file handle of the file to trim.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_reserve_file
+ */
+uint8_t fat16_trim_file(struct fat16_file_struct* fd)
+{
+#if FAT16_WRITE_SUPPORT
+    cluster_t cluster_num = fd->dir_entry.cluster;
+    uint32_t size = fd->dir_entry.file_size;
+
+    fd->reserve_count = 0;
+    fd->reserve_last = 0;
+
+    if(!cluster_num)
+        return 1;
+
+    if(!size)
+    {
+        /* nothing was written, so give back the whole chain */
+        fd->dir_entry.cluster = 0;
+        if(!fat16_write_dir_entry(fd->fs, &fd->dir_entry))
+            return 0;
+        return fat16_free_clusters(fd->fs, cluster_num);
+    }
+
+    /* find the cluster holding the last byte and cut the chain behind it */
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    while(size > cluster_size)
+    {
+        size -= cluster_size;
+        cluster_num = fat16_get_next_cluster(fd->fs, cluster_num);
+        if(!cluster_num)
+            return 0;
+    }
+
+    if(!fat16_get_next_cluster(fd->fs, cluster_num))
+        return 1;
+    return fat16_terminate_clusters(fd->fs, cluster_num);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup fat16_file
+ * Makes a file's cluster chain and directory entry agree again.
+ *
+ * A file which was not closed, because the power or the card went
+ * away while it was written, may have a size which is behind its data
+ * (see fat16_set_file_sync()) and reserved clusters behind its size
+ * (see fat16_reserve_file()). Its size is what was last synced, so
+ * the data written since is given up, and so are the clusters behind
+ * it, which would otherwise be lost for good. If the chain is shorter
+ * than the size, the size is cut back to the end of the chain.
+ *
+ * Only the file's own chain is walked, so this is quick enough to do
+ * on every boot for the last file written.
+ *
+ * \param[in] fd The file handle of the file to recover.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_close_file
+ */
+uint8_t fat16_recover_file(struct fat16_file_struct* fd)
+{
+#if FAT16_WRITE_SUPPORT
+    if(!fd)
+        return 0;
+
+    cluster_t cluster_num = fd->dir_entry.cluster;
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    uint32_t size = 0;
+    cluster_t entry;
+    while(cluster_num && size + cluster_size < fd->dir_entry.file_size)
+    {
+        if(!fat16_read_fat(fd->fs, cluster_num, &entry))
+            return 0;
+        if(entry >= FAT16_CLUSTER_LAST_MIN && entry <= FAT16_CLUSTER_LAST_MAX)
+            break;
+        if(entry < 2 || entry == FAT16_CLUSTER_BAD ||
+           (entry >= FAT16_CLUSTER_RESERVED_MIN && entry <= FAT16_CLUSTER_RESERVED_MAX))
+            return 0;
+
+        size += cluster_size;
+        cluster_num = entry;
+    }
+
+    if(!cluster_num)
+        size = 0;
+    else if(size + cluster_size < fd->dir_entry.file_size)
+        /* the chain ends before the size does */
+        size += cluster_size;
+    else
+        size = fd->dir_entry.file_size;
+
+    if(size != fd->dir_entry.file_size)
+    {
+        fd->dir_entry.file_size = size;
+        if(!fat16_write_dir_entry(fd->fs, &fd->dir_entry))
+            return 0;
+        fd->size_synced = size;
+    }
+
+    /* a chain behind the size is reserved clusters nobody got to close */
+    return fat16_trim_file(fd);
+#else
+    return 0;
+#endif
+}
+
 /**
  * \ingroup fat16_file
  * Repositions the read/write file offset.
@@ -1160,6 +1958,8 @@ struct fat16_dir_struct* fat16_open_dir(struct fat16_fs_struct* fs, const struct
     memcpy(&dd->dir_entry, dir_entry, sizeof(*dir_entry));
     dd->fs = fs;
     dd->entry_next = 0;
+    dd->entry_offset = 0;
+    dd->entry_cluster = 0;
 
     return dd;
 }
@@ -1202,7 +2002,7 @@ uint8_t fat16_read_dir(struct fat16_dir_struct* dd, struct fat16_dir_entry_struc
     if(dd->dir_entry.cluster == 0)
     {
         /* read entry from root directory */
-        if(fat16_read_root_dir_entry(dd->fs, dd->entry_next, dir_entry))
+        if(fat16_read_root_dir_entry(dd->fs, &dd->entry_offset, dir_entry))
         {
             ++dd->entry_next;
             return 1;
@@ -1211,7 +2011,7 @@ uint8_t fat16_read_dir(struct fat16_dir_struct* dd, struct fat16_dir_entry_struc
     else
     {
         /* read entry from a subdirectory */
-        if(fat16_read_sub_dir_entry(dd->fs, dd->entry_next, &dd->dir_entry, dir_entry))
+        if(fat16_read_sub_dir_entry(dd->fs, &dd->entry_cluster, &dd->entry_offset, &dd->dir_entry, dir_entry))
         {
             ++dd->entry_next;
             return 1;
@@ -1220,6 +2020,8 @@ uint8_t fat16_read_dir(struct fat16_dir_struct* dd, struct fat16_dir_entry_struc
 
     /* restart reading */
     dd->entry_next = 0;
+    dd->entry_offset = 0;
+    dd->entry_cluster = 0;
 
     return 0;
 }
@@ -1241,6 +2043,8 @@ uint8_t fat16_reset_dir(struct fat16_dir_struct* dd)
         return 0;
 
     dd->entry_next = 0;
+    dd->entry_offset = 0;
+    dd->entry_cluster = 0;
     return 1;
 }
 
@@ -1252,7 +2056,7 @@ uint8_t fat16_reset_dir(struct fat16_dir_struct* dd)
  * \param[in] dir_entry The directory entry for which to search space.
  * \returns 0 on failure, a device offset on success.
  */
-uint32_t fat16_find_offset_for_dir_entry(const struct fat16_fs_struct* fs, const struct fat16_dir_struct* parent, const struct fat16_dir_entry_struct* dir_entry)
+offset_t fat16_find_offset_for_dir_entry(struct fat16_fs_struct* fs, const struct fat16_dir_struct* parent, const struct fat16_dir_entry_struct* dir_entry)
 {
 #if FAT16_WRITE_SUPPORT
     if(!fs || !dir_entry)
@@ -1261,10 +2065,10 @@ uint32_t fat16_find_offset_for_dir_entry(const struct fat16_fs_struct* fs, const
     /* search for a place where to write the directory entry to disk */
     uint8_t free_dir_entries_needed = (strlen(dir_entry->long_name) + 12) / 13 + 1;
     uint8_t free_dir_entries_found = 0;
-    uint16_t cluster_num = parent->dir_entry.cluster;
-    uint32_t dir_entry_offset = 0;
-    uint32_t offset = 0;
-    uint32_t offset_to = 0;
+    cluster_t cluster_num = parent->dir_entry.cluster;
+    offset_t dir_entry_offset = 0;
+    offset_t offset = 0;
+    offset_t offset_to = 0;
 
     if(cluster_num == 0)
     {
@@ -1290,7 +2094,7 @@ uint32_t fat16_find_offset_for_dir_entry(const struct fat16_fs_struct* fs, const
                  * switch to the next cluster.
                  */
 
-                uint16_t cluster_next = fat16_get_next_cluster(fs, cluster_num);
+                cluster_t cluster_next = fat16_get_next_cluster(fs, cluster_num);
                 if(!cluster_next)
                 {
                     cluster_next = fat16_append_clusters(fs, cluster_num, 1);
@@ -1299,7 +2103,7 @@ uint32_t fat16_find_offset_for_dir_entry(const struct fat16_fs_struct* fs, const
 
                     /* we appended a new cluster and know it is free */
                     dir_entry_offset = fs->header.cluster_zero_offset +
-                                       (uint32_t) (cluster_next - 2) * fs->header.cluster_size;
+                                       (offset_t) (cluster_next - 2) * fs->header.cluster_size;
 
                     /* clear cluster to avoid garbage directory entries */
                     fat16_clear_cluster(fs, cluster_next);
@@ -1310,7 +2114,7 @@ uint32_t fat16_find_offset_for_dir_entry(const struct fat16_fs_struct* fs, const
             }
 
             offset = fs->header.cluster_zero_offset +
-                     (uint32_t) (cluster_num - 2) * fs->header.cluster_size;
+                     (offset_t) (cluster_num - 2) * fs->header.cluster_size;
             offset_to = offset + fs->header.cluster_size;
             dir_entry_offset = offset;
             free_dir_entries_found = 0;
@@ -1386,7 +2190,7 @@ uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, struct fat16_dir
     }
 #endif
 
-    uint32_t offset = dir_entry->entry_offset;
+    offset_t offset = dir_entry->entry_offset;
     const char* name = dir_entry->long_name;
     uint8_t name_len = strlen(name);
     uint8_t buffer[32];
@@ -1396,7 +2200,7 @@ uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, struct fat16_dir
 
     /* generate 8.3 file name */
     memset(&buffer[0], ' ', 11);
-    char* name_ext = strrchr(name, '.');
+    const char* name_ext = strrchr(name, '.');
     if(name_ext && *++name_ext)
     {
         uint8_t name_ext_len = strlen(name_ext);
@@ -1436,6 +2240,10 @@ uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, struct fat16_dir
     buffer[0x17] = (dir_entry->modification_time >> 8) & 0xff;
     buffer[0x18] = (dir_entry->modification_date >> 0) & 0xff;
     buffer[0x19] = (dir_entry->modification_date >> 8) & 0xff;
+#endif
+#if FAT16_FAT32_SUPPORT
+    buffer[0x14] = (dir_entry->cluster >> 16) & 0xff;
+    buffer[0x15] = (dir_entry->cluster >> 24) & 0xff;
 #endif
     buffer[0x1a] = (dir_entry->cluster >> 0) & 0xff;
     buffer[0x1b] = (dir_entry->cluster >> 8) & 0xff;
@@ -1532,12 +2340,12 @@ uint8_t fat16_create_file(struct fat16_dir_struct* parent, const char* file, str
  * \param[in] fs The filesystem on which to operate.
  * \returns 0 on failure, the filesystem size in bytes otherwise.
  */
-uint32_t fat16_get_fs_size(const struct fat16_fs_struct* fs)
+offset_t fat16_get_fs_size(const struct fat16_fs_struct* fs)
 {
     if(!fs)
         return 0;
 
-    return (fs->header.fat_size / 2 - 2) * fs->header.cluster_size;
+    return (offset_t) (fs->header.fat_size / FAT16_ENTRY_SIZE(fs) - 2) * fs->header.cluster_size;
 }
 
 /**
@@ -1550,7 +2358,7 @@ uint32_t fat16_get_fs_size(const struct fat16_fs_struct* fs)
  * \param[in] fs The filesystem on which to operate.
  * \returns 0 on failure, the free filesystem space in bytes otherwise.
  */
-uint32_t fat16_get_fs_free(const struct fat16_fs_struct* fs)
+offset_t fat16_get_fs_free(const struct fat16_fs_struct* fs)
 {
     if(!fs)
         return 0;
@@ -1558,19 +2366,23 @@ uint32_t fat16_get_fs_free(const struct fat16_fs_struct* fs)
     uint8_t fat[32];
     struct fat16_usage_count_callback_arg count_arg;
     count_arg.cluster_count = 0;
-    count_arg.buffer_size = sizeof(fat);
+    count_arg.entry_size = FAT16_ENTRY_SIZE(fs);
 
-    uint32_t fat_offset = fs->header.fat_offset;
+    offset_t fat_offset = fs->header.fat_offset;
     uint32_t fat_size = fs->header.fat_size;
     while(fat_size > 0)
     {
-        uint16_t length = UINT16_MAX - 1;
+        /* whole buffers only, the tail of the FAT goes last */
+        uint16_t length = UINT16_MAX & ~(sizeof(fat) - 1);
         if(fat_size < length)
             length = fat_size;
+        if(length >= sizeof(fat))
+            length &= ~(sizeof(fat) - 1);
+        count_arg.buffer_size = length < sizeof(fat) ? length : sizeof(fat);
 
         if(!sd_raw_read_interval(fat_offset,
                                                 fat,
-                                                sizeof(fat),
+                                                count_arg.buffer_size,
                                                 length,
                                                 fat16_get_fs_free_callback,
                                                 &count_arg
@@ -1582,25 +2394,32 @@ uint32_t fat16_get_fs_free(const struct fat16_fs_struct* fs)
         fat_size -= length;
     }
 
-    return (uint32_t) count_arg.cluster_count * fs->header.cluster_size;
+    return (offset_t) count_arg.cluster_count * fs->header.cluster_size;
 }
 
 /**
  * \ingroup fat16_fs
  * Callback function used for counting free clusters.
  */
-uint8_t fat16_get_fs_free_callback(uint8_t* buffer, uint32_t offset, void* p)
+uint8_t fat16_get_fs_free_callback(uint8_t* buffer, offset_t offset, void* p)
 {
     struct fat16_usage_count_callback_arg* count_arg = (struct fat16_usage_count_callback_arg*) p;
     uint8_t buffer_size = count_arg->buffer_size;
+    uint8_t entry_size = count_arg->entry_size;
     uint8_t i;
 
-    for(i = 0; i < buffer_size; i += 2)
+    for(i = 0; i < buffer_size; i += entry_size)
     {
-        if((((uint16_t) buffer[1] << 8) | ((uint16_t) buffer[0] << 0)) == FAT16_CLUSTER_FREE)
+        uint8_t used = buffer[0] | buffer[1];
+#if FAT16_FAT32_SUPPORT
+        /* the upper four bits of a FAT32 entry are reserved */
+        if(entry_size == 4)
+            used |= buffer[2] | (buffer[3] & 0x0f);
+#endif
+        if(!used)
             ++(count_arg->cluster_count);
 
-        buffer += 2;
+        buffer += entry_size;
     }
 
     return 1;
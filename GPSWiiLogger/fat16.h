@@ -52,6 +52,11 @@
 /** The given offset is relative to the end of the file. */
 #define FAT16_SEEK_END 2
 
+/** The file's size is written to its directory entry only when synced. */
+#define FAT16_SYNC_DEFER (1 << 0)
+/** The file's size is synced whenever the file grows into another cluster. */
+#define FAT16_SYNC_CLUSTER (1 << 1)
+
 /**
  * @}
  */
@@ -78,11 +83,11 @@ struct fat16_dir_entry_struct
     uint16_t modification_date;
 #endif
     /** The cluster in which the file's first byte resides. */
-    uint16_t cluster;
+    cluster_t cluster;
     /** The file's size. */
     uint32_t file_size;
     /** The total disk offset of this directory entry. */
-    uint32_t entry_offset;
+    offset_t entry_offset;
 };
 
 struct fat16_fs_struct* fat16_open(struct partition_struct* partition);
@@ -94,6 +99,10 @@ int16_t fat16_read_file(struct fat16_file_struct* fd, uint8_t* buffer, uint16_t
 int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, uint16_t buffer_len);
 uint8_t fat16_seek_file(struct fat16_file_struct* fd, int32_t* offset, uint8_t whence);
 uint8_t fat16_resize_file(struct fat16_file_struct* fd, uint32_t size);
+uint8_t fat16_reserve_file(struct fat16_file_struct* fd, uint16_t count);
+uint8_t fat16_set_file_sync(struct fat16_file_struct* fd, uint16_t bytes, uint8_t flags);
+uint8_t fat16_sync_file(struct fat16_file_struct* fd);
+uint8_t fat16_recover_file(struct fat16_file_struct* fd);
 
 struct fat16_dir_struct* fat16_open_dir(struct fat16_fs_struct* fs, const struct fat16_dir_entry_struct* dir_entry);
 void fat16_close_dir(struct fat16_dir_struct* dd);
@@ -111,30 +120,34 @@ void fat16_get_file_modification_time(const struct fat16_dir_entry_struct* dir_e
 
 uint8_t fat16_get_dir_entry_of_root(struct fat16_fs_struct* fs, struct fat16_dir_entry_struct* dir_entry);
 
-uint32_t fat16_get_fs_size(const struct fat16_fs_struct* fs);
-uint32_t fat16_get_fs_free(const struct fat16_fs_struct* fs);
-uint8_t fat16_get_fs_free_callback(uint8_t* buffer, uint32_t offset, void* p);
+offset_t fat16_get_fs_size(const struct fat16_fs_struct* fs);
+offset_t fat16_get_fs_free(const struct fat16_fs_struct* fs);
+uint8_t fat16_get_fs_free_callback(uint8_t* buffer, offset_t offset, void* p);
 
 
 struct fat16_header_struct
 {
-    uint32_t size;
+    offset_t size;
 
-    uint32_t fat_offset;
+    offset_t fat_offset;
     uint32_t fat_size;
 
     uint16_t sector_size;
     uint16_t cluster_size;
 
-    uint32_t root_dir_offset;
+    offset_t root_dir_offset;
+#if FAT16_FAT32_SUPPORT
+    cluster_t root_dir_cluster;
+#endif
 
-    uint32_t cluster_zero_offset;
+    offset_t cluster_zero_offset;
 };
 
 struct fat16_fs_struct
 {
     struct partition_struct* partition;
     struct fat16_header_struct header;
+    cluster_t cluster_free;
 };
 
 struct fat16_file_struct
@@ -142,7 +155,12 @@ struct fat16_file_struct
     struct fat16_fs_struct* fs;
     struct fat16_dir_entry_struct dir_entry;
     uint32_t pos;
-    uint16_t pos_cluster;
+    cluster_t pos_cluster;
+    uint16_t reserve_count;
+    cluster_t reserve_last;
+    uint32_t size_synced;
+    uint16_t sync_bytes;
+    uint8_t sync_flags;
 };
 
 struct fat16_dir_struct
@@ -150,20 +168,23 @@ struct fat16_dir_struct
     struct fat16_fs_struct* fs;
     struct fat16_dir_entry_struct dir_entry;
     uint16_t entry_next;
+    offset_t entry_offset;
+    cluster_t entry_cluster;
 };
 
 struct fat16_read_callback_arg
 {
     uint16_t entry_cur;
     uint16_t entry_num;
-    uint32_t entry_offset;
+    offset_t entry_offset;
     uint8_t byte_count;
 };
 
 struct fat16_usage_count_callback_arg
 {
-    uint16_t cluster_count;
+    uint32_t cluster_count;
     uint8_t buffer_size;
+    uint8_t entry_size;
 };
 
 
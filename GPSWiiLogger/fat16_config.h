@@ -11,6 +11,9 @@
 #ifndef FAT16_CONFIG_H
 #define FAT16_CONFIG_G
 
+#include <stdint.h>
+#include "sd_raw_config.h"
+
 /**
  * \addtogroup fat16
  *
@@ -29,6 +32,16 @@
  */
 #define FAT16_WRITE_SUPPORT 1
 
+/**
+ * \ingroup fat16_config
+ * Controls FAT32 support.
+ *
+ * Set to 1 to also mount FAT32 filesystems, as found on cards of more
+ * than 2GB, set to 0 to disable it. Cluster numbers then take 32 bits,
+ * see cluster_t.
+ */
+#define FAT16_FAT32_SUPPORT SD_RAW_SDHC
+
 /**
  * \ingroup fat16_config
  * Controls FAT16 date and time support.
@@ -58,6 +71,19 @@
 /* forward declaration for the above */
 void get_datetime(uint16_t* year, uint8_t* month, uint8_t* day, uint8_t* hour, uint8_t* min, uint8_t* sec);
 
+/**
+ * \ingroup fat16_config
+ * Size of the FAT cache in bytes.
+ *
+ * This many bytes of the FAT around the entry accessed last are kept
+ * in RAM. Following and allocating clusters within that part of the
+ * FAT does not access the card, and all entries changed within it go
+ * out with a single write. Has to be a power of two of at most 512.
+ *
+ * Set to 0 to disable the cache.
+ */
+#define FAT16_FAT_CACHE_SIZE 32
+
 /**
  * \ingroup fat16_config
  * Maximum number of filesystem handles.
@@ -80,5 +106,15 @@ void get_datetime(uint16_t* year, uint8_t* month, uint8_t* day, uint8_t* hour, u
  * @}
  */
 
+/**
+ * \ingroup fat16_config
+ * The number of a cluster.
+ */
+#if FAT16_FAT32_SUPPORT
+typedef uint32_t cluster_t;
+#else
+typedef uint16_t cluster_t;
+#endif
+
 #endif
 
@@ -0,0 +1,17 @@
+/*
+ * WProgram.h -- host stand-in for the Arduino core header
+ *
+ * Only millis() and delay() are provided.  The host tools advance the
+ * clock themselves with host_set_millis(), and delay() advances it too,
+ * so time based policies run against simulated rather than wall clock
+ * time.
+ */
+
+#ifndef HOST_WPROGRAM_H
+#define HOST_WPROGRAM_H
+
+unsigned long millis(void);
+void delay(unsigned long ms);
+void host_set_millis(unsigned long ms);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * allocbench.cpp -- cluster allocation latency while filling a card
+ *
+ * Formats a fresh FAT16 image and fills it with FILLnnnn.BIN files
+ * through AF_SDLog, in writes of a few hundred bytes like the logger
+ * does.  Every write which crosses into a new cluster has to allocate
+ * one, and the bus time those writes take is reported as percentiles,
+ * in SPI bytes (1us each at 8MHz).  Finally the image is checked for
+ * consistency.
+ *
+ * usage: allocbench [-i image] [-s size_mb] [-c sectors_per_cluster]
+ *                   [-u percent_full] [-w write_size] [-n file_kb]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AF_SDLog.h"
+#include "sd_image.h"
+#include "fat_image.h"
+
+AF_SDLog card;
+
+static int compare_costs(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char** argv)
+{
+    const char* image_path = "allocbench.img";
+    uint32_t size_mb = 64;
+    uint8_t sectors_per_cluster = 4;
+    uint32_t percent_full = 95;
+    uint16_t write_size = 300;
+    uint32_t file_kb = 1024;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:s:c:u:w:n:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i': image_path = optarg; break;
+            case 's': size_mb = atoi(optarg); break;
+            case 'c': sectors_per_cluster = atoi(optarg); break;
+            case 'u': percent_full = atoi(optarg); break;
+            case 'w': write_size = atoi(optarg); break;
+            case 'n': file_kb = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-i image] [-s size_mb] [-c sectors_per_cluster] [-u percent_full] [-w write_size] [-n file_kb]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(write_size < 1 || write_size > 4096 || file_kb < 1)
+    {
+        fprintf(stderr, "bad write or file size\n");
+        return 2;
+    }
+
+    uint32_t size = size_mb * 1024 * 1024;
+    if(!sd_image_open(image_path, size) ||
+       !fat_image_format(sd_image_data(), size, sectors_per_cluster))
+    {
+        fprintf(stderr, "can't create FAT16 image %s\n", image_path);
+        return 1;
+    }
+
+    if(!card.init_card() || !card.open_partition() ||
+       !card.open_filesys() || !card.open_dir((char*) "/"))
+    {
+        fprintf(stderr, "can't mount %s\n", image_path);
+        return 1;
+    }
+
+    uint32_t cluster_size = (uint32_t) sectors_per_cluster * 512;
+    uint32_t total = (uint64_t) size * percent_full / 100;
+    uint32_t file_size = file_kb * 1024;
+    uint32_t* costs = (uint32_t*) malloc((total / cluster_size + 501) * sizeof(*costs));
+    uint32_t allocations = 0;
+    uint32_t written = 0;
+    uint8_t data[4096];
+    char name[20];
+    uint16_t files;
+
+    memset(data, 0x55, sizeof(data));
+    sd_image_reset_stats();
+    for(files = 0; written < total && files < 500; ++files)
+    {
+        snprintf(name, sizeof(name), "FILL%04u.BIN", (unsigned) files);
+        File f;
+        if(!card.create_file(name) || !(f = card.open_file(name)))
+        {
+            fprintf(stderr, "can't create %s\n", name);
+            return 1;
+        }
+
+        uint32_t pos;
+        for(pos = 0; pos < file_size && written < total; pos += write_size, written += write_size)
+        {
+            uint32_t spi_bytes = sd_image_get_stats()->spi_bytes;
+            if(card.write_file(f, data, write_size) != write_size)
+            {
+                fprintf(stderr, "%s: can't write at %lu\n", name, (unsigned long) pos);
+                return 1;
+            }
+
+            /* the first write of a file or one crossing a cluster boundary allocates */
+            if(pos % cluster_size == 0 || pos / cluster_size != (pos + write_size - 1) / cluster_size)
+                costs[allocations++] = sd_image_get_stats()->spi_bytes - spi_bytes;
+        }
+
+        card.close_file(f);
+    }
+    sd_raw_sync();
+
+    const struct sd_image_stats* stats = sd_image_get_stats();
+    qsort(costs, allocations, sizeof(*costs), compare_costs);
+    printf("fill:\n");
+    printf("  files:             %u\n", (unsigned) files);
+    printf("  bytes written:     %lu\n", (unsigned long) written);
+    printf("  allocations:       %lu\n", (unsigned long) allocations);
+    printf("  CMD17 reads:       %lu\n", (unsigned long) stats->commands[17]);
+    printf("  CMD24 writes:      %lu\n", (unsigned long) stats->commands[24]);
+    printf("  bus time:          %.3f s\n", stats->spi_bytes / 1e6);
+    printf("allocating write, spi bytes:\n");
+    static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint8_t i;
+    for(i = 0; i < sizeof(percentiles) / sizeof(*percentiles); ++i)
+        printf("  p%-5g            %lu\n", percentiles[i] * 100,
+               (unsigned long) costs[(uint32_t) (percentiles[i] * (allocations - 1))]);
+    printf("  max               %lu\n", (unsigned long) costs[allocations - 1]);
+
+    struct fat_image_check_result check;
+    if(!fat_image_check(sd_image_data(), &check))
+    {
+        fprintf(stderr, "inconsistent file system: %lu of %lu files bad, %lu of %lu clusters lost\n",
+                (unsigned long) check.files_bad, (unsigned long) check.files,
+                (unsigned long) check.clusters_lost, (unsigned long) check.clusters_allocated);
+        return 1;
+    }
+    printf("verified %lu files, %lu clusters\n", (unsigned long) check.files,
+           (unsigned long) check.clusters_allocated);
+
+    free(costs);
+    sd_image_close();
+    return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * avr/interrupt.h -- host stand-in for the avr-libc interrupt header
+ *
+ * Interrupt handlers become ordinary functions which the host tools
+ * call themselves, and there is nothing to disable.
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector) void vector(void)
+#define SIGNAL(vector) ISR(vector)
+#define cli()
+#define sei()
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * avr/io.h -- host stand-in for the avr-libc register header
+ *
+ * Only the registers touched by the sd-reader code and nmea_rx.cpp
+ * are provided.
+ * Writing SPDR clocks one byte through the emulated card in
+ * sd_image.cpp and sets SPIF, exactly like the real SPI unit does
+ * once a transfer completes.  The port registers are plain bytes,
+ * so select_card()/unselect_card() work unchanged and the card
+ * emulation looks at PORTB to find out whether it is addressed.
+ */
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+/* SPCR */
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE  6
+#define SPIE 7
+/* SPSR */
+#define SPI2X 0
+#define SPIF  7
+
+/* port B bits, atmega168 numbering */
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDB6 6
+#define DDB7 7
+
+extern uint8_t SPCR;
+extern uint8_t SPSR;
+extern uint8_t DDRB;
+extern uint8_t PORTB;
+extern uint8_t DDRC;
+extern uint8_t PORTC;
+extern uint8_t PINC;
+
+/* The UART data register only holds the byte the host tools feed to
+ * the receive interrupt, which is a plain function here.
+ */
+extern uint8_t UDR0;
+extern uint8_t SREG;
+#define USART_RX_vect host_usart_rx_vect
+
+/* AFSoftSerial_funcs.h's pin change and Timer2 registers and interrupts,
+ * which host/softrxbench.cpp runs against a simulated line and timer
+ */
+#define _BV(bit) (1 << (bit))
+#define WGM21  1
+#define CS20   0
+#define CS21   1
+#define CS22   2
+#define OCIE2A 1
+#define OCF2A  1
+extern uint8_t TCCR2A;
+extern uint8_t TCCR2B;
+extern uint8_t TCNT2;
+extern uint8_t OCR2A;
+extern uint8_t TIMSK2;
+extern uint8_t TIFR2;
+extern uint8_t PCICR;
+extern uint8_t PCIFR;
+extern uint8_t PCMSK0;
+extern uint8_t PCMSK2;
+#define SIG_PIN_CHANGE0 host_pin_change0
+#define SIG_PIN_CHANGE2 host_pin_change2
+#define SIG_OUTPUT_COMPARE2A host_timer2_compa
+
+uint8_t sd_image_spi_xfer(uint8_t out);
+
+struct host_spi_data_register
+{
+    uint8_t in;
+
+    host_spi_data_register& operator=(uint8_t out)
+    {
+        in = sd_image_spi_xfer(out);
+        SPSR |= (1 << SPIF);
+        return *this;
+    }
+    operator uint8_t() const { return in; }
+};
+
+extern struct host_spi_data_register SPDR;
+
+#endif
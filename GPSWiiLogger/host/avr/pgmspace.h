@@ -0,0 +1,17 @@
+/*
+ * avr/pgmspace.h -- host stand-in for the avr-libc flash access header
+ *
+ * There is only one address space on the host, so PSTR() strings are
+ * ordinary string literals and pgm_read_byte() is a plain dereference.
+ */
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * deltabench.cpp -- size of the sensor pod's replies, plain and delta coded
+ *
+ * Reads the given logs (default: the GPSWiiLogger logs in example_data)
+ * and sends each sensor line's samples, as 10 bit values, through the
+ * three ways GPSWiiUI can reply:
+ *  - "|xxyyzz", 8 bits an axis in hex, what old loggers ask for;
+ *  - "!ccccc", 10 bits an axis in five 6 bit chars;
+ *  - delta coded (see sample_delta.h), a keyframe every -k samples.
+ * Reports the bytes each takes on the 4800 baud line, command char and
+ * "\r\n" included, and how many samples a second would fit an nmea_rx
+ * slot at each one's average size.  Every delta coded line is read back
+ * and must give the samples it was made from.
+ *
+ * Samples logged with 8 bits are taken as the top 8 of 10, so their
+ * changes come in steps of 4 counts and code a little worse than real
+ * 10 bit ones would.
+ *
+ * usage: deltabench [-k keyframe_every] [log ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpslog.h"
+#include "nmea_rx.h"
+#include "sample_delta.h"
+
+#define BAUD 4800
+#define REPLY_OVERHEAD 3        /* command char, "\r\n" */
+#define REPLY_SAMPLES 16        /* the most GPSWiiUI sends, SAMPLER_RING */
+
+struct totals
+{
+    uint32_t lines;
+    uint32_t samples;
+    uint64_t hex;
+    uint64_t wide;
+    uint64_t delta;
+    uint32_t longest;           /* longest delta line, overhead included */
+    uint32_t failures;
+};
+
+static uint8_t keyframe_every = SAMPLE_DELTA_KEYFRAME;
+
+/* Codes one line's samples and reads them back. */
+static void code_line(struct totals* t, const uint32_t* xyz, uint32_t n)
+{
+    char line[255];
+    uint8_t len;
+    uint8_t done = sample_delta_write(line, sizeof(line), xyz, n, keyframe_every, &len);
+    if(done != n)
+    {
+        ++t->failures;
+        return;
+    }
+
+    const char* p = line;
+    uint32_t v = 0;
+    uint32_t i;
+    for(i = 0; i < n; ++i)
+    {
+        p = sample_delta_read(p, line + len, &v);
+        if(!p || v != xyz[i])
+            break;
+    }
+    if(i != n || p != line + len)
+    {
+        if(t->failures++ < 5)
+            fprintf(stderr, "line of %u samples did not read back: \"%.*s\"\n", n, (int) len, line);
+    }
+
+    ++t->lines;
+    t->samples += n;
+    t->hex += REPLY_OVERHEAD + 7 * n;
+    t->wide += REPLY_OVERHEAD + 6 * n;
+    t->delta += REPLY_OVERHEAD + len;
+    if((uint32_t) (REPLY_OVERHEAD + len) > t->longest)
+        t->longest = REPLY_OVERHEAD + len;
+}
+
+/* Codes the samples of a log, one sensor line at a time. */
+static uint8_t code_log(struct totals* t, const char* path)
+{
+    FILE* in = fopen(path, "rb");
+    if(!in)
+    {
+        perror(path);
+        return 0;
+    }
+    fseek(in, 0, SEEK_END);
+    long len = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char* text = (char*) malloc(len + 1);
+    if(fread(text, 1, len, in) != (size_t) len)
+    {
+        perror(path);
+        fclose(in);
+        free(text);
+        return 0;
+    }
+    fclose(in);
+    text[len] = 0;
+
+    struct gpslog log;
+    gpslog_init(&log);
+    char* p = text;
+    while(*p)
+    {
+        size_t l = strcspn(p + 1, "\r\n$") + 1;
+        if(*p != '$')
+        {
+            log.samples = 0;
+            gpslog_parse(&log, p, l);
+            /* longer lines, put together by hand, are cut up */
+            uint32_t xyz[REPLY_SAMPLES];
+            uint32_t i, n = 0;
+            for(i = 0; i < log.samples; ++i)
+            {
+                xyz[n++] = (uint32_t) gpslog_axis10(&log, 0, i) << 20 |
+                           (uint32_t) gpslog_axis10(&log, 1, i) << 10 | gpslog_axis10(&log, 2, i);
+                if(n == REPLY_SAMPLES || i + 1 == log.samples)
+                {
+                    code_line(t, xyz, n);
+                    n = 0;
+                }
+            }
+        }
+        p += l;
+        while(*p == '\r' || *p == '\n')
+            ++p;
+    }
+    gpslog_free(&log);
+    free(text);
+    return 1;
+}
+
+static void report(const char* name, const struct totals* t)
+{
+    if(!t->samples)
+    {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    double ms_per_byte = 10000.0 / BAUD;
+    /* room for samples in a slot: the line, its '\r' and a 0 */
+    uint32_t room = NMEA_RX_SLOT_SIZE - REPLY_OVERHEAD;
+    printf("%s: %u lines, %u samples\n", name, t->lines, t->samples);
+    printf("  |xxyyzz %7lu bytes  %6.1f ms/line              %4u samples/slot\n",
+           (unsigned long) t->hex, ms_per_byte * t->hex / t->lines, room / 7);
+    printf("  !ccccc  %7lu bytes  %6.1f ms/line  %5.2fx      %4u samples/slot\n",
+           (unsigned long) t->wide, ms_per_byte * t->wide / t->lines, (double) t->hex / t->wide, room / 6);
+    printf("  delta   %7lu bytes  %6.1f ms/line  %5.2fx  ~%6.1f samples/slot, %u bytes at most\n",
+           (unsigned long) t->delta, ms_per_byte * t->delta / t->lines, (double) t->hex / t->delta,
+           room / ((double) (t->delta - REPLY_OVERHEAD * t->lines) / t->samples), t->longest);
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while((opt = getopt(argc, argv, "k:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'k': keyframe_every = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-k keyframe_every] [log ...]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    static const char* examples[] = {
+        "../example_data/GPSLOG00-wii.TXT", "../example_data/john1.txt", "../example_data/john1-fixed.txt"
+    };
+    const char** logs = (const char**) argv + optind;
+    int count = argc - optind;
+    if(!count)
+    {
+        logs = examples;
+        count = sizeof(examples) / sizeof(*examples);
+    }
+
+    printf("keyframe every %u samples, %u baud\n", keyframe_every, BAUD);
+    struct totals all;
+    memset(&all, 0, sizeof(all));
+    int i;
+    for(i = 0; i < count; ++i)
+    {
+        struct totals t;
+        memset(&t, 0, sizeof(t));
+        if(!code_log(&t, logs[i]))
+            return 1;
+        report(logs[i], &t);
+
+        all.lines += t.lines;
+        all.samples += t.samples;
+        all.hex += t.hex;
+        all.wide += t.wide;
+        all.delta += t.delta;
+        all.failures += t.failures;
+        if(t.longest > all.longest)
+            all.longest = t.longest;
+    }
+    if(count > 1)
+        report("all", &all);
+
+    if(all.failures)
+        fprintf(stderr, "%u lines did not survive delta coding\n", all.failures);
+    return all.failures ? 1 : 0;
+}
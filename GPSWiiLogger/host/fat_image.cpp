@@ -0,0 +1,486 @@
+/*
+ * fat_image.cpp -- format and inspect FAT16 and FAT32 card images on the host
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fat_image.h"
+
+#define FAT_IMAGE_SECTOR_SIZE 512
+#define FAT_IMAGE_ROOT_ENTRIES 512
+
+/* the FAT32 layout mkfs.fat uses */
+#define FAT_IMAGE_FAT32_RESERVED 32
+#define FAT_IMAGE_FAT32_FSINFO 1
+#define FAT_IMAGE_FAT32_BACKUP 6
+
+/* FAT entries as fat_image_next() returns them, for both FAT types */
+#define FAT_IMAGE_CLUSTER_RESERVED 0x0ffffff0
+#define FAT_IMAGE_CLUSTER_LAST 0x0fffffff
+
+struct fat_image_layout
+{
+    uint64_t partition_offset;
+    uint64_t fat_offset;
+    uint64_t root_dir_offset;
+    uint64_t cluster_zero_offset;
+    uint32_t cluster_size;
+    uint32_t cluster_count;
+    uint16_t root_entries;
+    uint8_t fat32;
+    uint32_t root_cluster;
+    uint64_t fsinfo_offset;
+};
+
+static void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+    return (uint16_t) p[0] | ((uint16_t) p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return (uint32_t) get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+/**
+ * Writes an MBR with a single partition.
+ *
+ * \param[out] image The image contents.
+ * \param[in] type The partition type, e.g. 0x06 for FAT16 or 0x0c for FAT32.
+ * \param[in] start The first sector of the partition.
+ * \param[in] sectors The partition size in sectors.
+ */
+void fat_image_set_partition(uint8_t* image, uint8_t type, uint32_t start, uint32_t sectors)
+{
+    uint8_t* entry = image + 0x1be;
+    memset(entry, 0, 4 * 16);
+    entry[4] = type;
+    put32(entry + 8, start);
+    put32(entry + 12, sectors);
+    image[0x1fe] = 0x55;
+    image[0x1ff] = 0xaa;
+}
+
+/**
+ * Writes an MBR with a single FAT16 partition and formats it.
+ *
+ * \param[out] image The image contents.
+ * \param[in] size The image size in bytes.
+ * \param[in] sectors_per_cluster The cluster size in sectors.
+ * \returns 0 if the resulting volume would not be a FAT16, 1 on success.
+ */
+uint8_t fat_image_format(uint8_t* image, uint64_t size, uint8_t sectors_per_cluster)
+{
+    uint32_t sector_count = size / FAT_IMAGE_SECTOR_SIZE - FAT_IMAGE_PARTITION_START;
+    uint16_t reserved_sectors = 1;
+    uint16_t root_sectors = FAT_IMAGE_ROOT_ENTRIES * 32 / FAT_IMAGE_SECTOR_SIZE;
+
+    /* find the smallest FAT which covers all clusters */
+    uint32_t sectors_per_fat = 1;
+    uint32_t cluster_count;
+    while(1)
+    {
+        cluster_count = (sector_count - reserved_sectors - root_sectors - 2 * sectors_per_fat) / sectors_per_cluster;
+        uint32_t needed = ((cluster_count + 2) * 2 + FAT_IMAGE_SECTOR_SIZE - 1) / FAT_IMAGE_SECTOR_SIZE;
+        if(needed <= sectors_per_fat)
+            break;
+        sectors_per_fat = needed;
+    }
+    if(size / FAT_IMAGE_SECTOR_SIZE > 0xffffffff ||
+       cluster_count < 4085 || cluster_count >= 65525 || sectors_per_fat > 0xffff)
+        return 0;
+
+    memset(image, 0, FAT_IMAGE_SECTOR_SIZE * (FAT_IMAGE_PARTITION_START + reserved_sectors + 2 * sectors_per_fat + root_sectors));
+
+    fat_image_set_partition(image, 0x06, FAT_IMAGE_PARTITION_START, sector_count);
+
+    /* boot sector */
+    uint8_t* boot = image + FAT_IMAGE_PARTITION_START * FAT_IMAGE_SECTOR_SIZE;
+    boot[0] = 0xeb;
+    boot[1] = 0x3c;
+    boot[2] = 0x90;
+    memcpy(boot + 3, "GPSWII  ", 8);
+    put16(boot + 0x0b, FAT_IMAGE_SECTOR_SIZE);
+    boot[0x0d] = sectors_per_cluster;
+    put16(boot + 0x0e, reserved_sectors);
+    boot[0x10] = 2;
+    put16(boot + 0x11, FAT_IMAGE_ROOT_ENTRIES);
+    put16(boot + 0x13, sector_count < 0x10000 ? sector_count : 0);
+    boot[0x15] = 0xf8;
+    put16(boot + 0x16, sectors_per_fat);
+    put32(boot + 0x1c, FAT_IMAGE_PARTITION_START);
+    put32(boot + 0x20, sector_count < 0x10000 ? 0 : sector_count);
+    boot[0x26] = 0x29;
+    memcpy(boot + 0x2b, "GPSWII     ", 11);
+    memcpy(boot + 0x36, "FAT16   ", 8);
+    boot[0x1fe] = 0x55;
+    boot[0x1ff] = 0xaa;
+
+    /* both FATs start with the media descriptor and an end-of-chain marker */
+    uint8_t* fat = boot + reserved_sectors * FAT_IMAGE_SECTOR_SIZE;
+    uint8_t i;
+    for(i = 0; i < 2; ++i)
+    {
+        put16(fat, 0xfff8);
+        put16(fat + 2, 0xffff);
+        fat += sectors_per_fat * FAT_IMAGE_SECTOR_SIZE;
+    }
+
+    return 1;
+}
+
+/**
+ * Writes an MBR with a single FAT32 partition and formats it the way
+ * mkfs.fat does: 32 reserved sectors with the FSInfo sector at 1 and
+ * a backup boot sector at 6, two FATs and the root directory in
+ * cluster 2.
+ *
+ * \param[out] image The image contents.
+ * \param[in] size The image size in bytes.
+ * \param[in] sectors_per_cluster The cluster size in sectors.
+ * \returns 0 if the resulting volume would not be a FAT32, 1 on success.
+ */
+uint8_t fat_image_format_fat32(uint8_t* image, uint64_t size, uint8_t sectors_per_cluster)
+{
+    if(size / FAT_IMAGE_SECTOR_SIZE > 0xffffffff)
+        return 0;
+
+    uint32_t sector_count = size / FAT_IMAGE_SECTOR_SIZE - FAT_IMAGE_PARTITION_START;
+    uint16_t reserved_sectors = FAT_IMAGE_FAT32_RESERVED;
+
+    /* find the smallest FAT which covers all clusters */
+    uint32_t sectors_per_fat = 1;
+    uint32_t cluster_count;
+    while(1)
+    {
+        cluster_count = (sector_count - reserved_sectors - 2 * sectors_per_fat) / sectors_per_cluster;
+        uint32_t needed = ((uint64_t) (cluster_count + 2) * 4 + FAT_IMAGE_SECTOR_SIZE - 1) / FAT_IMAGE_SECTOR_SIZE;
+        if(needed <= sectors_per_fat)
+            break;
+        sectors_per_fat = needed;
+    }
+    if(cluster_count < 65525 || cluster_count >= 0x0ffffff0)
+        return 0;
+
+    /* everything up to and including the root directory's cluster */
+    uint64_t used = (uint64_t) FAT_IMAGE_SECTOR_SIZE *
+                    (FAT_IMAGE_PARTITION_START + reserved_sectors + 2 * (uint64_t) sectors_per_fat + sectors_per_cluster);
+    memset(image, 0, used);
+
+    fat_image_set_partition(image, 0x0c, FAT_IMAGE_PARTITION_START, sector_count);
+
+    /* boot sector */
+    uint8_t* boot = image + FAT_IMAGE_PARTITION_START * FAT_IMAGE_SECTOR_SIZE;
+    boot[0] = 0xeb;
+    boot[1] = 0x58;
+    boot[2] = 0x90;
+    memcpy(boot + 3, "GPSWII  ", 8);
+    put16(boot + 0x0b, FAT_IMAGE_SECTOR_SIZE);
+    boot[0x0d] = sectors_per_cluster;
+    put16(boot + 0x0e, reserved_sectors);
+    boot[0x10] = 2;
+    boot[0x15] = 0xf8;
+    put16(boot + 0x18, 32);
+    put16(boot + 0x1a, 64);
+    put32(boot + 0x1c, FAT_IMAGE_PARTITION_START);
+    put32(boot + 0x20, sector_count);
+    put32(boot + 0x24, sectors_per_fat);
+    put32(boot + 0x2c, 2);
+    put16(boot + 0x30, FAT_IMAGE_FAT32_FSINFO);
+    put16(boot + 0x32, FAT_IMAGE_FAT32_BACKUP);
+    boot[0x40] = 0x80;
+    boot[0x42] = 0x29;
+    memcpy(boot + 0x47, "GPSWII     ", 11);
+    memcpy(boot + 0x52, "FAT32   ", 8);
+    boot[0x1fe] = 0x55;
+    boot[0x1ff] = 0xaa;
+
+    /* FSInfo sector: all clusters but the root directory's are free */
+    uint8_t* fsinfo = boot + FAT_IMAGE_FAT32_FSINFO * FAT_IMAGE_SECTOR_SIZE;
+    put32(fsinfo, 0x41615252);
+    put32(fsinfo + 0x1e4, 0x61417272);
+    put32(fsinfo + 0x1e8, cluster_count - 1);
+    put32(fsinfo + 0x1ec, 3);
+    put32(fsinfo + 0x1fc, 0xaa550000);
+
+    /* and the backups of both */
+    memcpy(boot + FAT_IMAGE_FAT32_BACKUP * FAT_IMAGE_SECTOR_SIZE, boot, 2 * FAT_IMAGE_SECTOR_SIZE);
+
+    /* both FATs start with the media descriptor, an end-of-chain marker
+     * and the root directory, which is a chain of one cluster
+     */
+    uint8_t* fat = boot + reserved_sectors * FAT_IMAGE_SECTOR_SIZE;
+    uint8_t i;
+    for(i = 0; i < 2; ++i)
+    {
+        put32(fat, 0x0ffffff8);
+        put32(fat + 4, 0x0fffffff);
+        put32(fat + 8, 0x0fffffff);
+        fat += (uint64_t) sectors_per_fat * FAT_IMAGE_SECTOR_SIZE;
+    }
+
+    return 1;
+}
+
+static uint8_t fat_image_get_layout(const uint8_t* image, struct fat_image_layout* layout)
+{
+    const uint8_t* entry = image + 0x1be;
+    uint32_t partition_start = entry[4] ? get32(entry + 8) : 0;
+    const uint8_t* boot = image + (uint64_t) partition_start * FAT_IMAGE_SECTOR_SIZE;
+
+    uint16_t bytes_per_sector = get16(boot + 0x0b);
+    uint32_t sectors_per_fat = get16(boot + 0x16);
+    memset(layout, 0, sizeof(*layout));
+    if(sectors_per_fat == 0)
+    {
+        /* the FAT type follows from the cluster count, but only FAT32 has no 16 bit FAT size */
+        layout->fat32 = 1;
+        sectors_per_fat = get32(boot + 0x24);
+        layout->root_cluster = get32(boot + 0x2c) & 0x0fffffff;
+    }
+    if(bytes_per_sector != FAT_IMAGE_SECTOR_SIZE || sectors_per_fat == 0 || boot[0x0d] == 0)
+        return 0;
+
+    layout->partition_offset = (uint64_t) partition_start * FAT_IMAGE_SECTOR_SIZE;
+    layout->fat_offset = layout->partition_offset + get16(boot + 0x0e) * FAT_IMAGE_SECTOR_SIZE;
+    layout->root_dir_offset = layout->fat_offset + (uint64_t) boot[0x10] * sectors_per_fat * FAT_IMAGE_SECTOR_SIZE;
+    layout->root_entries = get16(boot + 0x11);
+    layout->cluster_zero_offset = layout->root_dir_offset + layout->root_entries * 32;
+    layout->cluster_size = (uint32_t) boot[0x0d] * FAT_IMAGE_SECTOR_SIZE;
+    if(layout->fat32 && get16(boot + 0x30))
+        layout->fsinfo_offset = layout->partition_offset + get16(boot + 0x30) * FAT_IMAGE_SECTOR_SIZE;
+
+    uint32_t sector_count = get16(boot + 0x13) ? get16(boot + 0x13) : get32(boot + 0x20);
+    uint64_t data_offset = layout->cluster_zero_offset - layout->partition_offset;
+    layout->cluster_count = ((uint64_t) sector_count * FAT_IMAGE_SECTOR_SIZE - data_offset) / layout->cluster_size;
+    if(layout->fat32 != (layout->cluster_count >= 65525))
+        return 0;
+    return 1;
+}
+
+/* the FAT entry of a cluster, with FAT16 end-of-chain and such widened to FAT32 */
+static uint32_t fat_image_next(const uint8_t* image, const struct fat_image_layout* layout, uint32_t cluster)
+{
+    const uint8_t* fat = image + layout->fat_offset;
+    if(layout->fat32)
+        return get32(fat + 4 * (uint64_t) cluster) & 0x0fffffff;
+
+    uint32_t entry = get16(fat + 2 * cluster);
+    return entry >= 0xfff0 ? entry | 0x0fff0000 : entry;
+}
+
+static const uint8_t* fat_image_cluster(const uint8_t* image, const struct fat_image_layout* layout, uint32_t cluster)
+{
+    return image + layout->cluster_zero_offset + (uint64_t) (cluster - 2) * layout->cluster_size;
+}
+
+/* the n'th entry of the root directory, or 0 behind its end */
+static const uint8_t* fat_image_root_entry(const uint8_t* image, const struct fat_image_layout* layout, uint32_t n)
+{
+    if(!layout->fat32)
+        return n < layout->root_entries ? image + layout->root_dir_offset + 32 * n : 0;
+
+    uint32_t entries_per_cluster = layout->cluster_size / 32;
+    uint32_t cluster = layout->root_cluster;
+    while(n >= entries_per_cluster)
+    {
+        cluster = fat_image_next(image, layout, cluster);
+        if(cluster < 2 || cluster >= FAT_IMAGE_CLUSTER_RESERVED)
+            return 0;
+        n -= entries_per_cluster;
+    }
+    return fat_image_cluster(image, layout, cluster) + 32 * n;
+}
+
+/**
+ * Sets where the FSInfo sector of a FAT32 image suggests to start
+ * looking for free clusters.
+ *
+ * \param[in,out] image The image contents.
+ * \param[in] cluster The next free cluster hint.
+ * \returns 0 if the image is no FAT32 with an FSInfo sector, 1 on success.
+ */
+uint8_t fat_image_set_next_free(uint8_t* image, uint32_t cluster)
+{
+    struct fat_image_layout layout;
+    if(!fat_image_get_layout(image, &layout) || !layout.fsinfo_offset)
+        return 0;
+
+    uint8_t* fsinfo = image + layout.fsinfo_offset;
+    if(get32(fsinfo + 0x1e4) != 0x61417272)
+        return 0;
+    put32(fsinfo + 0x1ec, cluster);
+    return 1;
+}
+/* turns "GPSLOG00.TXT" into the space padded "GPSLOG00TXT" */
+static void fat_image_short_name(const char* name, char* short_name)
+{
+    memset(short_name, ' ', 11);
+    uint8_t i = 0;
+    while(*name && *name != '.' && i < 8)
+        short_name[i++] = *name++;
+    while(*name && *name != '.')
+        ++name;
+    if(*name == '.')
+        ++name;
+    for(i = 8; *name && i < 11; ++i)
+        short_name[i] = *name++;
+}
+
+/**
+ * Reads a file from the root directory of the image.
+ *
+ * \param[in] image The image contents.
+ * \param[in] name The file's 8.3 name.
+ * \param[out] buffer Receives up to buffer_len bytes of the file.
+ * \param[in] buffer_len The size of buffer.
+ * \returns The file size as recorded in its directory entry, or
+ *          FAT_IMAGE_NOT_FOUND if there is no such file.
+ */
+uint32_t fat_image_read_file(const uint8_t* image, const char* name, uint8_t* buffer, uint32_t buffer_len)
+{
+    struct fat_image_layout layout;
+    if(!fat_image_get_layout(image, &layout))
+        return FAT_IMAGE_NOT_FOUND;
+
+    char short_name[11];
+    fat_image_short_name(name, short_name);
+
+    const uint8_t* dir;
+    uint32_t i;
+    for(i = 0; (dir = fat_image_root_entry(image, &layout, i)) != 0; ++i)
+    {
+        if(dir[0] == 0x00)
+            return FAT_IMAGE_NOT_FOUND;
+        if(dir[0] == 0xe5 || dir[11] == 0x0f)
+            continue;
+        if(memcmp(dir, short_name, 11) == 0)
+            break;
+    }
+    if(!dir)
+        return FAT_IMAGE_NOT_FOUND;
+
+    uint32_t file_size = get32(dir + 28);
+    uint32_t cluster = get16(dir + 26);
+    if(layout.fat32)
+        cluster |= (uint32_t) get16(dir + 20) << 16;
+    uint32_t left = file_size < buffer_len ? file_size : buffer_len;
+    while(left > 0 && cluster >= 2 && cluster < FAT_IMAGE_CLUSTER_RESERVED)
+    {
+        uint32_t length = left < layout.cluster_size ? left : layout.cluster_size;
+        memcpy(buffer, fat_image_cluster(image, &layout, cluster), length);
+        buffer += length;
+        left -= length;
+        cluster = fat_image_next(image, &layout, cluster);
+    }
+
+    return file_size;
+}
+
+/**
+ * Cross-checks the root directory against the FAT, like a tiny fsck.
+ *
+ * Every file's cluster chain has to be exactly as long as its size
+ * needs and must not run into free clusters or clusters of another
+ * file, and every allocated cluster has to belong to some file or,
+ * on FAT32, to the root directory. The FSInfo free cluster count of
+ * a FAT32 has to be either right or marked as unknown.
+ *
+ * \param[in] image The image contents.
+ * \param[out] result Receives the counts.
+ * \returns 1 if the file system is consistent, 0 otherwise.
+ */
+uint8_t fat_image_check(const uint8_t* image, struct fat_image_check_result* result)
+{
+    memset(result, 0, sizeof(*result));
+
+    struct fat_image_layout layout;
+    if(!fat_image_get_layout(image, &layout))
+        return 0;
+
+    uint32_t cluster_max = layout.cluster_count + 2;
+    uint8_t* owned = (uint8_t*) calloc(cluster_max, 1);
+    if(!owned)
+        return 0;
+
+    uint32_t cluster;
+    if(layout.fat32)
+    {
+        /* the root directory's chain has to be sound as well */
+        for(cluster = layout.root_cluster; cluster >= 2 && cluster < FAT_IMAGE_CLUSTER_RESERVED;
+            cluster = fat_image_next(image, &layout, cluster))
+        {
+            if(cluster >= cluster_max || owned[cluster] || fat_image_next(image, &layout, cluster) == 0)
+            {
+                ++result->files_bad;
+                break;
+            }
+            owned[cluster] = 1;
+        }
+    }
+
+    const uint8_t* dir;
+    uint32_t i;
+    for(i = 0; (dir = fat_image_root_entry(image, &layout, i)) != 0 && dir[0] != 0x00; ++i)
+    {
+        if(dir[0] == 0xe5 || dir[11] == 0x0f || (dir[11] & 0x18))
+            continue;
+        ++result->files;
+
+        uint32_t needed = (get32(dir + 28) + (uint64_t) layout.cluster_size - 1) / layout.cluster_size;
+        uint32_t length = 0;
+        uint8_t bad = 0;
+        cluster = get16(dir + 26);
+        if(layout.fat32)
+            cluster |= (uint32_t) get16(dir + 20) << 16;
+        while(cluster >= 2 && cluster < FAT_IMAGE_CLUSTER_RESERVED)
+        {
+            if(cluster >= cluster_max || owned[cluster] || fat_image_next(image, &layout, cluster) == 0)
+            {
+                bad = 1;
+                break;
+            }
+            owned[cluster] = 1;
+            ++length;
+            cluster = fat_image_next(image, &layout, cluster);
+        }
+        if(bad || length != needed)
+            ++result->files_bad;
+    }
+
+    uint32_t free_count = 0;
+    for(cluster = 2; cluster < cluster_max; ++cluster)
+    {
+        if(fat_image_next(image, &layout, cluster) == 0)
+        {
+            ++free_count;
+            continue;
+        }
+        ++result->clusters_allocated;
+        if(!owned[cluster])
+            ++result->clusters_lost;
+    }
+
+    if(layout.fsinfo_offset)
+    {
+        uint32_t fsinfo_free = get32(image + layout.fsinfo_offset + 0x1e8);
+        if(fsinfo_free != 0xffffffff && fsinfo_free != free_count)
+            result->fsinfo_bad = 1;
+    }
+
+    free(owned);
+    return result->files_bad == 0 && result->clusters_lost == 0 && !result->fsinfo_bad;
+}
@@ -0,0 +1,44 @@
+/*
+ * fat_image.h -- format and inspect FAT16 and FAT32 card images on the host
+ *
+ * These helpers work on the raw image bytes and share no code with
+ * fat16.cpp, so they double as an independent check of what the
+ * logger's storage stack actually wrote.
+ */
+
+#ifndef FAT_IMAGE_H
+#define FAT_IMAGE_H
+
+#include <stdint.h>
+
+/** The sector at which fat_image_format() starts the partition. */
+#define FAT_IMAGE_PARTITION_START 63
+
+/** Returned by fat_image_read_file() if the file does not exist. */
+#define FAT_IMAGE_NOT_FOUND 0xffffffffUL
+
+/**
+ * Result of fat_image_check().
+ */
+struct fat_image_check_result
+{
+    /** Files in the root directory. */
+    uint32_t files;
+    /** Files whose cluster chain does not match their size. */
+    uint32_t files_bad;
+    /** Clusters marked as used in the FAT. */
+    uint32_t clusters_allocated;
+    /** Used clusters which no file refers to. */
+    uint32_t clusters_lost;
+    /** Set if the FAT32 FSInfo free cluster count is neither right nor unknown. */
+    uint8_t fsinfo_bad;
+};
+
+void fat_image_set_partition(uint8_t* image, uint8_t type, uint32_t start, uint32_t sectors);
+uint8_t fat_image_format(uint8_t* image, uint64_t size, uint8_t sectors_per_cluster);
+uint8_t fat_image_format_fat32(uint8_t* image, uint64_t size, uint8_t sectors_per_cluster);
+uint8_t fat_image_set_next_free(uint8_t* image, uint32_t cluster);
+uint32_t fat_image_read_file(const uint8_t* image, const char* name, uint8_t* buffer, uint32_t buffer_len);
+uint8_t fat_image_check(const uint8_t* image, struct fat_image_check_result* result);
+
+#endif
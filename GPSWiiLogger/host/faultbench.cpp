@@ -0,0 +1,395 @@
+/*
+ * faultbench.cpp -- the logger's card workload while the card misbehaves
+ *
+ * Formats a fresh FAT16 image and logs one $GPRMC line and one sensor
+ * line per simulated second to GPSL0000.TXT through AF_SDLog, set up
+ * the way GPSWiiLogger's setup() does it: contiguous runs of -r
+ * clusters, the size synced every -T seconds and on every cluster
+ * boundary, blocks streamed.  Meanwhile the emulated card (see
+ * sd_image.h) has faults injected:
+ *
+ *  -e  every n'th block written is rejected with a write error; the
+ *      writes are tried again and the log must read back complete.
+ *  -x  the card is pulled at that second; the write at hand must give
+ *      up with SDLOG_CARD_GONE, and the ones after it right away.
+ *  -P  that many runs, each losing power after a random number of
+ *      blocks programmed, as a brown-out mid-ride would.
+ *
+ * After each run the logger boots again on a fresh process, the way
+ * the sketch does, recovering the last log with AF_SDLog::recover_file().
+ * The image must then pass fat_image_check() -- no clusters lost to the
+ * reservation of a log that never got closed -- and the log must hold
+ * the start of what was written, short by at most what was logged in
+ * the last -T seconds before the fault.  A card which fills up (-s
+ * small enough for -t) must end with SDLOG_CARD_FULL and a complete log.
+ * -F 32 formats a FAT32 instead (see logbench).
+ *
+ * usage: faultbench [-i image] [-s size_mb] [-c sectors_per_cluster]
+ *                   [-t seconds] [-r reserve_clusters] [-T sync_seconds]
+ *                   [-e reject_every] [-x pull_second] [-P power_cuts]
+ *                   [-z seed] [-F 16|32]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "AF_SDLog.h"
+#include "WProgram.h"
+#include "sd_image.h"
+#include "fat_image.h"
+
+AF_SDLog card;
+File f;
+
+char buffer[75];
+char name[13];
+
+/* what a logging run tells the boot after it */
+struct run_result
+{
+    /* bytes AF_SDLog said it wrote */
+    uint32_t logged;
+    /* the second in which writing stopped, or the run's length */
+    uint32_t t_end;
+    /* AF_SDLog::card_state() at the end */
+    uint8_t state;
+    /* the log was closed, so nothing may be missing */
+    uint8_t closed;
+    uint16_t write_errors;
+    /* blocks the card rejected, and bus time spent once it was gone */
+    uint32_t blocks_rejected;
+    uint32_t gone_spi_bytes;
+};
+
+/* one $GPRMC line as GPSWiiLogger writes it: '\r' kept, '\n' dropped */
+static uint8_t make_gps_line(uint32_t t)
+{
+    sprintf(buffer, "$GPRMC,%02lu%02lu%02lu.000,A,3409.%04lu,N,11808.%04lu,W,0.31,295.65,010908,,*",
+            (unsigned long) (t / 3600) % 24, (unsigned long) (t / 60) % 60, (unsigned long) t % 60,
+            (unsigned long) (9172 + t) % 10000, (unsigned long) (1017 + 3 * t) % 10000);
+    uint8_t sum = 0;
+    char* p;
+    for(p = buffer + 1; *p != '*'; ++p)
+        sum ^= *p;
+    sprintf(p + 1, "%02X\r", sum);
+    return strlen(buffer);
+}
+
+/* one sensor pod reply: command char, ten "|xxyyzz" samples, '\r' */
+static uint8_t make_sensor_line(uint32_t t)
+{
+    uint8_t len = 0;
+    buffer[len++] = 'r';
+    uint8_t i;
+    for(i = 0; i < 10; ++i)
+    {
+        uint32_t r = (t * 10 + i) * 2654435761UL;
+        len += sprintf(buffer + len, "|%02X%02X%02X",
+                       0x78 + ((r >> 8) & 0x0f), 0x90 + ((r >> 16) & 0x1f), 0xb0 + ((r >> 24) & 0x1f));
+    }
+    buffer[len++] = '\r';
+    buffer[len] = 0;
+    return len;
+}
+
+/* everything logged in seconds [0, t) */
+static uint32_t make_log(uint8_t* out, uint32_t t)
+{
+    uint32_t len = 0;
+    uint32_t s;
+    for(s = 0; s < t; ++s)
+    {
+        uint8_t n = make_gps_line(s);
+        if(out)
+            memcpy(out + len, buffer, n);
+        len += n;
+        n = make_sensor_line(s);
+        if(out)
+            memcpy(out + len, buffer, n);
+        len += n;
+    }
+    return len;
+}
+
+static uint8_t mount()
+{
+    return card.init_card() && card.open_partition() &&
+           card.open_filesys() && card.open_dir((char*) "/");
+}
+
+/* what setup() and loop() do, until the card gives up or time is up */
+static void log_run(uint32_t seconds, uint16_t reserve, uint16_t sync_seconds,
+                    uint32_t reject_every, uint32_t pull_second, uint32_t cut_blocks,
+                    struct run_result* result)
+{
+    memset(result, 0, sizeof(*result));
+    host_set_millis(0);
+    if(!mount() ||
+       !card.numbered_name(name, "GPSL", card.last_numbered_file("GPSL") + 1, "TXT") ||
+       !card.create_file(name) || !(f = card.open_file(name)) ||
+       !card.reserve_file(f, reserve) ||
+       !card.set_sync_policy(f, 0, sync_seconds, FAT16_SYNC_CLUSTER) ||
+       !card.begin_stream())
+    {
+        fprintf(stderr, "can't set up the log\n");
+        exit(1);
+    }
+
+    sd_image_reject_writes(reject_every);
+    sd_image_remove_after(cut_blocks);
+    uint32_t t;
+    for(t = 0; t < seconds; ++t)
+    {
+        host_set_millis(t * 1000);
+        if(t == pull_second)
+            sd_image_remove();
+
+        uint32_t spi_bytes = sd_image_get_stats()->spi_bytes;
+        uint8_t len = make_gps_line(t);
+        uint16_t done = card.write_file(f, (uint8_t*) buffer, len);
+        result->logged += done;
+        if(done == len)
+        {
+            len = make_sensor_line(t);
+            done = card.write_file(f, (uint8_t*) buffer, len);
+            result->logged += done;
+        }
+        if(!sd_image_inserted())
+            result->gone_spi_bytes += sd_image_get_stats()->spi_bytes - spi_bytes;
+        if(done != len)
+            break;
+    }
+    result->t_end = t;
+    result->state = card.card_state();
+    result->write_errors = card.write_errors();
+    result->blocks_rejected = sd_image_get_stats()->blocks_rejected;
+
+    if(t < seconds && !(result->state & (SDLOG_CARD_GONE | SDLOG_CARD_FULL)))
+    {
+        fprintf(stderr, "a write failed at second %lu, but the card is fine\n", (unsigned long) t);
+        exit(1);
+    }
+    if(result->state & SDLOG_CARD_GONE)
+    {
+        /* what's left of the loop must not keep the logger busy */
+        uint32_t spi_bytes = sd_image_get_stats()->spi_bytes;
+        if(card.write_file(f, (uint8_t*) buffer, 1) != 0 ||
+           sd_image_get_stats()->spi_bytes != spi_bytes)
+        {
+            fprintf(stderr, "writes go on after the card is gone\n");
+            exit(1);
+        }
+        return;     /* and the power with it, so the log stays open */
+    }
+
+    sd_image_reject_writes(0);
+    card.close_file(f);
+    card.end_stream();
+    sd_raw_sync();
+    result->closed = 1;
+}
+
+/* boot again, recover the last log and check what it holds */
+static void check_boot(const struct run_result* result, uint16_t sync_seconds)
+{
+    sd_image_insert();
+    int32_t last;
+    if(!mount() || (last = card.last_numbered_file("GPSL")) < 0 ||
+       !card.numbered_name(name, "GPSL", last, "TXT") || !card.recover_file(name))
+    {
+        fprintf(stderr, "can't recover the log after the fault\n");
+        exit(1);
+    }
+
+    struct fat_image_check_result check;
+    if(!fat_image_check(sd_image_data(), &check))
+    {
+        fprintf(stderr, "inconsistent file system: %lu of %lu files bad, %lu of %lu clusters lost\n",
+                (unsigned long) check.files_bad, (unsigned long) check.files,
+                (unsigned long) check.clusters_lost, (unsigned long) check.clusters_allocated);
+        exit(1);
+    }
+
+    uint32_t expected_len = make_log(0, result->t_end + 1);
+    uint8_t* expected = (uint8_t*) malloc(expected_len);
+    make_log(expected, result->t_end + 1);
+    uint8_t* actual = (uint8_t*) malloc(expected_len + 1);
+    uint32_t actual_len = fat_image_read_file(sd_image_data(), name, actual, expected_len + 1);
+    if(actual_len > result->logged || memcmp(actual, expected, actual_len) != 0)
+    {
+        fprintf(stderr, "%s: %lu bytes are not what was logged\n", name, (unsigned long) actual_len);
+        exit(1);
+    }
+
+    /* a size synced at the start of one second covers all before it */
+    uint32_t window_start = result->t_end > sync_seconds ? result->t_end - sync_seconds : 0;
+    uint32_t allowed = result->closed ? 0 : result->logged - make_log(0, window_start);
+    uint32_t lost = result->logged - actual_len;
+    if(lost > allowed)
+    {
+        fprintf(stderr, "%s: lost %lu bytes, only %lu were not synced\n", name,
+                (unsigned long) lost, (unsigned long) allowed);
+        exit(1);
+    }
+
+    free(actual);
+    free(expected);
+}
+
+/* runs fn in a process of its own, so the next boot finds no file open */
+static void in_child(void (*fn)(void*), void* arg)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        fn(arg);
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    if(pid < 0 || waitpid(pid, &status, 0) != pid ||
+       !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        exit(1);
+}
+
+struct run_args
+{
+    uint32_t seconds;
+    uint16_t reserve;
+    uint16_t sync_seconds;
+    uint32_t reject_every;
+    uint32_t pull_second;
+    uint32_t cut_blocks;
+    struct run_result* result;
+};
+
+static void run_logger(void* p)
+{
+    struct run_args* a = (struct run_args*) p;
+    log_run(a->seconds, a->reserve, a->sync_seconds, a->reject_every,
+            a->pull_second, a->cut_blocks, a->result);
+}
+
+static void run_boot(void* p)
+{
+    struct run_args* a = (struct run_args*) p;
+    check_boot(a->result, a->sync_seconds);
+}
+
+int main(int argc, char** argv)
+{
+    const char* image_path = "faultbench.img";
+    uint32_t size_mb = 16;
+    uint8_t sectors_per_cluster = 4;
+    uint32_t seconds = 600;
+    uint16_t reserve = 32;
+    uint16_t sync_seconds = 10;
+    uint32_t reject_every = 0;
+    uint32_t pull_second = 0xffffffff;
+    uint32_t power_cuts = 0;
+    unsigned seed = 1;
+    uint8_t fat_bits = 16;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:s:c:t:r:T:e:x:P:z:F:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i': image_path = optarg; break;
+            case 's': size_mb = atoi(optarg); break;
+            case 'c': sectors_per_cluster = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 'r': reserve = atoi(optarg); break;
+            case 'T': sync_seconds = atoi(optarg); break;
+            case 'e': reject_every = atoi(optarg); break;
+            case 'x': pull_second = atoi(optarg); break;
+            case 'P': power_cuts = atoi(optarg); break;
+            case 'z': seed = atoi(optarg); break;
+            case 'F': fat_bits = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-i image] [-s size_mb] [-c sectors_per_cluster] [-t seconds] [-r reserve_clusters] [-T sync_seconds] [-e reject_every] [-x pull_second] [-P power_cuts] [-z seed] [-F 16|32]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    /* shared with the children, which see the card's contents through the mapping */
+    uint32_t size = size_mb * 1024 * 1024;
+    if(!sd_image_open(image_path, size))
+    {
+        fprintf(stderr, "can't create %s\n", image_path);
+        return 1;
+    }
+
+    struct run_result* result = (struct run_result*) malloc(sizeof(*result));
+    struct run_args args = { seconds, reserve, sync_seconds, reject_every,
+                             pull_second, 0, result };
+    uint32_t runs = power_cuts ? power_cuts : 1;
+    uint32_t blocks_max = make_log(0, seconds) / 512 + 1;
+    uint32_t lost_max = 0;
+    uint32_t lost_sum = 0;
+    uint32_t i;
+    srand(seed);
+    for(i = 0; i < runs; ++i)
+    {
+        if(!(fat_bits == 32 ? fat_image_format_fat32(sd_image_data(), size, sectors_per_cluster)
+                            : fat_image_format(sd_image_data(), size, sectors_per_cluster)))
+        {
+            fprintf(stderr, "can't format %s\n", image_path);
+            return 1;
+        }
+        if(power_cuts)
+            args.cut_blocks = 1 + rand() % blocks_max;
+
+        /* the result comes back through a shared page */
+        struct run_result* shared = (struct run_result*)
+            mmap(0, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        args.result = shared;
+        in_child(run_logger, &args);
+        memcpy(result, shared, sizeof(*result));
+        in_child(run_boot, &args);
+        munmap(shared, sizeof(*shared));
+
+        /* the boot's count of lost bytes, worked out again out here */
+        card.numbered_name(name, "GPSL", 0, "TXT");
+        uint32_t lost = result->logged - fat_image_read_file(sd_image_data(), name, 0, 0);
+        if(lost > lost_max)
+            lost_max = lost;
+        lost_sum += lost;
+
+        if(!power_cuts)
+        {
+            printf("%lu seconds logged, %lu bytes:\n", (unsigned long) result->t_end,
+                   (unsigned long) result->logged);
+            printf("  blocks rejected:   %lu\n", (unsigned long) result->blocks_rejected);
+            printf("  write errors:      %u\n", (unsigned) result->write_errors);
+            printf("  card state:        %s\n", !result->state ? "ok" :
+                   (result->state & SDLOG_CARD_GONE) ? "gone" : "full");
+            if(result->state & SDLOG_CARD_GONE)
+                printf("  bus time gone:     %lu us\n", (unsigned long) result->gone_spi_bytes);
+            printf("  lost at boot:      %lu bytes\n", (unsigned long) lost);
+        }
+    }
+    if(power_cuts)
+        printf("%lu power cuts: recovered every time, lost %.0f bytes on average, %lu at most\n",
+               (unsigned long) runs, (double) lost_sum / runs, (unsigned long) lost_max);
+
+    if(reject_every && !result->write_errors)
+    {
+        fprintf(stderr, "no write failed, the faults were not injected\n");
+        return 1;
+    }
+    if(pull_second < seconds && !(result->state & SDLOG_CARD_GONE))
+    {
+        fprintf(stderr, "the card was pulled, but nobody noticed\n");
+        return 1;
+    }
+
+    free(result);
+    sd_image_close();
+    return 0;
+}
@@ -0,0 +1,621 @@
+/*
+ * gpslog.cpp -- load GPSWiiLogger text logs into columns
+ *
+ * See gpslog.h.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gpslog.h"
+#include "nmea_field.h"
+#include "sample_delta.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GPSLOG_X86 1
+#endif
+
+void gpslog_init(struct gpslog* log)
+{
+    memset(log, 0, sizeof(*log));
+}
+
+void gpslog_free(struct gpslog* log)
+{
+    free(log->time_ms);
+    free(log->lat);
+    free(log->lon);
+    free(log->speed);
+    free(log->course);
+    free(log->valid);
+    free(log->x);
+    free(log->y);
+    free(log->z);
+    free(log->low);
+    free(log->sample_fix);
+    gpslog_init(log);
+}
+
+#define GROW(array, room) array = (__typeof__(array)) realloc(array, (room) * sizeof(*(array)))
+
+static void reserve_fixes(struct gpslog* log, uint32_t room)
+{
+    if(room <= log->fix_room)
+        return;
+    GROW(log->time_ms, room);
+    GROW(log->lat, room);
+    GROW(log->lon, room);
+    GROW(log->speed, room);
+    GROW(log->course, room);
+    GROW(log->valid, room);
+    log->fix_room = room;
+}
+
+static void reserve_samples(struct gpslog* log, uint32_t room)
+{
+    if(room <= log->sample_room)
+        return;
+    GROW(log->x, room);
+    GROW(log->y, room);
+    GROW(log->z, room);
+    GROW(log->low, room);
+    GROW(log->sample_fix, room);
+    log->sample_room = room;
+}
+
+static inline uint8_t hex_value(char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return 0xff;
+}
+
+/*
+ * Sample decoding.  A run of n samples is n "|xxyyzz" groups of 7 bytes.
+ * The vector versions look at a window of 80 (SSE2) or 96 (AVX2) bytes
+ * at a time: one mask bit per byte for '|' and one for hex digits,
+ * compared with where the 11 or 13 groups fitting in the window must
+ * have them, tells how many groups in a row are good.  The nibbles come
+ * out of the same pass and are paired into bytes in registers; AVX2
+ * also picks the axes out with byte shuffles.
+ */
+
+#define SSE2_WINDOW 80
+#define AVX2_WINDOW 96
+
+static uint8_t decoder = GPSLOG_DECODE_SCALAR;
+static uint8_t decoder_chosen;
+
+static uint8_t hex_table[256];
+/* bits 0, 7, 14, ... of a window: where the '|' of each group goes */
+static uint64_t bar_lo, bar_hi;
+/* shuffles picking axis a of the groups out of 32 bytes i of the
+ * paired nibbles of an AVX2 window, per 16 byte lane
+ */
+static uint8_t gather_masks[3][AVX2_WINDOW / 32][32] __attribute__((aligned(32)));
+
+static uint32_t decode_scalar(const char* p, const char* end,
+                              uint8_t* x, uint8_t* y, uint8_t* z, uint32_t max)
+{
+    uint32_t n;
+    for(n = 0; n < max && p + 7 <= end && *p == '|'; ++n, p += 7)
+    {
+        const uint8_t* s = (const uint8_t*) p;
+        uint8_t a = hex_table[s[1]], b = hex_table[s[2]];
+        uint8_t c = hex_table[s[3]], d = hex_table[s[4]];
+        uint8_t e = hex_table[s[5]], f = hex_table[s[6]];
+        if((a | b | c | d | e | f) > 0x0f)
+            break;
+        x[n] = a << 4 | b;
+        y[n] = c << 4 | d;
+        z[n] = e << 4 | f;
+    }
+    return n;
+}
+
+/* How many good groups a window starts with, from its 128 bit masks. */
+static inline uint32_t good_groups(uint64_t bars_lo, uint64_t bars_hi,
+                                   uint64_t hex_lo, uint64_t hex_hi, uint32_t window)
+{
+    uint32_t bits = window / 7 * 7;
+    uint64_t bad_lo = ~((bars_lo & bar_lo) | (hex_lo & ~bar_lo));
+    uint64_t bad_hi = ~((bars_hi & bar_hi) | (hex_hi & ~bar_hi)) & ((1ULL << (bits - 64)) - 1);
+    uint32_t first = bad_lo ? __builtin_ctzll(bad_lo) : bad_hi ? 64 + __builtin_ctzll(bad_hi) : bits;
+    return first / 7;
+}
+
+/* Copies the bytes of n groups out of the paired nibbles. */
+static inline void take_groups(const uint8_t* pairs, uint32_t n, uint8_t* x, uint8_t* y, uint8_t* z)
+{
+    uint32_t i;
+    for(i = 0; i < n; ++i, pairs += 7)
+    {
+        x[i] = pairs[1];
+        y[i] = pairs[3];
+        z[i] = pairs[5];
+    }
+}
+
+#ifdef GPSLOG_X86
+/* The nibble of each hex digit in c (0 for other bytes), and masks of
+ * digits and '|'s.
+ */
+static inline __m128i nibbles_sse2(const char* p, uint64_t* hex, uint64_t* bars, uint32_t shift)
+{
+    const __m128i flip = _mm_set1_epi8((char) 0x80);
+    __m128i c = _mm_loadu_si128((const __m128i*) p);
+    __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    /* unsigned v < n, as a signed compare of v ^ 0x80 */
+    __m128i is_digit = _mm_cmplt_epi8(_mm_xor_si128(digit, flip), _mm_set1_epi8((char) (0x80 + 10)));
+    __m128i is_letter = _mm_cmplt_epi8(_mm_xor_si128(letter, flip), _mm_set1_epi8((char) (0x80 + 6)));
+
+    *hex |= (uint64_t) _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) << shift;
+    *bars |= (uint64_t) _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('|'))) << shift;
+    return _mm_or_si128(_mm_and_si128(is_digit, digit),
+                        _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+/* Each byte's nibble << 4 | the next byte's nibble.  Nibbles are below
+ * 16, so the 16 bit shift does not carry into the next byte.
+ */
+static inline __m128i pair_sse2(__m128i v, __m128i next)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 4), _mm_or_si128(_mm_srli_si128(v, 1), _mm_slli_si128(next, 15)));
+}
+
+static uint32_t decode_sse2(const char* p, const char* end,
+                            uint8_t* x, uint8_t* y, uint8_t* z, uint32_t max)
+{
+    uint32_t n = 0;
+    while(n < max && end - p >= SSE2_WINDOW)
+    {
+        uint64_t hex_lo = 0, hex_hi = 0, bars_lo = 0, bars_hi = 0;
+        __m128i v0 = nibbles_sse2(p, &hex_lo, &bars_lo, 0);
+        __m128i v1 = nibbles_sse2(p + 16, &hex_lo, &bars_lo, 16);
+        __m128i v2 = nibbles_sse2(p + 32, &hex_lo, &bars_lo, 32);
+        __m128i v3 = nibbles_sse2(p + 48, &hex_lo, &bars_lo, 48);
+        __m128i v4 = nibbles_sse2(p + 64, &hex_hi, &bars_hi, 0);
+
+        uint32_t got = good_groups(bars_lo, bars_hi, hex_lo, hex_hi, SSE2_WINDOW);
+        if(got > max - n)
+            got = max - n;
+
+        uint8_t pairs[SSE2_WINDOW];
+        _mm_storeu_si128((__m128i*) pairs, pair_sse2(v0, v1));
+        _mm_storeu_si128((__m128i*) (pairs + 16), pair_sse2(v1, v2));
+        _mm_storeu_si128((__m128i*) (pairs + 32), pair_sse2(v2, v3));
+        _mm_storeu_si128((__m128i*) (pairs + 48), pair_sse2(v3, v4));
+        _mm_storeu_si128((__m128i*) (pairs + 64), pair_sse2(v4, _mm_setzero_si128()));
+        take_groups(pairs, got, x + n, y + n, z + n);
+
+        n += got;
+        p += 7 * got;
+        if(got < SSE2_WINDOW / 7)
+            return n;
+    }
+    return n + decode_scalar(p, end, x + n, y + n, z + n, max - n);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nibbles_avx2(const char* p, uint64_t* hex, uint64_t* bars, uint32_t shift)
+{
+    const __m256i flip = _mm256_set1_epi8((char) 0x80);
+    __m256i c = _mm256_loadu_si256((const __m256i*) p);
+    __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i is_digit = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (0x80 + 10)), _mm256_xor_si256(digit, flip));
+    __m256i is_letter = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (0x80 + 6)), _mm256_xor_si256(letter, flip));
+
+    *hex |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) << shift;
+    *bars |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('|'))) << shift;
+    return _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                           _mm256_and_si256(is_letter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pair_avx2(__m256i v, __m256i next)
+{
+    /* bytes 1..32 of v and next; alignr works per 128 bit lane */
+    __m256i shifted = _mm256_alignr_epi8(_mm256_permute2x128_si256(v, next, 0x21), v, 1);
+    return _mm256_or_si256(_mm256_slli_epi16(v, 4), shifted);
+}
+
+__attribute__((target("avx2")))
+static inline __m128i gather_avx2(__m256i p0, __m256i p1, __m256i p2, uint32_t axis)
+{
+    const __m256i* m = (const __m256i*) gather_masks[axis];
+    __m256i both = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(p0, _mm256_load_si256(m)),
+                                                   _mm256_shuffle_epi8(p1, _mm256_load_si256(m + 1))),
+                                   _mm256_shuffle_epi8(p2, _mm256_load_si256(m + 2)));
+    return _mm_or_si128(_mm256_castsi256_si128(both), _mm256_extracti128_si256(both, 1));
+}
+
+__attribute__((target("avx2")))
+static uint32_t decode_avx2(const char* p, const char* end,
+                            uint8_t* x, uint8_t* y, uint8_t* z, uint32_t max)
+{
+    uint32_t n = 0;
+    while(n < max && end - p >= AVX2_WINDOW)
+    {
+        uint64_t hex_lo = 0, hex_hi = 0, bars_lo = 0, bars_hi = 0;
+        __m256i v0 = nibbles_avx2(p, &hex_lo, &bars_lo, 0);
+        __m256i v1 = nibbles_avx2(p + 32, &hex_lo, &bars_lo, 32);
+        __m256i v2 = nibbles_avx2(p + 64, &hex_hi, &bars_hi, 0);
+
+        uint32_t got = good_groups(bars_lo, bars_hi, hex_lo, hex_hi, AVX2_WINDOW);
+        if(got > max - n)
+            got = max - n;
+
+        __m256i p0 = pair_avx2(v0, v1);
+        __m256i p1 = pair_avx2(v1, v2);
+        __m256i p2 = pair_avx2(v2, _mm256_setzero_si256());
+        if(max - n >= 16)
+        {
+            /* 16 bytes of room per axis: the bytes past got are scratch */
+            _mm_storeu_si128((__m128i*) (x + n), gather_avx2(p0, p1, p2, 0));
+            _mm_storeu_si128((__m128i*) (y + n), gather_avx2(p0, p1, p2, 1));
+            _mm_storeu_si128((__m128i*) (z + n), gather_avx2(p0, p1, p2, 2));
+        }
+        else
+        {
+            uint8_t pairs[AVX2_WINDOW];
+            _mm256_storeu_si256((__m256i*) pairs, p0);
+            _mm256_storeu_si256((__m256i*) (pairs + 32), p1);
+            _mm256_storeu_si256((__m256i*) (pairs + 64), p2);
+            take_groups(pairs, got, x + n, y + n, z + n);
+        }
+
+        n += got;
+        p += 7 * got;
+        if(got < AVX2_WINDOW / 7)
+            return n;
+    }
+    return n + decode_scalar(p, end, x + n, y + n, z + n, max - n);
+}
+#endif
+
+static void choose_decoder(void)
+{
+    uint32_t c;
+    for(c = 0; c < 256; ++c)
+        hex_table[c] = hex_value(c);
+    for(c = 0; c < 128; c += 7)
+    {
+        if(c < 64)
+            bar_lo |= 1ULL << c;
+        else
+            bar_hi |= 1ULL << (c - 64);
+    }
+
+    /* output byte g of axis a comes from pair 7g + 1 + 2a of the window */
+    uint32_t a, i, g;
+    for(a = 0; a < 3; ++a)
+    {
+        for(i = 0; i < AVX2_WINDOW / 32; ++i)
+        {
+            for(g = 0; g < 32; ++g)
+            {
+                uint32_t lane = 32 * i + (g & 16);
+                uint32_t at = 7 * (g & 15) + 1 + 2 * a;
+                gather_masks[a][i][g] = (g & 15) < AVX2_WINDOW / 7 && at >= lane && at < lane + 16 ? at - lane : 0x80;
+            }
+        }
+    }
+
+#ifdef GPSLOG_X86
+    __builtin_cpu_init();
+    decoder = __builtin_cpu_supports("avx2") ? GPSLOG_DECODE_AVX2 : GPSLOG_DECODE_SSE2;
+#endif
+    decoder_chosen = 1;
+}
+
+/*
+ * Picks how samples are decoded, for comparing them.  Falls back to
+ * what the CPU can do; returns the decoder now in use.
+ */
+uint8_t gpslog_set_decoder(uint8_t d)
+{
+    if(!decoder_chosen)
+        choose_decoder();
+    uint8_t best = decoder;
+
+#ifdef GPSLOG_X86
+    if(d == GPSLOG_DECODE_AVX2 && !__builtin_cpu_supports("avx2"))
+        d = GPSLOG_DECODE_SSE2;
+#else
+    d = GPSLOG_DECODE_SCALAR;
+#endif
+    decoder = d <= GPSLOG_DECODE_AVX2 ? d : best;
+    return decoder;
+}
+
+/*
+ * Decodes the "|xxyyzz" groups at p into x, y and z, up to max of them.
+ * Returns how many there were before the first byte not fitting a
+ * group, or the end of the buffer.
+ */
+uint32_t gpslog_decode_samples(const char* p, const char* end,
+                               uint8_t* x, uint8_t* y, uint8_t* z, uint32_t max)
+{
+    if(!decoder_chosen)
+        choose_decoder();
+
+    switch(decoder)
+    {
+#ifdef GPSLOG_X86
+        case GPSLOG_DECODE_AVX2:
+            return decode_avx2(p, end, x, y, z, max);
+        case GPSLOG_DECODE_SSE2:
+            return decode_sse2(p, end, x, y, z, max);
+#endif
+        default:
+            return decode_scalar(p, end, x, y, z, max);
+    }
+}
+
+/* Splits x << 20 | y << 10 | z into the columns. */
+static inline void split_wide(uint32_t v, uint8_t* x, uint8_t* y, uint8_t* z, uint8_t* low)
+{
+    *x = v >> 22;
+    *y = v >> 12;
+    *z = v >> 2;
+    *low = (v >> 20 & 3) | (v >> 10 & 3) << 2 | (v & 3) << 4;
+}
+
+/*
+ * Decodes the "!ccccc" groups at p into the top 8 bits of each axis in
+ * x, y and z and the low 2 bits in low, up to max of them.  Returns how
+ * many there were before the first byte not fitting a group.
+ */
+static uint32_t decode_wide(const char* p, const char* end,
+                            uint8_t* x, uint8_t* y, uint8_t* z, uint8_t* low, uint32_t max)
+{
+    uint32_t n;
+    for(n = 0; n < max && p + 6 <= end && *p == '!'; ++n, p += 6)
+    {
+        uint32_t v = 0;
+        uint8_t i;
+        for(i = 1; i <= 5; ++i)
+        {
+            uint8_t c = (uint8_t) p[i] - '0';
+            if(c > 63)
+                return n;
+            v = v << 6 | c;
+        }
+        split_wide(v, x + n, y + n, z + n, low + n);
+    }
+    return n;
+}
+
+/*
+ * The same for a delta coded line (see sample_delta.h), *last being the
+ * sample before *p.  Moves *p past the samples decoded.
+ */
+static uint32_t decode_delta(const char** p, const char* end, uint32_t* last,
+                             uint8_t* x, uint8_t* y, uint8_t* z, uint8_t* low, uint32_t max)
+{
+    uint32_t n;
+    const char* next;
+    for(n = 0; n < max && (next = sample_delta_read(*p, end, last)); ++n, *p = next)
+        split_wide(*last, x + n, y + n, z + n, low + n);
+    return n;
+}
+
+/*
+ * All 10 bits of sample i of axis 0 (x), 1 (y) or 2 (z), 0x200 being
+ * about 0g.
+ */
+uint16_t gpslog_axis10(const struct gpslog* log, uint8_t axis, uint32_t i)
+{
+    const uint8_t* top[3] = { log->x, log->y, log->z };
+    return top[axis][i] << 2 | (log->low[i] >> (2 * axis) & 3);
+}
+
+/* Where the line p is in ends: its '\r' or '\n', or a '$' starting the
+ * next sentence.
+ */
+static const char* line_end(const char* p, const char* end)
+{
+    for(++p; p < end; ++p)
+    {
+        if(*p == '\r' || *p == '\n' || *p == '$')
+            break;
+    }
+    return p;
+}
+
+/* ddmm.mmmm into degrees, or NaN if the field is empty */
+static double read_angle(const char* p)
+{
+    int32_t e7;
+    return nmea_angle(p, &e7) ? e7 / 1e7 : NAN;
+}
+
+/* hundredths, or NaN if the field is empty */
+static float read_hundredths(const char* p)
+{
+    uint32_t v;
+    return nmea_fixed(p, 2, &v) ? v / 100.0f : NAN;
+}
+
+/* Takes the sentence at p; returns where the next line may start. */
+static const char* parse_sentence(struct gpslog* log, const char* p, const char* end)
+{
+    const char* q = p + 1;
+    uint8_t sum = 0;
+    while(q < end && *q != '*' && *q != '\r' && *q != '\n' && *q != '$')
+        sum ^= *q++;
+
+    /* the checksum also makes sure the fields end inside the buffer */
+    if(q + 3 > end || *q != '*' ||
+       hex_value(q[1]) > 0x0f || hex_value(q[2]) > 0x0f ||
+       (hex_value(q[1]) << 4 | hex_value(q[2])) != sum)
+    {
+        ++log->bad_lines;
+        return line_end(p, end);
+    }
+    if(q - p < 7 || memcmp(p, "$GPRMC,", 7) != 0)
+        return q + 3;
+
+    if(log->fixes == log->fix_room)
+        reserve_fixes(log, log->fix_room ? 2 * log->fix_room : 1024);
+    uint32_t n = log->fixes++;
+
+    const char* f = p + 7;
+    uint32_t ms;
+    log->time_ms[n] = nmea_time(f, &ms) ? ms : 0;
+    f = nmea_next_field(f);
+    log->valid[n] = *f == 'A';
+    f = nmea_next_field(f);
+    log->lat[n] = read_angle(f);
+    f = nmea_next_field(nmea_next_field(f));
+    log->lon[n] = read_angle(f);
+    f = nmea_next_field(nmea_next_field(f));
+    log->speed[n] = read_hundredths(f);
+    f = nmea_next_field(f);
+    log->course[n] = read_hundredths(f);
+
+    return q + 3;
+}
+
+static inline uint8_t is_mark(char c)
+{
+    return c == '|' || c == '!' || c == SAMPLE_DELTA_KEY;
+}
+
+/* Takes the sensor line at p: an optional command char, then "|xxyyzz"
+ * or "!ccccc" samples, or a delta coded line.  Returns where the next
+ * line may start.
+ */
+static const char* parse_sensor(struct gpslog* log, const char* p, const char* end)
+{
+    const char* q = p;
+    if(!is_mark(*q))
+        ++q;
+    if(q >= end || !is_mark(*q))
+    {
+        ++log->bad_lines;
+        return line_end(p, end);
+    }
+    char kind = *q;
+    uint32_t last = 0;
+
+    uint32_t fix = log->fixes ? log->fixes - 1 : GPSLOG_NO_FIX;
+    uint32_t first = log->samples;
+    while(1)
+    {
+        if(log->sample_room - log->samples < 16)
+            reserve_samples(log, 2 * log->sample_room + 16);
+        uint32_t n = log->samples;
+        uint32_t room = log->sample_room - n;
+        uint32_t got;
+        if(kind == SAMPLE_DELTA_KEY)
+        {
+            got = decode_delta(&q, end, &last, log->x + n, log->y + n, log->z + n, log->low + n, room);
+        }
+        else if(kind == '!')
+        {
+            got = decode_wide(q, end, log->x + n, log->y + n, log->z + n, log->low + n, room);
+            q += 6 * got;
+        }
+        else
+        {
+            got = gpslog_decode_samples(q, end, log->x + n, log->y + n, log->z + n, room);
+            memset(log->low + n, 0, got);
+            q += 7 * got;
+        }
+        log->samples += got;
+        if(got < room)
+            break;
+    }
+
+    /* keep nothing of a line with a broken sample or trailing junk */
+    if(q < end && *q != '\r' && *q != '\n' && *q != '$')
+    {
+        log->samples = first;
+        ++log->bad_lines;
+        return line_end(q, end);
+    }
+
+    uint32_t n;
+    for(n = first; n < log->samples; ++n)
+        log->sample_fix[n] = fix;
+    return q;
+}
+
+/*
+ * Parses a log already in memory, appending to the columns.
+ */
+void gpslog_parse(struct gpslog* log, const char* data, size_t len)
+{
+    const char* p = data;
+    const char* end = data + len;
+
+    /* a fix and its ten samples take about 140 bytes */
+    reserve_fixes(log, log->fixes + len / 140 + 1);
+    reserve_samples(log, log->samples + len / 14 + 1);
+
+    while(p < end)
+    {
+        if(*p == '\r' || *p == '\n')
+            ++p;
+        else if(*p == '$')
+            p = parse_sentence(log, p, end);
+        else
+            p = parse_sensor(log, p, end);
+    }
+    log->bytes += len;
+}
+
+/*
+ * Maps a log file and parses it, appending to the columns.
+ * Returns 0 if the file cannot be read.
+ */
+uint8_t gpslog_load(struct gpslog* log, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        perror(path);
+        return 0;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        perror(path);
+        close(fd);
+        return 0;
+    }
+    if(st.st_size == 0)
+    {
+        close(fd);
+        return 1;
+    }
+
+    void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+    {
+        perror(path);
+        return 0;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    gpslog_parse(log, (const char*) data, st.st_size);
+
+    munmap(data, st.st_size);
+    return 1;
+}
@@ -0,0 +1,95 @@
+/*
+ * gpslog.h -- load GPSWiiLogger text logs into columns
+ *
+ * gpslog_load() maps a GPSLOGnn.TXT / GPSLnnnn.TXT file into memory and
+ * parses its $GPRMC sentences and sensor pod lines in one pass, without
+ * allocating anything per line.  The results go into one array per
+ * field, so a consumer can sweep a whole ride's speeds or z samples
+ * without touching the rest.  Several logs can be loaded one after the
+ * other into the same columns.
+ *
+ * Lines may end in '\r', '\n' or both, and a '$' starts a new sentence
+ * even right after a sensor line, as in older logs.  Sentences with a
+ * bad checksum and malformed sensor lines are counted and skipped.
+ * Fields are read with the fixed point parser the logger uses, see
+ * nmea_field.h, so positions come to the nearest 1e-7 degree and speed
+ * and course to the hundredth.
+ *
+ * The "|xxyyzz" samples are checked and decoded 64 bytes at a time with
+ * SSE2 or AVX2 where the CPU has it, see gpslog_decode_samples().  Pods
+ * asked for 10 bit samples send "!ccccc" instead, five chars of 6 bits
+ * from '0' up, most significant first, holding x << 20 | y << 10 | z.
+ * Their top 8 bits go into x, y and z like the hex ones, and the low 2
+ * bits of each axis into low.  The same goes for delta coded lines, see
+ * sample_delta.h.
+ */
+
+#ifndef GPSLOG_H
+#define GPSLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Ways gpslog_decode_samples() can work, see gpslog_set_decoder(). */
+#define GPSLOG_DECODE_SCALAR 0
+#define GPSLOG_DECODE_SSE2   1
+#define GPSLOG_DECODE_AVX2   2
+
+/** sample_fix of samples logged before the first fix. */
+#define GPSLOG_NO_FIX 0xffffffffUL
+
+/**
+ * Columns of one or more logs.  Arrays are owned by the struct and
+ * hold fixes or samples entries.
+ */
+struct gpslog
+{
+    /** $GPRMC sentences taken. */
+    uint32_t fixes;
+    /** UTC time of each fix in ms since midnight. */
+    uint32_t* time_ms;
+    /** Latitude in degrees, south negative. */
+    double* lat;
+    /** Longitude in degrees, west negative. */
+    double* lon;
+    /** Speed over ground in knots. */
+    float* speed;
+    /** Course over ground in degrees. */
+    float* course;
+    /** 1 if the GPS reported a valid fix ('A'). */
+    uint8_t* valid;
+
+    /** Accelerometer samples taken. */
+    uint32_t samples;
+    /** Raw accelerometer axes, top 8 bits, 0x80 being about 0g. */
+    uint8_t* x;
+    uint8_t* y;
+    uint8_t* z;
+    /**
+     * The 2 bits below those, of x in bits 0-1, y in 2-3 and z in 4-5;
+     * 0 for samples logged with 8 bits.  See gpslog_axis10().
+     */
+    uint8_t* low;
+    /** The fix each sample was logged after. */
+    uint32_t* sample_fix;
+
+    /** Lines that were neither a good sentence nor a sensor line. */
+    uint32_t bad_lines;
+    /** Bytes parsed. */
+    uint64_t bytes;
+
+    uint32_t fix_room;
+    uint32_t sample_room;
+};
+
+void gpslog_init(struct gpslog* log);
+void gpslog_free(struct gpslog* log);
+uint8_t gpslog_load(struct gpslog* log, const char* path);
+void gpslog_parse(struct gpslog* log, const char* data, size_t len);
+uint16_t gpslog_axis10(const struct gpslog* log, uint8_t axis, uint32_t i);
+
+uint8_t gpslog_set_decoder(uint8_t decoder);
+uint32_t gpslog_decode_samples(const char* p, const char* end,
+                               uint8_t* x, uint8_t* y, uint8_t* z, uint32_t max);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * hexbench.cpp -- decoding "|xxyyzz" sensor samples
+ *
+ * Collects the sensor pod lines from the given logs (default: the
+ * GPSWiiLogger logs in example_data), repeats them into -s MB of lines,
+ * and decodes them all with each of gpslog's sample decoders, the
+ * scalar one being the reference the others must agree with.  Each
+ * decoder runs -r times, taking turns with the others, and the fastest
+ * run counts.
+ *
+ * Before that, -f lines with a few bytes mangled are decoded by every
+ * decoder, both with the line ending the buffer and with more lines
+ * behind it, and must give the same samples as the scalar one.  And
+ * as many lines of random 10 bit samples, every other one delta coded
+ * (see sample_delta.h), must come back out of gpslog_parse() and
+ * log_record_samples() as they went in.
+ *
+ * usage: hexbench [-s size_mb] [-r runs] [-f fuzz_lines] [log ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpslog.h"
+#include "log_record.h"
+#include "sample_delta.h"
+#include "host_util.h"
+
+static const char* decoder_names[] = { "scalar", "SSE2", "AVX2" };
+
+static char* pattern;
+static uint32_t pattern_len;
+
+/* Appends the sensor lines of a log, each ended by '\r'. */
+static void collect_lines(const char* path)
+{
+    FILE* in = fopen(path, "rb");
+    if(!in)
+    {
+        perror(path);
+        exit(1);
+    }
+    fseek(in, 0, SEEK_END);
+    long len = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char* text = (char*) malloc(len + 1);
+    if(fread(text, 1, len, in) != (size_t) len)
+    {
+        perror(path);
+        exit(1);
+    }
+    fclose(in);
+    text[len] = 0;
+
+    pattern = (char*) realloc(pattern, pattern_len + len + 1);
+    char* p = text;
+    while(*p)
+    {
+        size_t l = strcspn(p + 1, "\r\n$") + 1;
+        if(p[0] == '|' || (p[0] != '$' && p[1] == '|'))
+        {
+            memcpy(pattern + pattern_len, p, l);
+            pattern_len += l;
+            pattern[pattern_len++] = '\r';
+        }
+        p += l;
+        while(*p == '\r' || *p == '\n')
+            ++p;
+    }
+    free(text);
+}
+
+/* Decodes every line in the buffer; returns the samples found. */
+static uint32_t decode_all(const char* data, uint32_t len, uint8_t* x, uint8_t* y, uint8_t* z, uint32_t room)
+{
+    const char* p = data;
+    const char* end = data + len;
+    uint32_t n = 0;
+    while(p < end)
+    {
+        if(*p != '|')
+            ++p;
+        uint32_t got = gpslog_decode_samples(p, end, x + n, y + n, z + n, room - n);
+        n += got;
+        p += 7 * got;
+        while(p < end && *p++ != '\r')
+            ;
+    }
+    return n;
+}
+
+/* Mangles lines and compares the decoders on them; returns the mismatches. */
+static uint32_t fuzz(uint32_t lines)
+{
+    static const char junk[] = "|||0123456789abcdefABCDEFgG:@`/\r$ \xff";
+    uint32_t failures = 0;
+    uint32_t l;
+    srand(11);
+    for(l = 0; l < lines; ++l)
+    {
+        /* a clean line from the pattern, then a few bytes changed */
+        char buf[256];
+        uint32_t start = (uint32_t) rand() % (pattern_len - 80);
+        while(start < pattern_len && pattern[start] != '|')
+            ++start;
+        uint32_t len = 70 + (uint32_t) rand() % 100;
+        if(start + len > pattern_len)
+            len = pattern_len - start;
+        memcpy(buf, pattern + start, len);
+        uint32_t changes = (uint32_t) rand() % 4;
+        while(changes--)
+            buf[(uint32_t) rand() % len] = junk[(uint32_t) rand() % (sizeof(junk) - 1)];
+        /* sometimes cut the line short */
+        uint32_t end = rand() & 1 ? len : (uint32_t) rand() % len;
+
+        uint8_t rx[32], ry[32], rz[32];
+        gpslog_set_decoder(GPSLOG_DECODE_SCALAR);
+        uint32_t ref = gpslog_decode_samples(buf, buf + end, rx, ry, rz, 32);
+
+        uint8_t d;
+        for(d = GPSLOG_DECODE_SSE2; d <= GPSLOG_DECODE_AVX2; ++d)
+        {
+            if(gpslog_set_decoder(d) != d)
+                continue;
+            uint8_t x[32], y[32], z[32];
+            uint32_t got = gpslog_decode_samples(buf, buf + end, x, y, z, 32);
+            if(got != ref || memcmp(x, rx, got) || memcmp(y, ry, got) || memcmp(z, rz, got))
+            {
+                if(failures++ < 5)
+                    fprintf(stderr, "%s decoder: %u samples, scalar: %u, in \"%.*s\"\n",
+                            decoder_names[d], got, ref, (int) end, buf);
+            }
+        }
+    }
+    return failures;
+}
+
+/* Sends 10 bit samples through both of their readers; returns the mismatches. */
+static uint32_t wide_round_trip(uint32_t lines)
+{
+    uint32_t failures = 0;
+    uint32_t l;
+    srand(13);
+    for(l = 0; l < lines; ++l)
+    {
+        /* a pod line like "r!ccccc!ccccc...\r" or "r#ccccc...\r" */
+        uint16_t xyz[LOG_RECORD_SAMPLES][3];
+        uint32_t packed[LOG_RECORD_SAMPLES];
+        char line[80];
+        char* p = line;
+        *p++ = 'r';
+        uint32_t count = 1 + (uint32_t) rand() % LOG_RECORD_SAMPLES;
+        uint32_t i, a;
+        for(i = 0; i < count; ++i)
+        {
+            uint32_t v = 0;
+            for(a = 0; a < 3; ++a)
+            {
+                xyz[i][a] = (uint32_t) rand() & 0x3ff;
+                v = v << 10 | xyz[i][a];
+            }
+            packed[i] = v;
+            if(l & 1)
+                continue;
+            *p++ = '!';
+            int shift;
+            for(shift = 24; shift >= 0; shift -= 6)
+                *p++ = '0' + (v >> shift & 0x3f);
+        }
+        if(l & 1)
+        {
+            /* random samples change a lot, so fewer of them fit */
+            uint8_t len;
+            count = sample_delta_write(p, sizeof(line) - 3, packed, count, SAMPLE_DELTA_KEYFRAME, &len);
+            p += len;
+        }
+        *p++ = '\r';
+        *p = 0;
+
+        struct gpslog log;
+        gpslog_init(&log);
+        gpslog_parse(&log, line, p - line);
+        struct log_record rec;
+        log_record_begin(&rec);
+        log_record_samples(&rec, line);
+
+        uint8_t bad = log.samples != count || log.bad_lines || rec.samples != count ||
+                      !(rec.flags & LOG_RECORD_WIDE);
+        for(i = 0; i < count && !bad; ++i)
+        {
+            for(a = 0; a < 3; ++a)
+            {
+                if(gpslog_axis10(&log, a, i) != xyz[i][a] || LOG_RECORD_AXIS(rec.xyz[i], a) != xyz[i][a])
+                    bad = 1;
+            }
+        }
+        if(bad && failures++ < 5)
+            fprintf(stderr, "10 bit samples did not come back from \"%s\"\n", line);
+        gpslog_free(&log);
+    }
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t size_mb = 256;
+    uint32_t runs = 3;
+    uint32_t fuzz_lines = 100000;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:r:f:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's': size_mb = atoi(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            case 'f': fuzz_lines = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-s size_mb] [-r runs] [-f fuzz_lines] [log ...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(!size_mb || !runs)
+    {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    if(optind < argc)
+    {
+        for(; optind < argc; ++optind)
+            collect_lines(argv[optind]);
+    }
+    else
+    {
+        collect_lines("../example_data/GPSLOG00-wii.TXT");
+        collect_lines("../example_data/john1.txt");
+    }
+    if(pattern_len < 200)
+    {
+        fprintf(stderr, "not enough sensor lines\n");
+        return 1;
+    }
+
+    uint32_t failures = fuzz(fuzz_lines);
+    printf("%u mangled lines: %u mismatches\n", fuzz_lines, failures);
+    uint32_t wide_failures = wide_round_trip(fuzz_lines);
+    printf("%u lines of 10 bit samples: %u mismatches\n", fuzz_lines, wide_failures);
+    failures += wide_failures;
+
+    uint32_t len = ((uint64_t) size_mb << 20) / pattern_len * pattern_len;
+    char* data = (char*) malloc(len);
+    uint32_t i;
+    for(i = 0; i < len; i += pattern_len)
+        memcpy(data + i, pattern, pattern_len);
+
+    /* three columns per decoder; the runs take turns, so that a slower
+     * stretch of the machine does not count against one decoder only
+     */
+    uint32_t room = len / 7 + 16;
+    uint8_t* columns[3];
+    uint32_t samples[3] = { 0, 0, 0 };
+    double best[3] = { 1e30, 1e30, 1e30 };
+    uint8_t supported[3];
+    uint8_t d;
+    for(d = GPSLOG_DECODE_SCALAR; d <= GPSLOG_DECODE_AVX2; ++d)
+    {
+        supported[d] = gpslog_set_decoder(d) == d;
+        columns[d] = supported[d] ? (uint8_t*) malloc(3 * room) : 0;
+    }
+
+    printf("%.1f MB of sensor lines\n", len / 1048576.0);
+    uint32_t r;
+    for(r = 0; r < runs; ++r)
+    {
+        for(d = GPSLOG_DECODE_SCALAR; d <= GPSLOG_DECODE_AVX2; ++d)
+        {
+            if(!supported[d])
+                continue;
+            gpslog_set_decoder(d);
+            uint8_t* buf = columns[d];
+            double t = seconds_now();
+            samples[d] = decode_all(data, len, buf, buf + room, buf + 2 * room, room);
+            t = seconds_now() - t;
+            if(t < best[d])
+                best[d] = t;
+        }
+    }
+
+    uint8_t* ref = columns[GPSLOG_DECODE_SCALAR];
+    for(d = GPSLOG_DECODE_SCALAR; d <= GPSLOG_DECODE_AVX2; ++d)
+    {
+        if(!supported[d])
+        {
+            printf("  %-7s not supported here\n", decoder_names[d]);
+            continue;
+        }
+        uint8_t* buf = columns[d];
+        if(samples[d] != samples[0] || memcmp(buf, ref, samples[0]) ||
+           memcmp(buf + room, ref + room, samples[0]) || memcmp(buf + 2 * room, ref + 2 * room, samples[0]))
+        {
+            fprintf(stderr, "%s decoder disagrees with the scalar one\n", decoder_names[d]);
+            ++failures;
+        }
+        printf("  %-7s %7.3f s  %8.1f MB/s  %5.2f ns/sample  %4.1fx\n", decoder_names[d], best[d],
+               len / 1048576.0 / best[d], best[d] * 1e9 / samples[d], best[0] / best[d]);
+    }
+    printf("  samples: %u\n", samples[0]);
+
+    for(d = GPSLOG_DECODE_SCALAR; d <= GPSLOG_DECODE_AVX2; ++d)
+        free(columns[d]);
+
+    free(data);
+    free(pattern);
+    return failures ? 1 : 0;
+}
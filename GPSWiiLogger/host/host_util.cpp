@@ -0,0 +1,45 @@
+/*
+ * host_util.cpp -- host versions of the helpers in util.cpp, and a clock
+ * for timing the host tools
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <avr/io.h>
+#include "util.h"
+#include "WProgram.h"
+#include "host_util.h"
+
+uint8_t UDR0;
+uint8_t SREG;
+
+void ROM_putstring(const char *str, uint8_t nl)
+{
+    fputs(str, stderr);
+    if (nl)
+        fputs("\n", stderr);
+}
+
+static unsigned long host_millis;
+
+unsigned long millis(void)
+{
+    return host_millis;
+}
+
+void delay(unsigned long ms)
+{
+    host_millis += ms;
+}
+
+void host_set_millis(unsigned long ms)
+{
+    host_millis = ms;
+}
+
+double seconds_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,13 @@
+/*
+ * host_util.h -- helpers the host tools share, see host_util.cpp
+ *
+ * millis(), delay() and host_set_millis() are declared in WProgram.h.
+ */
+
+#ifndef HOST_UTIL_H
+#define HOST_UTIL_H
+
+/* wall clock seconds from CLOCK_MONOTONIC, for timing the benches */
+double seconds_now(void);
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ * ingestbench.cpp -- loading big text logs into columns
+ *
+ * Builds a -s MB log out of the given logs (default: the GPSWiiLogger
+ * logs in example_data) repeated over and over, then loads it twice:
+ *  - line by line the way GPSWiiGrapher does it: every line becomes a
+ *    string, every field and sample a substring that gets parsed;
+ *  - with gpslog_load(), straight from the mapped file into columns.
+ * Both must come up with the same fixes and samples.  Each load runs
+ * -r times, and the fastest run counts.
+ *
+ * usage: ingestbench [-s size_mb] [-r runs] [-o file] [log ...]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gpslog.h"
+#include "host_util.h"
+
+/* what both loaders must agree on */
+struct digest
+{
+    uint64_t fixes;
+    uint64_t samples;
+    uint64_t time_sum;
+    uint64_t xyz_sum;
+    double lat_sum;
+    double speed_sum;
+};
+
+static uint8_t digests_match(const struct digest* a, const struct digest* b)
+{
+    return a->fixes == b->fixes && a->samples == b->samples &&
+           a->time_sum == b->time_sum && a->xyz_sum == b->xyz_sum &&
+           fabs(a->lat_sum - b->lat_sum) < 1e-6 * (1 + fabs(a->lat_sum)) &&
+           fabs(a->speed_sum - b->speed_sum) < 1e-3 * (1 + fabs(a->speed_sum));
+}
+
+/* Splits the file into lines like Processing's loadStrings() does,
+ * with a '$' also starting a new line.
+ */
+static void split_lines(const std::string& text, std::vector<std::string>& lines)
+{
+    std::string line;
+    size_t i;
+    for(i = 0; i < text.size(); ++i)
+    {
+        char c = text[i];
+        if(c == '\r' || c == '\n' || (c == '$' && !line.empty()))
+        {
+            if(!line.empty())
+                lines.push_back(line);
+            line.clear();
+            if(c != '$')
+                continue;
+        }
+        line += c;
+    }
+    if(!line.empty())
+        lines.push_back(line);
+}
+
+static uint8_t checksum_ok(const std::string& l)
+{
+    size_t star = l.find('*');
+    if(star == std::string::npos || star + 3 > l.size())
+        return 0;
+    uint8_t sum = 0;
+    size_t i;
+    for(i = 1; i < star; ++i)
+        sum ^= l[i];
+    char* e;
+    std::string check = l.substr(star + 1, 2);
+    return strtol(check.c_str(), &e, 16) == sum && *e == 0;
+}
+
+/* GPSWiiGrapher's parseFile(), give or take */
+static void load_lines(const char* path, struct digest* d)
+{
+    memset(d, 0, sizeof(*d));
+
+    FILE* in = fopen(path, "rb");
+    std::string text;
+    char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        text.append(buf, n);
+    fclose(in);
+
+    std::vector<std::string> lines;
+    split_lines(text, lines);
+
+    size_t i;
+    for(i = 0; i < lines.size(); ++i)
+    {
+        const std::string& l = lines[i];
+        if(l[0] == '$')
+        {
+            if(l.substr(0, 7) != "$GPRMC," || !checksum_ok(l))
+                continue;
+            std::vector<std::string> f;
+            size_t start = 0, comma;
+            while((comma = l.find_first_of(",*", start)) != std::string::npos)
+            {
+                f.push_back(l.substr(start, comma - start));
+                start = comma + 1;
+            }
+            uint32_t t = atoi(f[1].substr(0, 2).c_str()) * 3600000 +
+                         atoi(f[1].substr(2, 2).c_str()) * 60000 +
+                         atoi(f[1].substr(4, 2).c_str()) * 1000;
+            if(f[1].size() > 7)
+                t += atoi((f[1].substr(7) + "00").substr(0, 3).c_str());
+            ++d->fixes;
+            d->time_sum += t;
+            if(!f[3].empty())
+            {
+                double v = atof(f[3].c_str());
+                double deg = floor(v / 100);
+                v = deg + (v - deg * 100) / 60;
+                d->lat_sum += f[4] == "S" ? -v : v;
+            }
+            if(!f[7].empty())
+                d->speed_sum += (float) atof(f[7].c_str());
+        }
+        else
+        {
+            std::vector<std::string> samples;
+            size_t start = l.find('|');
+            if(start > 1)
+                continue;
+            uint8_t bad = 0;
+            while(start != std::string::npos)
+            {
+                size_t next = l.find('|', start + 1);
+                std::string s = l.substr(start + 1, next == std::string::npos ? std::string::npos : next - start - 1);
+                if(s.size() != 6 || s.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+                    bad = 1;
+                samples.push_back(s);
+                start = next;
+            }
+            if(bad)
+                continue;
+            size_t j;
+            for(j = 0; j < samples.size(); ++j)
+            {
+                d->xyz_sum += strtol(samples[j].substr(0, 2).c_str(), 0, 16) +
+                              strtol(samples[j].substr(2, 2).c_str(), 0, 16) +
+                              strtol(samples[j].substr(4, 2).c_str(), 0, 16);
+                ++d->samples;
+            }
+        }
+    }
+}
+
+static void load_columns(const char* path, struct digest* d)
+{
+    memset(d, 0, sizeof(*d));
+
+    struct gpslog log;
+    gpslog_init(&log);
+    if(!gpslog_load(&log, path))
+        exit(1);
+
+    uint32_t i;
+    d->fixes = log.fixes;
+    for(i = 0; i < log.fixes; ++i)
+    {
+        d->time_sum += log.time_ms[i];
+        if(!isnan(log.lat[i]))
+            d->lat_sum += log.lat[i];
+        if(!isnan(log.speed[i]))
+            d->speed_sum += log.speed[i];
+    }
+    d->samples = log.samples;
+    for(i = 0; i < log.samples; ++i)
+        d->xyz_sum += log.x[i] + log.y[i] + log.z[i];
+    gpslog_free(&log);
+}
+
+/* Fills the output with copies of the inputs; returns its size. */
+static uint64_t build_file(const char* output, uint64_t size, char** inputs, int count)
+{
+    std::string pattern;
+    int i;
+    for(i = 0; i < count; ++i)
+    {
+        FILE* in = fopen(inputs[i], "rb");
+        if(!in)
+        {
+            perror(inputs[i]);
+            exit(1);
+        }
+        char buf[65536];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), in)) > 0)
+            pattern.append(buf, n);
+        fclose(in);
+        /* keep a file's last line from running into the next one's first */
+        pattern += '\r';
+    }
+    while(pattern.size() < (1 << 20))
+        pattern += pattern;
+
+    FILE* out = fopen(output, "wb");
+    if(!out)
+    {
+        perror(output);
+        exit(1);
+    }
+    uint64_t written = 0;
+    while(written < size)
+    {
+        fwrite(pattern.data(), 1, pattern.size(), out);
+        written += pattern.size();
+    }
+    fclose(out);
+    return written;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t size_mb = 64;
+    uint32_t runs = 3;
+    const char* output = "host/obj/ingest.txt";
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:r:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's': size_mb = atoi(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-s size_mb] [-r runs] [-o file] [log ...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(!size_mb || !runs)
+    {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    static char* defaults[] = { (char*) "../example_data/GPSLOG00-wii.TXT", (char*) "../example_data/john1.txt" };
+    char** inputs = optind < argc ? argv + optind : defaults;
+    int count = optind < argc ? argc - optind : 2;
+
+    uint64_t bytes = build_file(output, (uint64_t) size_mb << 20, inputs, count);
+    printf("%.1f MB log built from %d file(s)\n", bytes / 1048576.0, count);
+
+    struct digest lines, columns;
+    double best_lines = 1e30, best_columns = 1e30;
+    uint32_t r;
+    for(r = 0; r < runs; ++r)
+    {
+        double t = seconds_now();
+        load_lines(output, &lines);
+        t = seconds_now() - t;
+        if(t < best_lines)
+            best_lines = t;
+
+        t = seconds_now();
+        load_columns(output, &columns);
+        t = seconds_now() - t;
+        if(t < best_columns)
+            best_columns = t;
+    }
+
+    printf("  fixes:             %llu\n", (unsigned long long) columns.fixes);
+    printf("  samples:           %llu\n", (unsigned long long) columns.samples);
+    printf("line by line:        %7.3f s  %8.1f MB/s\n", best_lines, bytes / 1048576.0 / best_lines);
+    printf("gpslog_load:         %7.3f s  %8.1f MB/s\n", best_columns, bytes / 1048576.0 / best_columns);
+    printf("speedup:             %.1fx\n", best_lines / best_columns);
+
+    unlink(output);
+
+    if(!digests_match(&lines, &columns))
+    {
+        fprintf(stderr, "the loaders disagree: %llu/%llu fixes, %llu/%llu samples\n",
+                (unsigned long long) lines.fixes, (unsigned long long) columns.fixes,
+                (unsigned long long) lines.samples, (unsigned long long) columns.samples);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,535 @@
+/*
+ * logbench.cpp -- run the GPSWiiLogger card workload against a disk image
+ *
+ * Formats a fresh FAT16 image, then does what GPSWiiLogger's setup()
+ * and loop() do to the card: find the next GPSLnnnn.TXT name,
+ * create and open it, and append one $GPRMC line plus one sensor line
+ * per simulated second.  Afterwards the file is read back straight
+ * from the image and compared against what was written.
+ *
+ * Bus times assume the full SPI clock of f_OSC / 2 = 8MHz, so every
+ * byte clocked to or from the card costs 1us of logger CPU time.
+ *
+ * -m turns on multi-block streaming as the sketch does, -w collects
+ * the lines into writes of up to that many bytes instead of writing
+ * each line on its own, and -B sets the card's busy time per streamed
+ * block (default: the same as -b).  -r reserves contiguous runs of
+ * that many clusters for the log, as the sketch does.  -p fills the
+ * card with a FILL.BIN of that many KB first, so that free clusters
+ * are only found far into the FAT.
+ *
+ * -S and -T defer writing the log's size to its directory entry until
+ * that many bytes or seconds have been logged, -C also writes it on
+ * every cluster boundary.  The seconds are simulated ones, one per
+ * pair of lines.  Each second the size found on the image is compared
+ * with what was logged, and the largest difference is reported as the
+ * data a power loss could have cost.
+ *
+ * Afterwards the directory is scanned for the newest log again, and
+ * the log is exported, read back through fat16_read_file() in pieces
+ * of -x bytes (default 64), the way a download over the serial line
+ * would.  Both report the block cache's hit rate and what multi-block
+ * reads saved.  Build with SD_RAW_CACHE_BLOCKS above one (see
+ * logbench_cache4 in Makefile.host) to compare cache sizes.
+ *
+ * -F 32 formats a FAT32 instead, the way mkfs.fat lays it out, and -M
+ * has mkfs.vfat itself format it.  -N sets the FAT32 FSInfo sector's
+ * next free cluster hint, which the log has to start at or behind, so
+ * a large sparse image puts the log beyond 4GB.  -K picks the card to
+ * emulate: mmc, sd1, sd2 or sdhc (default: sdhc above 2GB, else sd2).
+ * FAT32 and SDHC cards need SD_RAW_SDHC (see logbench_sdhc in
+ * Makefile.host); the default build refuses to open them.
+ *
+ * usage: logbench [-i image] [-s size_mb] [-c sectors_per_cluster]
+ *                 [-t seconds] [-f existing_logs] [-b busy_bytes]
+ *                 [-B stream_busy_bytes] [-m] [-w write_size]
+ *                 [-r reserve_clusters] [-p prefill_kb]
+ *                 [-S sync_bytes] [-T sync_seconds] [-C]
+ *                 [-x export_chunk] [-F 16|32] [-M] [-N next_free]
+ *                 [-K mmc|sd1|sd2|sdhc]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AF_SDLog.h"
+#include "WProgram.h"
+#include "sd_image.h"
+#include "fat_image.h"
+#include "host_util.h"
+
+AF_SDLog card;
+File f;
+
+char buffer[75];
+char name[13];
+
+static uint8_t* expected;
+static uint32_t expected_len;
+
+static uint16_t write_size;
+static uint32_t pending;
+static uint32_t worst_write;
+static uint32_t* write_costs;
+static uint32_t write_count;
+
+/* writes to the log, remembering the bus time each write took */
+static uint8_t write_log(const uint8_t* data, uint16_t len)
+{
+    uint32_t spi_bytes = sd_image_get_stats()->spi_bytes;
+    uint8_t ok = card.write_file(f, (uint8_t*) data, len) == len;
+    spi_bytes = sd_image_get_stats()->spi_bytes - spi_bytes;
+    if(spi_bytes > worst_write)
+        worst_write = spi_bytes;
+    write_costs[write_count++] = spi_bytes;
+    return ok;
+}
+
+static int compare_costs(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+/* the bus time below which the given fraction of all writes stayed */
+static uint32_t write_percentile(double fraction)
+{
+    if(!write_count)
+        return 0;
+    return write_costs[(uint32_t) (fraction * (write_count - 1))];
+}
+
+static uint32_t worst_at_risk;
+
+#if SD_RAW_CACHE_STATS
+static struct sd_raw_cache_stats cache_start;
+#endif
+
+/* restarts the card counters and the cache counters for the next phase */
+static void reset_stats()
+{
+    sd_image_reset_stats();
+#if SD_RAW_CACHE_STATS
+    sd_raw_get_cache_stats(&cache_start);
+#endif
+}
+
+static void report_cache()
+{
+#if SD_RAW_CACHE_STATS
+    struct sd_raw_cache_stats cache;
+    sd_raw_get_cache_stats(&cache);
+    uint32_t hits = cache.hits - cache_start.hits;
+    uint32_t misses = cache.misses - cache_start.misses;
+    printf("  cache hits/misses: %lu / %lu (%.1f%% hits, %u blocks)\n",
+           (unsigned long) hits, (unsigned long) misses,
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0, (unsigned) cache.blocks);
+#endif
+}
+
+/* what a phase which only reads cost, per call and per byte read */
+static void report_read(const char* phase, double seconds, uint32_t bytes, uint32_t calls)
+{
+    const struct sd_image_stats* stats = sd_image_get_stats();
+    printf("%s:\n", phase);
+    if(bytes)
+        printf("  read bytes:        %lu\n", (unsigned long) bytes);
+    printf("  spi bytes:         %lu\n", (unsigned long) stats->spi_bytes);
+    printf("  CMD17 reads:       %lu\n", (unsigned long) stats->commands[17]);
+    printf("  CMD18 reads:       %lu\n", (unsigned long) stats->commands[18]);
+    printf("  CMD12 stops:       %lu\n", (unsigned long) stats->commands[12]);
+    printf("  blocks read:       %lu\n", (unsigned long) stats->blocks_read);
+    printf("  blocks streamed:   %lu\n", (unsigned long) stats->blocks_read_streamed);
+    report_cache();
+    printf("  spi bytes/call:    %.1f\n", calls ? (double) stats->spi_bytes / calls : 0.0);
+    if(bytes)
+    {
+        printf("  spi bytes/read:    %.3f\n", (double) stats->spi_bytes / bytes);
+        printf("  bus throughput:    %.0f bytes/s\n", bytes / (stats->spi_bytes / 1e6));
+    }
+    printf("  host time:         %.6f s\n", seconds);
+}
+
+static void report(const char* phase, double seconds, uint32_t bytes)
+{
+    const struct sd_image_stats* stats = sd_image_get_stats();
+    printf("%s:\n", phase);
+    if(bytes)
+        printf("  logged bytes:      %lu\n", (unsigned long) bytes);
+    printf("  spi bytes:         %lu\n", (unsigned long) stats->spi_bytes);
+    printf("  busy bytes:        %lu\n", (unsigned long) stats->busy_bytes);
+    printf("  CMD17 reads:       %lu\n", (unsigned long) stats->commands[17]);
+    printf("  CMD24 writes:      %lu\n", (unsigned long) stats->commands[24]);
+    printf("  CMD25 writes:      %lu\n", (unsigned long) stats->commands[25]);
+    printf("  blocks read:       %lu\n", (unsigned long) stats->blocks_read);
+    printf("  blocks written:    %lu\n", (unsigned long) stats->blocks_written);
+    printf("  blocks streamed:   %lu\n", (unsigned long) stats->blocks_streamed);
+    printf("  bus time:          %.3f s\n", stats->spi_bytes / 1e6);
+    report_cache();
+    if(bytes)
+    {
+        printf("  bus throughput:    %.0f bytes/s\n", bytes / (stats->spi_bytes / 1e6));
+        printf("  spi bytes/logged:  %.1f\n", (double) stats->spi_bytes / bytes);
+        printf("  write cmds/MB:     %.0f\n",
+               (stats->commands[24] + stats->commands[25]) * 1048576.0 / bytes);
+        printf("  write amplif.:     %.2f\n", stats->blocks_written * 512.0 / bytes);
+        printf("  max bytes at risk: %lu\n", (unsigned long) worst_at_risk);
+        qsort(write_costs, write_count, sizeof(*write_costs), compare_costs);
+        printf("  write p50/p99:     %lu / %lu spi bytes\n",
+               (unsigned long) write_percentile(0.50), (unsigned long) write_percentile(0.99));
+        printf("  worst write:       %lu spi bytes\n", (unsigned long) worst_write);
+        printf("  host bytes/s:      %.0f\n", bytes / seconds);
+    }
+    else
+    {
+        printf("  host time:         %.6f s\n", seconds);
+    }
+}
+
+/* one $GPRMC line as GPSWiiLogger writes it: '\r' kept, '\n' dropped */
+static uint8_t make_gps_line(uint32_t t)
+{
+    sprintf(buffer, "$GPRMC,%02lu%02lu%02lu.000,A,3409.%04lu,N,11808.%04lu,W,0.31,295.65,010908,,*",
+            (unsigned long) (t / 3600) % 24, (unsigned long) (t / 60) % 60, (unsigned long) t % 60,
+            (unsigned long) (9172 + t) % 10000, (unsigned long) (1017 + 3 * t) % 10000);
+    uint8_t sum = 0;
+    char* p;
+    for(p = buffer + 1; *p != '*'; ++p)
+        sum ^= *p;
+    sprintf(p + 1, "%02X\r", sum);
+    return strlen(buffer);
+}
+
+/* one sensor pod reply: command char, ten "|xxyyzz" samples, '\r' */
+static uint8_t make_sensor_line(uint32_t t)
+{
+    uint8_t len = 0;
+    buffer[len++] = 'r';
+    uint8_t i;
+    for(i = 0; i < 10; ++i)
+    {
+        uint32_t r = (t * 10 + i) * 2654435761UL;
+        len += sprintf(buffer + len, "|%02X%02X%02X",
+                       0x78 + ((r >> 8) & 0x0f), 0x90 + ((r >> 16) & 0x1f), 0xb0 + ((r >> 24) & 0x1f));
+    }
+    buffer[len++] = '\r';
+    buffer[len] = 0;
+    return len;
+}
+
+/* hand the lines collected so far to the card in one write */
+static uint8_t flush_lines()
+{
+    uint16_t len = pending;
+    pending = 0;
+    if(!len)
+        return 1;
+    return write_log(expected + expected_len - len, len);
+}
+
+static uint8_t log_line(uint8_t len)
+{
+    if(write_size && pending + len > write_size && !flush_lines())
+        return 0;
+
+    memcpy(expected + expected_len, buffer, len);
+    expected_len += len;
+    if(!write_size)
+        return write_log((uint8_t*) buffer, len);
+
+    pending += len;
+    return 1;
+}
+
+/* formats the image's partition with mkfs.vfat, behind an MBR of our own */
+static uint8_t format_mkfs(const char* image_path, uint64_t size, uint8_t sectors_per_cluster)
+{
+    uint32_t blocks = (size - FAT_IMAGE_PARTITION_START * 512) / 1024;
+    char command[512];
+    snprintf(command, sizeof(command),
+             "mkfs.vfat -F 32 -s %u -n GPSWII --offset %u %s %lu > /dev/null",
+             (unsigned) sectors_per_cluster, (unsigned) FAT_IMAGE_PARTITION_START,
+             image_path, (unsigned long) blocks);
+    if(system(command) != 0)
+        return 0;
+
+    fat_image_set_partition(sd_image_data(), 0x0c, FAT_IMAGE_PARTITION_START, blocks * 2);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* image_path = "logbench.img";
+    uint64_t size_mb = 32;
+    uint8_t sectors_per_cluster = 4;
+    uint32_t seconds = 3600;
+    uint32_t existing = 0;
+    int busy = 500;
+    int stream_busy = -1;
+    uint8_t stream = 0;
+    uint16_t reserve = 0;
+    uint32_t prefill = 0;
+    uint16_t sync_bytes = 0;
+    uint16_t sync_seconds = 0;
+    uint8_t sync_flags = 0;
+    uint16_t export_chunk = 64;
+    uint8_t fat_bits = 16;
+    uint8_t mkfs = 0;
+    uint32_t next_free = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:s:c:t:f:b:B:mw:r:p:S:T:Cx:F:MN:K:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i': image_path = optarg; break;
+            case 's': size_mb = strtoull(optarg, 0, 10); break;
+            case 'c': sectors_per_cluster = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 'f': existing = atoi(optarg); break;
+            case 'b': busy = atoi(optarg); break;
+            case 'B': stream_busy = atoi(optarg); break;
+            case 'm': stream = 1; break;
+            case 'w': write_size = atoi(optarg); break;
+            case 'r': reserve = atoi(optarg); break;
+            case 'p': prefill = atoi(optarg); break;
+            case 'S': sync_bytes = atoi(optarg); break;
+            case 'T': sync_seconds = atoi(optarg); break;
+            case 'C': sync_flags |= FAT16_SYNC_CLUSTER | FAT16_SYNC_DEFER; break;
+            case 'x': export_chunk = atoi(optarg); break;
+            case 'F': fat_bits = atoi(optarg); break;
+            case 'M': mkfs = 1; fat_bits = 32; break;
+            case 'N': next_free = strtoul(optarg, 0, 10); break;
+            case 'K':
+                if(strcmp(optarg, "mmc") == 0)
+                    sd_image_set_card(SD_IMAGE_CARD_MMC);
+                else if(strcmp(optarg, "sd1") == 0)
+                    sd_image_set_card(SD_IMAGE_CARD_SD1);
+                else if(strcmp(optarg, "sd2") == 0)
+                    sd_image_set_card(SD_IMAGE_CARD_SD2);
+                else if(strcmp(optarg, "sdhc") == 0)
+                    sd_image_set_card(SD_IMAGE_CARD_SDHC);
+                else
+                    goto usage;
+                break;
+            default:
+            usage:
+                fprintf(stderr, "usage: %s [-i image] [-s size_mb] [-c sectors_per_cluster] [-t seconds] [-f existing_logs] [-b busy_bytes] [-B stream_busy_bytes] [-m] [-w write_size] [-r reserve_clusters] [-p prefill_kb] [-S sync_bytes] [-T sync_seconds] [-C] [-x export_chunk] [-F 16|32] [-M] [-N next_free] [-K mmc|sd1|sd2|sdhc]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    sd_image_set_busy(busy);
+    sd_image_set_stream_busy(stream_busy < 0 ? busy : stream_busy);
+
+    uint64_t size = size_mb * 1024 * 1024;
+    uint8_t formatted = 0;
+    if(sd_image_open(image_path, size))
+    {
+        if(mkfs)
+            formatted = format_mkfs(image_path, size, sectors_per_cluster);
+        else if(fat_bits == 32)
+            formatted = fat_image_format_fat32(sd_image_data(), size, sectors_per_cluster);
+        else
+            formatted = fat_image_format(sd_image_data(), size, sectors_per_cluster);
+    }
+    if(!formatted || (next_free && !fat_image_set_next_free(sd_image_data(), next_free)))
+    {
+        fprintf(stderr, "can't create FAT%u image %s\n", (unsigned) fat_bits, image_path);
+        return 1;
+    }
+
+    if(!card.init_card() || !card.open_partition() ||
+       !card.open_filesys() || !card.open_dir((char*) "/"))
+    {
+        fprintf(stderr, "can't mount %s\n", image_path);
+        return 1;
+    }
+
+    uint32_t i;
+    if(prefill)
+    {
+        static uint8_t chunk[8192];
+        strcpy(name, "FILL.BIN");
+        if(!card.create_file(name) || !(f = card.open_file(name)))
+        {
+            fprintf(stderr, "can't create %s\n", name);
+            return 1;
+        }
+        for(i = 0; i < prefill; i += sizeof(chunk) / 1024)
+        {
+            if(card.write_file(f, chunk, sizeof(chunk)) != sizeof(chunk))
+            {
+                fprintf(stderr, "can't fill the card\n");
+                return 1;
+            }
+        }
+        card.close_file(f);
+    }
+    for(i = 0; i < existing; ++i)
+    {
+        card.numbered_name(name, "GPSL", i, "TXT");
+        if(!card.create_file(name))
+        {
+            fprintf(stderr, "can't create %s\n", name);
+            return 1;
+        }
+    }
+
+    /* setup(): name the log after the newest GPSLnnnn.TXT, the way the sketch does */
+    reset_stats();
+    double start = seconds_now();
+    if(!card.numbered_name(name, "GPSL", card.last_numbered_file("GPSL") + 1, "TXT") ||
+       !card.create_file(name) || !(f = card.open_file(name)))
+    {
+        fprintf(stderr, "can't create %s\n", name);
+        return 1;
+    }
+    if(reserve && !card.reserve_file(f, reserve))
+    {
+        fprintf(stderr, "can't reserve %u clusters\n", (unsigned) reserve);
+        return 1;
+    }
+    host_set_millis(0);
+    if(!card.set_sync_policy(f, sync_bytes, sync_seconds, sync_flags))
+    {
+        fprintf(stderr, "can't set the sync policy\n");
+        return 1;
+    }
+    if(stream && !card.begin_stream())
+    {
+        fprintf(stderr, "streaming is not compiled in\n");
+        return 1;
+    }
+    report("boot", seconds_now() - start, 0);
+
+    /* loop(): one GPS line and one sensor line per second */
+    expected = (uint8_t*) malloc(seconds * 160);
+    write_costs = (uint32_t*) malloc(seconds * 2 * sizeof(*write_costs));
+    expected_len = 0;
+    reset_stats();
+    start = seconds_now();
+    uint32_t t;
+    for(t = 0; t < seconds; ++t)
+    {
+        host_set_millis(t * 1000);
+        if(!log_line(make_gps_line(t)) || !log_line(make_sensor_line(t)))
+        {
+            fprintf(stderr, "can't write at second %lu\n", (unsigned long) t);
+            return 1;
+        }
+
+        uint32_t size_on_card = fat_image_read_file(sd_image_data(), name, 0, 0);
+        if(expected_len - size_on_card > worst_at_risk)
+            worst_at_risk = expected_len - size_on_card;
+    }
+    if(!flush_lines())
+    {
+        fprintf(stderr, "can't write at second %lu\n", (unsigned long) t);
+        return 1;
+    }
+    double elapsed = seconds_now() - start;
+    cluster_t first_cluster = f->dir_entry.cluster;
+    offset_t first_offset = f->fs->header.cluster_zero_offset + (offset_t) (first_cluster - 2) * f->fs->header.cluster_size;
+    card.close_file(f);
+    if(stream)
+        card.end_stream();
+    sd_raw_sync();
+    report("log", elapsed, expected_len);
+    if(next_free)
+    {
+        /* the allocation has to pick up the FSInfo hint */
+        printf("log starts at cluster %lu, %.2f GB into the card\n",
+               (unsigned long) first_cluster, first_offset / (double) (1 << 30));
+        if(first_cluster < next_free)
+        {
+            fprintf(stderr, "log starts before the hinted cluster %lu\n", (unsigned long) next_free);
+            return 1;
+        }
+    }
+    if(sd_image_get_stats()->protocol_errors)
+    {
+        fprintf(stderr, "card saw %lu protocol errors\n",
+                (unsigned long) sd_image_get_stats()->protocol_errors);
+        return 1;
+    }
+
+    /* read the log back without going through fat16.cpp */
+    uint8_t* actual = (uint8_t*) malloc(expected_len + 1);
+    uint32_t actual_len = fat_image_read_file(sd_image_data(), name, actual, expected_len + 1);
+    if(actual_len != expected_len || memcmp(actual, expected, expected_len) != 0)
+    {
+        fprintf(stderr, "%s: read back %lu bytes, expected %lu\n", name,
+                (unsigned long) actual_len, (unsigned long) expected_len);
+        return 1;
+    }
+    struct fat_image_check_result check;
+    if(!fat_image_check(sd_image_data(), &check))
+    {
+        fprintf(stderr, "inconsistent file system: %lu of %lu files bad, %lu of %lu clusters lost%s\n",
+                (unsigned long) check.files_bad, (unsigned long) check.files,
+                (unsigned long) check.clusters_lost, (unsigned long) check.clusters_allocated,
+                check.fsinfo_bad ? ", wrong FSInfo free count" : "");
+        return 1;
+    }
+    printf("verified %s, %lu bytes\n", name, (unsigned long) actual_len);
+
+    /* find the newest log again, as the next boot does */
+    reset_stats();
+    start = seconds_now();
+    int32_t newest = card.last_numbered_file("GPSL");
+    report_read("dir scan", seconds_now() - start, 0, 1);
+    if(newest != (int32_t) existing)
+    {
+        fprintf(stderr, "dir scan found GPSL%04ld, expected GPSL%04lu\n",
+                (long) newest, (unsigned long) existing);
+        return 1;
+    }
+
+    /* export the log through the file system in small pieces */
+    uint8_t* chunk = (uint8_t*) malloc(export_chunk);
+    uint32_t exported = 0;
+    uint32_t calls = 0;
+    reset_stats();
+    start = seconds_now();
+    if(!export_chunk || !(f = card.open_file(name)))
+    {
+        fprintf(stderr, "can't open %s for export\n", name);
+        return 1;
+    }
+    for(;;)
+    {
+        int16_t r = card.read_file(f, chunk, export_chunk);
+        ++calls;
+        if(r <= 0)
+            break;
+        if(exported + r > expected_len || memcmp(chunk, expected + exported, r) != 0)
+        {
+            fprintf(stderr, "%s: export differs at byte %lu\n", name, (unsigned long) exported);
+            return 1;
+        }
+        exported += r;
+    }
+    card.close_file(f);
+    elapsed = seconds_now() - start;
+    report_read("export", elapsed, exported, calls);
+    if(exported != expected_len || sd_image_get_stats()->protocol_errors)
+    {
+        fprintf(stderr, "%s: exported %lu bytes, expected %lu, %lu protocol errors\n", name,
+                (unsigned long) exported, (unsigned long) expected_len,
+                (unsigned long) sd_image_get_stats()->protocol_errors);
+        return 1;
+    }
+    printf("exported %s, %lu bytes\n", name, (unsigned long) exported);
+
+    free(chunk);
+
+    free(actual);
+    free(expected);
+    free(write_costs);
+    sd_image_close();
+    return 0;
+}
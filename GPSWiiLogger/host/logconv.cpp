@@ -0,0 +1,355 @@
+/*
+ * logconv.cpp -- convert between binary and text GPSWiiLogger logs
+ *
+ * Turns a binary log (GPSLnnnn.BIN, see log_record.h) back into the text
+ * the logger writes otherwise: a $GPRMC line, then the sensor pod's
+ * line if the record has samples, each ended by '\r'.  Records that do
+ * not check out are skipped, and the reader looks for the next one
+ * byte by byte.  Logs of the older records with 8 bit samples are read
+ * too, and may be mixed with the new ones.
+ *
+ * -b goes the other way, turning a text log into records with the same
+ * code the logger uses.  -c does both in memory and fails unless the
+ * text comes back as it was, and reports the sizes of the two formats.
+ *
+ * usage: logconv [-b | -c] [-o output] log
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log_record.h"
+#include "sample_delta.h"
+
+/* the record before samples had 10 bits, starting with LOG_RECORD_MAGIC_8BIT */
+struct log_record_8bit
+{
+    uint8_t magic;
+    uint8_t flags;
+    uint32_t time_ms;
+    uint8_t day;
+    uint8_t month;
+    uint8_t year;
+    int32_t lat;
+    int32_t lon;
+    uint16_t speed;
+    uint16_t course;
+    uint8_t reply;
+    uint8_t samples;
+    uint8_t xyz[LOG_RECORD_SAMPLES][3];
+    uint8_t check;
+} __attribute__((packed));
+
+/* Reads an old record at data into r, if it checks out. */
+static uint8_t read_8bit(const uint8_t* data, struct log_record* r)
+{
+    struct log_record_8bit old;
+    memcpy(&old, data, sizeof(old));
+    uint8_t sum = 0;
+    uint32_t i;
+    for(i = 0; i < sizeof(old); ++i)
+        sum ^= data[i];
+    if(old.magic != LOG_RECORD_MAGIC_8BIT || old.samples > LOG_RECORD_SAMPLES || sum != 0)
+        return 0;
+
+    log_record_begin(r);
+    r->flags = old.flags & ~LOG_RECORD_WIDE;
+    r->time_ms = old.time_ms;
+    r->day = old.day;
+    r->month = old.month;
+    r->year = old.year;
+    r->lat = old.lat;
+    r->lon = old.lon;
+    r->speed = old.speed;
+    r->course = old.course;
+    r->reply = old.reply;
+    r->samples = old.samples;
+    for(i = 0; i < old.samples; ++i)
+        r->xyz[i] = (uint32_t) old.xyz[i][0] << 22 | (uint32_t) old.xyz[i][1] << 12 | old.xyz[i][2] << 2;
+    return 1;
+}
+
+static uint8_t* read_all(const char* path, uint32_t* len)
+{
+    FILE* in = fopen(path, "rb");
+    if(!in)
+    {
+        perror(path);
+        return 0;
+    }
+    fseek(in, 0, SEEK_END);
+    *len = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t* data = (uint8_t*) malloc(*len + 1);
+    if(fread(data, 1, *len, in) != *len)
+    {
+        perror(path);
+        fclose(in);
+        free(data);
+        return 0;
+    }
+    data[*len] = 0;
+    fclose(in);
+    return data;
+}
+
+/* ddmm.mmmm or dddmm.mmmm, and the hemisphere */
+static int format_angle(char* out, int32_t angle, uint8_t degree_digits, const char* hemispheres)
+{
+    char hemisphere = hemispheres[angle < 0];
+    uint32_t a = angle < 0 ? -angle : angle;
+    uint32_t minutes = a % 600000;
+    return sprintf(out, "%0*lu%02lu.%04lu,%c", degree_digits, (unsigned long) (a / 600000),
+                   (unsigned long) (minutes / 10000), (unsigned long) (minutes % 10000), hemisphere);
+}
+
+/* Writes the text lines of one record; returns their length. */
+static uint32_t format_record(char* out, const struct log_record* r)
+{
+    char* p = out;
+    p += sprintf(p, "$GPRMC,%02lu%02lu%02lu.%03lu,%c,",
+                 (unsigned long) (r->time_ms / 3600000), (unsigned long) (r->time_ms / 60000 % 60),
+                 (unsigned long) (r->time_ms / 1000 % 60), (unsigned long) (r->time_ms % 1000),
+                 r->flags & LOG_RECORD_FIX ? 'A' : 'V');
+    if(r->flags & LOG_RECORD_POSITION)
+    {
+        p += format_angle(p, r->lat, 2, "NS");
+        *p++ = ',';
+        p += format_angle(p, r->lon, 3, "EW");
+        *p++ = ',';
+    }
+    else
+    {
+        p += sprintf(p, ",,,,");
+    }
+    if(r->flags & LOG_RECORD_SPEED)
+        p += sprintf(p, "%u.%02u", r->speed / 100, r->speed % 100);
+    *p++ = ',';
+    if(r->flags & LOG_RECORD_COURSE)
+        p += sprintf(p, "%u.%02u", r->course / 100, r->course % 100);
+    *p++ = ',';
+    if(r->flags & LOG_RECORD_DATE)
+        p += sprintf(p, "%02u%02u%02u", r->day, r->month, r->year);
+    p += sprintf(p, ",,*");
+
+    uint8_t sum = 0;
+    char* c;
+    for(c = out + 1; *c != '*'; ++c)
+        sum ^= *c;
+    p += sprintf(p, "%02X\r", sum);
+
+    if(r->samples)
+    {
+        if(r->reply)
+            *p++ = r->reply;
+        uint8_t i;
+        if(r->flags & LOG_RECORD_DELTA)
+        {
+            uint32_t xyz[LOG_RECORD_SAMPLES];
+            uint8_t len;
+            memcpy(xyz, r->xyz, sizeof(xyz));
+            sample_delta_write(p, 255, xyz, r->samples, SAMPLE_DELTA_KEYFRAME, &len);
+            p += len;
+        }
+        else
+        {
+            for(i = 0; i < r->samples; ++i)
+            {
+                uint32_t v = r->xyz[i];
+                if(r->flags & LOG_RECORD_WIDE)
+                {
+                    *p++ = '!';
+                    int shift;
+                    for(shift = 24; shift >= 0; shift -= 6)
+                        *p++ = '0' + (v >> shift & 0x3f);
+                }
+                else
+                {
+                    p += sprintf(p, "|%02X%02X%02X", LOG_RECORD_AXIS(v, 0) >> 2,
+                                 LOG_RECORD_AXIS(v, 1) >> 2, LOG_RECORD_AXIS(v, 2) >> 2);
+                }
+            }
+        }
+        *p++ = '\r';
+    }
+    *p = 0;
+    return p - out;
+}
+
+/* Binary to text; returns the count of bytes skipped over. */
+static uint32_t to_text(const uint8_t* data, uint32_t len, FILE* out, uint32_t* records)
+{
+    uint32_t skipped = 0;
+    uint32_t pos = 0;
+    char text[256];
+    *records = 0;
+    while(pos < len)
+    {
+        struct log_record r;
+        uint32_t size = 0;
+        if(pos + sizeof(r) <= len)
+        {
+            memcpy(&r, data + pos, sizeof(r));
+            if(log_record_valid(&r))
+                size = sizeof(r);
+        }
+        if(!size && pos + sizeof(struct log_record_8bit) <= len && read_8bit(data + pos, &r))
+            size = sizeof(struct log_record_8bit);
+        if(!size)
+        {
+            ++pos;
+            ++skipped;
+            continue;
+        }
+        fwrite(text, 1, format_record(text, &r), out);
+        pos += size;
+        ++*records;
+    }
+    return skipped;
+}
+
+/* what a sample group starts with, 8 bit, 10 bit or delta coded */
+static uint8_t is_mark(char c)
+{
+    return c == '|' || c == '!' || c == SAMPLE_DELTA_KEY;
+}
+
+/* Text to binary: a record per $GPRMC line, with the pod's line after
+ * it if there is one.  Returns the count of lines which fit neither.
+ */
+static uint32_t to_binary(char* text, FILE* out, uint32_t* records)
+{
+    struct log_record r;
+    uint8_t open = 0;
+    uint32_t other = 0;
+    *records = 0;
+
+    char* line = strtok(text, "\r\n");
+    for(; line; line = strtok(0, "\r\n"))
+    {
+        if(strncmp(line, "$GPRMC,", 7) == 0)
+        {
+            if(open)
+            {
+                log_record_seal(&r);
+                fwrite(&r, sizeof(r), 1, out);
+                ++*records;
+            }
+            log_record_begin(&r);
+            open = log_record_gps(&r, line);
+            if(!open)
+                ++other;
+        }
+        else if(open && (is_mark(line[0]) || is_mark(line[1])) && log_record_samples(&r, line))
+        {
+            log_record_seal(&r);
+            fwrite(&r, sizeof(r), 1, out);
+            ++*records;
+            open = 0;
+        }
+        else
+        {
+            ++other;
+        }
+    }
+    if(open)
+    {
+        log_record_seal(&r);
+        fwrite(&r, sizeof(r), 1, out);
+        ++*records;
+    }
+    return other;
+}
+
+int main(int argc, char** argv)
+{
+    uint8_t binary = 0;
+    uint8_t check = 0;
+    const char* output = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "bco:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b': binary = 1; break;
+            case 'c': check = 1; break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-b | -c] [-o output] log\n", argv[0]);
+                return 2;
+        }
+    }
+    if(optind != argc - 1 || (binary && check))
+    {
+        fprintf(stderr, "usage: %s [-b | -c] [-o output] log\n", argv[0]);
+        return 2;
+    }
+
+    uint32_t len;
+    uint8_t* data = read_all(argv[optind], &len);
+    if(!data)
+        return 1;
+
+    if(check)
+    {
+        char* text = (char*) malloc(len + 1);
+        memcpy(text, data, len + 1);
+
+        char* bin;
+        size_t bin_len;
+        FILE* mem = open_memstream(&bin, &bin_len);
+        uint32_t records;
+        uint32_t other = to_binary(text, mem, &records);
+        fclose(mem);
+
+        char* back;
+        size_t back_len;
+        mem = open_memstream(&back, &back_len);
+        uint32_t skipped = to_text((uint8_t*) bin, bin_len, mem, &records);
+        fclose(mem);
+
+        printf("%s: %lu records\n", argv[optind], (unsigned long) records);
+        printf("  text:    %lu bytes\n", (unsigned long) len);
+        printf("  binary:  %lu bytes (%.1f%%)\n", (unsigned long) bin_len, 100.0 * bin_len / len);
+
+        int failed = other || skipped || back_len != len || memcmp(back, data, len) != 0;
+        if(failed)
+            fprintf(stderr, "text did not survive the round trip (%lu lines not converted)\n",
+                    (unsigned long) other);
+        free(back);
+        free(bin);
+        free(text);
+        free(data);
+        return failed;
+    }
+
+    FILE* out = output ? fopen(output, "wb") : stdout;
+    if(!out)
+    {
+        perror(output);
+        free(data);
+        return 1;
+    }
+
+    uint32_t records;
+    if(binary)
+    {
+        uint32_t other = to_binary((char*) data, out, &records);
+        if(other)
+            fprintf(stderr, "%lu lines were neither $GPRMC nor sensor lines\n", (unsigned long) other);
+    }
+    else
+    {
+        uint32_t skipped = to_text(data, len, out, &records);
+        if(skipped)
+            fprintf(stderr, "%lu bytes did not belong to a record\n", (unsigned long) skipped);
+    }
+
+    if(out != stdout)
+        fclose(out);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,535 @@
+/*
+ * logindex.cpp -- keep a ride index next to every log
+ *
+ * Looks through the given directories (and the ones below them) for
+ * text logs, *.TXT, and writes the summary of each to its index file,
+ * see ride_index.h.  Logs whose index still has their size and mtime
+ * are left alone, unless -f is given.
+ *
+ * The work is spread over -j threads (default: one per core).  Each
+ * thread has a queue of tasks and takes from its own end of it; a
+ * thread running out of work steals from the other end of someone
+ * else's.  A task is first a whole log.  The thread picking up a log
+ * bigger than -c KB splits it into pieces starting at a $GPRMC sentence,
+ * queues all but the first piece where the others can steal them, and
+ * the last thread done with a piece of a log merges the pieces' summaries
+ * in order and writes the index.
+ *
+ * -l lists the summaries afterwards.  -V checks every index against the
+ * log loaded in one go by one thread, then looks again and fails if any
+ * log would be indexed once more.
+ *
+ * usage: logindex [-j threads] [-c chunk_kb] [-f] [-l] [-V] dir ...
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gpslog.h"
+#include "ride_index.h"
+#include "host_util.h"
+
+/* a log and, while it is being indexed, its pieces */
+struct log_file
+{
+    char* path;
+    char* index_path;
+    uint8_t stale;
+    uint8_t failed;
+    struct ride_index idx;
+
+    const char* data;
+    uint64_t size;
+    uint32_t pieces;
+    uint32_t pieces_left;
+    struct ride_index* parts;
+};
+
+#define WHOLE_LOG 0xffffffffUL
+
+struct task
+{
+    uint32_t file;
+    /* WHOLE_LOG until the log has been split */
+    uint32_t piece;
+    uint64_t start;
+    uint64_t end;
+};
+
+struct worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /* the owner works at the tail, thieves take from the head */
+    struct task* tasks;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t room;
+
+    struct gpslog log;
+    uint32_t done;
+    uint32_t stolen;
+};
+
+static struct log_file* files;
+static uint32_t file_count;
+static struct worker* workers;
+static uint32_t worker_count;
+static uint64_t chunk_size = 8192 * 1024;
+/* tasks queued or running; the workers stop when it drops to 0 */
+static uint32_t pending;
+
+static void push_task(struct worker* w, const struct task* t)
+{
+    pthread_mutex_lock(&w->lock);
+    if(w->tail == w->room)
+    {
+        /* move what is left to the front before growing */
+        memmove(w->tasks, w->tasks + w->head, (w->tail - w->head) * sizeof(*w->tasks));
+        w->tail -= w->head;
+        w->head = 0;
+        if(w->tail == w->room)
+        {
+            w->room = w->room ? 2 * w->room : 64;
+            w->tasks = (struct task*) realloc(w->tasks, w->room * sizeof(*w->tasks));
+        }
+    }
+    w->tasks[w->tail++] = *t;
+    pthread_mutex_unlock(&w->lock);
+}
+
+static uint8_t pop_task(struct worker* w, struct task* t)
+{
+    uint8_t got = 0;
+    pthread_mutex_lock(&w->lock);
+    if(w->head < w->tail)
+    {
+        *t = w->tasks[--w->tail];
+        got = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return got;
+}
+
+static uint8_t steal_task(struct worker* victim, struct task* t)
+{
+    uint8_t got = 0;
+    pthread_mutex_lock(&victim->lock);
+    if(victim->head < victim->tail)
+    {
+        *t = victim->tasks[victim->head++];
+        got = 1;
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return got;
+}
+
+/* Merges the summaries of a log's pieces and writes its index. */
+static void finish_log(struct log_file* f, int64_t mtime_ns)
+{
+    ride_index_clear(&f->idx);
+    uint32_t i;
+    for(i = 0; i < f->pieces; ++i)
+        ride_index_merge(&f->idx, &f->parts[i]);
+    f->idx.log_size = f->size;
+    f->idx.log_mtime_ns = mtime_ns;
+    if(!ride_index_write(f->index_path, &f->idx))
+        f->failed = 1;
+
+    if(f->size)
+        munmap((void*) f->data, f->size);
+    free(f->parts);
+    f->parts = 0;
+}
+
+static int64_t mtime_ns(const struct stat* st)
+{
+    return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static void run_piece(struct worker* w, const struct task* t)
+{
+    struct log_file* f = &files[t->file];
+
+    /* reuse the worker's columns */
+    w->log.fixes = w->log.samples = w->log.bad_lines = 0;
+    if(t->end > t->start)
+        gpslog_parse(&w->log, f->data + t->start, t->end - t->start);
+    ride_index_clear(&f->parts[t->piece]);
+    ride_index_add(&f->parts[t->piece], &w->log);
+
+    if(__atomic_sub_fetch(&f->pieces_left, 1, __ATOMIC_ACQ_REL) == 0)
+        finish_log(f, f->idx.log_mtime_ns);
+}
+
+/* Maps a log and splits it into pieces, then takes on the first one. */
+static void run_log(struct worker* w, const struct task* t)
+{
+    struct log_file* f = &files[t->file];
+
+    struct stat st;
+    int fd = open(f->path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(f->path);
+        if(fd >= 0)
+            close(fd);
+        f->failed = 1;
+        return;
+    }
+    f->size = st.st_size;
+    f->data = 0;
+    if(f->size)
+    {
+        void* data = mmap(0, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+        {
+            perror(f->path);
+            close(fd);
+            f->failed = 1;
+            return;
+        }
+        f->data = (const char*) data;
+    }
+    close(fd);
+    /* kept here until finish_log() */
+    f->idx.log_mtime_ns = mtime_ns(&st);
+
+    /* each piece but the last ends at the first $GPRMC after chunk_size */
+    uint64_t starts_room = f->size / chunk_size + 2;
+    uint64_t* starts = (uint64_t*) malloc(starts_room * sizeof(*starts));
+    uint32_t n = 0;
+    uint64_t at = 0;
+    while(1)
+    {
+        starts[n++] = at;
+        if(f->size - at <= chunk_size)
+            break;
+        const char* next = (const char*) memmem(f->data + at + chunk_size, f->size - at - chunk_size, "$GPRMC,", 7);
+        if(!next)
+            break;
+        at = next - f->data;
+    }
+
+    f->pieces = n;
+    f->pieces_left = n;
+    f->parts = (struct ride_index*) malloc(n * sizeof(*f->parts));
+
+    struct task piece;
+    piece.file = t->file;
+    __atomic_add_fetch(&pending, n - 1, __ATOMIC_ACQ_REL);
+    uint32_t i;
+    for(i = n - 1; i > 0; --i)
+    {
+        piece.piece = i;
+        piece.start = starts[i];
+        piece.end = i + 1 < n ? starts[i + 1] : f->size;
+        push_task(w, &piece);
+    }
+    piece.piece = 0;
+    piece.start = 0;
+    piece.end = n > 1 ? starts[1] : f->size;
+    free(starts);
+    run_piece(w, &piece);
+}
+
+static void* work(void* arg)
+{
+    struct worker* w = (struct worker*) arg;
+    uint32_t me = w - workers;
+    uint32_t victim = me;
+
+    while(__atomic_load_n(&pending, __ATOMIC_ACQUIRE))
+    {
+        struct task t;
+        if(!pop_task(w, &t))
+        {
+            uint32_t tries;
+            for(tries = 0; tries < worker_count; ++tries)
+            {
+                victim = (victim + 1) % worker_count;
+                if(victim != me && steal_task(&workers[victim], &t))
+                    break;
+            }
+            if(tries == worker_count)
+            {
+                sched_yield();
+                continue;
+            }
+            ++w->stolen;
+        }
+
+        if(t.piece == WHOLE_LOG)
+            run_log(w, &t);
+        else
+            run_piece(w, &t);
+        ++w->done;
+        __atomic_sub_fetch(&pending, 1, __ATOMIC_ACQ_REL);
+    }
+    return 0;
+}
+
+static uint8_t is_log_name(const char* name)
+{
+    size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".txt") == 0;
+}
+
+/* Adds the logs in a directory and below it. */
+static void find_logs(const char* dir)
+{
+    DIR* d = opendir(dir);
+    if(!d)
+    {
+        perror(dir);
+        return;
+    }
+    struct dirent* e;
+    while((e = readdir(d)) != 0)
+    {
+        if(e->d_name[0] == '.')
+            continue;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        struct stat st;
+        if(stat(path, &st) != 0)
+            continue;
+        if(S_ISDIR(st.st_mode))
+        {
+            find_logs(path);
+            continue;
+        }
+        if(!S_ISREG(st.st_mode) || !is_log_name(e->d_name))
+            continue;
+
+        if((file_count & (file_count - 1)) == 0)
+            files = (struct log_file*) realloc(files, (file_count ? 2 * file_count : 1) * sizeof(*files));
+        struct log_file* f = &files[file_count++];
+        memset(f, 0, sizeof(*f));
+        f->path = strdup(path);
+        f->index_path = (char*) malloc(strlen(path) + 8);
+        ride_index_path(f->index_path, strlen(path) + 8, path);
+    }
+    closedir(d);
+}
+
+/* Marks the logs whose index is missing or out of date; returns how many. */
+static uint32_t check_stale(uint8_t force)
+{
+    uint32_t stale = 0;
+    uint32_t i;
+    for(i = 0; i < file_count; ++i)
+    {
+        struct log_file* f = &files[i];
+        struct stat st;
+        f->stale = force || stat(f->path, &st) != 0 ||
+                   !ride_index_read(f->index_path, &f->idx) ||
+                   f->idx.log_size != (uint64_t) st.st_size ||
+                   f->idx.log_mtime_ns != mtime_ns(&st);
+        stale += f->stale;
+    }
+    return stale;
+}
+
+/* biggest first, so that the long ones start early */
+static int by_size(const void* a, const void* b)
+{
+    const struct log_file* fa = &files[((const struct task*) a)->file];
+    const struct log_file* fb = &files[((const struct task*) b)->file];
+    return fa->size < fb->size ? 1 : fa->size > fb->size ? -1 : 0;
+}
+
+/* Indexes the stale logs on the workers. */
+static void index_logs(void)
+{
+    struct task* tasks = (struct task*) malloc((file_count + 1) * sizeof(*tasks));
+    uint32_t n = 0;
+    uint32_t i;
+    for(i = 0; i < file_count; ++i)
+    {
+        if(!files[i].stale)
+            continue;
+        struct stat st;
+        files[i].size = stat(files[i].path, &st) == 0 ? st.st_size : 0;
+        tasks[n].file = i;
+        tasks[n].piece = WHOLE_LOG;
+        tasks[n].start = tasks[n].end = 0;
+        ++n;
+    }
+    qsort(tasks, n, sizeof(*tasks), by_size);
+
+    /* dealt out in turn; the stealing evens out the rest */
+    pending = n;
+    for(i = 0; i < n; ++i)
+        push_task(&workers[i % worker_count], &tasks[i]);
+    free(tasks);
+
+    for(i = 0; i < worker_count; ++i)
+        pthread_create(&workers[i].thread, 0, work, &workers[i]);
+    for(i = 0; i < worker_count; ++i)
+        pthread_join(workers[i].thread, 0);
+}
+
+static void print_time(uint32_t ms)
+{
+    printf("%02u:%02u:%02u", ms / 3600000, ms / 60000 % 60, ms / 1000 % 60);
+}
+
+static void list_index(const struct log_file* f)
+{
+    const struct ride_index* r = &f->idx;
+    printf("%s\n", f->path);
+    printf("  %u fixes, %u valid, %u with position, %u samples, %u bad lines\n",
+           r->fixes, r->valid_fixes, r->positions, r->samples, r->bad_lines);
+    if(r->fixes)
+    {
+        printf("  ");
+        print_time(r->first_ms);
+        printf(" to ");
+        print_time(r->last_ms);
+        printf(" UTC\n");
+    }
+    if(r->positions)
+        printf("  lat %.6f to %.6f, lon %.6f to %.6f, max %.2f knots\n",
+               r->lat_min, r->lat_max, r->lon_min, r->lon_max, r->max_speed);
+    if(r->samples)
+        printf("  x %03x-%03x  y %03x-%03x  z %03x-%03x\n", r->min_xyz[0], r->max_xyz[0],
+               r->min_xyz[1], r->max_xyz[1], r->min_xyz[2], r->max_xyz[2]);
+}
+
+/* Checks the indexes against the logs loaded in one go; returns the failures. */
+static uint32_t verify(void)
+{
+    uint32_t failures = 0;
+    uint32_t i;
+    for(i = 0; i < file_count; ++i)
+    {
+        struct log_file* f = &files[i];
+        struct ride_index on_disk, whole;
+        if(!ride_index_read(f->index_path, &on_disk))
+        {
+            fprintf(stderr, "%s: no index\n", f->path);
+            ++failures;
+            continue;
+        }
+        struct gpslog log;
+        gpslog_init(&log);
+        gpslog_load(&log, f->path);
+        ride_index_clear(&whole);
+        ride_index_add(&whole, &log);
+        gpslog_free(&log);
+        if(!ride_index_equal(&on_disk, &whole))
+        {
+            fprintf(stderr, "%s: index disagrees with the log\n", f->path);
+            ++failures;
+        }
+    }
+
+    uint32_t stale = check_stale(0);
+    if(stale)
+    {
+        fprintf(stderr, "%u logs would be indexed again\n", stale);
+        ++failures;
+    }
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint8_t force = 0;
+    uint8_t list = 0;
+    uint8_t check = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "j:c:flV")) != -1)
+    {
+        switch(opt)
+        {
+            case 'j': threads = atoi(optarg); break;
+            case 'c': chunk_size = (uint64_t) atoi(optarg) * 1024; break;
+            case 'f': force = 1; break;
+            case 'l': list = 1; break;
+            case 'V': check = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-j threads] [-c chunk_kb] [-f] [-l] [-V] dir ...\n", argv[0]);
+                return 2;
+        }
+    }
+    if(!threads || !chunk_size || optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-j threads] [-c chunk_kb] [-f] [-l] [-V] dir ...\n", argv[0]);
+        return 2;
+    }
+
+    for(; optind < argc; ++optind)
+        find_logs(argv[optind]);
+
+    /* pick the sample decoder before the threads race to do it */
+    gpslog_set_decoder(0xff);
+
+    worker_count = threads;
+    workers = (struct worker*) calloc(worker_count, sizeof(*workers));
+    uint32_t i;
+    for(i = 0; i < worker_count; ++i)
+    {
+        pthread_mutex_init(&workers[i].lock, 0);
+        gpslog_init(&workers[i].log);
+    }
+
+    double t = seconds_now();
+    uint32_t stale = check_stale(force);
+    index_logs();
+    t = seconds_now() - t;
+
+    uint32_t tasks = 0, stolen = 0, failed = 0;
+    uint64_t bytes = 0;
+    for(i = 0; i < worker_count; ++i)
+    {
+        tasks += workers[i].done;
+        stolen += workers[i].stolen;
+        gpslog_free(&workers[i].log);
+        pthread_mutex_destroy(&workers[i].lock);
+        free(workers[i].tasks);
+    }
+    for(i = 0; i < file_count; ++i)
+    {
+        failed += files[i].failed;
+        if(files[i].stale)
+            bytes += files[i].size;
+    }
+    printf("%u logs: %u indexed (%.1f MB, %u tasks, %u stolen), %u up to date, %u failed\n",
+           file_count, stale - failed, bytes / 1048576.0, tasks, stolen, file_count - stale, failed);
+    printf("%.3f s on %u threads, %.1f MB/s\n", t, worker_count, t > 0 ? bytes / 1048576.0 / t : 0);
+
+    if(list)
+    {
+        for(i = 0; i < file_count; ++i)
+            list_index(&files[i]);
+    }
+
+    uint32_t failures = failed;
+    if(check)
+    {
+        failures += verify();
+        printf("verified against single-threaded loads: %s\n", failures ? "FAILED" : "ok");
+    }
+
+    for(i = 0; i < file_count; ++i)
+    {
+        free(files[i].path);
+        free(files[i].index_path);
+    }
+    free(files);
+    free(workers);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,392 @@
+/*
+ * nmeabench.cpp -- checking and timing the fixed point field parser
+ *
+ * First goes through every value the fields of a $GPRMC sentence can
+ * take, writes it out the way a GPS would and parses it back with
+ * nmea_field.cpp:
+ *  - every ms of a day as "hhmmss.sss",
+ *  - every "dddmm.mmmm" from 0 to 180 degrees, both into 1/10000 arc
+ *    minutes, which must come back exactly, and into 1e-7 degrees,
+ *    which must be the nearest 1e-7 and map back to the same minutes,
+ *  - every "ddmm.mmmmm" of the first and last degree,
+ *  - every speed "ddd.dd" up to 999.99,
+ * and a list of malformed fields, which must be turned down.
+ *
+ * Then the time, position, speed and course of the $GPRMC sentences in
+ * the given logs (default: the GPSWiiLogger logs in example_data),
+ * repeated -n times, are parsed with nmea_field.cpp and with strtod the
+ * way gpslog.cpp used to, -r times each, and the fastest run counts.
+ * -q leaves out the exhaustive part.
+ *
+ * usage: nmeabench [-q] [-n repeats] [-r runs] [log ...]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nmea_field.h"
+#include "host_util.h"
+
+static uint32_t failures;
+
+static void fail(const char* what, const char* field)
+{
+    if(failures++ < 10)
+        fprintf(stderr, "%s: \"%s\"\n", what, field);
+}
+
+/* Writes v as exactly the given count of digits. */
+static char* put_digits(char* out, uint32_t v, uint8_t digits)
+{
+    uint8_t i;
+    for(i = digits; i > 0; --i)
+    {
+        out[i - 1] = '0' + v % 10;
+        v /= 10;
+    }
+    return out + digits;
+}
+
+static void check_times(void)
+{
+    char field[16];
+    uint32_t ms;
+    for(ms = 0; ms < 86400000; ++ms)
+    {
+        char* p = put_digits(field, ms / 3600000, 2);
+        p = put_digits(p, ms / 60000 % 60, 2);
+        p = put_digits(p, ms / 1000 % 60, 2);
+        *p++ = '.';
+        p = put_digits(p, ms % 1000, 3);
+        strcpy(p, ",A");
+
+        uint32_t got;
+        if(!nmea_time(field, &got) || got != ms)
+            fail("time", field);
+    }
+}
+
+/* Tells whether e7 is the 1e-7 degree nearest to m5 1e-5 minutes, and
+ * the one m5 is found again from.
+ */
+static uint8_t e7_matches(int32_t e7, uint32_t degrees, uint32_t m5)
+{
+    int64_t frac = e7 - (int64_t) degrees * 10000000;
+    /* e7 - exact = (3 frac - 5 m5) / 3, at most half a unit off */
+    int64_t off = 3 * frac - 5 * (int64_t) m5;
+    if(off < -1 || off > 1)
+        return 0;
+    return (3 * frac + 2) / 5 == m5;
+}
+
+static void check_angles(void)
+{
+    char field[24];
+    uint32_t d, m;
+    for(d = 0; d <= 180; ++d)
+    {
+        for(m = 0; m < 600000; ++m)
+        {
+            char* p = put_digits(field, d, 3);
+            p = put_digits(p, m / 10000, 2);
+            *p++ = '.';
+            p = put_digits(p, m % 10000, 4);
+            strcpy(p, ",N,");
+
+            int32_t minutes, e7;
+            if(!nmea_minutes(field, &minutes) || minutes != (int32_t) (d * 600000 + m))
+                fail("minutes", field);
+            if(!nmea_angle(field, &e7) || !e7_matches(e7, d, m * 10))
+                fail("degrees", field);
+        }
+    }
+
+    static const uint32_t degrees[] = { 0, 180 };
+    uint8_t i;
+    for(i = 0; i < 2; ++i)
+    {
+        for(m = 0; m < 6000000; ++m)
+        {
+            char* p = put_digits(field, degrees[i], 2 + (degrees[i] > 99));
+            p = put_digits(p, m / 100000, 2);
+            *p++ = '.';
+            p = put_digits(p, m % 100000, 5);
+            strcpy(p, ",W,");
+
+            int32_t e7;
+            if(!nmea_angle(field, &e7) || !e7_matches(-e7, degrees[i], m))
+                fail("degrees, five decimals", field);
+        }
+    }
+
+    /* hemispheres */
+    static const char* signs[] = { "4807.038,N,", "4807.038,S,", "01131.000,E,", "01131.000,W," };
+    static const int32_t signed_minutes[] = { 28870380, -28870380, 6910000, -6910000 };
+    for(i = 0; i < 4; ++i)
+    {
+        int32_t minutes;
+        if(!nmea_minutes(signs[i], &minutes) || minutes != signed_minutes[i])
+            fail("hemisphere", signs[i]);
+    }
+}
+
+static void check_speeds(void)
+{
+    char field[16];
+    uint32_t v;
+    for(v = 0; v < 100000; ++v)
+    {
+        char* p = field;
+        if(v >= 10000)
+            p = put_digits(p, v / 100, 3);
+        else if(v >= 1000)
+            p = put_digits(p, v / 100, 2);
+        else
+            p = put_digits(p, v / 100, 1);
+        *p++ = '.';
+        p = put_digits(p, v % 100, 2);
+        strcpy(p, "*4F");
+
+        uint32_t got;
+        if(!nmea_fixed(field, 2, &got) || got != v)
+            fail("speed", field);
+    }
+
+    /* fewer and more decimals than asked for */
+    uint32_t got;
+    if(!nmea_fixed("12,", 2, &got) || got != 1200)
+        fail("speed", "12");
+    if(!nmea_fixed("12.3456,", 2, &got) || got != 1234)
+        fail("speed", "12.3456");
+}
+
+static void check_malformed(void)
+{
+    static const char* bad[] = { ",", "*", "", ".,", "1.2.3,", "12a,", "-1,", " 1,", "4294967296,", "99999999999," };
+    static const char* bad_times[] = { "240000.000,", "126000,", "120060,", "12:00:00," };
+    static const char* bad_angles[] = { ",N,", "4860.0000,N,", "18100.0000,E,", "48x7.0380,N," };
+    uint32_t v;
+    int32_t a;
+    uint8_t i;
+    for(i = 0; i < sizeof(bad) / sizeof(*bad); ++i)
+    {
+        if(nmea_fixed(bad[i], 2, &v))
+            fail("taken", bad[i]);
+    }
+    for(i = 0; i < sizeof(bad_times) / sizeof(*bad_times); ++i)
+    {
+        if(nmea_time(bad_times[i], &v))
+            fail("time taken", bad_times[i]);
+    }
+    for(i = 0; i < sizeof(bad_angles) / sizeof(*bad_angles); ++i)
+    {
+        if(nmea_minutes(bad_angles[i], &a) || nmea_angle(bad_angles[i], &a))
+            fail("angle taken", bad_angles[i]);
+    }
+}
+
+/* where the timed loops leave their results, so they are not dropped */
+static volatile double sink;
+
+static char** sentences;
+static uint32_t sentence_count;
+
+/* Takes the $GPRMC sentences of a log, 0-terminated. */
+static void collect_sentences(const char* path)
+{
+    FILE* in = fopen(path, "rb");
+    if(!in)
+    {
+        perror(path);
+        exit(1);
+    }
+    char line[256];
+    while(fgets(line, sizeof(line), in))
+    {
+        char* s = strstr(line, "$GPRMC,");
+        if(!s || !strchr(s, '*'))
+            continue;
+        s[strcspn(s, "\r\n")] = 0;
+        sentences = (char**) realloc(sentences, (sentence_count + 1) * sizeof(*sentences));
+        sentences[sentence_count++] = strdup(s);
+    }
+    fclose(in);
+}
+
+/* the fields of a sentence, as both parsers see them */
+struct fix
+{
+    double time;
+    double lat;
+    double lon;
+    double speed;
+    double course;
+};
+
+static const char* skip(const char* p, uint8_t fields)
+{
+    while(fields--)
+        p = nmea_next_field(p);
+    return p;
+}
+
+static void parse_fixed(const char* s, struct fix* f)
+{
+    uint32_t ms, v;
+    int32_t e7;
+    const char* p = s + 7;
+    f->time = nmea_time(p, &ms) ? ms : NAN;
+    p = skip(p, 2);
+    f->lat = nmea_angle(p, &e7) ? e7 / 1e7 : NAN;
+    p = skip(p, 2);
+    f->lon = nmea_angle(p, &e7) ? e7 / 1e7 : NAN;
+    p = skip(p, 2);
+    f->speed = nmea_fixed(p, 2, &v) ? v / 100.0 : NAN;
+    p = skip(p, 1);
+    f->course = nmea_fixed(p, 2, &v) ? v / 100.0 : NAN;
+}
+
+static double strtod_angle(const char* p)
+{
+    if(*p == ',')
+        return NAN;
+    double v = strtod(p, 0);
+    double degrees = floor(v / 100);
+    v = degrees + (v - degrees * 100) / 60;
+    p = nmea_next_field(p);
+    return *p == 'S' || *p == 'W' ? -v : v;
+}
+
+static void parse_strtod(const char* s, struct fix* f)
+{
+    const char* p = s + 7;
+    double hms = strtod(p, 0);
+    double whole = floor(hms);
+    uint32_t h = (uint32_t) whole;
+    f->time = (h / 10000) * 3600000.0 + (h / 100 % 100) * 60000.0 + (h % 100) * 1000.0 +
+              floor((hms - whole) * 1000 + 0.5);
+    p = skip(p, 2);
+    f->lat = strtod_angle(p);
+    p = skip(p, 2);
+    f->lon = strtod_angle(p);
+    p = skip(p, 2);
+    f->speed = *p == ',' ? NAN : strtod(p, 0);
+    p = skip(p, 1);
+    f->course = *p == ',' ? NAN : strtod(p, 0);
+}
+
+static uint8_t close_enough(double a, double b, double tolerance)
+{
+    return (isnan(a) && isnan(b)) || fabs(a - b) <= tolerance;
+}
+
+int main(int argc, char** argv)
+{
+    uint8_t quick = 0;
+    uint32_t repeats = 20000;
+    uint32_t runs = 3;
+    int opt;
+
+    while((opt = getopt(argc, argv, "qn:r:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'q': quick = 1; break;
+            case 'n': repeats = atoi(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-q] [-n repeats] [-r runs] [log ...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(!repeats || !runs)
+    {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    if(!quick)
+    {
+        double t = seconds_now();
+        check_times();
+        check_angles();
+        check_speeds();
+        check_malformed();
+        printf("round trip of every time, angle and speed: %u failures (%.1f s)\n",
+               failures, seconds_now() - t);
+    }
+
+    if(optind < argc)
+    {
+        for(; optind < argc; ++optind)
+            collect_sentences(argv[optind]);
+    }
+    else
+    {
+        collect_sentences("../example_data/GPSLOG00-wii.TXT");
+        collect_sentences("../example_data/john1.txt");
+    }
+    if(!sentence_count)
+    {
+        fprintf(stderr, "no $GPRMC sentences\n");
+        return 1;
+    }
+
+    struct fix a, b;
+    uint32_t i;
+    for(i = 0; i < sentence_count; ++i)
+    {
+        parse_fixed(sentences[i], &a);
+        parse_strtod(sentences[i], &b);
+        if(!close_enough(a.time, b.time, 0) || !close_enough(a.lat, b.lat, 1e-7) ||
+           !close_enough(a.lon, b.lon, 1e-7) || !close_enough(a.speed, b.speed, 0.01) ||
+           !close_enough(a.course, b.course, 0.01))
+            fail("parsers disagree", sentences[i]);
+    }
+
+    double best_fixed = 1e30, best_strtod = 1e30, sum = 0;
+    uint32_t r, k;
+    for(r = 0; r < runs; ++r)
+    {
+        double t = seconds_now();
+        for(k = 0; k < repeats; ++k)
+        {
+            for(i = 0; i < sentence_count; ++i)
+            {
+                parse_fixed(sentences[i], &a);
+                sum += a.lat;
+            }
+        }
+        t = seconds_now() - t;
+        if(t < best_fixed)
+            best_fixed = t;
+
+        t = seconds_now();
+        for(k = 0; k < repeats; ++k)
+        {
+            for(i = 0; i < sentence_count; ++i)
+            {
+                parse_strtod(sentences[i], &b);
+                sum += b.lat;
+            }
+        }
+        t = seconds_now() - t;
+        if(t < best_strtod)
+            best_strtod = t;
+    }
+
+    double n = (double) repeats * sentence_count;
+    sink = sum;
+    printf("%u sentences x %u, 5 fields each\n", sentence_count, repeats);
+    printf("  nmea_field  %7.3f s  %6.1f ns/sentence\n", best_fixed, best_fixed * 1e9 / n);
+    printf("  strtod      %7.3f s  %6.1f ns/sentence\n", best_strtod, best_strtod * 1e9 / n);
+    printf("  speedup     %.1fx\n", best_strtod / best_fixed);
+
+    for(i = 0; i < sentence_count; ++i)
+        free(sentences[i]);
+    free(sentences);
+    return failures ? 1 : 0;
+}
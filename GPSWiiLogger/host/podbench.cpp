@@ -0,0 +1,524 @@
+/*
+ * podbench.cpp -- GPS and sensor pod traffic sharing the logger's RX line
+ *
+ * Simulates the logger's serial port with a GPS sending one $GPRMC
+ * sentence every 1/-g seconds and a fake sensor pod answering each
+ * "sHHMMSS" request after -l to -L ms, except for the -x percent of
+ * requests it misses.  pod_link asks for -P samples a reply ("sHHMMSS/nnd",
+ * 0 for none), and the pod sends that many 10 bit samples delta coded,
+ * as many as fit an nmea_rx slot, or ten "|xxyyzz" to a plain request.
+ * The samples are noisier than a ride's, so the replies run long.  Both
+ * talk to the logger through the AND gate in front of its RX pin, so
+ * bytes sent at the same time arrive garbled.  Every 16th sentence has
+ * no fix.  The logger's other wire carries its progress chars ('_' for
+ * no fix, '#' and '|' for lines written, '?' for a request never
+ * answered) between the requests, without newlines, and the pod reads
+ * it the way GPSWiiUI does.
+ * Every line the logger writes to the card keeps it busy for -w ms,
+ * every -n'th one for another -W ms.
+ *
+ * The same traffic is run through two versions of loop():
+ *  - blocking: write the GPS line, send the request, then wait for the
+ *    reply, giving up only when the next sentence arrives first;
+ *  - pod_link: write the GPS line and pod_request(), then carry on
+ *    writing whatever nmea_rx has complete, and let pod_poll() retry a
+ *    request unanswered after -T ms, up to -R times, as long as it is
+ *    within -D ms of taking the sentence.
+ * The request goes out after the write in both, so that the reply does
+ * not take the slot the next sentence needs while the card stalls.
+ * The run fails if the pod_link version loses a GPS sentence, or logs
+ * one that was not sent like that.
+ *
+ * usage: podbench [-t seconds] [-g gps_hz] [-b baud] [-l min_latency_ms]
+ *                 [-L max_latency_ms] [-x miss_percent] [-w write_ms]
+ *                 [-W stall_ms] [-n stall_every] [-T timeout_ms] [-R retries]
+ *                 [-D window_ms] [-P packet]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "nmea_rx.h"
+#include "pod_link.h"
+#include "sample_delta.h"
+
+ISR(USART_RX_vect);
+
+#define MODE_BLOCKING 0
+#define MODE_POD_LINK 1
+
+/* the simulation advances in steps of this many us */
+#define STEP_US 10
+
+static uint32_t seconds = 600;
+static uint32_t gps_hz = 5;
+static uint32_t baud = 38400;
+static uint32_t latency_min = 5;
+static uint32_t latency_max = 35;
+static uint32_t miss = 2;
+static uint32_t write_ms = 10;
+static uint32_t stall_ms = 100;
+static uint32_t stall_every = 50;
+static uint32_t timeout_ms = 70;
+static uint32_t retries = 1;
+static uint32_t window_ms = 120;
+static uint32_t packet = 14;
+
+static uint32_t byte_us;
+
+/* one transmission on the RX line */
+struct burst
+{
+    uint32_t start_us;
+    uint8_t len;
+    char data[NMEA_RX_SLOT_SIZE + 2];
+};
+
+/* a transmitter: its bursts, in the order they are sent */
+struct source
+{
+    struct burst* bursts;
+    uint32_t count;
+    uint32_t size;
+    uint32_t cur;       /* burst being sent */
+    uint8_t pos;        /* next byte of it */
+    uint32_t matched;   /* bursts before this one were matched by a logged line */
+};
+
+static struct source gps;
+static struct source pod;
+
+/* the pod: requests it has heard and not answered yet */
+static uint32_t pod_heard_at[16];
+static uint8_t pod_heard_samples[16];
+static uint8_t pod_heard_delta[16];
+static uint8_t pod_heard;
+
+/* the logger's TX line: when it is free again, and the pod's command line */
+static uint32_t tx_free_us;
+static char pod_cmd[12];
+static uint8_t pod_cmdidx;
+static uint32_t pod_unread;   /* lines the pod couldn't make out */
+
+static struct burst* add_burst(struct source* s, uint32_t start_us)
+{
+    if(s->count == s->size)
+    {
+        s->size = s->size ? 2 * s->size : 1024;
+        s->bursts = (struct burst*) realloc(s->bursts, s->size * sizeof(*s->bursts));
+    }
+    struct burst* b = &s->bursts[s->count++];
+    b->start_us = start_us;
+    return b;
+}
+
+/* when the burst's byte pos has been sent completely */
+static uint32_t byte_end(const struct burst* b, uint8_t pos)
+{
+    return b->start_us + (pos + 1) * byte_us;
+}
+
+static uint32_t burst_end(const struct burst* b)
+{
+    return b->start_us + b->len * byte_us;
+}
+
+/* the byte a source is putting on the line at a time, or 0xff (idle) */
+static uint8_t line_level(const struct source* s, uint32_t t)
+{
+    uint32_t n;
+    for(n = s->cur; n < s->count && n <= s->cur + 1; ++n)
+    {
+        const struct burst* b = &s->bursts[n];
+        if(t >= b->start_us && t < burst_end(b))
+            return b->data[(t - b->start_us) / byte_us];
+    }
+    return 0xff;
+}
+
+/* the GPS's n'th $GPRMC sentence, with "\r\n" */
+static void make_gps_burst(struct burst* b, uint32_t n)
+{
+    uint32_t ms = n * 1000 / gps_hz;
+    uint32_t t = ms / 1000;
+    sprintf(b->data, "$GPRMC,%02lu%02lu%02lu.%03lu,%c,3409.%04lu,N,11808.%04lu,W,0.31,295.65,010908,,*",
+            (unsigned long) (t / 3600) % 24, (unsigned long) (t / 60) % 60, (unsigned long) t % 60,
+            (unsigned long) ms % 1000, n % 16 == 15 ? 'V' : 'A',
+            (unsigned long) (9172 + n) % 10000, (unsigned long) (1017 + 3 * n) % 10000);
+    uint8_t sum = 0;
+    char* p;
+    for(p = b->data + 1; *p != '*'; ++p)
+        sum ^= *p;
+    sprintf(p + 1, "%02X\r\n", sum);
+    b->len = strlen(b->data);
+}
+
+/* the pod's n'th reply: command char, 'samples' "|xxyyzz" or, delta
+ * coded, as many of them as fit, "\r\n"
+ */
+static void make_pod_burst(struct burst* b, uint32_t n, uint8_t samples, uint8_t delta)
+{
+    uint32_t xyz[16];
+    uint8_t len = 0;
+    b->data[len++] = 'r';
+    uint8_t i;
+    for(i = 0; i < samples; ++i)
+    {
+        uint32_t r = (n * 10 + i) * 2654435761UL;
+        uint32_t x = 0x78 + ((r >> 8) & 0x0f), y = 0x90 + ((r >> 16) & 0x1f), z = 0xb0 + ((r >> 24) & 0x1f);
+        if(delta)
+            xyz[i] = x << 22 | (r & 3) << 20 | y << 12 | (r >> 2 & 3) << 10 | z << 2 | (r >> 4 & 3);
+        else
+            len += sprintf(b->data + len, "|%02X%02X%02X", x, y, z);
+    }
+    if(delta)
+    {
+        uint8_t l;
+        sample_delta_write(b->data + len, NMEA_RX_SLOT_SIZE - 3, xyz, samples, SAMPLE_DELTA_KEYFRAME, &l);
+        len += l;
+    }
+    b->data[len++] = '\r';
+    b->data[len++] = '\n';
+    b->data[len] = 0;
+    b->len = len;
+}
+
+/* Checks that a logged line was sent as it is, at or behind the
+ * source's last match.  A burst sent while the other source was
+ * talking arrives garbled, which nmea_rx has to catch for sentences.
+ */
+static uint8_t match_line(struct source* s, const char* data, uint8_t len)
+{
+    uint32_t n;
+    for(n = s->matched; n < s->count; ++n)
+    {
+        if(s->bursts[n].len == len + 1 && memcmp(s->bursts[n].data, data, len) == 0)
+        {
+            s->matched = n + 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* The pod takes a complete command line, as GPSWiiUI's loop() does:
+ * a command char starts the line over, so the logger's progress chars
+ * before it don't spoil it.  Requests it hears, less the ones it
+ * misses, are answered after the latency.
+ */
+static void pod_read(char c, uint32_t at_us)
+{
+    if(c != '\r' && c != '\n')
+    {
+        if(c == 's' || c == 'S' || c == 'T')
+            pod_cmdidx = 0;
+        if(pod_cmdidx < sizeof(pod_cmd) - 1)
+            pod_cmd[pod_cmdidx++] = c;
+        return;
+    }
+    uint8_t len = pod_cmdidx;
+    pod_cmd[pod_cmdidx] = 0;
+    pod_cmdidx = 0;
+    if(len < 7 || (pod_cmd[0] != 's' && pod_cmd[0] != 'S'))
+    {
+        if(len)
+            ++pod_unread;
+        return;
+    }
+
+    const char* slash = strchr(pod_cmd, '/');
+    if((uint32_t) rand() % 100 >= miss && pod_heard < 16)
+    {
+        pod_heard_samples[pod_heard] = slash ? atoi(slash + 1) : 10;
+        pod_heard_delta[pod_heard] = slash && strchr(slash, 'd');
+        pod_heard_at[pod_heard++] = at_us + 1000 *
+            (latency_min + (uint32_t) rand() % (latency_max - latency_min + 1));
+    }
+}
+
+/* Serial.print() from the logger, on the wire to the pod */
+static void logger_print(const char* s, uint32_t now)
+{
+    if(tx_free_us < now)
+        tx_free_us = now;
+    for(; *s; ++s)
+    {
+        tx_free_us += byte_us;
+        pod_read(*s, tx_free_us);
+    }
+}
+
+struct result
+{
+    uint32_t gps_sent;
+    uint32_t gps_intact;
+    uint32_t gps_logged;
+    uint32_t pod_sent;
+    uint32_t pod_logged;
+    uint32_t requests;
+    uint32_t unread;
+    uint32_t bad_gps;
+    uint32_t bad_pod;
+    uint32_t worst_wait_us;
+};
+
+static struct result run(uint8_t mode)
+{
+    struct result r;
+    memset(&r, 0, sizeof(r));
+    memset(&gps, 0, sizeof(gps));
+    free(pod.bursts);
+    memset(&pod, 0, sizeof(pod));
+
+    uint32_t end_us = seconds * 1000000UL;
+    uint32_t n;
+    for(n = 0; n * 1000000ULL / gps_hz < end_us; ++n)
+        make_gps_burst(add_burst(&gps, n * 1000000ULL / gps_hz), n);
+    r.gps_sent = gps.count;
+
+    nmea_rx_reset();
+    pod_begin(timeout_ms, retries, window_ms, packet);
+    srand(7);
+
+    pod_heard = 0;
+    tx_free_us = 0;
+    pod_cmdidx = 0;
+    pod_unread = 0;
+
+    /* loop(): busy writing until busy_until, holding a slot meanwhile */
+    uint32_t busy_until = 0;
+    uint8_t holding = 0;
+    uint8_t waiting = 0;            /* blocking: waiting for the reply */
+    uint8_t request_after_write = 0;
+    char request_time[7];
+    uint32_t fix_at = 0;
+    uint32_t writes = 0;
+    uint32_t sentences_seen = 0;
+    uint32_t sentences_taken = 0;
+    uint32_t complete_at[NMEA_RX_SLOTS * 2];
+    uint8_t gps_garbled = 0;
+
+    uint32_t now;
+    for(now = 0; now < end_us + 1000000UL; now += STEP_US)
+    {
+        /* the line: deliver the bytes which have just been sent completely */
+        struct source* sources[2] = { &gps, &pod };
+        uint8_t i;
+        for(i = 0; i < 2; ++i)
+        {
+            struct source* s = sources[i];
+            struct source* other = sources[1 - i];
+            if(s->cur >= s->count || s->bursts[s->cur].start_us > now)
+                continue;
+            struct burst* b = &s->bursts[s->cur];
+            if(byte_end(b, s->pos) > now)
+                continue;
+
+            /* what the AND gate let through while this byte was sent */
+            uint32_t from = byte_end(b, s->pos) - byte_us;
+            uint8_t c = b->data[s->pos];
+            uint8_t clash = line_level(other, from) & line_level(other, from + byte_us - 1);
+            if(s == &gps && clash != 0xff)
+                gps_garbled = 1;
+            UDR0 = c & clash;
+            USART_RX_vect();
+
+            if(++s->pos == b->len)
+            {
+                if(s == &gps && !gps_garbled)
+                    ++r.gps_intact;
+                gps_garbled = 0;
+                s->pos = 0;
+                ++s->cur;
+            }
+        }
+        if(nmea_rx_get_stats()->sentences != sentences_seen)
+            complete_at[sentences_seen++ % (NMEA_RX_SLOTS * 2)] = now;
+
+        /* the pod answers requests it heard, one after the other */
+        if(pod_heard && now >= pod_heard_at[0])
+        {
+            uint32_t start = now;
+            if(pod.count && burst_end(&pod.bursts[pod.count - 1]) > start)
+                start = burst_end(&pod.bursts[pod.count - 1]);
+            make_pod_burst(add_burst(&pod, start), pod.count, pod_heard_samples[0], pod_heard_delta[0]);
+            memmove(pod_heard_at, pod_heard_at + 1, --pod_heard * sizeof(*pod_heard_at));
+            memmove(pod_heard_samples, pod_heard_samples + 1, pod_heard);
+            memmove(pod_heard_delta, pod_heard_delta + 1, pod_heard);
+        }
+
+        /* loop() */
+        if(now < busy_until)
+            continue;
+        if(holding)
+        {
+            nmea_rx_release();
+            holding = 0;
+        }
+
+        uint8_t send = 0;
+        if(request_after_write)
+        {
+            request_after_write = 0;
+            if(mode == MODE_POD_LINK)
+            {
+                /* behind: the next fix is in already, so skip this one */
+                if(!nmea_rx_next())
+                    pod_request('s', request_time, fix_at / 1000);
+            }
+            else
+            {
+                send = 1;
+                waiting = 1;
+            }
+        }
+        else
+        {
+            struct nmea_rx_slot* line = nmea_rx_next();
+            if(line && line->type == NMEA_RX_SENTENCE)
+            {
+                uint32_t wait = now - complete_at[sentences_taken++ % (NMEA_RX_SLOTS * 2)];
+                if(wait > r.worst_wait_us)
+                    r.worst_wait_us = wait;
+                if(match_line(&gps, line->data, line->len))
+                    ++r.gps_logged;
+                else
+                    ++r.bad_gps;
+                if(strstr(line->data, ",V,"))
+                    logger_print("_", now);
+                logger_print("#", now);
+
+                waiting = 0;
+                fix_at = now;
+                memcpy(request_time, line->data + 7, 6);
+                request_time[6] = 0;
+                request_after_write = 1;
+                holding = 1;
+            }
+            else if(line)
+            {
+                uint8_t wanted = mode == MODE_POD_LINK ? pod_reply() : waiting;
+                waiting = 0;
+                if(wanted)
+                {
+                    if(match_line(&pod, line->data, line->len))
+                        ++r.pod_logged;
+                    else
+                        ++r.bad_pod;
+                    logger_print("|", now);
+                    holding = 1;
+                }
+                else
+                {
+                    nmea_rx_release();
+                }
+            }
+            if(holding)
+                busy_until = now + (++writes % stall_every == 0 ? (write_ms + stall_ms) : write_ms) * 1000;
+        }
+
+        if(mode == MODE_POD_LINK)
+        {
+            uint8_t poll = pod_poll(now / 1000);
+            if(poll == POD_SEND)
+                send = 1;
+            else if(poll == POD_TIMEOUT)
+                logger_print("?", now);
+        }
+        if(send)
+        {
+            /* "sHHMMSS[/nnd]\r\n" reaches the pod on the other wire */
+            ++r.requests;
+            if(mode == MODE_POD_LINK)
+                logger_print(pod_request_line(), now);
+            else
+            {
+                logger_print("s", now);
+                logger_print(request_time, now);
+            }
+            logger_print("\r\n", now);
+        }
+    }
+
+    r.pod_sent = pod.count;
+    r.unread = pod_unread;
+    return r;
+}
+
+static void report(const char* name, const struct result* r)
+{
+    printf("%s:\n", name);
+    printf("  GPS sentences:     %lu sent, %lu garbled, %lu logged\n",
+           (unsigned long) r->gps_sent, (unsigned long) (r->gps_sent - r->gps_intact),
+           (unsigned long) r->gps_logged);
+    printf("  GPS lost:          %lu\n", (unsigned long) (r->gps_sent - r->gps_logged));
+    printf("  pod requests:      %lu, %lu unreadable\n", (unsigned long) r->requests,
+           (unsigned long) r->unread);
+    printf("  pod replies:       %lu sent, %lu logged\n",
+           (unsigned long) r->pod_sent, (unsigned long) r->pod_logged);
+    printf("  fixes w/ samples:  %.1f%%\n", 100.0 * r->pod_logged / r->gps_sent);
+    printf("  garbled logged:    %lu GPS, %lu pod\n", (unsigned long) r->bad_gps, (unsigned long) r->bad_pod);
+    printf("  worst fix wait:    %.1f ms\n", r->worst_wait_us / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while((opt = getopt(argc, argv, "t:g:b:l:L:x:w:W:n:T:R:D:P:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': seconds = atoi(optarg); break;
+            case 'g': gps_hz = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'l': latency_min = atoi(optarg); break;
+            case 'L': latency_max = atoi(optarg); break;
+            case 'x': miss = atoi(optarg); break;
+            case 'w': write_ms = atoi(optarg); break;
+            case 'W': stall_ms = atoi(optarg); break;
+            case 'n': stall_every = atoi(optarg); break;
+            case 'T': timeout_ms = atoi(optarg); break;
+            case 'R': retries = atoi(optarg); break;
+            case 'D': window_ms = atoi(optarg); break;
+            case 'P': packet = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-t seconds] [-g gps_hz] [-b baud] [-l min_latency_ms] [-L max_latency_ms] [-x miss_percent] [-w write_ms] [-W stall_ms] [-n stall_every] [-T timeout_ms] [-R retries] [-D window_ms] [-P packet]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(!seconds || !gps_hz || !baud || !stall_every || latency_max < latency_min ||
+       packet > 16)
+    {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+    byte_us = 10000000UL / baud;
+
+    printf("%lu s of %lu Hz GPS at %lu baud, pod latency %lu-%lu ms, %lu%% missed\n",
+           (unsigned long) seconds, (unsigned long) gps_hz, (unsigned long) baud,
+           (unsigned long) latency_min, (unsigned long) latency_max, (unsigned long) miss);
+
+    struct result blocking = run(MODE_BLOCKING);
+    report("blocking", &blocking);
+    struct result link = run(MODE_POD_LINK);
+    report("pod_link", &link);
+    const struct pod_link_stats* stats = pod_get_stats();
+    printf("  retries/timeouts:  %u / %u\n", stats->retries, stats->timeouts);
+    printf("  superseded/stray:  %u / %u\n", stats->superseded, stats->stray);
+
+    if(link.bad_gps || link.gps_logged != link.gps_sent)
+    {
+        fprintf(stderr, "pod_link version lost GPS sentences\n");
+        return 1;
+    }
+    if(blocking.unread || link.unread)
+    {
+        fprintf(stderr, "the pod couldn't read requests behind the logger's progress chars\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * ride_index.cpp -- per log summaries kept next to the logs
+ *
+ * See ride_index.h.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ride_index.h"
+
+/* Starts an empty summary. */
+void ride_index_clear(struct ride_index* idx)
+{
+    memset(idx, 0, sizeof(*idx));
+    idx->magic = RIDE_INDEX_MAGIC;
+    idx->version = RIDE_INDEX_VERSION;
+    idx->size = sizeof(*idx);
+    idx->min_ms = 0xffffffffUL;
+    idx->lat_min = idx->lon_min = 1000;
+    idx->lat_max = idx->lon_max = -1000;
+    memset(idx->min_xyz, 0xff, sizeof(idx->min_xyz));
+}
+
+/* Adds the fixes and samples of loaded columns to the summary. */
+void ride_index_add(struct ride_index* idx, const struct gpslog* log)
+{
+    struct ride_index part;
+    ride_index_clear(&part);
+
+    uint32_t i;
+    for(i = 0; i < log->fixes; ++i)
+    {
+        uint32_t t = log->time_ms[i];
+        if(i == 0)
+            part.first_ms = t;
+        part.last_ms = t;
+        if(t < part.min_ms)
+            part.min_ms = t;
+        if(t > part.max_ms)
+            part.max_ms = t;
+
+        if(!log->valid[i])
+            continue;
+        ++part.valid_fixes;
+        if(!isnan(log->speed[i]) && log->speed[i] > part.max_speed)
+            part.max_speed = log->speed[i];
+        if(isnan(log->lat[i]) || isnan(log->lon[i]))
+            continue;
+        ++part.positions;
+        if(log->lat[i] < part.lat_min)
+            part.lat_min = log->lat[i];
+        if(log->lat[i] > part.lat_max)
+            part.lat_max = log->lat[i];
+        if(log->lon[i] < part.lon_min)
+            part.lon_min = log->lon[i];
+        if(log->lon[i] > part.lon_max)
+            part.lon_max = log->lon[i];
+    }
+    part.fixes = log->fixes;
+
+    uint8_t a;
+    for(a = 0; a < 3; ++a)
+    {
+        uint16_t lo = 0xffff, hi = 0;
+        for(i = 0; i < log->samples; ++i)
+        {
+            uint16_t v = gpslog_axis10(log, a, i);
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+        part.min_xyz[a] = lo;
+        part.max_xyz[a] = hi;
+    }
+    part.samples = log->samples;
+    part.bad_lines = log->bad_lines;
+
+    ride_index_merge(idx, &part);
+}
+
+/* Adds the summary of the piece of log right after the one summed up. */
+void ride_index_merge(struct ride_index* idx, const struct ride_index* later)
+{
+    if(later->fixes)
+    {
+        if(!idx->fixes)
+            idx->first_ms = later->first_ms;
+        idx->last_ms = later->last_ms;
+        if(later->min_ms < idx->min_ms)
+            idx->min_ms = later->min_ms;
+        if(later->max_ms > idx->max_ms)
+            idx->max_ms = later->max_ms;
+    }
+    idx->fixes += later->fixes;
+    idx->valid_fixes += later->valid_fixes;
+    if(later->max_speed > idx->max_speed)
+        idx->max_speed = later->max_speed;
+
+    if(later->positions)
+    {
+        if(later->lat_min < idx->lat_min)
+            idx->lat_min = later->lat_min;
+        if(later->lat_max > idx->lat_max)
+            idx->lat_max = later->lat_max;
+        if(later->lon_min < idx->lon_min)
+            idx->lon_min = later->lon_min;
+        if(later->lon_max > idx->lon_max)
+            idx->lon_max = later->lon_max;
+    }
+    idx->positions += later->positions;
+
+    uint8_t a;
+    for(a = 0; a < 3; ++a)
+    {
+        if(later->min_xyz[a] < idx->min_xyz[a])
+            idx->min_xyz[a] = later->min_xyz[a];
+        if(later->max_xyz[a] > idx->max_xyz[a])
+            idx->max_xyz[a] = later->max_xyz[a];
+    }
+    idx->samples += later->samples;
+    idx->bad_lines += later->bad_lines;
+}
+
+/* Tells whether two summaries say the same about their logs. */
+uint8_t ride_index_equal(const struct ride_index* a, const struct ride_index* b)
+{
+    return a->fixes == b->fixes && a->valid_fixes == b->valid_fixes &&
+           a->positions == b->positions &&
+           a->first_ms == b->first_ms && a->last_ms == b->last_ms &&
+           a->min_ms == b->min_ms && a->max_ms == b->max_ms &&
+           a->lat_min == b->lat_min && a->lat_max == b->lat_max &&
+           a->lon_min == b->lon_min && a->lon_max == b->lon_max &&
+           a->max_speed == b->max_speed && a->samples == b->samples &&
+           memcmp(a->min_xyz, b->min_xyz, sizeof(a->min_xyz)) == 0 &&
+           memcmp(a->max_xyz, b->max_xyz, sizeof(a->max_xyz)) == 0 &&
+           a->bad_lines == b->bad_lines;
+}
+
+/* Where the index of a log goes. */
+void ride_index_path(char* out, uint32_t room, const char* log_path)
+{
+    snprintf(out, room, "%s.idx", log_path);
+}
+
+/*
+ * Reads an index file.  Returns 0 if there is none, or it was written
+ * by some other version.
+ */
+uint8_t ride_index_read(const char* path, struct ride_index* idx)
+{
+    FILE* in = fopen(path, "rb");
+    if(!in)
+        return 0;
+    size_t got = fread(idx, 1, sizeof(*idx), in);
+    fclose(in);
+    return got == sizeof(*idx) && idx->magic == RIDE_INDEX_MAGIC &&
+           idx->version == RIDE_INDEX_VERSION && idx->size == sizeof(*idx);
+}
+
+/*
+ * Writes an index file, through a temporary file so that a reader never
+ * sees half of one.  Returns 0 on failure.
+ */
+uint8_t ride_index_write(const char* path, const struct ride_index* idx)
+{
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* out = fopen(tmp, "wb");
+    if(!out)
+    {
+        perror(tmp);
+        return 0;
+    }
+    uint8_t ok = fwrite(idx, 1, sizeof(*idx), out) == sizeof(*idx);
+    if(fclose(out) != 0 || !ok)
+    {
+        perror(tmp);
+        remove(tmp);
+        return 0;
+    }
+    if(rename(tmp, path) != 0)
+    {
+        perror(path);
+        remove(tmp);
+        return 0;
+    }
+    return 1;
+}
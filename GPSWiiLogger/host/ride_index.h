@@ -0,0 +1,79 @@
+/*
+ * ride_index.h -- per log summaries kept next to the logs
+ *
+ * A ride index sums up one text log: where the fixes are (bounding box),
+ * when (time range), how hard the sensor pod was shaken (smallest and
+ * largest raw value per axis), and how good the fixes were.  Questions
+ * like "which rides went past 2g near here" can then pick the few logs
+ * worth loading from the indexes alone.
+ *
+ * The index of GPSLOG00.TXT is GPSLOG00.TXT.idx.  It records the size
+ * and mtime of the log it was made from, so a log that changed or got
+ * replaced is noticed and indexed again.
+ *
+ * Summaries of consecutive pieces of a log can be merged, which is how
+ * host/logindex.cpp indexes big logs on several cores.
+ */
+
+#ifndef RIDE_INDEX_H
+#define RIDE_INDEX_H
+
+#include <stdint.h>
+
+#include "gpslog.h"
+
+#define RIDE_INDEX_MAGIC   0x58444952UL /* "RIDX" */
+#define RIDE_INDEX_VERSION 2
+
+/** Summary of one log, as stored in its index file. */
+struct ride_index
+{
+    uint32_t magic;
+    uint16_t version;
+    /** sizeof(struct ride_index), to catch other builds' files. */
+    uint16_t size;
+
+    /** The log the summary was made from. */
+    uint64_t log_size;
+    int64_t log_mtime_ns;
+
+    /** $GPRMC sentences taken. */
+    uint32_t fixes;
+    /** Fixes the GPS reported valid ('A'). */
+    uint32_t valid_fixes;
+    /** Valid fixes with a position, the ones in the bounding box. */
+    uint32_t positions;
+    /** UTC time of the first and last fix in ms since midnight. */
+    uint32_t first_ms;
+    uint32_t last_ms;
+    /** Earliest and latest fix, for rides over midnight. */
+    uint32_t min_ms;
+    uint32_t max_ms;
+    /** Bounding box of the positions in degrees. */
+    double lat_min;
+    double lat_max;
+    double lon_min;
+    double lon_max;
+    /** Fastest valid fix in knots. */
+    float max_speed;
+
+    /** Accelerometer samples taken. */
+    uint32_t samples;
+    /** Smallest and largest raw 10 bit value of x, y and z. */
+    uint16_t min_xyz[3];
+    uint16_t max_xyz[3];
+
+    /** Lines that were neither a good sentence nor a sensor line. */
+    uint32_t bad_lines;
+};
+
+void ride_index_clear(struct ride_index* idx);
+void ride_index_add(struct ride_index* idx, const struct gpslog* log);
+void ride_index_merge(struct ride_index* idx, const struct ride_index* later);
+uint8_t ride_index_equal(const struct ride_index* a, const struct ride_index* b);
+
+void ride_index_path(char* out, uint32_t room, const char* log_path);
+uint8_t ride_index_read(const char* path, struct ride_index* idx);
+uint8_t ride_index_write(const char* path, const struct ride_index* idx);
+
+#endif
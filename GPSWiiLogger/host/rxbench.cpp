@@ -0,0 +1,316 @@
+/*
+ * rxbench.cpp -- GPS line reception while the logger is busy writing
+ *
+ * Replays what arrives on the logger's serial port at 4800 baud: one
+ * $GPRMC sentence per second, some of them corrupted, followed by the
+ * sensor pod's reply line.  (The reply is sent at a fixed time after
+ * each fix instead of on request.)  Every line the logger takes costs
+ * -w ms of card writing, and every -n'th one an extra -W ms stall.
+ *
+ * Two receivers run over the same byte stream:
+ *  - the old one: Arduino's RX interrupt puts bytes into a -r byte ring,
+ *    and loop() frames and checks them whenever it is not writing;
+ *  - nmea_rx.cpp: the interrupt frames and checks lines into slots,
+ *    and loop() writes each slot while holding it.
+ * For both, the intact lines that made it to loop() are counted.  The
+ * lines nmea_rx hands on are also compared with what was sent, and the
+ * run fails if it lost or let through anything it should not have.
+ *
+ * usage: rxbench [-t seconds] [-w write_ms] [-W stall_ms] [-n stall_every]
+ *                [-e corrupt_percent] [-r ring_bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "nmea_rx.h"
+
+ISR(USART_RX_vect);
+
+/* 10 bits per byte at 4800 baud */
+#define BYTE_US 2083UL
+
+struct line
+{
+    uint32_t start_us;
+    uint8_t len;
+    uint8_t intact;
+    char data[NMEA_RX_SLOT_SIZE + 2];
+};
+
+static struct line* lines;
+static uint32_t line_count;
+
+/* one $GPRMC line as the GPS sends it, with "\r\n" */
+static void make_gps_line(struct line* l, uint32_t t)
+{
+    sprintf(l->data, "$GPRMC,%02lu%02lu%02lu.000,A,3409.%04lu,N,11808.%04lu,W,0.31,295.65,010908,,*",
+            (unsigned long) (t / 3600) % 24, (unsigned long) (t / 60) % 60, (unsigned long) t % 60,
+            (unsigned long) (9172 + t) % 10000, (unsigned long) (1017 + 3 * t) % 10000);
+    uint8_t sum = 0;
+    char* p;
+    for(p = l->data + 1; *p != '*'; ++p)
+        sum ^= *p;
+    sprintf(p + 1, "%02X\r\n", sum);
+    l->len = strlen(l->data);
+    l->intact = 1;
+}
+
+/* one sensor pod reply: command char, ten "|xxyyzz" samples, "\r\n" */
+static void make_sensor_line(struct line* l, uint32_t t)
+{
+    uint8_t len = 0;
+    l->data[len++] = 'r';
+    uint8_t i;
+    for(i = 0; i < 10; ++i)
+    {
+        uint32_t r = (t * 10 + i) * 2654435761UL;
+        len += sprintf(l->data + len, "|%02X%02X%02X",
+                       0x78 + ((r >> 8) & 0x0f), 0x90 + ((r >> 16) & 0x1f), 0xb0 + ((r >> 24) & 0x1f));
+    }
+    l->data[len++] = '\r';
+    l->data[len++] = '\n';
+    l->data[len] = 0;
+    l->len = len;
+    l->intact = 1;
+}
+
+static uint32_t write_ms = 5;
+static uint32_t stall_ms = 250;
+static uint32_t stall_every = 30;
+
+/* how long loop() spends on writing its n'th line */
+static uint32_t write_us(uint32_t n)
+{
+    return write_ms * 1000 + (n % stall_every == 0 ? stall_ms * 1000 : 0);
+}
+
+/* Finds a received line among the intact lines sent, at or behind *next.
+ * Returns 0 if the line was never sent like that.
+ */
+static uint8_t match_line(uint32_t* next, const char* data, uint8_t len)
+{
+    uint32_t n;
+    for(n = *next; n < line_count; ++n)
+    {
+        if(lines[n].intact && lines[n].len == len + 1 &&
+           memcmp(lines[n].data, data, len) == 0)
+        {
+            *next = n + 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the old loop(): frames lines out of single bytes read from the ring */
+static char old_buffer[75];
+static uint8_t old_idx;
+
+/* returns the length of a line it took, '\r' included, or 0 */
+static uint8_t old_frame(char c)
+{
+    if(old_idx == 0 && c != '$' && c != 'r')
+        return 0;
+    old_buffer[old_idx] = c;
+    if(c == '\n')
+    {
+        uint8_t len = old_idx;
+        old_idx = 0;
+        if(old_buffer[0] == 'r')
+            return len;
+        if(len < 4 || old_buffer[len - 4] != '*')
+            return 0;
+        uint8_t sum = 0, i;
+        for(i = 1; i < len - 4; ++i)
+            sum ^= old_buffer[i];
+        char check[3];
+        sprintf(check, "%02X", sum);
+        return memcmp(check, old_buffer + len - 3, 2) == 0 ? len : 0;
+    }
+    if(++old_idx == sizeof(old_buffer) - 1)
+        old_idx = 0;
+    return 0;
+}
+
+static uint8_t* ring;
+static uint32_t ring_size = 32;
+static uint32_t ring_head, ring_tail, ring_dropped;
+static uint32_t old_busy_until, old_writes, old_logged, old_bad;
+static uint32_t old_next;
+
+/* the old receiver gets a byte at the given time */
+static void old_receive(uint32_t now, uint8_t c)
+{
+    if(ring_head - ring_tail < ring_size)
+        ring[ring_head++ % ring_size] = c;
+    else
+        ++ring_dropped;
+
+    while(now >= old_busy_until && ring_tail != ring_head)
+    {
+        uint8_t len = old_frame(ring[ring_tail++ % ring_size]);
+        if(!len)
+            continue;
+
+        if(match_line(&old_next, old_buffer, len))
+            ++old_logged;
+        else
+            ++old_bad;
+        old_busy_until = now + write_us(++old_writes);
+    }
+}
+
+static uint32_t new_busy_until, new_writes, new_logged;
+static uint32_t new_next;
+static uint8_t holding;
+static uint8_t failed;
+
+/* loop() with nmea_rx catches up to the given time */
+static void new_loop(uint32_t now)
+{
+    uint32_t start = now;
+    while(1)
+    {
+        if(holding)
+        {
+            if(now < new_busy_until)
+                break;
+            nmea_rx_release();
+            holding = 0;
+            start = new_busy_until;
+        }
+
+        struct nmea_rx_slot* slot = nmea_rx_next();
+        if(!slot)
+            break;
+
+        if(match_line(&new_next, slot->data, slot->len))
+        {
+            ++new_logged;
+        }
+        else
+        {
+            fprintf(stderr, "nmea_rx handed on a line never sent intact: %s\n", slot->data);
+            failed = 1;
+        }
+        holding = 1;
+        new_busy_until = start + write_us(++new_writes);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t seconds = 600;
+    uint32_t corrupt = 5;
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:w:W:n:e:r:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': seconds = atoi(optarg); break;
+            case 'w': write_ms = atoi(optarg); break;
+            case 'W': stall_ms = atoi(optarg); break;
+            case 'n': stall_every = atoi(optarg); break;
+            case 'e': corrupt = atoi(optarg); break;
+            case 'r': ring_size = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-t seconds] [-w write_ms] [-W stall_ms] [-n stall_every] [-e corrupt_percent] [-r ring_bytes]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(!seconds || !ring_size || !stall_every)
+    {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    /* what goes over the wire */
+    lines = (struct line*) malloc(seconds * 2 * sizeof(*lines));
+    uint32_t intact = 0;
+    uint32_t t;
+    srand(1);
+    for(t = 0; t < seconds; ++t)
+    {
+        struct line* gps = &lines[line_count++];
+        make_gps_line(gps, t);
+        gps->start_us = t * 1000000UL;
+        if((uint32_t) rand() % 100 < corrupt)
+        {
+            /* a flipped bit, or a sentence cut short */
+            if(rand() & 1)
+            {
+                gps->data[7 + rand() % 40] ^= 0x04;
+            }
+            else
+            {
+                gps->len = 20 + rand() % 40;
+                strcpy(gps->data + gps->len, "\r\n");
+                gps->len += 2;
+            }
+            gps->intact = 0;
+        }
+
+        struct line* sensor = &lines[line_count++];
+        make_sensor_line(sensor, t);
+        sensor->start_us = t * 1000000UL + 300000UL;
+    }
+    for(t = 0; t < line_count; ++t)
+        intact += lines[t].intact;
+
+    ring = (uint8_t*) malloc(ring_size);
+    nmea_rx_reset();
+
+    uint32_t l;
+    for(l = 0; l < line_count; ++l)
+    {
+        uint8_t i;
+        for(i = 0; i < lines[l].len; ++i)
+        {
+            uint32_t now = lines[l].start_us + i * BYTE_US;
+            uint8_t c = lines[l].data[i];
+
+            old_receive(now, c);
+
+            new_loop(now);
+            UDR0 = c;
+            USART_RX_vect();
+            new_loop(now);
+        }
+    }
+
+    const struct nmea_rx_stats* stats = nmea_rx_get_stats();
+    printf("sent:\n");
+    printf("  lines:             %lu\n", (unsigned long) line_count);
+    printf("  intact lines:      %lu\n", (unsigned long) intact);
+    printf("old receiver (%lu byte ring):\n", (unsigned long) ring_size);
+    printf("  bytes dropped:     %lu\n", (unsigned long) ring_dropped);
+    printf("  lines logged:      %lu\n", (unsigned long) (old_logged + old_bad));
+    printf("  garbled lines:     %lu\n", (unsigned long) old_bad);
+    printf("  intact lines lost: %lu\n", (unsigned long) (intact - old_logged));
+    printf("nmea_rx (%u slots of %u bytes):\n", NMEA_RX_SLOTS, NMEA_RX_SLOT_SIZE);
+    printf("  sentences:         %u\n", stats->sentences);
+    printf("  other lines:       %u\n", stats->lines);
+    printf("  checksum errors:   %u\n", stats->checksum_errors);
+    printf("  framing errors:    %u\n", stats->framing_errors);
+    printf("  dropped, no slot:  %u\n", stats->dropped);
+    printf("  lines logged:      %lu\n", (unsigned long) new_logged);
+    printf("  intact lines lost: %lu\n", (unsigned long) (intact - new_logged));
+
+    if(failed)
+        return 1;
+    if(new_logged != intact && stats->dropped == 0)
+    {
+        fprintf(stderr, "nmea_rx lost intact lines without running out of slots\n");
+        return 1;
+    }
+
+    free(ring);
+    free(lines);
+    return 0;
+}
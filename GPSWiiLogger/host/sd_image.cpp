@@ -0,0 +1,678 @@
+/*
+ * sd_image.cpp -- emulated MMC/SD card backed by a disk image file
+ *
+ * Implements just enough of the SPI mode protocol for sd_raw.cpp:
+ * reset and init (CMD0, CMD1, CMD8, ACMD41, CMD58), block length
+ * (CMD16), CID/CSD reads (CMD9, CMD10), single block reads (CMD17),
+ * open-ended multi-block reads (CMD18, ended by CMD12), single block
+ * writes (CMD24) and open-ended multi-block writes (CMD25).  Command
+ * CRCs are not checked, as the card does not check them either once
+ * it is in SPI mode.
+ *
+ * The card answers its init commands like an MMC, an SD 1.x, an SD 2.0
+ * or an SDHC card would; the latter takes block numbers instead of
+ * byte addresses and only wakes up for hosts announcing they know.
+ *
+ * For fault injection, the card can reject data blocks with a write
+ * error, be pulled out of its slot and put back, or lose power after a
+ * given number of blocks, which is the same as being pulled out.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <avr/io.h>
+#include "sd_image.h"
+
+/* the registers host/avr/io.h promises */
+uint8_t SPCR;
+uint8_t SPSR;
+uint8_t DDRB;
+uint8_t PORTB;
+uint8_t DDRC;
+uint8_t PORTC;
+uint8_t PINC;
+struct host_spi_data_register SPDR;
+
+#define SD_IMAGE_BLOCK_SIZE 512
+
+/* R1 response bits */
+#define SD_IMAGE_R1_IDLE 0x01
+#define SD_IMAGE_R1_ILLEGAL 0x04
+#define SD_IMAGE_R1_ADDRESS 0x20
+
+/* data tokens */
+#define SD_IMAGE_TOKEN_START 0xfe
+#define SD_IMAGE_TOKEN_MULTI 0xfc
+#define SD_IMAGE_TOKEN_STOP 0xfd
+#define SD_IMAGE_DATA_ACCEPTED 0xe5
+#define SD_IMAGE_DATA_WRITE_ERROR 0xed
+
+/* each block was already waited for, so ending the write is quick */
+#define SD_IMAGE_STOP_BUSY 8
+/* what the card was sending when CMD12 arrived, clocked out as the stuff byte */
+#define SD_IMAGE_STOP_STUFF 0xa5
+
+/* card states */
+#define SD_IMAGE_STATE_COMMAND 0
+#define SD_IMAGE_STATE_WRITE_TOKEN 1
+#define SD_IMAGE_STATE_WRITE_DATA 2
+#define SD_IMAGE_STATE_READ_MULTI 3
+
+static int image_fd = -1;
+static uint8_t* image;
+static uint64_t image_size;
+
+static uint8_t state;
+static uint8_t idle;
+static uint8_t init_polls;
+static uint8_t card_type = SD_IMAGE_CARD_SD2;
+static uint8_t card_type_set;
+static uint8_t app_command;
+
+static uint8_t cmd[6];
+static uint8_t cmd_len;
+
+/* bytes waiting to be shifted out to the host */
+static uint8_t out_queue[2 * SD_IMAGE_BLOCK_SIZE];
+static uint16_t out_head;
+static uint16_t out_tail;
+static uint16_t busy_left;
+static uint16_t busy_per_block = 500;
+static uint16_t busy_per_stream_block = 500;
+
+static uint8_t write_block[SD_IMAGE_BLOCK_SIZE + 2];
+static uint16_t write_len;
+static uint64_t write_address;
+static uint8_t write_multi;
+
+static uint64_t read_address;
+
+static uint8_t removed;
+static uint32_t reject_every;
+static uint32_t reject_count;
+static uint32_t remove_after;
+
+static struct sd_image_stats stats;
+
+static void sd_image_push(uint8_t b)
+{
+    out_queue[out_tail] = b;
+    out_tail = (out_tail + 1) % sizeof(out_queue);
+}
+
+static void sd_image_push_block(const uint8_t* data, uint16_t length)
+{
+    sd_image_push(0xff);
+    sd_image_push(SD_IMAGE_TOKEN_START);
+    while(length--)
+        sd_image_push(*data++);
+    /* dummy crc16 */
+    sd_image_push(0xff);
+    sd_image_push(0xff);
+}
+
+static uint8_t sd_image_address_ok(uint64_t address)
+{
+    return (address % SD_IMAGE_BLOCK_SIZE) == 0 &&
+           address + SD_IMAGE_BLOCK_SIZE <= image_size;
+}
+
+/* the byte address a read or write command argument stands for */
+static uint64_t sd_image_address(uint32_t arg)
+{
+    if(card_type == SD_IMAGE_CARD_SDHC)
+        return (uint64_t) arg * SD_IMAGE_BLOCK_SIZE;
+    return arg;
+}
+
+static void sd_image_push_csd()
+{
+    if(card_type == SD_IMAGE_CARD_SDHC)
+    {
+        /* CSD version 2.0: capacity = (c_size + 1) * 512kB */
+        uint32_t c_size = image_size / (512 * 1024) - 1;
+
+        uint8_t csd[16];
+        memset(csd, 0, sizeof(csd));
+        csd[0] = 0x40;
+        csd[5] = 9;
+        csd[7] = (c_size >> 16) & 0x3f;
+        csd[8] = (c_size >> 8) & 0xff;
+        csd[9] = c_size & 0xff;
+        sd_image_push_block(csd, sizeof(csd));
+        return;
+    }
+
+    /* CSD version 1.0: capacity = (c_size + 1) << (c_size_mult + 2 + read_bl_len) */
+    uint8_t read_bl_len = 9;
+    uint8_t c_size_mult = 7;
+    uint32_t c_size = (image_size >> (c_size_mult + 2 + read_bl_len));
+    while(c_size > 4096 && read_bl_len < 11)
+    {
+        ++read_bl_len;
+        c_size >>= 1;
+    }
+    --c_size;
+
+    uint8_t csd[16];
+    memset(csd, 0, sizeof(csd));
+    csd[5] = read_bl_len;
+    csd[6] = (c_size >> 10) & 0x03;
+    csd[7] = (c_size >> 2) & 0xff;
+    csd[8] = (c_size << 6) & 0xc0;
+    csd[9] = (c_size_mult >> 1) & 0x03;
+    csd[10] = (c_size_mult << 7) & 0x80;
+    sd_image_push_block(csd, sizeof(csd));
+}
+
+static void sd_image_push_cid()
+{
+    static const uint8_t cid[16] =
+    {
+        0x00, 'G', 'W', 'I', 'M', 'A', 'G', 'E', 0x10,
+        0x00, 0x00, 0x00, 0x01, 0x00, 0x89, 0x00
+    };
+    sd_image_push_block(cid, sizeof(cid));
+}
+
+static void sd_image_command()
+{
+    uint8_t index = cmd[0] & 0x3f;
+    uint32_t arg = ((uint32_t) cmd[1] << 24) |
+                   ((uint32_t) cmd[2] << 16) |
+                   ((uint32_t) cmd[3] << 8) |
+                   ((uint32_t) cmd[4] << 0);
+
+    ++stats.commands[index];
+
+    /* an application specific command is announced by CMD55 */
+    uint8_t app = app_command;
+    app_command = 0;
+
+    if(idle && index != 0x00 && index != 0x01 && index != 0x08 &&
+       index != 0x29 && index != 0x37 && index != 0x3a)
+    {
+        sd_image_push(SD_IMAGE_R1_IDLE | SD_IMAGE_R1_ILLEGAL);
+        return;
+    }
+
+    switch(index)
+    {
+        case 0x00: /* CMD0 GO_IDLE_STATE */
+            idle = 1;
+            init_polls = 2;
+            sd_image_push(SD_IMAGE_R1_IDLE);
+            break;
+        case 0x01: /* CMD1 SEND_OP_COND */
+            if(init_polls)
+                --init_polls;
+            else
+                idle = 0;
+            sd_image_push(idle ? SD_IMAGE_R1_IDLE : 0x00);
+            break;
+        case 0x08: /* CMD8 SEND_IF_COND */
+            if(card_type < SD_IMAGE_CARD_SD2)
+            {
+                sd_image_push((idle ? SD_IMAGE_R1_IDLE : 0x00) | SD_IMAGE_R1_ILLEGAL);
+                break;
+            }
+            /* R7: echo voltage range and check pattern */
+            sd_image_push(idle ? SD_IMAGE_R1_IDLE : 0x00);
+            sd_image_push(0x00);
+            sd_image_push(0x00);
+            sd_image_push((arg >> 8) & 0x0f);
+            sd_image_push(arg & 0xff);
+            break;
+        case 0x29: /* ACMD41 SD_SEND_OP_COND */
+            if(!app || card_type == SD_IMAGE_CARD_MMC)
+            {
+                sd_image_push((idle ? SD_IMAGE_R1_IDLE : 0x00) | SD_IMAGE_R1_ILLEGAL);
+                break;
+            }
+            /* an SDHC card never leaves the idle state for a host without HCS */
+            if(init_polls)
+                --init_polls;
+            else if(card_type != SD_IMAGE_CARD_SDHC || (arg & 0x40000000))
+                idle = 0;
+            sd_image_push(idle ? SD_IMAGE_R1_IDLE : 0x00);
+            break;
+        case 0x37: /* CMD55 APP_CMD */
+            if(card_type == SD_IMAGE_CARD_MMC)
+            {
+                sd_image_push((idle ? SD_IMAGE_R1_IDLE : 0x00) | SD_IMAGE_R1_ILLEGAL);
+                break;
+            }
+            app_command = 1;
+            sd_image_push(idle ? SD_IMAGE_R1_IDLE : 0x00);
+            break;
+        case 0x3a: /* CMD58 READ_OCR */
+            sd_image_push(idle ? SD_IMAGE_R1_IDLE : 0x00);
+            /* powered up, 3.2V - 3.4V, and the capacity status once ready */
+            sd_image_push((idle ? 0x00 : 0x80) |
+                          (!idle && card_type == SD_IMAGE_CARD_SDHC ? 0x40 : 0x00));
+            sd_image_push(0x30);
+            sd_image_push(0x00);
+            sd_image_push(0x00);
+            break;
+        case 0x09: /* CMD9 SEND_CSD */
+            sd_image_push(0x00);
+            sd_image_push_csd();
+            break;
+        case 0x0a: /* CMD10 SEND_CID */
+            sd_image_push(0x00);
+            sd_image_push_cid();
+            break;
+        case 0x10: /* CMD16 SET_BLOCKLEN */
+            sd_image_push(arg == SD_IMAGE_BLOCK_SIZE ? 0x00 : SD_IMAGE_R1_ILLEGAL);
+            break;
+        case 0x11: /* CMD17 READ_SINGLE_BLOCK */
+            if(!sd_image_address_ok(sd_image_address(arg)))
+            {
+                sd_image_push(SD_IMAGE_R1_ADDRESS);
+                break;
+            }
+            sd_image_push(0x00);
+            sd_image_push_block(image + sd_image_address(arg), SD_IMAGE_BLOCK_SIZE);
+            ++stats.blocks_read;
+            break;
+        case 0x12: /* CMD18 READ_MULTIPLE_BLOCK */
+            if(!sd_image_address_ok(sd_image_address(arg)))
+            {
+                sd_image_push(SD_IMAGE_R1_ADDRESS);
+                break;
+            }
+            /* the blocks follow one by one as the host clocks them out */
+            sd_image_push(0x00);
+            read_address = sd_image_address(arg);
+            state = SD_IMAGE_STATE_READ_MULTI;
+            break;
+        case 0x18: /* CMD24 WRITE_BLOCK */
+            if(!sd_image_address_ok(sd_image_address(arg)))
+            {
+                sd_image_push(SD_IMAGE_R1_ADDRESS);
+                break;
+            }
+            sd_image_push(0x00);
+            write_address = sd_image_address(arg);
+            write_multi = 0;
+            state = SD_IMAGE_STATE_WRITE_TOKEN;
+            break;
+        case 0x19: /* CMD25 WRITE_MULTIPLE_BLOCK */
+            if(!sd_image_address_ok(sd_image_address(arg)))
+            {
+                sd_image_push(SD_IMAGE_R1_ADDRESS);
+                break;
+            }
+            sd_image_push(0x00);
+            write_address = sd_image_address(arg);
+            write_multi = 1;
+            state = SD_IMAGE_STATE_WRITE_TOKEN;
+            break;
+        default:
+            sd_image_push(SD_IMAGE_R1_ILLEGAL);
+            break;
+    }
+}
+
+/**
+ * Clocks one byte through the emulated card.
+ *
+ * \param[in] out The byte the host shifts out on MOSI.
+ * \returns The byte the card shifts back on MISO.
+ */
+uint8_t sd_image_spi_xfer(uint8_t out)
+{
+    ++stats.spi_bytes;
+
+    if(!image || removed || (PORTB & (1 << PB2)))
+    {
+        /* not selected, the card leaves MISO floating high */
+        cmd_len = 0;
+        return 0xff;
+    }
+
+    /* during a multi-block read, the next block follows the last one */
+    if(state == SD_IMAGE_STATE_READ_MULTI && out_head == out_tail &&
+       sd_image_address_ok(read_address))
+    {
+        sd_image_push_block(image + read_address, SD_IMAGE_BLOCK_SIZE);
+        read_address += SD_IMAGE_BLOCK_SIZE;
+        ++stats.blocks_read;
+        ++stats.blocks_read_streamed;
+    }
+
+    /* figure out what the card drives onto MISO during this byte */
+    uint8_t in = 0xff;
+    if(out_head != out_tail)
+    {
+        in = out_queue[out_head];
+        out_head = (out_head + 1) % sizeof(out_queue);
+    }
+    else if(busy_left)
+    {
+        --busy_left;
+        ++stats.busy_bytes;
+        in = 0x00;
+    }
+
+    /* and what it makes of the byte the host sent */
+    switch(state)
+    {
+        case SD_IMAGE_STATE_COMMAND:
+            if(cmd_len == 0 && (out & 0xc0) != 0x40)
+                break;
+            cmd[cmd_len++] = out;
+            if(cmd_len == sizeof(cmd))
+            {
+                cmd_len = 0;
+                sd_image_command();
+            }
+            break;
+        case SD_IMAGE_STATE_READ_MULTI:
+            /* the card keeps sending until it sees a command */
+            if(cmd_len == 0 && (out & 0xc0) != 0x40)
+                break;
+            cmd[cmd_len++] = out;
+            if(cmd_len < sizeof(cmd))
+                break;
+            cmd_len = 0;
+            state = SD_IMAGE_STATE_COMMAND;
+            out_head = out_tail = 0;
+            if((cmd[0] & 0x3f) == 0x00)
+            {
+                sd_image_command();
+            }
+            else if((cmd[0] & 0x3f) == 0x0c)
+            {
+                /* CMD12 STOP_TRANSMISSION: drop the rest of the block */
+                ++stats.commands[0x0c];
+                sd_image_push(SD_IMAGE_STOP_STUFF);
+                sd_image_push(0x00);
+                busy_left = SD_IMAGE_STOP_BUSY;
+            }
+            else
+            {
+                /* nothing else is allowed while the card is sending */
+                ++stats.commands[cmd[0] & 0x3f];
+                ++stats.protocol_errors;
+                sd_image_push(SD_IMAGE_R1_ILLEGAL);
+            }
+            break;
+        case SD_IMAGE_STATE_WRITE_TOKEN:
+            if(out == (write_multi ? SD_IMAGE_TOKEN_MULTI : SD_IMAGE_TOKEN_START))
+            {
+                write_len = 0;
+                state = SD_IMAGE_STATE_WRITE_DATA;
+            }
+            else if(write_multi && out == SD_IMAGE_TOKEN_STOP)
+            {
+                /* one stuff byte, then a short busy while the card wraps up */
+                sd_image_push(0xff);
+                busy_left = SD_IMAGE_STOP_BUSY;
+                state = SD_IMAGE_STATE_COMMAND;
+            }
+            else if(out != 0xff)
+            {
+                ++stats.protocol_errors;
+            }
+            break;
+        case SD_IMAGE_STATE_WRITE_DATA:
+            write_block[write_len++] = out;
+            if(write_len == sizeof(write_block))
+            {
+                if(reject_every && ++reject_count % reject_every == 0)
+                {
+                    /* an injected fault, the block is not programmed */
+                    ++stats.blocks_rejected;
+                    sd_image_push(SD_IMAGE_DATA_WRITE_ERROR);
+                }
+                else if(sd_image_address_ok(write_address))
+                {
+                    memcpy(image + write_address, write_block, SD_IMAGE_BLOCK_SIZE);
+                    ++stats.blocks_written;
+                    if(write_multi)
+                        ++stats.blocks_streamed;
+                    sd_image_push(SD_IMAGE_DATA_ACCEPTED);
+                    if(remove_after && --remove_after == 0)
+                    {
+                        /* the power is gone before the card can answer */
+                        sd_image_remove();
+                        return in;
+                    }
+                }
+                else
+                {
+                    /* a multi-block write ran past the end of the card */
+                    ++stats.protocol_errors;
+                    sd_image_push(SD_IMAGE_DATA_WRITE_ERROR);
+                }
+                if(write_multi)
+                {
+                    write_address += SD_IMAGE_BLOCK_SIZE;
+                    busy_left = busy_per_stream_block;
+                    state = SD_IMAGE_STATE_WRITE_TOKEN;
+                }
+                else
+                {
+                    busy_left = busy_per_block;
+                    state = SD_IMAGE_STATE_COMMAND;
+                }
+            }
+            break;
+    }
+
+    return in;
+}
+
+/**
+ * Maps a disk image file as the card's contents.
+ *
+ * \param[in] path The image file.
+ * Unless sd_image_set_card() chose otherwise, an image of more than
+ * 2GB makes an SDHC card, a smaller one an SD 2.0 card.
+ *
+ * \param[in] path The image file.
+ * \param[in] size The card capacity in bytes. If nonzero, the file is
+ *                 created or resized to this size; if zero, the size
+ *                 of the existing file is used.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_image_open(const char* path, uint64_t size)
+{
+    sd_image_close();
+
+    image_fd = open(path, size ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+    if(image_fd < 0)
+        return 0;
+
+    if(size)
+    {
+        if(ftruncate(image_fd, size) != 0)
+        {
+            sd_image_close();
+            return 0;
+        }
+    }
+    else
+    {
+        struct stat st;
+        if(fstat(image_fd, &st) != 0)
+        {
+            sd_image_close();
+            return 0;
+        }
+        size = st.st_size;
+    }
+
+    void* data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+    if(data == MAP_FAILED)
+    {
+        sd_image_close();
+        return 0;
+    }
+
+    image = (uint8_t*) data;
+    image_size = size;
+    if(!card_type_set)
+        card_type = size > ((uint64_t) 2 << 30) ? SD_IMAGE_CARD_SDHC : SD_IMAGE_CARD_SD2;
+    app_command = 0;
+    state = SD_IMAGE_STATE_COMMAND;
+    write_multi = 0;
+    idle = 1;
+    cmd_len = 0;
+    out_head = out_tail = 0;
+    busy_left = 0;
+    removed = 0;
+    reject_every = 0;
+    reject_count = 0;
+    remove_after = 0;
+    sd_image_reset_stats();
+
+    /* the card starts out deselected */
+    PORTB |= (1 << PB2);
+
+    return 1;
+}
+
+/**
+ * Unmaps the image, flushing it to disk.
+ */
+void sd_image_close()
+{
+    if(image)
+    {
+        msync(image, image_size, MS_SYNC);
+        munmap(image, image_size);
+        image = 0;
+        image_size = 0;
+    }
+    if(image_fd >= 0)
+    {
+        close(image_fd);
+        image_fd = -1;
+    }
+}
+
+/**
+ * Direct access to the card contents, e.g. for formatting or checking.
+ */
+uint8_t* sd_image_data()
+{
+    return image;
+}
+
+/**
+ * The card capacity in bytes.
+ */
+uint64_t sd_image_size()
+{
+    return image_size;
+}
+
+/**
+ * Chooses which kind of card to emulate, for this and all following
+ * images.
+ *
+ * \param[in] type One of the SD_IMAGE_CARD_* types.
+ */
+void sd_image_set_card(uint8_t type)
+{
+    card_type = type;
+    card_type_set = 1;
+}
+
+/**
+ * Sets how many bytes the card stays busy after programming a block.
+ *
+ * At the full SPI clock of f_OSC / 2, one byte takes 1us, so this is
+ * roughly the card's block program time in microseconds.
+ */
+void sd_image_set_busy(uint16_t bytes_per_block)
+{
+    busy_per_block = bytes_per_block;
+}
+
+/**
+ * Sets how many bytes the card stays busy after each block of a
+ * multi-block write.
+ *
+ * Cards usually program streamed blocks faster than single ones, as
+ * they can erase ahead; by default both take the same time, so that
+ * only the saved command overhead shows up in the numbers.
+ */
+void sd_image_set_stream_busy(uint16_t bytes_per_block)
+{
+    busy_per_stream_block = bytes_per_block;
+}
+
+/**
+ * Makes the card reject every n'th data block it is sent with a write
+ * error, without programming it.
+ *
+ * \param[in] n The blocks per rejected one, or zero for none.
+ */
+void sd_image_reject_writes(uint32_t n)
+{
+    reject_every = n;
+    reject_count = 0;
+}
+
+/**
+ * Pulls the card out of its slot.
+ *
+ * From now on it leaves MISO floating high, whatever the host sends,
+ * and what it was doing is lost. The image keeps what was programmed.
+ */
+void sd_image_remove()
+{
+    removed = 1;
+    remove_after = 0;
+}
+
+/**
+ * Puts the card back, powered up afresh and waiting for CMD0.
+ */
+void sd_image_insert()
+{
+    removed = 0;
+    state = SD_IMAGE_STATE_COMMAND;
+    write_multi = 0;
+    app_command = 0;
+    idle = 1;
+    cmd_len = 0;
+    out_head = out_tail = 0;
+    busy_left = 0;
+}
+
+/**
+ * Pulls the card after it has programmed the given number of blocks
+ * more, as a brown-out would, right after it accepted the last one.
+ *
+ * \param[in] blocks The blocks still to be programmed, or zero for never.
+ */
+void sd_image_remove_after(uint32_t blocks)
+{
+    remove_after = blocks;
+}
+
+/**
+ * Checks whether the card is in its slot.
+ */
+uint8_t sd_image_inserted()
+{
+    return !removed;
+}
+
+const struct sd_image_stats* sd_image_get_stats()
+{
+    return &stats;
+}
+
+void sd_image_reset_stats()
+{
+    memset(&stats, 0, sizeof(stats));
+}
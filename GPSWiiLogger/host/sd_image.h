@@ -0,0 +1,69 @@
+/*
+ * sd_image.h -- emulated MMC/SD card backed by a disk image file
+ *
+ * The host build links the unmodified sd_raw.cpp against this card.
+ * Every byte sd_raw.cpp clocks through SPDR (see host/avr/io.h) ends
+ * up in sd_image_spi_xfer(), which runs the SPI mode protocol of a
+ * SD card on top of a memory-mapped image file.  So
+ * the whole storage stack -- sd_raw, partition, fat16 and AF_SDLog --
+ * runs on a workstation, and the counters below report exactly which
+ * card transactions a given workload costs on the real hardware.
+ */
+
+#ifndef SD_IMAGE_H
+#define SD_IMAGE_H
+
+#include <stdint.h>
+
+/**
+ * Card transaction counters, reset by sd_image_reset_stats().
+ */
+struct sd_image_stats
+{
+    /** Bytes clocked over SPI, selected or not. */
+    uint32_t spi_bytes;
+    /** Command frames received, indexed by command number. */
+    uint32_t commands[64];
+    /** Data blocks sent to the host. */
+    uint32_t blocks_read;
+    /** Data blocks sent as part of a multi-block read. */
+    uint32_t blocks_read_streamed;
+    /** Data blocks programmed into the image. */
+    uint32_t blocks_written;
+    /** Data blocks programmed as part of a multi-block write. */
+    uint32_t blocks_streamed;
+    /** Bytes clocked while the card held the busy signal. */
+    uint32_t busy_bytes;
+    /** Data blocks rejected by sd_image_reject_writes(). */
+    uint32_t blocks_rejected;
+    /** Tokens or data the card did not expect in its current state. */
+    uint32_t protocol_errors;
+};
+
+/* kinds of cards, see sd_image_set_card() */
+#define SD_IMAGE_CARD_MMC 0
+#define SD_IMAGE_CARD_SD1 1
+#define SD_IMAGE_CARD_SD2 2
+#define SD_IMAGE_CARD_SDHC 3
+
+uint8_t sd_image_open(const char* path, uint64_t size);
+void sd_image_close();
+uint8_t* sd_image_data();
+uint64_t sd_image_size();
+void sd_image_set_card(uint8_t type);
+
+void sd_image_set_busy(uint16_t bytes_per_block);
+void sd_image_set_stream_busy(uint16_t bytes_per_block);
+
+void sd_image_reject_writes(uint32_t n);
+void sd_image_remove();
+void sd_image_insert();
+void sd_image_remove_after(uint32_t blocks);
+uint8_t sd_image_inserted();
+
+const struct sd_image_stats* sd_image_get_stats();
+void sd_image_reset_stats();
+
+uint8_t sd_image_spi_xfer(uint8_t out);
+
+#endif
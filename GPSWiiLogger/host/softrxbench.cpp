@@ -0,0 +1,367 @@
+/*
+ * softrxbench.cpp -- AFSoftSerial_funcs.h receiving a sensor pod's replies
+ *
+ * Runs AFSoftSerial_funcs.h's receive interrupts against a simulated
+ * AFSS_BAUD line (38400 unless built with another) carrying -n pod
+ * replies, back to back like GPSWiiUI sends them, and a simulated
+ * Timer2.  Time is counted in 16MHz cycles: afss_whackDelay() takes 7 a
+ * loop, digitalRead() -c, and an interrupt starts -l cycles after its
+ * flag is set, or as soon as the last one returns, plus up to -j more
+ * at random for other interrupts holding it up, and costs another -i on
+ * top of what it does.  Edges set the pin change flag only while
+ * its mask bit is on.  Between interrupts, loop() reads what is
+ * waiting, except for a -s ms stall from the start of every -e'th
+ * reply: the bytes that do not fit the ring then must be the ones
+ * counted in afss_overflows, and only those go missing.  Everything
+ * else must come out of AFSoftSerial_read() as it was sent.  Reports
+ * the longest an interrupt held the others up.  Built as softrxbench_busy,
+ * with AFSS_BUSY_RX at 9600 baud, it runs the old receiver instead.
+ *
+ * Then a 64 byte reply is read out of a full ring -r times, and once
+ * more with the old read(), which shifted the whole buffer down a byte
+ * on every call, to compare the cost per byte.
+ *
+ * usage: softrxbench [-n replies] [-l latency_cycles] [-j jitter_cycles]
+ *                    [-c read_cycles] [-i isr_cycles] [-s stall_ms]
+ *                    [-e stall_every] [-r runs]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <avr/interrupt.h>
+#include "host_util.h"
+
+/* what AFSoftSerial_funcs.h takes from the Arduino core */
+typedef uint8_t byte;
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+static void pinMode(uint8_t, uint8_t) {}
+static void digitalWrite(uint8_t, uint8_t) {}
+static int digitalRead(uint8_t pin);
+static void afss_whackDelay(uint16_t delay);
+
+#ifndef AFSS_BAUD
+#define AFSS_BAUD 38400
+#endif
+#define F_CPU 16000000UL
+#define AFSS_RX_PIN 6
+#define AFSS_TX_PIN 7
+#define AFSS_MAX_RX_BUFF 64
+#include "AFSoftSerial_funcs.h"
+
+#define CPU_HZ F_CPU
+#define BIT_CYCLES ((double) CPU_HZ / AFSS_BAUD)
+#define LOOP_CYCLES 7            /* a turn of afss_whackDelay()'s loop */
+
+static uint64_t now;             /* cycles */
+static uint32_t read_cycles = 60;
+static uint32_t latency = 40;
+static uint32_t jitter = 80;
+static uint32_t isr_cycles = 40;
+
+uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, TIMSK2, TIFR2;
+uint8_t PCICR, PCIFR, PCMSK0, PCMSK2;
+
+static uint8_t* line;            /* the bytes on the wire */
+static uint64_t* line_start;     /* and the cycle each one's start bit falls */
+static uint32_t line_len;
+
+static void afss_whackDelay(uint16_t delay)
+{
+    now += (uint64_t) delay * LOOP_CYCLES;
+}
+
+/* the last byte whose start bit fell at or before t, +1; 0 for none */
+static uint32_t byte_at(uint64_t t)
+{
+    uint32_t lo = 0, hi = line_len;
+    while(lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if(line_start[mid] <= t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+#define NEVER UINT64_MAX
+
+/* the level of bit i of byte k on the wire: start, data low first, stop */
+static uint8_t bit_level(uint32_t k, uint32_t i)
+{
+    if(i == 0)
+        return LOW;
+    if(i <= 8)
+        return line[k] >> (i - 1) & 1;
+    return HIGH;
+}
+
+/* the first time after t that the level changes */
+static uint64_t next_edge_after(uint64_t t)
+{
+    uint32_t k = byte_at(t);
+    if(k)
+    {
+        uint64_t start = line_start[k - 1];
+        uint32_t i;
+        for(i = (uint32_t) ((t - start) / BIT_CYCLES) + 1; i <= 9; ++i)
+        {
+            if(bit_level(k - 1, i - 1) != bit_level(k - 1, i))
+            {
+                uint64_t edge = start + (uint64_t) ceil(i * BIT_CYCLES);
+                if(edge > t)
+                    return edge;
+            }
+        }
+    }
+    return k < line_len ? line_start[k] : NEVER;
+}
+
+static uint32_t timer2_prescale(void)
+{
+    static const uint32_t prescale[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+    return prescale[TCCR2B & 7];
+}
+
+/* the level on the wire now: idle high, start bit low, data low first,
+ * stop bit high
+ */
+static int digitalRead(uint8_t)
+{
+    now += read_cycles;
+    uint32_t k = byte_at(now);
+    if(!k)
+        return HIGH;
+    uint32_t bit = (uint32_t) ((now - line_start[k - 1]) / BIT_CYCLES);
+    return bit_level(k - 1, bit < 9 ? bit : 9);
+}
+
+/* one reply: command char, 64 chars of samples, "\r\n" */
+static uint32_t make_reply(uint8_t* out, uint32_t n)
+{
+    uint32_t len = 0;
+    out[len++] = 'r';
+    uint32_t i;
+    for(i = 0; i < 64; ++i)
+        out[len++] = '0' + ((n * 64 + i) * 2654435761UL >> 24) % 64;
+    out[len++] = '\r';
+    out[len++] = '\n';
+    return len;
+}
+
+/* the old AFSoftSerial_read(), shifting the buffer down on every call */
+static char shift_buffer[AFSS_MAX_RX_BUFF];
+static uint8_t shift_index;
+
+static int shift_read(void)
+{
+    uint8_t d, i;
+    if(!shift_index)
+        return -1;
+    d = shift_buffer[0];
+    for(i = 0; i < shift_index; i++)
+        shift_buffer[i] = shift_buffer[i + 1];
+    shift_index--;
+    return d;
+}
+
+/* volatile so that the timed loops are not thrown away */
+static volatile uint32_t sink;
+
+int main(int argc, char** argv)
+{
+    uint32_t replies = 1000;
+    uint32_t stall_ms = 100;
+    uint32_t stall_every = 50;
+    uint32_t runs = 200000;
+    int opt;
+    while((opt = getopt(argc, argv, "n:l:j:c:i:s:e:r:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': replies = atoi(optarg); break;
+            case 'l': latency = atoi(optarg); break;
+            case 'j': jitter = atoi(optarg); break;
+            case 'c': read_cycles = atoi(optarg); break;
+            case 'i': isr_cycles = atoi(optarg); break;
+            case 's': stall_ms = atoi(optarg); break;
+            case 'e': stall_every = atoi(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n replies] [-l latency_cycles] [-j jitter_cycles] [-c read_cycles] [-i isr_cycles] [-s stall_ms] [-e stall_every] [-r runs]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(!replies || !stall_every || !runs)
+    {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    /* the replies, a second apart, each byte right behind the last */
+    line = (uint8_t*) malloc(replies * 67);
+    line_start = (uint64_t*) malloc(replies * 67 * sizeof(uint64_t));
+    uint32_t* reply_end = (uint32_t*) malloc(replies * sizeof(uint32_t));
+    uint32_t n, i;
+    for(n = 0; n < replies; ++n)
+    {
+        uint32_t len = make_reply(line + line_len, n);
+        for(i = 0; i < len; ++i)
+            line_start[line_len + i] = (uint64_t) n * CPU_HZ + (uint64_t) ((i * 10 + 1) * BIT_CYCLES);
+        line_len += len;
+        reply_end[n] = line_len;
+    }
+
+    printf("%u replies at %u baud, interrupt latency %u+%u cycles, digitalRead %u cycles\n",
+           replies, AFSS_BAUD, latency, jitter, read_cycles);
+
+    AFSoftSerial_begin();
+    AFSoftSerial_print("");
+    uint8_t* got = (uint8_t*) malloc(line_len);
+    uint8_t* want = (uint8_t*) malloc(line_len);
+    uint32_t got_len = 0, want_len = 0;
+    uint32_t dropped = 0, dropped_reading = 0;
+    uint32_t interrupts = 0;
+    uint64_t longest = 0, busy = 0;
+    uint64_t stall_until = 0;
+    uint8_t drained = 1;             /* loop() read after the last interrupt */
+    uint64_t pc_since = 0;           /* edges after this set the pin change flag */
+    uint64_t match = NEVER;          /* Timer2's next compare match */
+    n = 0;
+    for(;;)
+    {
+        uint64_t t_pc = PCMSK2 & _BV(AFSS_RX_PIN) ? next_edge_after(pc_since) : NEVER;
+        uint64_t t_tm = TIMSK2 & _BV(OCIE2A) ? match : NEVER;
+        uint64_t t = t_pc < t_tm ? t_pc : t_tm;
+        if(t == NEVER)
+            break;
+        /* an interrupt does not start before the last one returned, and
+         * the pin change one goes first
+         */
+        if(t < now)
+            t = now;
+        uint8_t pin = t_pc <= t;
+        /* other interrupts hold this one up at random */
+        if(jitter)
+            t += (uint32_t) rand() % (jitter + 1);
+        now = t + latency;
+
+        uint8_t head = _receive_buffer_head;
+        uint8_t overflows = afss_overflows;
+        uint8_t masked_in = PCMSK2 & _BV(AFSS_RX_PIN);
+        TCNT2 = 1;
+        PCIFR = 0;
+        if(pin)
+        {
+            pc_since = t;            /* the flag clears as it is taken */
+            SIG_PIN_CHANGE2();
+        }
+#ifndef AFSS_BUSY_RX
+        else
+        {
+            SIG_OUTPUT_COMPARE2A();
+            match += (OCR2A + 1) * timer2_prescale();
+        }
+#endif
+        now += isr_cycles;
+        ++interrupts;
+        /* cleared right after the pin change interrupt's digitalRead() */
+        if(TCNT2 == 0)
+            match = t + latency + read_cycles + (OCR2A + 1) * timer2_prescale();
+        if((PCIFR & _BV(2)) || (!masked_in && (PCMSK2 & _BV(AFSS_RX_PIN))))
+            pc_since = now;
+        if(now - t > longest)
+            longest = now - t;
+        busy += now - t;
+
+        /* a byte taken now should be the one whose middle just went by */
+        uint32_t k = byte_at(now - (uint64_t) (5 * BIT_CYCLES));
+        if(head != _receive_buffer_head)
+            want[want_len++] = k ? line[k - 1] : 0;
+        if(overflows != afss_overflows)
+        {
+            ++dropped;
+            if(drained)
+                ++dropped_reading;
+        }
+
+        /* loop() takes what is waiting, except while stalled from the
+         * start of every -e'th reply
+         */
+        if(n < replies && byte_at(now) > (n ? reply_end[n - 1] : 0))
+        {
+            if(++n % stall_every == 0)
+                stall_until = now + (uint64_t) stall_ms * (CPU_HZ / 1000);
+        }
+        drained = now >= stall_until;
+        if(drained)
+        {
+            while(AFSoftSerial_available())
+                got[got_len++] = AFSoftSerial_read();
+        }
+    }
+    int c;
+    while((c = AFSoftSerial_read()) >= 0)
+        got[got_len++] = c;
+
+    uint32_t failures = 0;
+    printf("  bytes sent:        %u\n", line_len);
+    printf("  bytes read:        %u\n", got_len);
+    printf("  overflows:         %u counted, %u in stalls\n", (uint32_t) afss_overflows,
+           dropped - dropped_reading);
+#ifndef AFSS_BUSY_RX
+    printf("  framing errors:    %u\n", (uint32_t) afss_framing_errors);
+    if(afss_framing_errors)
+        ++failures;
+#endif
+    printf("  interrupts:        %u, longest %.1f us, %.1f%% of the time\n", interrupts,
+           longest * 1e6 / CPU_HZ, 100.0 * busy / now);
+    if(got_len != want_len || memcmp(got, want, got_len) != 0 || got_len + dropped != line_len ||
+       dropped_reading || (uint8_t) dropped != afss_overflows)
+        ++failures;
+    if(failures)
+        fprintf(stderr, "received bytes do not match what was sent\n");
+
+    /* cost per byte of taking a reply out of a full ring */
+    uint32_t fill = AFSS_MAX_RX_BUFF;
+    double best_ring = 1e30, best_shift = 1e30;
+    uint32_t run;
+    for(run = 0; run < runs; ++run)
+    {
+        _receive_buffer_tail = 0;
+        _receive_buffer_head = fill;
+        double t = seconds_now();
+        while((c = AFSoftSerial_read()) >= 0)
+            sink += c;
+        t = seconds_now() - t;
+        if(t < best_ring)
+            best_ring = t;
+
+        shift_index = fill;
+        t = seconds_now();
+        while((c = shift_read()) >= 0)
+            sink += c;
+        t = seconds_now() - t;
+        if(t < best_shift)
+            best_shift = t;
+    }
+    printf("reading %u bytes out of a full buffer, best of %u:\n", fill, runs);
+    printf("  ring:              %6.2f ns/byte, no bytes moved\n", best_ring * 1e9 / fill);
+    printf("  shifting:          %6.2f ns/byte, %u bytes moved\n", best_shift * 1e9 / fill,
+           fill * (fill + 1) / 2);
+
+    free(got);
+    free(want);
+    free(reply_end);
+    free(line_start);
+    free(line);
+    return failures ? 1 : 0;
+}
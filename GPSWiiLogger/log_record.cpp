@@ -0,0 +1,162 @@
+/*
+ * log_record.cpp -- compact binary log records
+ *
+ * See log_record.h.
+ */
+
+#include <string.h>
+#include "log_record.h"
+#include "nmea_field.h"
+#include "sample_delta.h"
+
+/* Starts an empty record. */
+void log_record_begin(struct log_record *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->magic = LOG_RECORD_MAGIC;
+}
+
+/*
+ * Fills in the GPS part of a record from a $GPRMC sentence:
+ *   $GPRMC,hhmmss.sss,A,ddmm.mmmm,N,dddmm.mmmm,W,knots,course,ddmmyy,...
+ * Returns 0 if it is some other sentence.
+ */
+uint8_t log_record_gps(struct log_record *r, const char *sentence)
+{
+    if(strncmp(sentence, "$GPRMC,", 7) != 0)
+        return 0;
+
+    const char *p = sentence + 7;
+    uint32_t v;
+    if(!nmea_time(p, &v))
+        return 0;
+    r->time_ms = v;
+
+    p = nmea_next_field(p);
+    r->flags = *p == 'A' ? LOG_RECORD_FIX : 0;
+
+    p = nmea_next_field(p);
+    const char *lon = nmea_next_field(nmea_next_field(p));
+    int32_t lat_angle, lon_angle;
+    if(nmea_minutes(p, &lat_angle) && nmea_minutes(lon, &lon_angle))
+    {
+        r->lat = lat_angle;
+        r->lon = lon_angle;
+        r->flags |= LOG_RECORD_POSITION;
+    }
+
+    p = nmea_next_field(nmea_next_field(lon));
+    if(nmea_fixed(p, 2, &v))
+    {
+        r->speed = v;
+        r->flags |= LOG_RECORD_SPEED;
+    }
+
+    p = nmea_next_field(p);
+    if(nmea_fixed(p, 2, &v))
+    {
+        r->course = v;
+        r->flags |= LOG_RECORD_COURSE;
+    }
+
+    p = nmea_next_field(p);
+    if(nmea_fixed(p, 0, &v))
+    {
+        r->day = v / 10000;
+        r->month = v / 100 % 100;
+        r->year = v % 100;
+        r->flags |= LOG_RECORD_DATE;
+    }
+    return 1;
+}
+
+static uint8_t hex_value(char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return 0xff;
+}
+
+/*
+ * Fills in the samples from a sensor pod line: an optional command char,
+ * then up to LOG_RECORD_SAMPLES "|xxyyzz" or "!ccccc", the five c's
+ * being 6 bits each from '0' up, most significant first, or a delta
+ * coded line starting with "#ccccc".  Returns the samples taken.
+ */
+uint8_t log_record_samples(struct log_record *r, const char *line)
+{
+    r->reply = *line != '|' && *line != '!' && *line != SAMPLE_DELTA_KEY ? *line++ : 0;
+    r->samples = 0;
+
+    char mark = *line;
+    if(mark == SAMPLE_DELTA_KEY)
+    {
+        const char *end = line + strlen(line);
+        uint32_t v = 0;
+        r->flags |= LOG_RECORD_WIDE | LOG_RECORD_DELTA;
+        while(r->samples < LOG_RECORD_SAMPLES && (line = sample_delta_read(line, end, &v)))
+            r->xyz[r->samples++] = v;
+        return r->samples;
+    }
+    if(mark == '!')
+        r->flags |= LOG_RECORD_WIDE;
+    while(*line == mark && (mark == '|' || mark == '!') && r->samples < LOG_RECORD_SAMPLES)
+    {
+        uint32_t v = 0;
+        uint8_t i;
+        if(mark == '!')
+        {
+            for(i = 1; i <= 5; ++i)
+            {
+                uint8_t c = line[i] - '0';
+                if(c > 63)
+                    return r->samples;
+                v = v << 6 | c;
+            }
+            line += 6;
+        }
+        else
+        {
+            for(i = 1; i <= 6; ++i)
+            {
+                uint8_t h = hex_value(line[i]);
+                if(h > 0x0f)
+                    return r->samples;
+                v = v << 4 | h;
+            }
+            /* each axis' 8 bits become the top 8 of 10 */
+            v = (v & 0xff0000UL) << 6 | (v & 0xff00) << 4 | (v & 0xff) << 2;
+            line += 7;
+        }
+        r->xyz[r->samples++] = v;
+    }
+    return r->samples;
+}
+
+static uint8_t xor_bytes(const struct log_record *r)
+{
+    const uint8_t *b = (const uint8_t *) r;
+    uint8_t sum = 0;
+    uint8_t i;
+    for(i = 0; i < sizeof(*r) - 1; ++i)
+        sum ^= b[i];
+    return sum;
+}
+
+/* Sets the check byte, once the record is complete. */
+void log_record_seal(struct log_record *r)
+{
+    r->check = xor_bytes(r);
+}
+
+/* Tells whether the bytes look like a sealed record. */
+uint8_t log_record_valid(const struct log_record *r)
+{
+    return r->magic == LOG_RECORD_MAGIC &&
+           r->samples <= LOG_RECORD_SAMPLES &&
+           r->check == xor_bytes(r);
+}
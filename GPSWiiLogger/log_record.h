@@ -0,0 +1,68 @@
+/*
+ * log_record.h -- compact binary log records
+ *
+ * With logBinary set, GPSWiiLogger stores each fix as one fixed size
+ * record instead of the ~70 byte $GPRMC line and the sensor pod's ~63
+ * byte line: the GPS time and date, latitude and longitude in units of
+ * 1/10000 arc minute (the four decimals the SiRF III sends), speed and
+ * course in hundredths, and the pod's raw accelerometer triplets, 10
+ * bits an axis packed into 32 bits.  Samples from a pod sending 8 bit
+ * "|xxyyzz" are kept as the top 8 of the 10 bits, and flagged so the
+ * text comes back as it was.  Fields the sentence left empty are marked
+ * missing in flags.
+ *
+ * Multi-byte fields are little-endian, as the AVR stores them.  Every
+ * record starts with LOG_RECORD_MAGIC and ends with the XOR of all
+ * bytes before it, so that a reader can find its way back into a log
+ * with a damaged block.  host/logconv turns a binary log back into
+ * the text format the mappers and GPSWiiGrapher read; it also reads
+ * the 54 byte records with 8 bit samples from before, which started
+ * with LOG_RECORD_MAGIC_8BIT.
+ */
+
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <stdint.h>
+
+#define LOG_RECORD_MAGIC    0xa6
+#define LOG_RECORD_MAGIC_8BIT 0xa5
+#define LOG_RECORD_SAMPLES  10      // samples asked of GPSWiiUI per fix
+
+// flags
+#define LOG_RECORD_FIX      (1<<0)  // status 'A'
+#define LOG_RECORD_POSITION (1<<1)  // lat and lon were given
+#define LOG_RECORD_SPEED    (1<<2)
+#define LOG_RECORD_COURSE   (1<<3)
+#define LOG_RECORD_DATE     (1<<4)
+#define LOG_RECORD_WIDE     (1<<5)  // samples came as 10 bit "!ccccc"
+#define LOG_RECORD_DELTA    (1<<6)  // or delta coded, see sample_delta.h
+
+// axis a (0 = x, 1 = y, 2 = z) of a packed sample
+#define LOG_RECORD_AXIS(v, a) ((uint16_t) ((v) >> (20 - 10 * (a))) & 0x3ff)
+
+struct log_record
+{
+    uint8_t magic;
+    uint8_t flags;
+    uint32_t time_ms;       // UTC, since midnight
+    uint8_t day;
+    uint8_t month;
+    uint8_t year;           // two digits, as in the sentence
+    int32_t lat;            // 1/10000 arc minute, south negative
+    int32_t lon;            // 1/10000 arc minute, west negative
+    uint16_t speed;         // 1/100 knot
+    uint16_t course;        // 1/100 degree
+    uint8_t reply;          // the pod's command char, 0 if it sent none
+    uint8_t samples;        // accelerometer triplets in xyz
+    uint32_t xyz[LOG_RECORD_SAMPLES];   // x << 20 | y << 10 | z
+    uint8_t check;
+} __attribute__((packed));
+
+void log_record_begin(struct log_record *r);
+uint8_t log_record_gps(struct log_record *r, const char *sentence);
+uint8_t log_record_samples(struct log_record *r, const char *line);
+void log_record_seal(struct log_record *r);
+uint8_t log_record_valid(const struct log_record *r);
+
+#endif
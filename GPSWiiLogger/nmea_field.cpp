@@ -0,0 +1,128 @@
+/*
+ * nmea_field.cpp -- fixed point parsing of NMEA sentence fields
+ *
+ * See nmea_field.h.
+ */
+
+#include "nmea_field.h"
+
+/* Skips to the start of the next comma separated field. */
+const char *nmea_next_field(const char *p)
+{
+    while(*p && *p != ',' && *p != '*')
+        ++p;
+    return *p == ',' ? p + 1 : p;
+}
+
+/*
+ * Reads a decimal number with the given count of decimals, more of them
+ * being cut off and fewer padded with zeros.  Returns 0 if the field is
+ * empty, has something else than digits and one '.', or does not fit.
+ */
+uint8_t nmea_fixed(const char *p, uint8_t decimals, uint32_t *value)
+{
+    uint32_t v = 0;
+    uint8_t digits = 0;
+    uint8_t frac = 0xff;
+
+    for(; *p != ',' && *p != '*' && *p; ++p)
+    {
+        if(*p == '.' && frac == 0xff)
+        {
+            frac = 0;
+            continue;
+        }
+        if(*p < '0' || *p > '9')
+            return 0;
+        if(frac != 0xff && frac++ >= decimals)
+            continue;
+        if(v > 429496728)
+            return 0;
+        v = v * 10 + (*p - '0');
+        ++digits;
+    }
+    if(!digits)
+        return 0;
+
+    if(frac == 0xff)
+        frac = 0;
+    for(; frac < decimals; ++frac)
+    {
+        if(v > 429496729)
+            return 0;
+        v *= 10;
+    }
+    *value = v;
+    return 1;
+}
+
+/* Turns "hhmmss.sss" into ms since midnight. */
+uint8_t nmea_time(const char *p, uint32_t *ms)
+{
+    uint32_t v;
+    if(!nmea_fixed(p, 3, &v))
+        return 0;
+
+    uint32_t hh = v / 10000000;
+    uint8_t mm = v / 100000 % 100;
+    uint32_t ss = v % 100000;
+    if(hh > 23 || mm > 59 || ss > 59999)
+        return 0;
+    *ms = hh * 3600000 + mm * 60000UL + ss;
+    return 1;
+}
+
+/* Reads the "dddmm.mm..." field and the hemisphere after it into degrees
+ * and decimals of a minute, the given count of them.
+ */
+static uint8_t read_angle(const char *p, uint8_t decimals, uint32_t *degrees, uint32_t *minutes,
+                          uint8_t *negative)
+{
+    uint32_t v, one = 100;
+    uint8_t i;
+    for(i = 0; i < decimals; ++i)
+        one *= 10;
+
+    if(!nmea_fixed(p, decimals, &v))
+        return 0;
+    *degrees = v / one;
+    *minutes = v % one;
+    if(*degrees > 180 || *minutes >= one / 100 * 60)
+        return 0;
+
+    p = nmea_next_field(p);
+    *negative = *p == 'S' || *p == 'W';
+    return 1;
+}
+
+/* Turns "ddmm.mmmm" (or "dddmm.mmmm") and its hemisphere into 1/10000
+ * arc minutes, south and west negative.
+ */
+uint8_t nmea_minutes(const char *p, int32_t *minutes)
+{
+    uint32_t d, m;
+    uint8_t negative;
+    if(!read_angle(p, 4, &d, &m, &negative))
+        return 0;
+    int32_t a = (int32_t) (d * 600000 + m);
+    *minutes = negative ? -a : a;
+    return 1;
+}
+
+/*
+ * Turns "ddmm.mmmmm" (or "dddmm.mmmmm") and its hemisphere into 1e-7
+ * degrees, south and west negative.  Up to five decimals of a minute
+ * are used; 1e-7 degrees being 6e-6 minutes, each of them still maps
+ * to its own value, rounded to the nearest.
+ */
+uint8_t nmea_angle(const char *p, int32_t *e7)
+{
+    uint32_t d, m;
+    uint8_t negative;
+    if(!read_angle(p, 5, &d, &m, &negative))
+        return 0;
+    /* 1e-5 minute is 5/3 of 1e-7 degree */
+    int32_t a = (int32_t) (d * 10000000 + (m * 5 + 1) / 3);
+    *e7 = negative ? -a : a;
+    return 1;
+}
@@ -0,0 +1,30 @@
+/*
+ * nmea_field.h -- fixed point parsing of NMEA sentence fields
+ *
+ * Turns the numeric fields of a sentence into integers without floats,
+ * strtod or sscanf, so the same code runs on the ATmega168 and in the
+ * host tools:
+ *  - "hhmmss.sss" into ms since midnight,
+ *  - "ddmm.mmmm" / "dddmm.mmmm" and its hemisphere into 1e-7 degrees
+ *    (or 1/10000 arc minute, the unit the SiRF III sends),
+ *  - speed, course and the like into a fixed count of decimals.
+ *
+ * Each function takes a pointer to the first char of a field, reads up
+ * to the ',' or '*' ending it, and returns 0 if the field is empty or
+ * malformed, leaving the output alone.  Sentences need not be
+ * 0-terminated, as long as they were checksummed: the '*' stops every
+ * scan.
+ */
+
+#ifndef NMEA_FIELD_H
+#define NMEA_FIELD_H
+
+#include <stdint.h>
+
+const char *nmea_next_field(const char *p);
+uint8_t nmea_fixed(const char *p, uint8_t decimals, uint32_t *value);
+uint8_t nmea_time(const char *p, uint32_t *ms);
+uint8_t nmea_minutes(const char *p, int32_t *minutes);
+uint8_t nmea_angle(const char *p, int32_t *e7);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * nmea_rx.cpp -- interrupt driven line framer for the GPS serial port
+ *
+ * See nmea_rx.h.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <string.h>
+#include "nmea_rx.h"
+
+#define STATE_IDLE     0   /* between lines */
+#define STATE_SENTENCE 1   /* after '$', summing up */
+#define STATE_CHECK1   2   /* after '*' */
+#define STATE_CHECK2   3   /* after the first checksum digit */
+#define STATE_END      4   /* after the checksum, waiting for '\n' */
+#define STATE_LINE     5   /* in a line not starting with '$' */
+#define STATE_SKIP     6   /* throwing away the rest of a line */
+
+static struct nmea_rx_slot slots[NMEA_RX_SLOTS];
+/* free running counts of slots filled by the interrupt and released by loop() */
+static volatile uint8_t slot_head;
+static volatile uint8_t slot_tail;
+
+static struct nmea_rx_slot* fill;
+static uint8_t fill_len;
+static uint8_t state;
+static uint8_t sum;
+static uint8_t check;
+
+static struct nmea_rx_stats stats;
+
+/* Forgets all lines and counts, and waits for the start of the next line. */
+void nmea_rx_reset(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    slot_head = 0;
+    slot_tail = 0;
+    state = STATE_IDLE;
+    memset(&stats, 0, sizeof(stats));
+    SREG = sreg;
+}
+
+static uint8_t hex_value(uint8_t c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return 0xff;
+}
+
+/* Starts filling the next free slot, or skips the line if there is none. */
+static void begin_line(uint8_t next_state)
+{
+    if((uint8_t) (slot_head - slot_tail) >= NMEA_RX_SLOTS)
+    {
+        ++stats.dropped;
+        state = STATE_SKIP;
+        return;
+    }
+
+    fill = &slots[slot_head & (NMEA_RX_SLOTS - 1)];
+    fill_len = 0;
+    sum = 0;
+    state = next_state;
+}
+
+/* Adds a byte to the slot being filled, skipping the line if it is full. */
+static uint8_t store(uint8_t c)
+{
+    if(fill_len >= NMEA_RX_SLOT_SIZE - 1)
+    {
+        ++stats.framing_errors;
+        state = STATE_SKIP;
+        return 0;
+    }
+    fill->data[fill_len++] = c;
+    return 1;
+}
+
+/* Hands the slot being filled on to loop(). */
+static void end_line(uint8_t type)
+{
+    fill->data[fill_len] = 0;
+    fill->len = fill_len;
+    fill->type = type;
+    ++slot_head;
+    state = STATE_IDLE;
+}
+
+/* Drops a malformed line, up to the given byte. */
+static void line_error(uint8_t c)
+{
+    ++stats.framing_errors;
+    state = c == '\n' ? STATE_IDLE : STATE_SKIP;
+}
+
+/*
+ * Feeds one received byte through the framer.  Called by the receive
+ * interrupt, or by loop() without NMEA_RX_ISR; the host tools call it
+ * directly.
+ */
+void nmea_rx_byte(uint8_t c)
+{
+    if(c == '$')
+    {
+        /* a sentence always starts over, even in the middle of a line */
+        if(state != STATE_IDLE && state != STATE_SKIP)
+            ++stats.framing_errors;
+        begin_line(STATE_SENTENCE);
+        if(state == STATE_SENTENCE)
+            store(c);
+        return;
+    }
+
+    switch(state)
+    {
+        case STATE_IDLE:
+            if(c == '\r' || c == '\n')
+                break;
+            begin_line(STATE_LINE);
+            if(state == STATE_LINE)
+                store(c);
+            break;
+
+        case STATE_SENTENCE:
+            if(c == '\r' || c == '\n')
+            {
+                line_error(c);
+                break;
+            }
+            if(!store(c))
+                break;
+            if(c == '*')
+                state = STATE_CHECK1;
+            else
+                sum ^= c;
+            break;
+
+        case STATE_CHECK1:
+        case STATE_CHECK2:
+        {
+            uint8_t value = hex_value(c);
+            if(value > 0x0f)
+            {
+                line_error(c);
+                break;
+            }
+            if(!store(c))
+                break;
+            if(state == STATE_CHECK1)
+            {
+                check = value << 4;
+                state = STATE_CHECK2;
+            }
+            else
+            {
+                check |= value;
+                state = STATE_END;
+            }
+            break;
+        }
+
+        case STATE_END:
+            if(c == '\r')
+            {
+                store(c);
+            }
+            else if(c == '\n')
+            {
+                if(check == sum)
+                {
+                    ++stats.sentences;
+                    end_line(NMEA_RX_SENTENCE);
+                }
+                else
+                {
+                    ++stats.checksum_errors;
+                    state = STATE_IDLE;
+                }
+            }
+            else
+            {
+                line_error(c);
+            }
+            break;
+
+        case STATE_LINE:
+            if(c == '\n')
+            {
+                ++stats.lines;
+                end_line(NMEA_RX_LINE);
+            }
+            else
+            {
+                store(c);
+            }
+            break;
+
+        case STATE_SKIP:
+            if(c == '\n')
+                state = STATE_IDLE;
+            break;
+    }
+}
+
+/* Returns the oldest complete line, or 0 if there is none yet. */
+struct nmea_rx_slot* nmea_rx_next(void)
+{
+    if(slot_head == slot_tail)
+        return 0;
+    return &slots[slot_tail & (NMEA_RX_SLOTS - 1)];
+}
+
+/* Gives the line returned by nmea_rx_next() back to the framer. */
+void nmea_rx_release(void)
+{
+    if(slot_head != slot_tail)
+        ++slot_tail;
+}
+
+const struct nmea_rx_stats* nmea_rx_get_stats(void)
+{
+    return &stats;
+}
+
+#if NMEA_RX_ISR
+#if defined(USART_RX_vect)
+ISR(USART_RX_vect)
+#else
+SIGNAL(SIG_USART_RECV)
+#endif
+{
+    nmea_rx_byte(UDR0);
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+ * nmea_rx.h -- interrupt driven line framer for the GPS serial port
+ *
+ * The UART receive interrupt sorts incoming bytes into a small ring of
+ * line slots.  A line starting with '$' is an NMEA sentence: its XOR
+ * checksum is computed as the bytes arrive, and the slot is only handed
+ * to loop() if the sentence ends in a matching "*hh\r\n".  Any other
+ * line, like the sensor pod's reply, is passed on as it is.
+ *
+ * loop() gets the oldest complete slot with nmea_rx_next(), may write
+ * its data straight to the card, and gives it back with
+ * nmea_rx_release().  While loop() is busy, the interrupt keeps filling
+ * the other slots, so card writes no longer lose GPS bytes.
+ *
+ * The interrupt replaces the one in Arduino's wiring_serial.c, so it is
+ * only there if NMEA_RX_ISR is set, which the Makefile does while it
+ * builds wiring_serial.c without its own.  Serial.print() still works,
+ * but Serial.available() and Serial.read() never see any data.  Built
+ * any other way, like in the Arduino IDE, the core keeps its interrupt
+ * and loop() has to feed Serial.read()'s bytes to nmea_rx_byte(); card
+ * writes then lose GPS bytes once the core's 128 byte buffer fills.
+ *
+ * Defines you can set
+ *  NMEA_RX_ISR       -- take the UART receive interrupt (default 0)
+ *  NMEA_RX_SLOTS     -- number of line slots, a power of two (default 2)
+ *  NMEA_RX_SLOT_SIZE -- longest line kept, including '\r' and a
+ *                       terminating 0 (default 80)
+ */
+
+#ifndef NMEA_RX_H
+#define NMEA_RX_H
+
+#include <stdint.h>
+
+#ifndef NMEA_RX_ISR
+#define NMEA_RX_ISR 0
+#endif
+#ifndef NMEA_RX_SLOTS
+#define NMEA_RX_SLOTS 2
+#endif
+#ifndef NMEA_RX_SLOT_SIZE
+#define NMEA_RX_SLOT_SIZE 80
+#endif
+
+#if NMEA_RX_SLOTS & (NMEA_RX_SLOTS - 1)
+#error "NMEA_RX_SLOTS must be a power of two"
+#endif
+
+// a "$...*hh" sentence whose checksum matched
+#define NMEA_RX_SENTENCE 1
+// any other line
+#define NMEA_RX_LINE     2
+
+struct nmea_rx_slot
+{
+    uint8_t type;                  // NMEA_RX_SENTENCE or NMEA_RX_LINE
+    uint8_t len;                   // bytes before the '\n', '\r' included
+    char data[NMEA_RX_SLOT_SIZE];  // the line, without '\n', 0-terminated
+};
+
+struct nmea_rx_stats
+{
+    uint16_t sentences;            // good sentences handed on
+    uint16_t lines;                // other lines handed on
+    uint16_t checksum_errors;      // sentences dropped for a bad checksum
+    uint16_t framing_errors;       // cut off, malformed or too long lines
+    uint16_t dropped;              // lines dropped because all slots were full
+};
+
+void nmea_rx_reset(void);
+void nmea_rx_byte(uint8_t c);
+struct nmea_rx_slot* nmea_rx_next(void);
+void nmea_rx_release(void);
+const struct nmea_rx_stats* nmea_rx_get_stats(void);
+
+#endif
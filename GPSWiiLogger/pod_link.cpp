@@ -0,0 +1,112 @@
+/*
+ * pod_link.cpp -- request/reply bookkeeping for the sensor pod
+ *
+ * See pod_link.h.
+ */
+
+#include <string.h>
+#include "pod_link.h"
+
+static uint16_t timeout;
+static uint8_t retries;
+static uint16_t window;
+static uint8_t packet;
+
+static char request[12];         // "sHHMMSS" or "sHHMMSS/nnd"
+static uint8_t pending;          // a request is waiting for its reply
+static uint8_t send_due;         // ... and has not been sent yet
+static uint8_t tries_left;
+static unsigned long fix_time;
+static unsigned long sent_at;
+
+static struct pod_link_stats stats;
+
+/* Sets how long to wait for a reply, how often to ask again, how long
+ * after a fix a request may still be sent, and how many samples a reply
+ * may have at most (0: leave it to the pod, up to 99).
+ */
+void pod_begin(uint16_t timeout_ms, uint8_t retry_count, uint16_t window_ms, uint8_t packet_size)
+{
+    timeout = timeout_ms;
+    retries = retry_count;
+    window = window_ms;
+    packet = packet_size < 100 ? packet_size : 99;
+    pending = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/* Asks for the pod's samples, with the GPS time as "HHMMSS", for the
+ * fix taken at millis() fix_at.
+ */
+void pod_request(char command, const char *hhmmss, unsigned long fix_at)
+{
+    if(pending)
+        ++stats.superseded;
+
+    request[0] = command;
+    memcpy(request + 1, hhmmss, 6);
+    request[7] = 0;
+    if(packet)
+    {
+        request[7] = '/';
+        request[8] = '0' + packet / 10;
+        request[9] = '0' + packet % 10;
+        request[10] = 'd';
+        request[11] = 0;
+    }
+
+    ++stats.requests;
+    fix_time = fix_at;
+    pending = 1;
+    send_due = 1;
+    tries_left = retries + 1;
+}
+
+/* Tells loop() whether to send the request now, or that it timed out. */
+uint8_t pod_poll(unsigned long now)
+{
+    if(!pending)
+        return POD_IDLE;
+
+    if(!send_due && now - sent_at < timeout)
+        return POD_IDLE;
+
+    if(!tries_left || now - fix_time > window)
+    {
+        pending = 0;
+        ++stats.timeouts;
+        return POD_TIMEOUT;
+    }
+
+    if(!send_due)
+        ++stats.retries;
+    send_due = 0;
+    --tries_left;
+    sent_at = now;
+    return POD_SEND;
+}
+
+/* Takes a reply line; returns 0 if no request was waiting for one. */
+uint8_t pod_reply(void)
+{
+    if(!pending)
+    {
+        ++stats.stray;
+        return 0;
+    }
+
+    pending = 0;
+    ++stats.replies;
+    return 1;
+}
+
+/* The request to send when pod_poll() says POD_SEND. */
+const char *pod_request_line(void)
+{
+    return request;
+}
+
+const struct pod_link_stats *pod_get_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,52 @@
+/*
+ * pod_link.h -- request/reply bookkeeping for the sensor pod
+ *
+ * After each GPS fix the logger asks the sensor pod (GPSWiiUI) for its
+ * samples by sending "sHHMMSS" or "SHHMMSS", and the pod answers with
+ * one line.  With a packet size set, the request is "sHHMMSS/nnd" and
+ * the pod fits its last second of samples into at most nn 10 bit
+ * samples, averaging neighbours if it sampled faster than that, and
+ * delta codes them (see sample_delta.h), leaving out any that would
+ * not fit an nmea_rx slot.  Without one, old pods and new send their
+ * fixed ten 8 bit "|xxyyzz".  Old pods answer "/nnd" like a plain
+ * request.  Instead of spinning until that line arrives, loop() calls
+ * pod_request() and carries on; pod_poll() tells it when to (re)send
+ * the request and when to give up, and pod_reply() accepts a reply
+ * line received by nmea_rx.  No I/O is done in here, so the host tools
+ * can run the same code against a simulated pod.
+ *
+ * A request left unanswered for the timeout is sent again, up to the
+ * given number of retries.  Nothing is sent later than the window after
+ * the fix the request is for, so that a late reply cannot run into the
+ * next GPS sentence on the shared RX line; the request is given up
+ * instead.  A new request replaces one still waiting.
+ */
+
+#ifndef POD_LINK_H
+#define POD_LINK_H
+
+#include <stdint.h>
+
+// what pod_poll() wants loop() to do
+#define POD_IDLE    0   // nothing
+#define POD_SEND    1   // send pod_request_line()
+#define POD_TIMEOUT 2   // the pod did not answer, request given up
+
+struct pod_link_stats
+{
+    uint16_t requests;    // requests made by pod_request()
+    uint16_t retries;     // requests sent again after a timeout
+    uint16_t replies;     // replies accepted
+    uint16_t timeouts;    // requests given up, unanswered or too late
+    uint16_t superseded;  // requests replaced before they were answered
+    uint16_t stray;       // replies nobody was waiting for
+};
+
+void pod_begin(uint16_t timeout_ms, uint8_t retries, uint16_t window_ms, uint8_t packet);
+void pod_request(char command, const char *hhmmss, unsigned long fix_at);
+uint8_t pod_poll(unsigned long now);
+uint8_t pod_reply(void);
+const char *pod_request_line(void);
+const struct pod_link_stats *pod_get_stats(void);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * sample_delta.cpp -- delta coded accelerometer samples
+ *
+ * See sample_delta.h.
+ */
+
+#include "sample_delta.h"
+
+/* Reads a zig-zag varint; returns where it ends, or 0. */
+static const char *read_change(const char *p, const char *end, int16_t *change)
+{
+    uint16_t v = 0;
+    uint8_t shift;
+    for(shift = 0; shift < 15; shift += 5)
+    {
+        if(p >= end)
+            return 0;
+        uint8_t c = (uint8_t) *p++ - '0';
+        if(c > 63)
+            return 0;
+        v |= (uint16_t) (c & 31) << shift;
+        if(!(c & 32))
+        {
+            *change = (int16_t) (v >> 1) ^ -(int16_t) (v & 1);
+            return p;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads one sample at p, a keyframe, or the change from the last one,
+ * which *xyz holds, as x << 20 | y << 10 | z.  Returns where the next
+ * sample starts, or 0 if there is none at p: the line ended, or holds
+ * something else, or a change goes past 0 or 1023.
+ */
+const char *sample_delta_read(const char *p, const char *end, uint32_t *xyz)
+{
+    uint32_t v = 0;
+    uint8_t i;
+
+    if(p < end && *p == SAMPLE_DELTA_KEY)
+    {
+        if(end - p < 6)
+            return 0;
+        for(i = 1; i <= 5; ++i)
+        {
+            uint8_t c = (uint8_t) p[i] - '0';
+            if(c > 63)
+                return 0;
+            v = v << 6 | c;
+        }
+        *xyz = v;
+        return p + 6;
+    }
+
+    for(i = 0; i < 3; ++i)
+    {
+        int16_t change;
+        p = read_change(p, end, &change);
+        if(!p)
+            return 0;
+        uint8_t shift = 20 - 10 * i;
+        int16_t axis = (int16_t) (*xyz >> shift & 0x3ff) + change;
+        if(axis < 0 || axis > 0x3ff)
+            return 0;
+        v |= (uint32_t) axis << shift;
+    }
+    *xyz = v;
+    return p;
+}
+
+/* Writes a zig-zag varint; returns its length. */
+static uint8_t write_change(char *out, int16_t change)
+{
+    uint16_t v = (uint16_t) (change << 1) ^ (uint16_t) (change >> 15);
+    uint8_t len = 0;
+    while(v > 31)
+    {
+        out[len++] = '0' + 32 + (v & 31);
+        v >>= 5;
+    }
+    out[len++] = '0' + v;
+    return len;
+}
+
+/*
+ * Writes n samples of xyz (as x << 20 | y << 10 | z) at out, the first
+ * and every keyframe_every'th one (0: only the first) as a keyframe,
+ * for as many as fit in room chars.  Returns how many samples were
+ * written, and sets *len to the chars they took.  No 0 is added.
+ */
+uint8_t sample_delta_write(char *out, uint8_t room, const uint32_t *xyz, uint8_t n,
+                           uint8_t keyframe_every, uint8_t *len)
+{
+    char buf[9];
+    uint8_t used = 0;
+    uint8_t s;
+    for(s = 0; s < n; ++s)
+    {
+        uint8_t l = 0;
+        uint8_t i;
+        if(s == 0 || (keyframe_every && s % keyframe_every == 0))
+        {
+            buf[l++] = SAMPLE_DELTA_KEY;
+            for(i = 0; i < 5; ++i)
+                buf[l++] = '0' + (xyz[s] >> (24 - 6 * i) & 0x3f);
+        }
+        else
+        {
+            for(i = 0; i < 3; ++i)
+            {
+                uint8_t shift = 20 - 10 * i;
+                int16_t change = (int16_t) (xyz[s] >> shift & 0x3ff) - (int16_t) (xyz[s - 1] >> shift & 0x3ff);
+                l += write_change(buf + l, change);
+            }
+        }
+        if(used + l > room)
+            break;
+        for(i = 0; i < l; ++i)
+            out[used++] = buf[i];
+    }
+    *len = used;
+    return s;
+}
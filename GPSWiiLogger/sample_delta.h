@@ -0,0 +1,37 @@
+/*
+ * sample_delta.h -- delta coded accelerometer samples
+ *
+ * Samples a pod sends one after the other differ by a few counts, so
+ * instead of five chars for each one (see "!ccccc" in log_record.h)
+ * GPSWiiUI can send:
+ *  - a keyframe "#ccccc": x << 20 | y << 10 | z, 10 bits an axis, in
+ *    five chars of 6 bits from '0' up, most significant first, then
+ *  - for each sample after it, how much x, y and z changed, each
+ *    zig-zag coded (0, -1, 1, -2, 2, ... become 0, 1, 2, 3, 4, ...) and
+ *    sent 5 bits a char from '0' up, low bits first, with 32 added to
+ *    every char but the last of a number.
+ * A change of up to 15 counts takes one char, of up to 511 two, so a
+ * quiet second costs 3 chars a sample.  The pod starts every line with a
+ * keyframe and puts in another one every SAMPLE_DELTA_KEYFRAME samples,
+ * so one bad char does not throw off the rest of a long line.
+ *
+ * All chars are '#' or from '0' to 'o', so a line never holds a '$',
+ * '|', '!' or line end, and is told apart from the other kinds by its
+ * first group.  The same code reads the lines on the logger
+ * (log_record.cpp) and in the host tools, and writes them back in
+ * host/logconv.
+ */
+
+#ifndef SAMPLE_DELTA_H
+#define SAMPLE_DELTA_H
+
+#include <stdint.h>
+
+#define SAMPLE_DELTA_KEY  '#'
+#define SAMPLE_DELTA_KEYFRAME 8   // sensorKeyframeEvery in GPSWiiUI
+
+const char *sample_delta_read(const char *p, const char *end, uint32_t *xyz);
+uint8_t sample_delta_write(char *out, uint8_t room, const uint32_t *xyz, uint8_t n,
+                           uint8_t keyframe_every, uint8_t *len);
+
+#endif
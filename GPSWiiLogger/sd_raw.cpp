@@ -43,6 +43,8 @@
 #define CMD_GO_IDLE_STATE 0x00
 /* CMD1: response R1 */
 #define CMD_SEND_OP_COND 0x01
+/* CMD8: arg0[31:12]: reserved, arg0[11:8]: voltage, arg0[7:0]: check pattern, response R7 */
+#define CMD_SEND_IF_COND 0x08
 /* CMD9: response R1 */
 #define CMD_SEND_CSD 0x09
 /* CMD10: response R1 */
@@ -85,10 +87,14 @@
 #define CMD_ERASE 0x26
 /* CMD42: arg0[31:0]: stuff bits, response R1b */
 #define CMD_LOCK_UNLOCK 0x2a
+/* CMD55: arg0[31:0]: stuff bits, response R1 */
+#define CMD_APP 0x37
 /* CMD58: response R3 */
 #define CMD_READ_OCR 0x3a
 /* CMD59: arg0[31:1]: stuff bits, arg0[0:0]: crc option, response R1 */
 #define CMD_CRC_ON_OFF 0x3b
+/* ACMD41: arg0[31]: stuff bits, arg0[30]: HCS, arg0[29:0]: stuff bits, response R1 */
+#define CMD_SD_SEND_OP_COND 0x29
 
 /* command responses */
 /* R1: size 1 byte */
@@ -132,22 +138,69 @@
 #define DR_STATUS_CRC_ERR 0x0a
 #define DR_STATUS_WRITE_ERR 0x0c
 
+/* card types */
+#define SD_RAW_SPEC_1 0
+#define SD_RAW_SPEC_2 1
+#define SD_RAW_SPEC_SDHC 2
 
 
 
+
+#if SD_RAW_CACHE_BLOCKS > 1
+  /* static data buffers for acceleration */
+  uint8_t raw_cache[SD_RAW_CACHE_BLOCKS][512];
+  /* offsets where the data within raw_cache lies on the card */
+  offset_t raw_cache_address[SD_RAW_CACHE_BLOCKS];
+  /* how many other blocks were used since each one was used last */
+  uint8_t raw_cache_age[SD_RAW_CACHE_BLOCKS];
+  /* the cached block accessed last, the only one which may hold unwritten data */
+  uint8_t raw_slot;
+  #define raw_block raw_cache[raw_slot]
+  #define raw_block_address raw_cache_address[raw_slot]
+#else
   /* static data buffer for acceleration */
   uint8_t raw_block[512];
   /* offset where the data within raw_block lies on the card */
-  uint32_t raw_block_address;
+  offset_t raw_block_address;
+#endif
+#if SD_RAW_CACHE_STATS
+  /* counts of reads served from and past the cache */
+  struct sd_raw_cache_stats cache_stats;
+#endif
 #if SD_RAW_WRITE_BUFFERING
   /* flag to remember if raw_block was written to the card */
   uint8_t raw_block_written;
 #endif
+#if SD_RAW_WRITE_STREAMING
+  /* flag to remember if consecutive blocks should be streamed */
+  uint8_t stream_enabled;
+  /* offset of the block the open multi-block write expects next */
+  offset_t stream_block_address = 0xffffffff;
+  /* offset of the block written last */
+  offset_t stream_last_address = 0xffffffff;
+#endif
+#if SD_RAW_READ_STREAMING
+  /* offset of the block the open multi-block read sends next */
+  offset_t read_stream_address = 0xffffffff;
+  /* offset of the block read last */
+  offset_t read_last_address = 0xffffffff;
+#endif
+  /* flag to remember if the card stopped answering commands */
+  uint8_t card_lost;
+  /* mask of the SD_RAW_SPEC_* the card follows */
+  uint8_t sd_raw_card_type;
 
 /* private helper functions */
 static void sd_raw_send_byte(uint8_t b);
 static uint8_t sd_raw_rec_byte();
 static uint8_t sd_raw_send_command_r1(uint8_t command, uint32_t arg);
+static uint32_t sd_raw_block_arg(offset_t block_address);
+static uint8_t sd_raw_write_block(offset_t block_address);
+static uint8_t sd_raw_stream_finish();
+#if !SD_RAW_SAVE_RAM
+static uint8_t sd_raw_cache_block(offset_t block_address, uint8_t load);
+static uint8_t sd_raw_read_block(offset_t block_address);
+#endif
 
 /**
  * \ingroup sd_raw
@@ -184,7 +237,9 @@ uint8_t sd_raw_init()
     SPSR &= ~(1 << SPI2X); /* No doubled clock frequency */
 
     /* initialization procedure */
-    
+
+    /* a card found to be gone may have been put back */
+    card_lost = 0;
     if(!sd_raw_available())
         return 0;
 
@@ -212,10 +267,49 @@ uint8_t sd_raw_init()
         }
     }
     
+    /* find out which specification the card follows */
+    sd_raw_card_type = 0;
+    response = sd_raw_send_command_r1(CMD_SEND_IF_COND, 0x100 /* 2.7V - 3.6V */ | 0xaa /* check pattern */);
+    if(!(response & (1 << R1_ILL_COMMAND)))
+    {
+        /* an SD 2 card, which echoes voltage and check pattern */
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+        if((sd_raw_rec_byte() & 0x0f) != 0x01 || sd_raw_rec_byte() != 0xaa)
+        {
+            /* the card does not work at our voltage, or did not get the command right */
+            unselect_card();
+            return 0;
+        }
+        sd_raw_card_type |= (1 << SD_RAW_SPEC_2);
+    }
+    else
+    {
+        /* an SD 1 card knows ACMD41, an MMC does not */
+        sd_raw_send_command_r1(CMD_APP, 0);
+        response = sd_raw_send_command_r1(CMD_SD_SEND_OP_COND, 0);
+        if(!(response & (1 << R1_ILL_COMMAND)))
+            sd_raw_card_type |= (1 << SD_RAW_SPEC_1);
+    }
+
     /* wait for card to get ready */
     for(i = 0; ; ++i)
     {
-        response = sd_raw_send_command_r1(CMD_SEND_OP_COND, 0);
+        if(sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2)))
+        {
+            uint32_t arg = 0;
+#if SD_RAW_SDHC
+            /* tell the card we can address blocks, or an SDHC card stays idle */
+            if(sd_raw_card_type & (1 << SD_RAW_SPEC_2))
+                arg = 0x40000000;
+#endif
+            sd_raw_send_command_r1(CMD_APP, 0);
+            response = sd_raw_send_command_r1(CMD_SD_SEND_OP_COND, arg);
+        }
+        else
+        {
+            response = sd_raw_send_command_r1(CMD_SEND_OP_COND, 0);
+        }
         if(!(response & (1 << R1_IDLE_STATE)))
             break;
 
@@ -226,6 +320,23 @@ uint8_t sd_raw_init()
         }
     }
 
+#if SD_RAW_SDHC
+    if(sd_raw_card_type & (1 << SD_RAW_SPEC_2))
+    {
+        /* the OCR's card capacity status tells whether the card is addressed by block */
+        if(sd_raw_send_command_r1(CMD_READ_OCR, 0))
+        {
+            unselect_card();
+            return 0;
+        }
+        if(sd_raw_rec_byte() & 0x40)
+            sd_raw_card_type |= (1 << SD_RAW_SPEC_SDHC);
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+    }
+#endif
+
     /* set block size to 512 bytes */
     if(sd_raw_send_command_r1(CMD_SET_BLOCKLEN, 512))
     {
@@ -236,12 +347,35 @@ uint8_t sd_raw_init()
     /* deaddress card */
     unselect_card();
 
+    /* the polls above may have gone unanswered while the card woke up */
+    card_lost = 0;
+
     /* switch to highest SPI frequency possible */
     SPCR &= ~((1 << SPR1) | (1 << SPR0)); /* Clock Frequency: f_OSC / 4 */
     SPSR |= (1 << SPI2X); /* Doubled Clock Frequency: f_OSC / 2 */
 
+#if SD_RAW_WRITE_STREAMING
+    /* the card has just been reset, so no multi-block write is open */
+    stream_block_address = 0xffffffff;
+    stream_last_address = 0xffffffff;
+#endif
+
+#if SD_RAW_READ_STREAMING
+    /* nor a multi-block read */
+    read_stream_address = 0xffffffff;
+    read_last_address = 0xffffffff;
+#endif
+
 #if !SD_RAW_SAVE_RAM
     /* the first block is likely to be accessed first, so precache it here */
+#if SD_RAW_CACHE_BLOCKS > 1
+    for(raw_slot = 0; raw_slot < SD_RAW_CACHE_BLOCKS; ++raw_slot)
+    {
+        raw_cache_address[raw_slot] = 0xffffffff;
+        raw_cache_age[raw_slot] = raw_slot;
+    }
+    raw_slot = 0;
+#endif
     raw_block_address = 0xffffffff;
 #if SD_RAW_WRITE_BUFFERING
     raw_block_written = 1;
@@ -257,11 +391,15 @@ uint8_t sd_raw_init()
  * \ingroup sd_raw
  * Checks wether a memory card is located in the slot.
  *
+ * Without a card detect switch, a card which did not answer a command
+ * counts as removed until sd_raw_init() finds one again: with no card
+ * in the slot, MISO floats high and every response reads as 0xff.
+ *
  * \returns 1 if the card is available, 0 if it is not.
  */
 uint8_t sd_raw_available()
 {
-    return get_pin_available() == 0x00;
+    return get_pin_available() == 0x00 && !card_lost;
 }
 
 /**
@@ -329,7 +467,19 @@ uint8_t sd_raw_send_command_r1(uint8_t command, uint32_t arg)
     sd_raw_send_byte((arg >> 16) & 0xff);
     sd_raw_send_byte((arg >> 8) & 0xff);
     sd_raw_send_byte((arg >> 0) & 0xff);
-    sd_raw_send_byte(command == CMD_GO_IDLE_STATE ? 0x95 : 0xff);
+    switch(command)
+    {
+        /* the card checks the crc of these even in SPI mode */
+        case CMD_GO_IDLE_STATE:
+            sd_raw_send_byte(0x95);
+            break;
+        case CMD_SEND_IF_COND:
+            sd_raw_send_byte(0x87);
+            break;
+        default:
+            sd_raw_send_byte(0xff);
+            break;
+    }
     
     /* receive response */
     for(i = 0; i < 10; ++i)
@@ -338,10 +488,30 @@ uint8_t sd_raw_send_command_r1(uint8_t command, uint32_t arg)
         if(response != 0xff)
             break;
     }
+    if(response == 0xff)
+        card_lost = 1;
 
     return response;
 }
 
+/**
+ * \ingroup sd_raw
+ * Turns the offset of a block into the address a read or write command takes.
+ *
+ * SDHC cards count in blocks, all others in bytes.
+ *
+ * \param[in] block_address The offset of the block on the card.
+ * \returns The command argument.
+ */
+uint32_t sd_raw_block_arg(offset_t block_address)
+{
+#if SD_RAW_SDHC
+    if(sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC))
+        return block_address / 512;
+#endif
+    return block_address;
+}
+
 /**
  * \ingroup sd_raw
  * Reads raw data from the card.
@@ -352,17 +522,16 @@ uint8_t sd_raw_send_command_r1(uint8_t command, uint32_t arg)
  * \returns 0 on failure, 1 on success.
  * \see sd_raw_read_interval, sd_raw_write, sd_raw_write_interval
  */
-uint8_t sd_raw_read(uint32_t offset, uint8_t* buffer, uint16_t length)
+uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uint16_t length)
 {
-    uint32_t block_address;
+    offset_t block_address;
     uint16_t block_offset;
     uint16_t read_length;
-    uint16_t i;
 
     while(length > 0)
     {
         /* determine byte count to read at once */
-        block_address = offset & 0xfffffe00;
+        block_address = offset & ~(offset_t) 0x1ff;
         block_offset = offset & 0x01ff;
         read_length = 512 - block_offset; /* read up to block border */
         if(read_length > length)
@@ -371,79 +540,292 @@ uint8_t sd_raw_read(uint32_t offset, uint8_t* buffer, uint16_t length)
 #if !SD_RAW_SAVE_RAM
         /* check if the requested data is cached */
         if(block_address != raw_block_address)
-#endif
         {
-#if SD_RAW_WRITE_BUFFERING
-            if(!raw_block_written)
-            {
-                if(!sd_raw_write(raw_block_address, raw_block, sizeof(raw_block)))
-                    return 0;
-            }
+            if(!sd_raw_cache_block(block_address, 1))
+                return 0;
+        }
+#if SD_RAW_CACHE_STATS
+        else
+        {
+            ++cache_stats.hits;
+        }
 #endif
-            /* address card */
-            select_card();
 
-            /* send single block request */
-            if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, block_address))
+        memcpy(buffer, raw_block + block_offset, read_length);
+        buffer += read_length;
+#else
+        uint16_t i;
+
+#if SD_RAW_READ_STREAMING
+        if(!sd_raw_read_stream_finish())
+            return 0;
+#endif
+        /* address card */
+        select_card();
+
+        /* send single block request */
+        if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, sd_raw_block_arg(block_address)))
+        {
+            unselect_card();
+            return 0;
+        }
+
+        /* wait for data block (start byte 0xfe) */
+        i = 0;
+        while(sd_raw_rec_byte() != 0xfe)
+        {
+            if(++i == 0)
             {
                 unselect_card();
                 return 0;
             }
+        }
 
-            /* wait for data block (start byte 0xfe) */
+        /* read byte block */
+        uint16_t read_to = block_offset + read_length;
+        for(i = 0; i < 512; ++i)
+        {
+            uint8_t b = sd_raw_rec_byte();
+            if(i >= block_offset && i < read_to)
+                *buffer++ = b;
+        }
 
-    i = 0;
-    while(sd_raw_rec_byte() != 0xfe) {
-      i++;
-      if (i == 0) {
-	unselect_card();
-	return 0;
-      }
+        /* read crc16 */
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+
+        /* deaddress card */
+        unselect_card();
+
+        /* let card some time to finish */
+        sd_raw_rec_byte();
+#endif
+
+        length -= read_length;
+        offset += read_length;
     }
 
-#if SD_RAW_SAVE_RAM
-            /* read byte block */
-            uint16_t read_to = block_offset + read_length;
-            for(i = 0; i < 512; ++i)
-            {
-                uint8_t b = sd_raw_rec_byte();
-                if(i >= block_offset && i < read_to)
-                    *buffer++ = b;
-            }
-#else
-            /* read byte block */
-            uint8_t* cache = raw_block;
-            for(i = 0; i < 512; ++i)
-                *cache++ = sd_raw_rec_byte();
-            raw_block_address = block_address;
+    return 1;
+}
 
-            memcpy(buffer, raw_block + block_offset, read_length);
-            buffer += read_length;
+#if !SD_RAW_SAVE_RAM
+/**
+ * \ingroup sd_raw
+ * Makes a block the one held in raw_block.
+ *
+ * If raw_block holds changes not yet written, they are written out
+ * first, so the card still sees writes in the order they were made.
+ * With SD_RAW_CACHE_BLOCKS above one, the block may still be cached
+ * from earlier; if not, it replaces the cached block used longest ago.
+ *
+ * \param[in] block_address The offset of the block on the card.
+ * \param[in] load Whether to read the block's content from the card,
+ *                 if it is not cached.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_cache_block(offset_t block_address, uint8_t load)
+{
+#if SD_RAW_WRITE_BUFFERING
+    if(!raw_block_written)
+    {
+        if(!sd_raw_write(raw_block_address, raw_block, sizeof(raw_block)))
+            return 0;
+    }
 #endif
-            
-            /* read crc16 */
-            sd_raw_rec_byte();
-            sd_raw_rec_byte();
-            
-            /* deaddress card */
+
+#if SD_RAW_CACHE_BLOCKS > 1
+    /* look for the block, and for the one used longest ago */
+    uint8_t slot;
+    uint8_t oldest = 0;
+    for(slot = 0; slot < SD_RAW_CACHE_BLOCKS; ++slot)
+    {
+        if(raw_cache_address[slot] == block_address)
+            break;
+        if(raw_cache_age[slot] > raw_cache_age[oldest])
+            oldest = slot;
+    }
+
+    uint8_t hit = slot < SD_RAW_CACHE_BLOCKS;
+    if(!hit)
+        slot = oldest;
+
+    /* all blocks used less recently than this one are one use older now */
+    uint8_t i;
+    for(i = 0; i < SD_RAW_CACHE_BLOCKS; ++i)
+    {
+        if(raw_cache_age[i] < raw_cache_age[slot])
+            ++raw_cache_age[i];
+    }
+    raw_cache_age[slot] = 0;
+    raw_slot = slot;
+
+    if(hit)
+    {
+#if SD_RAW_CACHE_STATS
+        if(load)
+            ++cache_stats.hits;
+#endif
+        return 1;
+    }
+#endif
+
+    if(load)
+    {
+#if SD_RAW_CACHE_STATS
+        ++cache_stats.misses;
+#endif
+        raw_block_address = 0xffffffff;
+        if(!sd_raw_read_block(block_address))
+            return 0;
+    }
+    raw_block_address = block_address;
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Reads a block from the card into raw_block.
+ *
+ * A block directly following the one read before is read with a
+ * multi-block read, which is kept open for the next one, as long as
+ * nothing else is sent to the card in between. So the card can read
+ * ahead, and the blocks come without a command each.
+ *
+ * \param[in] block_address The offset of the block on the card.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_read_stream_finish
+ */
+uint8_t sd_raw_read_block(offset_t block_address)
+{
+    uint16_t i;
+
+#if SD_RAW_WRITE_STREAMING
+    if(!sd_raw_stream_finish())
+        return 0;
+#endif
+
+#if SD_RAW_READ_STREAMING
+    if(block_address != read_stream_address)
+    {
+        /* the card sends nothing but the next block during a multi-block read */
+        if(!sd_raw_read_stream_finish())
+            return 0;
+
+        if(block_address == read_last_address + 512)
+        {
+            /* two blocks in a row, so assume more are to come */
+            select_card();
+            if(sd_raw_send_command_r1(CMD_READ_MULTIPLE_BLOCK, sd_raw_block_arg(block_address)))
+            {
+                unselect_card();
+                return 0;
+            }
             unselect_card();
 
-            /* let card some time to finish */
-            sd_raw_rec_byte();
+            read_stream_address = block_address;
         }
-#if !SD_RAW_SAVE_RAM
-        else
+    }
+    read_last_address = block_address;
+#endif
+
+    /* address card */
+    select_card();
+
+#if SD_RAW_READ_STREAMING
+    if(block_address == read_stream_address)
+        /* the multi-block read is open, the block is on its way */
+        read_stream_address += 512;
+    else
+#endif
+    /* send single block request */
+    if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, sd_raw_block_arg(block_address)))
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* wait for data block (start byte 0xfe) */
+    i = 0;
+    while(sd_raw_rec_byte() != 0xfe)
+    {
+        if(++i == 0)
         {
-            /* use cached data */
-            memcpy(buffer, raw_block + block_offset, read_length);
-            buffer += read_length;
+            unselect_card();
+#if SD_RAW_READ_STREAMING
+            sd_raw_read_stream_finish();
+#endif
+            return 0;
         }
+    }
+
+    /* read byte block */
+    uint8_t* cache = raw_block;
+    for(i = 0; i < 512; ++i)
+        *cache++ = sd_raw_rec_byte();
+
+    /* read crc16 */
+    sd_raw_rec_byte();
+    sd_raw_rec_byte();
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+
+    return 1;
+}
 #endif
 
-        length -= read_length;
-        offset += read_length;
+/**
+ * \ingroup sd_raw
+ * Ends an open multi-block read, if any.
+ *
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_read_block
+ */
+uint8_t sd_raw_read_stream_finish()
+{
+#if SD_RAW_READ_STREAMING
+    if(read_stream_address == 0xffffffff)
+        return 1;
+    read_stream_address = 0xffffffff;
+
+    /* address card */
+    select_card();
+
+    /* send stop transmission command */
+    sd_raw_send_byte(0x40 | CMD_STOP_TRANSMISSION);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0xff);
+
+    /* the card may still have been sending data, so skip the stuff byte */
+    sd_raw_rec_byte();
+
+    /* receive response */
+    uint8_t response;
+    uint8_t i;
+    for(i = 0; i < 10; ++i)
+    {
+        response = sd_raw_rec_byte();
+        if(response != 0xff)
+            break;
     }
 
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* deaddress card */
+    unselect_card();
+
+    if(response == 0xff)
+        card_lost = 1;
+    if(response)
+        return 0;
+#endif
     return 1;
 }
 
@@ -471,7 +853,7 @@ uint8_t sd_raw_read(uint32_t offset, uint8_t* buffer, uint16_t length)
  * \returns 0 on failure, 1 on success
  * \see sd_raw_write_interval, sd_raw_read, sd_raw_write
  */
-uint8_t sd_raw_read_interval(uint32_t offset, uint8_t* buffer, uint16_t interval, uint16_t length, sd_raw_read_interval_handler_t callback, void* p)
+uint8_t sd_raw_read_interval(offset_t offset, uint8_t* buffer, uint16_t interval, uint16_t length, sd_raw_read_interval_handler_t callback, void* p)
 {
     if(!buffer || interval == 0 || length < interval || !callback)
         return 0;
@@ -506,7 +888,7 @@ uint8_t sd_raw_read_interval(uint32_t offset, uint8_t* buffer, uint16_t interval
         read_length = 512 - block_offset;
         
         /* send single block request */
-        if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, offset & 0xfffffe00))
+        if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, sd_raw_block_arg(offset & ~(offset_t) 0x1ff)))
         {
             unselect_card();
             return 0;
@@ -551,7 +933,7 @@ uint8_t sd_raw_read_interval(uint32_t offset, uint8_t* buffer, uint16_t interval
         if(length < interval)
             break;
 
-        offset = (offset & 0xfffffe00) + 512;
+        offset = (offset & ~(offset_t) 0x1ff) + 512;
 
     } while(!finished);
     
@@ -579,22 +961,21 @@ uint8_t sd_raw_read_interval(uint32_t offset, uint8_t* buffer, uint16_t interval
  * \returns 0 on failure, 1 on success.
  * \see sd_raw_write_interval, sd_raw_read, sd_raw_read_interval
  */
-uint8_t sd_raw_write(uint32_t offset, const uint8_t* buffer, uint16_t length)
+uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uint16_t length)
 {
 #if SD_RAW_WRITE_SUPPORT
 
     if(get_pin_locked())
         return 0;
 
-    uint32_t block_address;
+    offset_t block_address;
     uint16_t block_offset;
     uint16_t write_length;
-    uint16_t i;
 
     while(length > 0)
     {
         /* determine byte count to write at once */
-        block_address = offset & 0xfffffe00;
+        block_address = offset & ~(offset_t) 0x1ff;
         block_offset = offset & 0x01ff;
         write_length = 512 - block_offset; /* write up to block border */
         if(write_length > length)
@@ -605,20 +986,8 @@ uint8_t sd_raw_write(uint32_t offset, const uint8_t* buffer, uint16_t length)
          */
         if(block_address != raw_block_address)
         {
-#if SD_RAW_WRITE_BUFFERING
-            if(!raw_block_written)
-            {
-                if(!sd_raw_write(raw_block_address, raw_block, sizeof(raw_block)))
-                    return 0;
-            }
-#endif
-
-            if(block_offset || write_length < 512)
-            {
-                if(!sd_raw_read(block_address, raw_block, sizeof(raw_block)))
-                    return 0;
-            }
-            raw_block_address = block_address;
+            if(!sd_raw_cache_block(block_address, block_offset || write_length < 512))
+                return 0;
         }
 
         if(buffer != raw_block)
@@ -635,49 +1004,208 @@ uint8_t sd_raw_write(uint32_t offset, const uint8_t* buffer, uint16_t length)
 
         buffer += write_length;
 
-        /* address card */
-        select_card();
+        if(!sd_raw_write_block(block_address))
+            return 0;
 
-        /* send single block request */
-        if(sd_raw_send_command_r1(CMD_WRITE_SINGLE_BLOCK, block_address))
+        length -= write_length;
+        offset += write_length;
+
+#if SD_RAW_WRITE_BUFFERING
+        raw_block_written = 1;
+#endif
+    }
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Programs the content of raw_block into a block on the card.
+ *
+ * While streaming is enabled, a block directly following the one
+ * written before is sent as part of a multi-block write, and the
+ * multi-block write is kept open for the next one. Any other block
+ * ends it and is written on its own.
+ *
+ * \param[in] block_address The offset of the block on the card.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_stream_begin
+ */
+uint8_t sd_raw_write_block(offset_t block_address)
+{
+#if SD_RAW_WRITE_SUPPORT
+    uint16_t i;
+    uint8_t token = 0xfe;
+    uint8_t response;
+
+#if SD_RAW_READ_STREAMING
+    if(!sd_raw_read_stream_finish())
+        return 0;
+#endif
+
+#if SD_RAW_WRITE_STREAMING
+    if(block_address != stream_block_address)
+    {
+        /* the card accepts nothing but the next block during a multi-block write */
+        if(!sd_raw_stream_finish())
+            return 0;
+
+        if(stream_enabled && block_address == stream_last_address + 512)
         {
+            /* two blocks in a row, so assume more are to come */
+            select_card();
+            if(sd_raw_send_command_r1(CMD_WRITE_MULTIPLE_BLOCK, sd_raw_block_arg(block_address)))
+            {
+                unselect_card();
+                return 0;
+            }
             unselect_card();
-            return 0;
+
+            stream_block_address = block_address;
         }
+    }
+    stream_last_address = block_address;
+#endif
 
-        /* send start byte */
-        sd_raw_send_byte(0xfe);
+    /* address card */
+    select_card();
 
-        /* write byte block */
-        uint8_t* cache = raw_block;
-        for(i = 0; i < 512; ++i)
-            sd_raw_send_byte(*cache++);
+#if SD_RAW_WRITE_STREAMING
+    if(block_address == stream_block_address)
+    {
+        /* the multi-block write is open, just send the data token */
+        token = 0xfc;
+        stream_block_address += 512;
+    }
+    else
+#endif
+    /* send single block request */
+    if(sd_raw_send_command_r1(CMD_WRITE_SINGLE_BLOCK, sd_raw_block_arg(block_address)))
+    {
+        unselect_card();
+        return 0;
+    }
 
-        /* write dummy crc16 */
-        sd_raw_send_byte(0xff);
-        sd_raw_send_byte(0xff);
+    /* send start byte */
+    sd_raw_send_byte(token);
 
-        /* wait while card is busy */
-        while(sd_raw_rec_byte() != 0xff);
-        sd_raw_rec_byte();
+    /* write byte block */
+    uint8_t* cache = raw_block;
+    for(i = 0; i < 512; ++i)
+        sd_raw_send_byte(*cache++);
 
-        /* deaddress card */
-        unselect_card();
+    /* write dummy crc16 */
+    sd_raw_send_byte(0xff);
+    sd_raw_send_byte(0xff);
 
-        length -= write_length;
-        offset += write_length;
+    /* wait while card is busy */
+    response = sd_raw_rec_byte();
+    while(sd_raw_rec_byte() != 0xff);
+    sd_raw_rec_byte();
 
-#if SD_RAW_WRITE_BUFFERING
-        raw_block_written = 1;
+    /* deaddress card */
+    unselect_card();
+
+    if((response & 0x1f) != DR_STATUS_ACCEPTED)
+    {
+        if(response == 0xff)
+            /* nobody answered, the card is gone */
+            card_lost = 1;
+#if SD_RAW_WRITE_STREAMING
+        /* the card rejected the block, so give up the multi-block write */
+        if(token == 0xfc)
+            sd_raw_stream_finish();
 #endif
+        /* the block stays in raw_block, for the next write or sync to retry */
+        return 0;
     }
-    
+
     return 1;
 #else
     return 0;
 #endif
 }
 
+/**
+ * \ingroup sd_raw
+ * Ends an open multi-block write, if any.
+ *
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_write_block
+ */
+uint8_t sd_raw_stream_finish()
+{
+#if SD_RAW_WRITE_STREAMING
+    if(stream_block_address == 0xffffffff)
+        return 1;
+    stream_block_address = 0xffffffff;
+
+    /* address card */
+    select_card();
+
+    /* send stop transmission token */
+    sd_raw_send_byte(0xfd);
+    sd_raw_rec_byte();
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* deaddress card */
+    unselect_card();
+#endif
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Starts streaming writes to the card.
+ *
+ * From now on, whenever blocks are written one after another at
+ * consecutive addresses, they are sent with a single open-ended
+ * CMD25 multi-block write instead of one CMD24 per block. This
+ * saves the command overhead and lets the card program the blocks
+ * back to back, which is much faster on most cards. Writes to any
+ * other address simply end the multi-block write and go out as
+ * single block writes, as do all reads, so streaming is transparent
+ * to the higher level modules.
+ *
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_stream_end
+ */
+uint8_t sd_raw_stream_begin()
+{
+#if SD_RAW_WRITE_STREAMING
+    stream_enabled = 1;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Stops streaming writes to the card.
+ *
+ * Writes out the write buffer and ends any open multi-block write.
+ *
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_stream_begin
+ */
+uint8_t sd_raw_stream_end()
+{
+#if SD_RAW_WRITE_STREAMING
+    stream_enabled = 0;
+    if(!sd_raw_sync())
+        return 0;
+    return sd_raw_stream_finish();
+#else
+    return 0;
+#endif
+}
+
 /**
  * \ingroup sd_raw
  * Writes a continuous data stream obtained from a callback function.
@@ -696,7 +1224,7 @@ uint8_t sd_raw_write(uint32_t offset, const uint8_t* buffer, uint16_t length)
  * \returns 0 on failure, 1 on success
  * \see sd_raw_read_interval, sd_raw_write, sd_raw_read
  */
-uint8_t sd_raw_write_interval(uint32_t offset, uint8_t* buffer, uint16_t length, sd_raw_write_interval_handler_t callback, void* p)
+uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uint16_t length, sd_raw_write_interval_handler_t callback, void* p)
 {
 #if SD_RAW_WRITE_SUPPORT
 
@@ -760,6 +1288,36 @@ uint8_t sd_raw_sync()
 #endif
 }
 
+/**
+ * \ingroup sd_raw
+ * Starts writing a block from scratch.
+ *
+ * Makes the block the one merged with by the next sd_raw_write(),
+ * filled with zeros instead of being read from the card. Use this
+ * before writing parts of a block whose old content does not matter,
+ * like one behind the end of a file being appended to.
+ *
+ * If the block is the one buffered already, its content is kept.
+ *
+ * \param[in] offset The offset of the block, a multiple of 512.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_write
+ */
+uint8_t sd_raw_clear_block(offset_t offset)
+{
+#if SD_RAW_WRITE_SUPPORT
+    if(offset == raw_block_address)
+        return 1;
+    if(!sd_raw_cache_block(offset, 0))
+        return 0;
+
+    memset(raw_block, 0, sizeof(raw_block));
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 /**
  * \ingroup sd_raw
  * Reads informational data from the card.
@@ -784,6 +1342,15 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
 
     memset(info, 0, sizeof(*info));
 
+#if SD_RAW_WRITE_STREAMING
+    if(!sd_raw_stream_finish())
+        return 0;
+#endif
+#if SD_RAW_READ_STREAMING
+    if(!sd_raw_read_stream_finish())
+        return 0;
+#endif
+
     select_card();
 
     /* read cid register */
@@ -833,9 +1400,10 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
     }
 
     /* read csd register */
+    uint8_t csd_structure = 0;
     uint8_t csd_read_bl_len = 0;
     uint8_t csd_c_size_mult = 0;
-    uint16_t csd_c_size = 0;
+    uint32_t csd_c_size = 0;
     if(sd_raw_send_command_r1(CMD_SEND_CSD, 0))
     {
         unselect_card();
@@ -846,30 +1414,59 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
     {
         uint8_t b = sd_raw_rec_byte();
 
-        switch(i)
+        if(csd_structure == 0x01)
         {
-            case 5:
-                csd_read_bl_len = b & 0x0f;
-                break;
-            case 6:
-                csd_c_size = (uint16_t) (b & 0x03) << 8;
-                break;
-            case 7:
-                csd_c_size |= b;
-                csd_c_size <<= 2;
-                break;
-            case 8:
-                csd_c_size |= b >> 6;
-                ++csd_c_size;
-                break;
-            case 9:
-                csd_c_size_mult = (b & 0x03) << 1;
-                break;
-            case 10:
-                csd_c_size_mult |= b >> 7;
-
-                info->capacity = (uint32_t) csd_c_size << (csd_c_size_mult + csd_read_bl_len + 2);
+            /* version 2.0, for SDHC cards: capacity = (c_size + 1) * 512kB */
+            switch(i)
+            {
+                case 7:
+                    csd_c_size = (uint32_t) (b & 0x3f) << 16;
+                    break;
+                case 8:
+                    csd_c_size |= (uint32_t) b << 8;
+                    break;
+                case 9:
+                    csd_c_size |= b;
+                    ++csd_c_size;
+                    info->capacity = (offset_t) csd_c_size * 512 * 1024;
+                    break;
+            }
+        }
+        else
+        {
+            /* version 1.0: capacity = (c_size + 1) << (c_size_mult + read_bl_len + 2) */
+            switch(i)
+            {
+                case 5:
+                    csd_read_bl_len = b & 0x0f;
+                    break;
+                case 6:
+                    csd_c_size = (uint16_t) (b & 0x03) << 8;
+                    break;
+                case 7:
+                    csd_c_size |= b;
+                    csd_c_size <<= 2;
+                    break;
+                case 8:
+                    csd_c_size |= b >> 6;
+                    ++csd_c_size;
+                    break;
+                case 9:
+                    csd_c_size_mult = (b & 0x03) << 1;
+                    break;
+                case 10:
+                    csd_c_size_mult |= b >> 7;
+
+                    info->capacity = (offset_t) csd_c_size << (csd_c_size_mult + csd_read_bl_len + 2);
+
+                    break;
+            }
+        }
 
+        switch(i)
+        {
+            case 0:
+                csd_structure = b >> 6;
                 break;
             case 14:
                 if(b & 0x40)
@@ -888,3 +1485,17 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
     return 1;
 }
 
+#if SD_RAW_CACHE_STATS
+/**
+ * \ingroup sd_raw
+ * Returns how many reads the block cache served since startup,
+ * and how many blocks had to be read from the card.
+ *
+ * \param[out] stats A pointer to the structure into which to save the counts.
+ */
+void sd_raw_get_cache_stats(struct sd_raw_cache_stats* stats)
+{
+    *stats = cache_stats;
+    stats->blocks = SD_RAW_CACHE_BLOCKS;
+}
+#endif
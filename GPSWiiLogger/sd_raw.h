@@ -85,7 +85,7 @@ struct sd_raw_info
     /**
      * The card's total capacity in bytes.
      */
-    uint32_t capacity;
+    offset_t capacity;
     /**
      * Defines wether the card's content is original or copied.
      *
@@ -116,20 +116,48 @@ struct sd_raw_info
     uint8_t format;
 };
 
-typedef uint8_t (*sd_raw_read_interval_handler_t)(uint8_t* buffer, uint32_t offset, void* p);
-typedef uint16_t (*sd_raw_write_interval_handler_t)(uint8_t* buffer, uint32_t offset, void* p);
+/**
+ * This struct is used by sd_raw_get_cache_stats() to return
+ * how well the block cache is doing.
+ */
+struct sd_raw_cache_stats
+{
+    /**
+     * The number of reads served from a cached block.
+     */
+    uint32_t hits;
+    /**
+     * The number of blocks read from the card.
+     */
+    uint32_t misses;
+    /**
+     * The number of blocks the cache holds, see SD_RAW_CACHE_BLOCKS.
+     */
+    uint8_t blocks;
+};
+
+typedef uint8_t (*sd_raw_read_interval_handler_t)(uint8_t* buffer, offset_t offset, void* p);
+typedef uint16_t (*sd_raw_write_interval_handler_t)(uint8_t* buffer, offset_t offset, void* p);
 
 uint8_t sd_raw_init();
 uint8_t sd_raw_available();
 uint8_t sd_raw_locked();
 
-uint8_t sd_raw_read(uint32_t offset, uint8_t* buffer, uint16_t length);
-uint8_t sd_raw_read_interval(uint32_t offset, uint8_t* buffer, uint16_t interval, uint16_t length, sd_raw_read_interval_handler_t callback, void* p);
-uint8_t sd_raw_write(uint32_t offset, const uint8_t* buffer, uint16_t length);
-uint8_t sd_raw_write_interval(uint32_t offset, uint8_t* buffer, uint16_t length, sd_raw_write_interval_handler_t callback, void* p);
+uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uint16_t length);
+uint8_t sd_raw_read_interval(offset_t offset, uint8_t* buffer, uint16_t interval, uint16_t length, sd_raw_read_interval_handler_t callback, void* p);
+uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uint16_t length);
+uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uint16_t length, sd_raw_write_interval_handler_t callback, void* p);
 uint8_t sd_raw_sync();
+uint8_t sd_raw_clear_block(offset_t offset);
+uint8_t sd_raw_stream_begin();
+uint8_t sd_raw_stream_end();
+
+uint8_t sd_raw_read_stream_finish();
 
 uint8_t sd_raw_get_info(struct sd_raw_info* info);
+#if SD_RAW_CACHE_STATS
+void sd_raw_get_cache_stats(struct sd_raw_cache_stats* stats);
+#endif
 
 /**
  * @}
@@ -11,6 +11,8 @@
 #ifndef SD_RAW_CONFIG_H
 #define SD_RAW_CONFIG_H
 
+#include <stdint.h>
+
 /**
  * \addtogroup sd_raw
  *
@@ -39,6 +41,71 @@
  */
 #define SD_RAW_WRITE_BUFFERING 1
 
+/**
+ * \ingroup sd_raw_config
+ * Controls MMC/SD multi-block write streaming.
+ *
+ * Set to 1 to let sd_raw_stream_begin() write runs of consecutive
+ * blocks with a single CMD25 instead of one CMD24 per block, set
+ * to 0 to disable it.
+ *
+ * \note This option has no effect when SD_RAW_WRITE_SUPPORT is 0.
+ */
+#define SD_RAW_WRITE_STREAMING 1
+
+/**
+ * \ingroup sd_raw_config
+ * Controls SDHC and SDXC support.
+ *
+ * Set to 1 to support cards of more than 2GB, which are addressed by
+ * block instead of by byte, set to 0 to disable it. Card offsets then
+ * take 64 bits, see offset_t, and FAT32 support comes along (see
+ * FAT16_FAT32_SUPPORT).
+ *
+ * Off by default, as nobody has weighed the 64 bit arithmetic against
+ * the ATmega168's flash and RAM yet. Build with -DSD_RAW_SDHC=1 on a
+ * bigger part.
+ */
+#ifndef SD_RAW_SDHC
+#define SD_RAW_SDHC 0
+#endif
+
+/**
+ * \ingroup sd_raw_config
+ * Controls MMC/SD multi-block read streaming.
+ *
+ * Set to 1 to read runs of consecutive blocks with a single CMD18
+ * instead of one CMD17 per block, set to 0 to disable it.
+ *
+ * \note This option has no effect when SD_RAW_SAVE_RAM is 1.
+ */
+#define SD_RAW_READ_STREAMING 1
+
+/**
+ * \ingroup sd_raw_config
+ * Number of blocks kept in the MMC/SD block cache.
+ *
+ * Each block takes 512 bytes of static RAM, so the ATmega168 with
+ * its 1kB can only afford one. On bigger parts, more blocks keep the
+ * FAT and directory blocks cached while file data passes by.
+ *
+ * \note This option has no effect when SD_RAW_SAVE_RAM is 1.
+ */
+#ifndef SD_RAW_CACHE_BLOCKS
+#define SD_RAW_CACHE_BLOCKS 1
+#endif
+
+/**
+ * \ingroup sd_raw_config
+ * Controls counting of MMC/SD block cache hits and misses.
+ *
+ * Set to 1 to count them in sd_raw_get_cache_stats(), set to 0
+ * to disable it.
+ */
+#ifndef SD_RAW_CACHE_STATS
+#define SD_RAW_CACHE_STATS 0
+#endif
+
 /**
  * \ingroup sd_raw_config
  * Controls MMC/SD access buffering.
@@ -96,8 +163,8 @@
 
 
 
-#define configure_pin_available() 0
-#define configure_pin_locked() 0
+#define configure_pin_available() ((void) 0)
+#define configure_pin_locked() ((void) 0)
 
 #define get_pin_available() 0
 #define get_pin_locked() 0
@@ -114,6 +181,24 @@
 #else
 #undef SD_RAW_WRITE_BUFFERING
 #define SD_RAW_WRITE_BUFFERING 0
+#undef SD_RAW_WRITE_STREAMING
+#define SD_RAW_WRITE_STREAMING 0
+#endif
+#if SD_RAW_SAVE_RAM
+#undef SD_RAW_READ_STREAMING
+#define SD_RAW_READ_STREAMING 0
+#undef SD_RAW_CACHE_BLOCKS
+#define SD_RAW_CACHE_BLOCKS 1
+#endif
+
+/**
+ * \ingroup sd_raw_config
+ * A byte offset on the card.
+ */
+#if SD_RAW_SDHC
+typedef uint64_t offset_t;
+#else
+typedef uint32_t offset_t;
 #endif
 
 #endif
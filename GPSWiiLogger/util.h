@@ -2,7 +2,9 @@
 
 void ROM_putstring(const char *str, uint8_t nl);
 
+#ifndef UINT16_MAX
 #define UINT16_MAX 65535U
+#endif
 #define putstring(x) ROM_putstring(PSTR(x), 0)
 #define putstring_nl(x) ROM_putstring(PSTR(x), 1)
 #define nop asm volatile ("nop\n\t")
@@ -9,6 +9,7 @@
 //   Joystick Up   : show max accel values
 //   Joystick Down : show min accel values
 //   Joystick Right: toggle displaying acceleration in g's or raw values 
+//   Joystick Left : step through sample rates, 10/25/50/100 per second
 //   C button      : clear min/max
 //   Z button      : stop/start recording (not implemented yet)
 //
@@ -24,39 +25,69 @@
 //  LCD display layout 
 //   0123456789012345
 //  .----------------. 
-// 0|Rec    hh:dd:ss.| 
+// 0|Recnnn hh:dd:ss.| 
 // 1|g:xxxx,yyyy,zzzz| 
 //  '----------------' 
+//  where nnn is the sample rate
+//
+// Commands from the logger, one a line:
+//   sHHMMSS    : the time, and send the last second's samples, ten of
+//                them, zero padded ('S' if the logger is paused)
+//   sHHMMSS/nn : the same, but at most nn samples, averaged down from
+//                the sample rate to fit
+//   sHHMMSS/nnw: the same, with all 10 bits of each sample as "!ccccc"
+//   sHHMMSS/nnd: the same, delta coded, leaving out what doesn't fit
+//   T          : send how the sampling is keeping up, see sampler_report(),
+//                then "l<last>,<most>": LCD bytes sent per frame
 //
 
 
 #define ledPin    13
 #define lcdoutPin  7
 
+// the logger's serial line, which it shares with the GPS, so it can't go
+// faster than the GPS talks.  GPSWiiUITester's uiBaud must match.
+#define loggerBaud 4800
+
 #include "LCDSerial.h"
 
 LCDSerial lcdSerial =  LCDSerial(lcdoutPin);
 
+// fast-mode I2C; the nunchuck is fine with it, but the internal pull-ups
+// are too weak for 400kHz edges, so this wants ~2.2k pull-ups on SDA and
+// SCL.  Without them, make it 100000L.
+#define TWI_FREQ 400000L
 #include "wiichuck_funcs.h"
+#include "sampler_funcs.h"
 
 // sensor data in form:
 // "|xxyyzz|xxyyzz|....\n"
 // where 'xx','yy','zz'. are each a byte in ascii hex, 3-bytes per data payload
 // spaced in time equally between GPS readings
 // terminated with newline
-// every this many millisecs, read sensors, should be even mult of 1000
-// this MUST match the same defines in the user of this (e.g. GPSWiiLogger)
-#define sensorUpdatesPerSec 10
-#define sensorUpdateMillis (1000/sensorUpdatesPerSec)
-#define SENSORBUFFSIZE (3*sensorUpdatesPerSec)
-
-// overhead 
-#define sensorUpdateMillisWFudge (sensorUpdateMillis - 10)
-
-uint8_t sensorbuff[SENSORBUFFSIZE];
-uint8_t sensorbuffidx;
-uint8_t sensor_max[3];
-uint8_t sensor_min[3];
+// or, if asked for, "!ccccc!ccccc...\n" where the five c's are 6 bits each,
+// '0'+0 to '0'+63, most significant first: 10 bits each of x, y and z
+// or, delta coded, "#ccccc" every sensorKeyframeEvery samples and in
+// between each axis' change from the sample before, zig-zagged (0,-1,1,
+// -2,...) and sent 5 bits a char, '0'+0 to '0'+31, low bits first, with
+// 32 added to all but the last char: a change of up to 15 counts takes
+// a char, up to 511 two.  See sample_delta.h in GPSWiiLogger.
+// Timer1 takes one of these many samples a second (see sampler_funcs.h)
+uint8_t sensorRates[] = { 10, 25, 50, 100 };
+uint8_t rateidx;
+// samples sent a second when the logger does not say, what old ones expect
+#define sensorPacketLegacy 10
+// delta coded, a full sample this often so a lost char only spoils a few
+#define sensorKeyframeEvery 8
+// longest line the logger keeps, less the 'r' before and "\r" after
+#define sensorLineRoom 77
+
+// the LCD is redrawn this often, independent of the sampling; only the
+// chars that changed go out (see LCDSerial.h)
+#define lcdUpdateMillis 100
+uint8_t lcdFrameBytes;      // bytes the last redraw sent
+uint8_t lcdFrameBytesMax;   // and the most any did, since the last 'T'
+
 uint8_t sensor_offsets[3] =   // zero-offsets, with initial guess
     {
         127,127,127
@@ -67,18 +98,21 @@ uint8_t sensor_offsets[3] =   // zero-offsets, with initial guess
 #define sensor_range 4   // wii nunchuck accelerometer is +/- 2g => 4g total
 // see http://wiire.org/Chips/LIS3L02AL
 
-#define BUFFSIZE 75
-char buffer[BUFFSIZE];      // this is the double buffer
-uint8_t bufferidx;
+#define CMDSIZE 12
+char cmd[CMDSIZE];          // command line from the logger
+uint8_t cmdidx;
+uint8_t packet = sensorPacketLegacy;
 
 char timebuff[7] = "hhddss";
 
 uint8_t i;
 unsigned long lasttime;
+uint8_t lastdropped;
 unsigned long lastctrltime;
 uint8_t disp_mode;   // 0 = rec/play, 1 = max, 2 = min, 3 = lat/ong
 uint8_t rec_mode = 0;    // 1 = record, 0 = pause/stop
 uint8_t key_down;
+uint8_t rate_key_down;
 uint8_t display_gees = 0;
 
 #define DISP_REC 0
@@ -94,12 +128,13 @@ void setup()
     pinMode( ledPin, OUTPUT);
     digitalWrite( ledPin, HIGH);
 
-    Serial.begin(4800);          // This goes to data logger
+    Serial.begin(loggerBaud);    // This goes to data logger
     Serial.println("GPSWiiUI");
 
     lcdSerial.begin(9600);       // this goes to the LCD, don't change baud!
     lcdSerial.clearScreen();
     lcdSerial.print("GPSWiiUI");
+    lcdSerial.update();
 
     //frameBufferFixSpaces();
     
@@ -107,10 +142,8 @@ void setup()
     delay(100);
     wiichuck_begin();
 
-
-    // initialize any data that needs to be specific values
-    memset(sensor_max, 0, 3);
-    memset(sensor_min, 255,3);
+    // from here on only the Timer1 interrupt talks to the nunchuck
+    sampler_begin(sensorRates[rateidx], packet);
 
     delay(1000);
     digitalWrite( ledPin, LOW);
@@ -126,6 +159,116 @@ static char toHex(uint8_t h)
     return (h - 10 + 'A');
 }
 
+// sends one sample as "|xxyyzz", the top 8 bits, or as "!ccccc"
+static void printSample(uint16_t* xyz, uint8_t wide)
+{
+    char buff[8];
+    if( wide ) {
+        uint32_t v = ((uint32_t)xyz[0] << 20) | ((uint32_t)xyz[1] << 10) | xyz[2];
+        buff[0] = '!';
+        for( uint8_t j=0; j<5; j++ )
+            buff[1+j] = '0' + ((v >> (24-6*j)) & 0x3f);
+        buff[6] = 0;
+    } else {
+        buff[0] = '|';
+        for( uint8_t j=0; j<3; j++ ) {
+            buff[1+j*2] = toHex(xyz[j]>>6);
+            buff[2+j*2] = toHex(xyz[j]>>2);
+        }
+        buff[7] = 0;
+    }
+    Serial.print(buff);
+}
+
+// sends one sample delta coded against last, or as "#ccccc" if key.
+// Returns the chars sent, or 0 without sending any if it takes more
+// than room.
+static uint8_t printDelta(uint16_t* xyz, uint16_t* last, uint8_t key, uint8_t room)
+{
+    char buff[10];
+    uint8_t l = 0;
+    if( key ) {
+        uint32_t v = ((uint32_t)xyz[0] << 20) | ((uint32_t)xyz[1] << 10) | xyz[2];
+        buff[l++] = '#';
+        for( uint8_t j=0; j<5; j++ )
+            buff[l++] = '0' + ((v >> (24-6*j)) & 0x3f);
+    } else {
+        for( uint8_t j=0; j<3; j++ ) {
+            int16_t d = xyz[j] - last[j];
+            uint16_t z = (d < 0) ? ((uint16_t)(-d) << 1) - 1 : (uint16_t)d << 1;
+            while( z > 31 ) {
+                buff[l++] = '0' + 32 + (z & 31);
+                z >>= 5;
+            }
+            buff[l++] = '0' + z;
+        }
+    }
+    if( l > room )
+        return 0;
+    buff[l] = 0;
+    Serial.print(buff);
+    return l;
+}
+
+// answers "sHHMMSS", "sHHMMSS/nn", "sHHMMSS/nnw" or "sHHMMSS/nnd" in cmd,
+// len chars long
+static void sendSamples(uint8_t len)
+{
+    sample_t s;
+    // one dot means we're paused, two means we're recording
+    gps_status = (cmd[0]=='S') ? '.' : ':';
+    memcpy(timebuff, cmd+1, 6);
+
+    uint8_t want = sensorPacketLegacy;
+    uint8_t legacy = 1;
+    char form = 0;
+    if( len > 8 && cmd[7] == '/' ) {
+        want = atoi(cmd+8);
+        form = cmd[len-1];
+        if( want == 0 ) want = 1;
+        if( want > SAMPLER_RING ) want = SAMPLER_RING;
+        legacy = 0;
+    }
+    if( want != packet ) {      // average down to what fits from now on
+        packet = want;
+        sampler_set_rate(sensorRates[rateidx], packet);
+    }
+
+    delay(5); // this is needed or SoftSerial reading this will choke 
+    Serial.print( (rec_mode) ? 'r':'s' );
+    // send the last second's samples, dropping any older ones; old
+    // loggers get exactly ten, padded with zeros if short
+    while( sampler_available() > packet )
+        sampler_read(&s);
+    uint8_t n = (legacy) ? packet : sampler_available();
+    if( form == 'd' ) {
+        // the newest are left out if a shaky second doesn't fit
+        uint16_t last[3];
+        uint8_t room = sensorLineRoom;
+        uint8_t sent = 0;
+        for( i=0; i<n; i++) {
+            sampler_read(&s);
+            if( sent == i ) {
+                uint8_t l = printDelta(s.xyz, last, i % sensorKeyframeEvery == 0, room);
+                if( l ) {
+                    room -= l;
+                    sent++;
+                    memcpy(last, s.xyz, sizeof(last));
+                }
+            }
+        }
+    } else {
+        for( i=0; i<n; i++) {
+            if( !sampler_read(&s) )
+                memset(s.xyz, 0, sizeof(s.xyz));
+            printSample(s.xyz, form == 'w');
+        }
+    }
+    Serial.print("\r\n");
+
+    lastctrltime = millis(); // say we saw a command
+}
+
 //
 static void formatInt8(char* buff, int8_t v)
 {
@@ -171,30 +314,22 @@ void loop()
     digitalWrite(ledPin, LOW);
     
     unsigned long thistime = millis();
-    if( (thistime - lasttime) >= sensorUpdateMillisWFudge ) { 
+    if( (thistime - lasttime) >= lcdUpdateMillis ) { 
         lasttime = thistime;
         digitalWrite(ledPin, HIGH); // turn off "good data" LED so it pulses
         
-        // Acquire sensor readings
-        wiichuck_get_data();
-        for( i=0; i<3; i++ ) { // loop thru x,y,z parts
-            uint8_t v = wiichuck_accelbuf[i];
-            if( v > sensor_max[i] && v!=255 ) sensor_max[i] = v;
-            if( v < sensor_min[i] && v!=0   ) sensor_min[i] = v;
-        }
+        // Latest sensor readings, taken by the Timer1 interrupt
+        sampler_latest();
 
-        // Save data
-        memcpy(sensorbuff+sensorbuffidx, wiichuck_accelbuf, 3);
-        sensorbuffidx += 3;
-        if( sensorbuffidx == SENSORBUFFSIZE ) {
-            sensorbuffidx = 0;  // just loop, what else we gonna do?
+        // samples dropped since last time means nobody is polling us
+        if( sampler_dropped != lastdropped ) {
+            lastdropped = sampler_dropped;
             gps_status = ' ';
         }
 
         // Do UI Parsing
         if( wiichuck_cbutton() ) {      // C button == clear min/max
-            memset(sensor_max, 0, 3);   // reset maxs to 0
-            memset(sensor_min, 255,3);  // reset mins to 255
+            sampler_clear_minmax();
             display_gees = !display_gees;
             //for( i=0; i<3; i++ ) 
             //    sensor_offsets[i] = wiichuck_accelbuf[i];  // FIXME: wrong
@@ -217,6 +352,15 @@ void loop()
         if( wiichuck_joyx() > 0xA0 ) 
             display_gees = !display_gees;
 
+        // move stick to the left, and let go, for the next sample rate
+        if( wiichuck_joyx() < 0x40 ) {
+            rate_key_down = 1;
+        } else if( rate_key_down ) {
+            rate_key_down = 0;
+            rateidx = (rateidx+1) % sizeof(sensorRates);
+            sampler_set_rate(sensorRates[rateidx], packet);
+        }
+
         // Write to LCD
         lcdSerial.gotoPos(0,0);  // line 1
         if( disp_mode == DISP_MAX )
@@ -226,6 +370,11 @@ void loop()
         else 
             lcdSerial.print( (rec_mode) ? "Rec":"Stp");
 
+        uint8_t rate = sensorRates[rateidx];
+        lcdSerial.print( (rate>=100) ? (char)(rate/100 + '0') : ' ' );
+        lcdSerial.print( (rate>=10) ? (char)(rate/10%10 + '0') : ' ' );
+        lcdSerial.print( (char)(rate%10 + '0') );
+
         lcdSerial.gotoPos(0,7);
         // if no time from controller
         if( thistime - lastctrltime > 5000 ) {
@@ -246,8 +395,8 @@ void loop()
         char buff[5];
         for( i=0; i<3; i++) {
             uint8_t v;
-            if( disp_mode==DISP_MAX ) v = sensor_max[i];
-            else if( disp_mode==DISP_MIN ) v = sensor_min[i];
+            if( disp_mode==DISP_MAX ) v = sampler_max[i];
+            else if( disp_mode==DISP_MIN ) v = sampler_min[i];
             else v = wiichuck_accelbuf[i];
             if( display_gees ) {
                 int8_t vo = v - sensor_offsets[i];
@@ -262,48 +411,40 @@ void loop()
         // indicate status
         lcdSerial.gotoPos(0,15);
         lcdSerial.print(gps_status);
+
+        lcdFrameBytes = lcdSerial.update();
+        if( lcdFrameBytes > lcdFrameBytesMax ) lcdFrameBytesMax = lcdFrameBytes;
     }
 
     
     // get sensor dump commands from serial (e.g. GPSWiiLogger)
-    int n = Serial.available();
-    if( n > 6 ) {       // "s221359", 7 bytes 
-        char c = Serial.read();
-        if( c != 's' && c!='S' )  // command byte
-            return;
-        // one dot means we're paused, two means we're recording
-        gps_status = (c=='S') ? '.' : ':';
-
-        // do rest of parsing, for time
-        for( i=0; i<6; i++ )
-            timebuff[i] = Serial.read();
-        delay(5); // this is needed or SoftSerial reading this will choke 
-        Serial.print( (rec_mode) ? 'r':'s' );
-        // fill buffer with text version of sensor data
-        bufferidx = 0;
-        for( i=0; i< sensorUpdatesPerSec; i++) {
-            uint8_t si = (i*3);
-            buffer[bufferidx+0] = '|';
-            buffer[bufferidx+1] = toHex(sensorbuff[si+0]>>4);
-            buffer[bufferidx+2] = toHex(sensorbuff[si+0]);
-            buffer[bufferidx+3] = toHex(sensorbuff[si+1]>>4);
-            buffer[bufferidx+4] = toHex(sensorbuff[si+1]);
-            buffer[bufferidx+5] = toHex(sensorbuff[si+2]>>4);
-            buffer[bufferidx+6] = toHex(sensorbuff[si+2]);
-            bufferidx+=7;
+    while( Serial.available() ) {
+        c = Serial.read();
+        if( c != '\r' && c != '\n' ) {
+            // a command starts the line over: the logger prints its
+            // progress chars ('#', '|', '_', '?') on this line too,
+            // without newlines, right before its requests
+            if( c == 's' || c == 'S' || c == 'T' )
+                cmdidx = 0;
+            if( cmdidx < CMDSIZE-1 )
+                cmd[cmdidx++] = c;
+            continue;
         }
-        buffer[bufferidx++] = '\r';
-        buffer[bufferidx]   = '\n';
-        buffer[bufferidx+1] = 0;
-        
-        Serial.print(buffer); // dump it out
-
-        sensorbuffidx = 0;   // reset
-        memset(sensorbuff, 0, sizeof(sensorbuff));
-
-        lastctrltime = millis(); // say we saw a command
+        uint8_t len = cmdidx;
+        cmd[cmdidx] = 0;
+        cmdidx = 0;
+        if( len == 1 && cmd[0] == 'T' ) {
+            sampler_report();
+            Serial.print('l');
+            Serial.print((int)lcdFrameBytes, DEC);
+            Serial.print(',');
+            Serial.print((int)lcdFrameBytesMax, DEC);
+            Serial.print("\r\n");
+            lcdFrameBytesMax = 0;
+        }
+        else if( len >= 7 && (cmd[0] == 's' || cmd[0] == 'S') )
+            sendSamples(len);
     }
-        
 }
 
 /*
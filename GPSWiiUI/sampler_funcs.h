@@ -0,0 +1,253 @@
+//
+// sampler_funcs.h -- timer driven nunchuck sampling
+//
+// Timer1 runs in CTC mode and interrupts sampler_rate times a second,
+// so samples are spaced as evenly as the crystal allows, whatever the
+// LCD and the serial port are doing in loop().  Each tick's interrupt
+// reads the nunchuck and puts the accelerometer triplet, along with the
+// number of the tick it was taken at, into a ring buffer.  loop() takes
+// samples out with sampler_read() whenever it gets around to it.
+//
+// The interrupt only starts the transfer (see wiichuck_start_read());
+// the TWI interrupt finishes it and puts the sample in the ring, so
+// neither loop() nor any interrupt waits on the bus.  If the previous
+// transfer is still going on at the next tick, that tick is counted in
+// sampler_missed, and one stuck for two ticks gets the bus recovered
+// (see twi_watchdog()).
+//
+// The ring keeps the newest samples: if loop() does not keep up, the
+// oldest ones are dropped and counted in sampler_dropped.
+//
+// The rate can be changed on the fly with sampler_set_rate().  What
+// goes out to the logger is capped by its 4800 baud line and the 80
+// byte lines it takes, about 14 delta coded samples a second, so above
+// that each ring entry is the average of as many readings as it takes
+// to stay under the cap.  sampler_max and sampler_min still see every reading.
+//
+// Where the time goes per reading, at 16MHz (estimated, see
+// sampler_report()):
+//   Timer1 interrupt, starting the transfer      ~10us CPU
+//   ~11 TWI interrupts and sampler_got()         ~70us CPU
+//   the transfer on the bus                      ~0.8ms at 100kHz
+//                                                ~0.2ms at 400kHz
+// so 100 readings a second cost under 1% of the CPU and, at 400kHz, 2%
+// of the bus.  LCDSerial's Timer2 interrupt takes a few us a bit of
+// each LCD byte.  Built with LCD_TX_BLOCKING, LCDSerial instead turns
+// interrupts off for ~1ms a character, which holds up each of the TWI
+// interrupts in turn: a transfer started during an LCD update can then
+// take up to ~12ms, and at 100Hz the next tick finds it still going and
+// counts itself in sampler_missed.
+//
+// Uses Timer1, so not compatible with the Servo library or PWM on pins
+// 9 and 10.  Needs wiichuck_funcs.h included first.
+//
+
+#ifndef SAMPLER_FUNCS_H
+#define SAMPLER_FUNCS_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// samples the ring holds, a power of two
+#ifndef SAMPLER_RING
+#define SAMPLER_RING 16
+#endif
+
+#if SAMPLER_RING & (SAMPLER_RING - 1)
+#error "SAMPLER_RING must be a power of two"
+#endif
+
+#define SAMPLER_PRESCALE 64    // 250kHz timer clock at 16MHz, 4Hz lowest rate
+
+typedef struct {
+    uint16_t tick;      // timer tick it was taken at, 1/sampler_rate sec each
+    uint16_t xyz[3];    // 10 bit x,y,z accel, averaged if need be
+} sample_t;
+
+static sample_t sampler_ring[SAMPLER_RING];
+static volatile uint8_t sampler_head;    // where the ISR puts the next one
+static volatile uint8_t sampler_tail;    // where loop() takes the next one
+static volatile uint16_t sampler_tick;
+static uint16_t sampler_pending;          // tick of the transfer under way
+volatile uint8_t sampler_dropped;
+volatile uint8_t sampler_missed;
+
+uint8_t sampler_rate;
+uint8_t sampler_average;                  // readings averaged per ring entry
+static uint8_t sampler_watch_every;       // ticks between twi_watchdog()s
+static uint8_t sampler_watch_count;
+static uint16_t sampler_sum[3];          // of up to 64 10 bit readings
+static uint8_t sampler_summed;
+// time from tick to reading, in Timer1 counts (4us), for sampler_report()
+static uint16_t sampler_latency_max;
+static uint32_t sampler_latency_sum;
+static uint16_t sampler_latency_count;
+// full nunchuck reading of the last tick, buttons and joystick too
+static volatile uint8_t sampler_chuck[6];
+// extremes since sampler_clear_minmax(), of every sample taken
+volatile uint8_t sampler_max[3];
+volatile uint8_t sampler_min[3];
+
+static void sampler_clear_minmax(void)
+{
+    cli();
+    memset((uint8_t*)sampler_max, 0, 3);
+    memset((uint8_t*)sampler_min, 255, 3);
+    sei();
+}
+
+// Samples 'rate' times a second, putting at most 'per_sec' entries a
+// second in the ring by averaging readings.  Can be called any time
+// after sampler_begin().
+static void sampler_set_rate(uint8_t rate, uint8_t per_sec)
+{
+    if( rate < 4 ) rate = 4;
+    if( per_sec == 0 ) per_sec = 1;
+    cli();
+    sampler_rate = rate;
+    sampler_average = (rate + per_sec - 1) / per_sec;
+    if( sampler_average > 64 ) sampler_average = 64;
+    sampler_summed = 0;
+    // let a transfer held up by the LCD run for 40ms or more
+    sampler_watch_every = rate / 25 + 1;
+    OCR1A = (F_CPU / SAMPLER_PRESCALE) / rate - 1;
+    TCNT1 = 0;
+    sampler_latency_max = 0;
+    sampler_latency_sum = 0;
+    sampler_latency_count = 0;
+    sei();
+}
+
+// Starts sampling 'rate' times a second, keeping at most 'per_sec'
+// samples a second.  Call after wiichuck_begin().
+static void sampler_begin(uint8_t rate, uint8_t per_sec)
+{
+    sampler_head = sampler_tail = 0;
+    sampler_tick = 0;
+    sampler_dropped = 0;
+    sampler_missed = 0;
+    sampler_clear_minmax();
+
+    cli();
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);   // CTC on OCR1A, clk/64
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
+    sei();
+    sampler_set_rate(rate, per_sec);
+}
+
+// Returns how many samples are waiting in the ring.
+static uint8_t sampler_available(void)
+{
+    return (uint8_t)(sampler_head - sampler_tail);
+}
+
+// Takes the oldest sample out of the ring.  Returns 0 if there was none.
+static uint8_t sampler_read(sample_t* s)
+{
+    uint8_t ok = 0;
+    cli();
+    if( sampler_head != sampler_tail ) {
+        *s = sampler_ring[sampler_tail % SAMPLER_RING];
+        sampler_tail++;
+        ok = 1;
+    }
+    sei();
+    return ok;
+}
+
+// Copies the last full reading into wiichuck_buf, for the
+// wiichuck_zbutton(), wiichuck_joyx(), ... macros.
+static void sampler_latest(void)
+{
+    cli();
+    memcpy(wiichuck_buf, (uint8_t*)sampler_chuck, 6);
+    sei();
+}
+
+// Prints "t<rate>,<averaged>,<avg us>,<max us>,<missed>,<dropped>,<twi
+// errors>" to Serial: how long readings took to come in since the last
+// call, and what was lost since sampler_begin().
+static void sampler_report(void)
+{
+    cli();
+    uint16_t lmax = sampler_latency_max;
+    uint32_t lsum = sampler_latency_sum;
+    uint16_t lcount = sampler_latency_count;
+    sampler_latency_max = 0;
+    sampler_latency_sum = 0;
+    sampler_latency_count = 0;
+    sei();
+
+    uint16_t us_per_count = SAMPLER_PRESCALE / (F_CPU / 1000000);
+    Serial.print('t');
+    Serial.print((int)sampler_rate, DEC);
+    Serial.print(',');
+    Serial.print((int)sampler_average, DEC);
+    Serial.print(',');
+    Serial.print((long)(lcount ? lsum * us_per_count / lcount : 0), DEC);
+    Serial.print(',');
+    Serial.print((long)lmax * us_per_count, DEC);
+    Serial.print(',');
+    Serial.print((int)sampler_missed, DEC);
+    Serial.print(',');
+    Serial.print((int)sampler_dropped, DEC);
+    Serial.print(',');
+    Serial.print((int)twi_errors, DEC);
+    Serial.print("\r\n");
+}
+
+// Called from the TWI interrupt with the reading of tick sampler_pending.
+static void sampler_got(uint8_t status, uint8_t* buf, uint8_t len)
+{
+    // Timer1 restarted from 0 at the tick, unless the next one is due
+    uint16_t latency = TCNT1;
+    if( status != TWI_OK ) {
+        sampler_missed++;
+        return;
+    }
+    if( sampler_tick == (uint16_t)(sampler_pending+1) ) {
+        if( latency > sampler_latency_max ) sampler_latency_max = latency;
+        sampler_latency_sum += latency;
+        sampler_latency_count++;
+    }
+
+    memcpy((uint8_t*)sampler_chuck, buf, 6);
+    for( uint8_t i=0; i<3; i++ ) {
+        uint8_t v = buf[2+i];
+        if( v > sampler_max[i] && v!=255 ) sampler_max[i] = v;
+        if( v < sampler_min[i] && v!=0   ) sampler_min[i] = v;
+        sampler_sum[i] = (sampler_summed ? sampler_sum[i] : 0) + wiichuck_accel10(buf, i);
+    }
+    if( ++sampler_summed < sampler_average )
+        return;
+
+    if( (uint8_t)(sampler_head - sampler_tail) == SAMPLER_RING ) {
+        sampler_tail++;          // full, drop the oldest
+        sampler_dropped++;
+    }
+    sample_t* s = &sampler_ring[sampler_head % SAMPLER_RING];
+    s->tick = sampler_pending;
+    for( uint8_t i=0; i<3; i++ )
+        s->xyz[i] = (sampler_sum[i] + sampler_summed/2) / sampler_summed;
+    sampler_head++;
+    sampler_summed = 0;
+}
+
+SIGNAL(SIG_OUTPUT_COMPARE1A)
+{
+    uint16_t tick = sampler_tick++;
+
+    if( ++sampler_watch_count >= sampler_watch_every ) {
+        sampler_watch_count = 0;
+        twi_watchdog();
+    }
+    if( wiichuck_start_read(sampler_got) ) {
+        sampler_missed++;        // still busy with the last one
+        return;
+    }
+    sampler_pending = tick;
+}
+
+#endif
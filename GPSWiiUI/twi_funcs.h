@@ -43,6 +43,16 @@
 #define TWI_BUFFER_LENGTH 16
 #endif
 
+// how long the blocking calls wait for the bus, about 20ms at 16MHz
+#ifndef TWI_SPIN_LIMIT
+#define TWI_SPIN_LIMIT 50000U
+#endif
+
+// status passed to a twi_callback_t, and returned by the blocking calls
+#define TWI_OK      0
+#define TWI_TOOLONG 1
+#define TWI_ERROR   2   // nack, lost arbitration, bus error or timeout
+
 #define TWI_READY 0
 #define TWI_MRX   1
 #define TWI_MTX   2
@@ -64,6 +74,21 @@ static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];
 volatile uint8_t twi_masterBufferIndex;
 static uint8_t twi_masterBufferLength;
 
+// called from the TWI interrupt when a twi_startRead() read is done
+typedef void (*twi_callback_t)(uint8_t status, uint8_t* data, uint8_t length);
+static twi_callback_t twi_callback;
+
+// write to send right after the read, see twi_startRead()
+static uint8_t twi_chainBuffer[TWI_BUFFER_LENGTH];
+static uint8_t twi_chainLength;
+static uint8_t twi_chainAddress;
+
+// transfers given up on, for any reason
+volatile uint8_t twi_errors;
+static uint8_t twi_watch;
+
+void twi_recover(void);
+
 
 /* 
  * Function twi_init
@@ -76,7 +101,7 @@ void twi_init(void)
     // initialize state
     twi_state = TWI_READY;
 
-#if defined(__AVR_ATmega168__) || defined(__AVR_ATmega8__) || 
+#if defined(__AVR_ATmega168__) || defined(__AVR_ATmega8__) || \
     defined(__AVR_ATmega88__)
     // activate internal pull-ups for twi
     // as per note from atmega8 manual pg167
@@ -123,22 +148,27 @@ void twi_setAddress(uint8_t address)
  * Input    address: 7bit i2c device address
  *          data: pointer to byte array
  *          length: number of bytes to read into array
- * Output   byte: 0 ok, 1 length too long for buffer
+ * Output   byte: 0 ok, 1 length too long for buffer, 2 bus gave no answer
  */
 uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length)
 {
     uint8_t i;
+    uint16_t spins;
 
     // ensure data will fit into buffer
     if(TWI_BUFFER_LENGTH < length){
-        return 1;
+        return TWI_TOOLONG;
     }
 
     // wait until twi is ready, become master receiver
-    while(TWI_READY != twi_state){
-        continue;
+    for(spins = 0; TWI_READY != twi_state; ++spins){
+        if(spins == TWI_SPIN_LIMIT){
+            twi_recover();
+        }
     }
     twi_state = TWI_MRX;
+    twi_callback = 0;
+    twi_chainLength = 0;
 
     // initialize buffer iteration vars
     twi_masterBufferIndex = 0;
@@ -152,8 +182,11 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length)
 	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
 
 	// wait for read operation to complete
-	while(TWI_MRX == twi_state){
-        continue;
+	for(spins = 0; TWI_MRX == twi_state; ++spins){
+        if(spins == TWI_SPIN_LIMIT){
+            twi_recover();
+            return TWI_ERROR;
+        }
 	}
 
     // copy twi buffer to data
@@ -172,22 +205,27 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length)
  *          data: pointer to byte array
  *          length: number of bytes in array
  *          wait: boolean indicating to wait for write or not
- * Output   byte: 0 ok, 1 length too long for buffer
+ * Output   byte: 0 ok, 1 length too long for buffer, 2 bus gave no answer
  */
 uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait)
 {
     uint8_t i;
+    uint16_t spins;
 
     // ensure data will fit into buffer
     if(TWI_BUFFER_LENGTH < length){
-        return 1;
+        return TWI_TOOLONG;
     }
 
     // wait until twi is ready, become master transmitter
-    while(TWI_READY != twi_state){
-        continue;
+    for(spins = 0; TWI_READY != twi_state; ++spins){
+        if(spins == TWI_SPIN_LIMIT){
+            twi_recover();
+        }
     }
     twi_state = TWI_MTX;
+    twi_callback = 0;
+    twi_chainLength = 0;
 
     // initialize buffer iteration vars
     twi_masterBufferIndex = 0;
@@ -206,11 +244,79 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
 	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
 
 	// wait for write operation to complete
-	while(wait && (TWI_MTX == twi_state)){
-        continue;
+	for(spins = 0; wait && (TWI_MTX == twi_state); ++spins){
+        if(spins == TWI_SPIN_LIMIT){
+            twi_recover();
+            return TWI_ERROR;
+        }
 	}
 	
-	return 0;
+	return TWI_OK;
+}
+
+/* 
+ * Function twi_startRead
+ * Desc     starts reading a series of bytes from a device on the bus,
+ *          and returns right away.  The TWI interrupt calls done with
+ *          the bytes once they are in, then writes next to the device,
+ *          if nextLength isn't 0.  done runs with the bus held, so it
+ *          should be short.  Call with interrupts off, or from an ISR.
+ * Input    address: 7bit i2c device address
+ *          length: number of bytes to read
+ *          next: bytes to write after the read, may be 0
+ *          nextLength: number of bytes in next
+ *          done: called with TWI_OK or TWI_ERROR and the bytes read
+ * Output   byte: 0 started, 1 length too long or bus busy
+ */
+uint8_t twi_startRead(uint8_t address, uint8_t length,
+                      uint8_t* next, uint8_t nextLength, twi_callback_t done)
+{
+    uint8_t i;
+
+    if(TWI_BUFFER_LENGTH < length || TWI_BUFFER_LENGTH < nextLength){
+        return 1;
+    }
+    if(TWI_READY != twi_state){
+        return 1;
+    }
+    twi_state = TWI_MRX;
+    twi_watch = 0;
+
+    twi_masterBufferIndex = 0;
+    twi_masterBufferLength = length;
+    twi_callback = done;
+
+    for(i = 0; i < nextLength; ++i){
+        twi_chainBuffer[i] = next[i];
+    }
+    twi_chainLength = nextLength;
+    twi_chainAddress = address;
+
+    twi_slarw = TW_READ;
+	twi_slarw |= address << 1;
+
+	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+    return 0;
+}
+
+/* 
+ * Function twi_watchdog
+ * Desc     gives up on a transfer that has been going on since the
+ *          call before last.  Call it regularly, a few ms apart or more.
+ * Input    none
+ * Output   byte: 1 if the bus had to be recovered
+ */
+uint8_t twi_watchdog(void)
+{
+    if(TWI_READY == twi_state){
+        twi_watch = 0;
+        return 0;
+    }
+    if(++twi_watch < 2){
+        return 0;
+    }
+    twi_recover();
+    return 1;
 }
 
 
@@ -243,8 +349,13 @@ void twi_stop(void)
 
     // wait for stop condition to be exectued on bus
     // TWINT is not set after a stop condition!
-    while(TWCR & _BV(TWSTO)){
-        continue;
+    // a few us at 100kHz; a bus held low never lets it go
+    uint16_t spins;
+    for(spins = 0; TWCR & _BV(TWSTO); ++spins){
+        if(spins == TWI_SPIN_LIMIT){
+            twi_recover();
+            return;
+        }
     }
 
     // update twi state
@@ -267,6 +378,78 @@ void twi_releaseBus(void)
 }
 
 
+/* 
+ * Function twi_recover
+ * Desc     drops whatever the twi was doing, clocks SCL until a slave
+ *          stuck in the middle of a byte lets go of SDA, and starts
+ *          the twi afresh.  A twi_startRead() read gets TWI_ERROR.
+ * Input    none
+ * Output   none
+ */
+void twi_recover(void)
+{
+    uint8_t i;
+    twi_callback_t done = twi_callback;
+
+    TWCR = 0;   // twi off, SDA and SCL are plain pins again
+    twi_errors++;
+    twi_callback = 0;
+    twi_chainLength = 0;
+
+#if defined(__AVR_ATmega168__) || defined(__AVR_ATmega8__) || \
+    defined(__AVR_ATmega88__)
+    // SDA is PC4, SCL is PC5; drive SCL low or let the pull-up have it
+    for(i = 0; i < 9 && !(PINC & _BV(4)); ++i){
+        cbi(PORTC, 5);
+        sbi(DDRC, 5);
+        delayMicroseconds(5);
+        cbi(DDRC, 5);
+        sbi(PORTC, 5);
+        delayMicroseconds(5);
+    }
+#endif
+
+    twi_init();
+    if(done){
+        done(TWI_ERROR, twi_masterBuffer, 0);
+    }
+}
+
+/* 
+ * Function twi_readDone
+ * Desc     hands a twi_startRead() read to its callback, then sends
+ *          the chained write if there is one, or a stop
+ * Input    status: TWI_OK or TWI_ERROR
+ * Output   none
+ */
+static void twi_readDone(uint8_t status)
+{
+    uint8_t i;
+    twi_callback_t done = twi_callback;
+    twi_callback = 0;
+    if(done){
+        done(status, twi_masterBuffer, twi_masterBufferIndex);
+    }
+
+    if(TWI_OK != status || 0 == twi_chainLength){
+        twi_chainLength = 0;
+        twi_stop();
+        return;
+    }
+
+    // become master transmitter, stop and start again in one go
+    for(i = 0; i < twi_chainLength; ++i){
+        twi_masterBuffer[i] = twi_chainBuffer[i];
+    }
+    twi_masterBufferIndex = 0;
+    twi_masterBufferLength = twi_chainLength;
+    twi_chainLength = 0;
+    twi_slarw = TW_WRITE;
+    twi_slarw |= twi_chainAddress << 1;
+    twi_state = TWI_MTX;
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO) | _BV(TWSTA);
+}
+
 SIGNAL(SIG_2WIRE_SERIAL)
 {
     switch(TW_STATUS){
@@ -292,9 +475,17 @@ SIGNAL(SIG_2WIRE_SERIAL)
         break;
     case TW_MT_SLA_NACK:  // address sent, nack received
     case TW_MT_DATA_NACK: // data sent, nack received
+        twi_errors++;
         twi_stop();
         break;
     case TW_MT_ARB_LOST: // lost bus arbitration
+        twi_errors++;
+        if(TWI_MRX == twi_state && twi_callback){
+            twi_callback_t done = twi_callback;
+            twi_callback = 0;
+            twi_chainLength = 0;
+            done(TWI_ERROR, twi_masterBuffer, 0);
+        }
         twi_releaseBus();
         break;
 
@@ -313,10 +504,17 @@ SIGNAL(SIG_2WIRE_SERIAL)
     case TW_MR_DATA_NACK: // data received, nack sent
         // put final byte into buffer
         twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+        twi_readDone(TWI_OK);
+        break;
     case TW_MR_SLA_NACK: // address sent, nack received
-        twi_stop();
+        twi_errors++;
+        twi_readDone(TWI_ERROR);
         break;
         // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
+
+    case TW_BUS_ERROR: // illegal start or stop condition
+        twi_recover();
+        break;
     }
 }
 
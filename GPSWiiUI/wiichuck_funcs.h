@@ -38,20 +38,23 @@ uint8_t wiichuck_buf[6];
 // returns value of y-axis joystick
 #define wiichuck_joyy() (wiichuck_buf[1])
 
-// returns value of x-axis accelerometer
-// FIXME: this leaves out 2-bits of the data
+// returns top 8 bits of x-axis accelerometer
 #define wiichuck_accelx() (wiichuck_buf[2])
 
-// returns value of y-axis accelerometer
-// FIXME: this leaves out 2-bits of the data
+// returns top 8 bits of y-axis accelerometer
 #define wiichuck_accely() (wiichuck_buf[3])
 
-// returns value of x-axis accelerometer
-// FIXME: this leaves out 2-bits of the data
+// returns top 8 bits of z-axis accelerometer
 #define wiichuck_accelz() (wiichuck_buf[4])
 
 #define wiichuck_accelbuf ((uint8_t*)(wiichuck_buf+2))
 
+// returns all 10 bits of accelerometer axis a (0=x, 1=y, 2=z) of a 6 byte
+// reading: the top 8 from bytes 2-4, the low 2 from bits 2-3, 4-5 and
+// 6-7 of byte 5
+#define wiichuck_accel10(buf,a) \
+    ((((uint16_t)(buf)[2+(a)]) << 2) | (((buf)[5] >> (2+2*(a))) & 3))
+
 // Uses port C (analog in) pins as power & ground for Nunchuck
 static void wiichuck_setpowerpins()
 {
@@ -84,55 +87,70 @@ static char wiichuck_decode_byte (char x)
     return x;
 }
 
-// Receive data back from the nunchuck, 
+// Receive data back from the nunchuck into a 6 byte buffer,
 // returns 0 on successful read. returns 1 on failure
-static int wiichuck_get_data()
+static int wiichuck_read(uint8_t* buf)
 {
-    twi_readFrom( wiichuck_addr, wiichuck_buf, 6);// request data from nunchuck
+    twi_readFrom( wiichuck_addr, buf, 6);// request data from nunchuck
 
     for( uint8_t i=0; i<6; i++ )
-        wiichuck_buf[i] = wiichuck_decode_byte(wiichuck_buf[i]);
+        buf[i] = wiichuck_decode_byte(buf[i]);
 
     wiichuck_send_request();  // send request for next data payload
-    
+
     return 0; // success, and look, no error checking above since we are studly
 }
 
+// Receive data back from the nunchuck into wiichuck_buf
+static int wiichuck_get_data()
+{
+    return wiichuck_read(wiichuck_buf);
+}
+
+static twi_callback_t wiichuck_done;
+
+// TWI interrupt side of wiichuck_start_read()
+static void wiichuck_got_data(uint8_t status, uint8_t* buf, uint8_t len)
+{
+    if( status == TWI_OK && len == 6 ) {
+        for( uint8_t i=0; i<6; i++ )
+            buf[i] = wiichuck_decode_byte(buf[i]);
+    } else {
+        status = TWI_ERROR;
+    }
+    wiichuck_done(status, buf, len);
+}
+
+// Starts reading the nunchuck without waiting.  The TWI interrupt calls
+// done(TWI_OK, buf, 6) with the decoded bytes, or done(TWI_ERROR, ...),
+// then asks the nunchuck for the next reading on its own.
+// Returns 1 if the bus was still busy.  Call with interrupts off.
+static uint8_t wiichuck_start_read(twi_callback_t done)
+{
+    static uint8_t request = 0x00;
+    wiichuck_done = done;
+    return twi_startRead( wiichuck_addr, 6, &request, 1, wiichuck_got_data);
+}
+
 static void wiichuck_print_data()
 { 
     static int i=0;
     int joy_x_axis   = wiichuck_buf[0];
     int joy_y_axis   = wiichuck_buf[1];
-    int accel_x_axis = wiichuck_buf[2] << 2; 
-    int accel_y_axis = wiichuck_buf[3] << 2;
-    int accel_z_axis = wiichuck_buf[4] << 2;
+    int accel_x_axis = wiichuck_accel10(wiichuck_buf, 0);
+    int accel_y_axis = wiichuck_accel10(wiichuck_buf, 1);
+    int accel_z_axis = wiichuck_accel10(wiichuck_buf, 2);
 
     int z_button = 0;
     int c_button = 0;
 
     // byte wiichuck_buf[5] contains bits for z and c buttons
-    // it also contains the least significant bits for the accelerometer data
-    // so we have to check each bit of byte outbuf[5]
+    // (the rest are the accelerometers' low bits, see wiichuck_accel10())
     if ((wiichuck_buf[5] >> 0) & 1) 
         z_button = 1;
     if ((wiichuck_buf[5] >> 1) & 1)
         c_button = 1;
 
-    if ((wiichuck_buf[5] >> 2) & 1)  // lower 2 bits of accel Z
-        accel_x_axis += 2;
-    if ((wiichuck_buf[5] >> 3) & 1)
-        accel_x_axis += 1;
-
-    if ((wiichuck_buf[5] >> 4) & 1)  // lower 2 bits of accel Y
-        accel_y_axis += 2;
-    if ((wiichuck_buf[5] >> 5) & 1)
-        accel_y_axis += 1;
-
-    if ((wiichuck_buf[5] >> 6) & 1)  // lower 2 bits of accel Z
-        accel_z_axis += 2;
-    if ((wiichuck_buf[5] >> 7) & 1)
-        accel_z_axis += 1;
-
     Serial.print(i,HEX);
     Serial.print('\t');
     Serial.print("joy:");
@@ -5,6 +5,11 @@
   mods added by tod:
   - made includes relative so this library can be used in-sketch
   x allow tuning of AFSS_MAX_RX_BUFF (this doesn't work, why not)
+  - received bytes go in a ring, so read() no longer shifts them all
+  - recv() only catches the start bit, then Timer2's compare interrupt
+    samples the middle of each bit, so interrupts are held up a few us a
+    bit instead of a whole byte and 38400 baud works.  Uses Timer2, so
+    no PWM on pins 3 and 11.  Define AFSS_BUSY_RX for the old busy wait.
 
   This library is free software; you can redistribute it and/or
   modify it under the terms of the GNU Lesser General Public
@@ -32,8 +37,14 @@
  * Definitions
  ******************************************************************************/
 //#ifndef AFSS_MAX_RX_BUFF   this doesn't work, why not? (also no work in .h)
-#define AFSS_MAX_RX_BUFF 64
+#define AFSS_MAX_RX_BUFF 64   // a power of two up to 128
 //#endif
+//#define AFSS_BUSY_RX        // receive whole bytes in the pin change interrupt
+
+// cycles from an interrupt's flag being set to its digitalRead() being
+// done, about: recv() clears TCNT2 that late after the start bit's edge,
+// and Timer2's samples that late after each match
+#define AFSS_ISR_CYCLES 100
 
 /******************************************************************************
  * Statics
@@ -42,8 +53,23 @@ static uint8_t _receivePin;
 static uint8_t _transmitPin;
 static int _bitDelay;
 
-static char _receive_buffer[AFSS_MAX_RX_BUFF]; 
-static uint8_t _receive_buffer_index;
+// the pin change interrupt only moves the head and read() only the
+// tail, so neither has to turn interrupts off
+static volatile char _receive_buffer[AFSS_MAX_RX_BUFF]; 
+static volatile uint8_t _receive_buffer_head;  // where recv() puts the next byte
+static volatile uint8_t _receive_buffer_tail;  // where read() takes the next one
+static volatile uint8_t _receive_overflows;    // bytes dropped, the ring being full
+
+#ifndef AFSS_BUSY_RX
+static volatile uint8_t *_receivePCMSK;  // the RX pin's pin change mask
+static uint8_t _receivePCBit;            // and its bit in it
+static uint8_t _receivePCIE;             // and its bit in PCICR/PCIFR
+static uint8_t _bitTicks;                // Timer2 ticks a bit
+static uint8_t _firstTicks;              // TCNT2 cleared to first data bit
+static volatile uint8_t _framing_errors; // bytes without a stop bit
+static uint8_t _rxByte;                  // the bits so far, low first
+static uint8_t _rxBits = 9;              // how many, 8: stop bit next, 9: none
+#endif
 
 #if (F_CPU == 16000000)
 void whackDelay(uint16_t delay) { 
@@ -77,6 +103,20 @@ SIGNAL(SIG_PIN_CHANGE2)
 }
 
 
+// puts a received byte in the ring, or counts it if there's no room
+static void store(uint8_t d)
+{
+  uint8_t head = _receive_buffer_head;
+  if ((uint8_t)(head - _receive_buffer_tail) == AFSS_MAX_RX_BUFF) {
+    _receive_overflows++;
+    return;
+  }
+  _receive_buffer[head % AFSS_MAX_RX_BUFF] = d; // save data 
+  _receive_buffer_head = head + 1;  // got a byte, now read() may have it
+}
+
+#ifdef AFSS_BUSY_RX
+
 void recv(void) { 
   char i, d = 0; 
   if (digitalRead(_receivePin)) 
@@ -90,11 +130,50 @@ void recv(void) {
       d |= (1 << i); 
    } 
   whackDelay(_bitDelay*2);
-  if (_receive_buffer_index >=  AFSS_MAX_RX_BUFF)
-    return;
-  _receive_buffer[_receive_buffer_index] = d; // save data 
-  _receive_buffer_index++;  // got a byte 
+  store(d);
 } 
+
+#else
+
+void recv(void) {
+  if (digitalRead(_receivePin))
+    return;       // not a start bit
+  if (_rxBits == 8)
+    store(_rxByte);     // the stop bit's sample was held up
+  TCNT2 = 0;
+  OCR2A = _firstTicks - 1;
+  TIFR2 = _BV(OCF2A);
+  TIMSK2 |= _BV(OCIE2A);
+  *_receivePCMSK &= ~_BV(_receivePCBit);  // the data bits' edges are Timer2's
+  _rxBits = 0;
+}
+
+SIGNAL(SIG_OUTPUT_COMPARE2A)
+{
+  uint8_t level = digitalRead(_receivePin);
+  OCR2A = _bitTicks - 1;        // the counter restarted at the match
+  if (_rxBits < 8) {
+    _rxByte >>= 1;
+    if (level)
+      _rxByte |= 0x80;
+    if (++_rxBits == 8) {
+      // only the stop bit's edge, if any, is left before the next start
+      // bit, and recv() ignores a rising one
+      PCIFR = _BV(_receivePCIE);
+      *_receivePCMSK |= _BV(_receivePCBit);
+    }
+    return;
+  }
+  // middle of the stop bit
+  TIMSK2 &= ~_BV(OCIE2A);
+  _rxBits = 9;
+  if (level)
+    store(_rxByte);
+  else
+    _framing_errors++;
+}
+
+#endif
   
 
 
@@ -127,6 +206,8 @@ void AFSoftSerial::begin(long speed)
 
   pinMode(_receivePin, INPUT); 
   digitalWrite(_receivePin, HIGH);  // pullup!
+  _receive_buffer_head = _receive_buffer_tail = 0;
+  _receive_overflows = 0;
 
   _baudRate = speed;
   switch (_baudRate) {
@@ -150,14 +231,41 @@ void AFSoftSerial::begin(long speed)
     _bitDelay = 0;
   }    
 
+#ifndef AFSS_BUSY_RX
+  // Timer2 clock, so that 1.5 bit times fit its 8 bits
+  uint8_t prescale, cs;
+  if (_baudRate >= 19200) {
+    prescale = 8;  cs = _BV(CS21);
+  } else if (_baudRate >= 4800) {
+    prescale = 32; cs = _BV(CS21) | _BV(CS20);
+  } else {
+    prescale = 64; cs = _BV(CS22);
+  }
+  _bitTicks = (F_CPU / prescale + _baudRate / 2) / _baudRate;
+  _firstTicks = (F_CPU * 3 / 2 / _baudRate - 2 * AFSS_ISR_CYCLES) / prescale;
+  _framing_errors = 0;
+  _rxBits = 9;
+  cli();
+  TCCR2A = _BV(WGM21);          // CTC on OCR2A
+  TCCR2B = cs;
+  TIMSK2 &= ~_BV(OCIE2A);
+  sei();
+#endif
+
    if (_receivePin < 8) {
      // a PIND pin, PCINT16-23
      PCMSK2 |= _BV(_receivePin);
      PCICR |= _BV(2);
+#ifndef AFSS_BUSY_RX
+     _receivePCMSK = &PCMSK2; _receivePCBit = _receivePin; _receivePCIE = 2;
+#endif
   } else if (_receivePin <= 13) {
     // a PINB pin, PCINT0-5
     PCICR |= _BV(0);    
     PCMSK0 |= _BV(_receivePin-8);
+#ifndef AFSS_BUSY_RX
+    _receivePCMSK = &PCMSK0; _receivePCBit = _receivePin - 8; _receivePCIE = 0;
+#endif
   } 
 
   whackDelay(_bitDelay*2); // if we were low this establishes the end
@@ -165,24 +273,36 @@ void AFSoftSerial::begin(long speed)
 
 int AFSoftSerial::read(void)
 {
-  uint8_t d,i;
+  uint8_t d;
+  uint8_t tail = _receive_buffer_tail;
 
-  if (! _receive_buffer_index)
+  if (tail == _receive_buffer_head)
     return -1;
 
-  d = _receive_buffer[0]; // grab first byte
-  // if we were awesome we would do some nifty queue action
-  // sadly, i dont care
-  for (i=0; i<_receive_buffer_index; i++) {
-    _receive_buffer[i] = _receive_buffer[i+1];
-  }
-  _receive_buffer_index--;
+  d = _receive_buffer[tail % AFSS_MAX_RX_BUFF]; // grab oldest byte
+  _receive_buffer_tail = tail + 1;  // only now may recv() reuse it
   return d;
 }
 
 uint8_t AFSoftSerial::available(void)
 {
-  return _receive_buffer_index;
+  return (uint8_t)(_receive_buffer_head - _receive_buffer_tail);
+}
+
+// bytes dropped since begin() because read() didn't keep up
+uint8_t AFSoftSerial::overflows(void)
+{
+  return _receive_overflows;
+}
+
+// bytes dropped since begin() for not ending in a stop bit
+uint8_t AFSoftSerial::framingErrors(void)
+{
+#ifdef AFSS_BUSY_RX
+  return 0;
+#else
+  return _framing_errors;
+#endif
 }
 
 void AFSoftSerial::print(uint8_t b)
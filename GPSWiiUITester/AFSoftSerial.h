@@ -39,6 +39,8 @@ class AFSoftSerial
     void begin(long);
     int read();
     uint8_t available(void);
+    uint8_t overflows(void);
+    uint8_t framingErrors(void);
     void print(char);
     void print(const char[]);
     void print(uint8_t);
@@ -17,6 +17,7 @@
 #define sensorUpdateMillis (1000/sensorUpdatesPerSec)
 #define sensorPacketSize 7   // "|xxyyzz" 7 bytes
 #define sensorBuffSize ((sensorPacketSize*sensorUpdatesPerSec)+5)
+#define uiBaud 4800          // GPSWiiUI's loggerBaud
 
 #define uiOutPin 7
 #define uiInPin 6
@@ -36,7 +37,7 @@ uint8_t i;
 void setup() 
 {
     Serial.begin(19200);     // this would normally be 4800 to the GPS
-    uiSerial.begin(19200);  // talk to GPSWiiGUI uses SoftSerial defines above
+    uiSerial.begin(uiBaud);  // talk to GPSWiiUI the way the logger does
 
     Serial.println("\r\nReady!");
 }
@@ -52,7 +53,7 @@ void loop()
         Serial.println("Getting sensor data");
         char buf[8] = "s123456";
         millisToTime( buf+1, thistime);
-        uiSerial.print(buf);
+        uiSerial.println(buf);  // GPSWiiUI takes a command a line
         
         unsigned long t1 = millis();
         readline();
@@ -26,8 +26,10 @@
 /******************************************************************************
  * Includes
  ******************************************************************************/
+#include <string.h>
 #include <avr/interrupt.h>
 #include "WConstants.h"
+#include "pins_arduino.h"
 
 #include "LCDSerial.h"
 
@@ -40,10 +42,59 @@
 #define LCD_BACKLIGHT_MIN     ((uint8_t)128)
 #define LCD_BACKLIGHT_MAX     ((uint8_t)157)
 
-#define putc(x) print((char)x)
+#define putc(x) send((uint8_t)x)
+
+// changes this close together are sent as one run, the unchanged chars
+// between them costing less than moving the cursor over them
+#define LCD_RUN_GAP 1
 
 static int _bitDelay;
 
+#if !LCD_TX_BLOCKING
+
+#if LCD_TX_QUEUE & (LCD_TX_QUEUE - 1)
+#error "LCD_TX_QUEUE must be a power of two"
+#endif
+
+// the Timer2 interrupt's side, for the one LCDSerial there is
+static volatile uint8_t* _txPort;
+static uint8_t _txMask;
+static uint8_t _txQueue[LCD_TX_QUEUE];
+static volatile uint8_t _txHead;       // where send() puts the next one
+static volatile uint8_t _txTail;       // where the interrupt takes it
+static uint8_t _txByte;                // bits of it still to go out
+static uint8_t _txBit;                 // 0 start bit next, 1-8 data, 9 stop
+
+// one bit time: start bit, data bits low first, stop bit, or, with
+// nothing left to send, turns itself off
+SIGNAL(SIG_OUTPUT_COMPARE2A)
+{
+  if (_txBit == 0) {
+    if (_txHead == _txTail) {
+      TIMSK2 &= ~_BV(OCIE2A);
+      return;
+    }
+    _txByte = _txQueue[_txTail % LCD_TX_QUEUE];
+    _txTail++;
+    *_txPort &= ~_txMask;
+    _txBit = 1;
+  }
+  else if (_txBit <= 8) {
+    if (_txByte & 1)
+      *_txPort |= _txMask;
+    else
+      *_txPort &= ~_txMask;
+    _txByte >>= 1;
+    _txBit++;
+  }
+  else {
+    *_txPort |= _txMask;
+    _txBit = 0;
+  }
+}
+
+#endif
+
 #if (F_CPU == 16000000)
 void LCDwhackDelay(uint16_t delay) { 
   uint8_t tmp=0;
@@ -64,6 +115,7 @@ LCDSerial::LCDSerial(uint8_t transmitPin)
 {
   _transmitPin = transmitPin;
   _baudRate = 0;
+  _bytesSent = 0;
 }
 
 void LCDSerial::begin(long speed)
@@ -95,7 +147,81 @@ void LCDSerial::begin(long speed)
 
   LCDwhackDelay(_bitDelay*2); // if we were low this establishes the end
 
+#if !LCD_TX_BLOCKING
+  _txPort = portOutputRegister(digitalPinToPort(_transmitPin));
+  _txMask = digitalPinToBitMask(_transmitPin);
+  _txHead = _txTail = 0;
+  _txBit = 0;
+  // Timer2 in CTC mode, a compare match every bit time
+  uint16_t ticks = F_CPU / 8 / _baudRate;
+  cli();
+  TCCR2A = _BV(WGM21);
+  if (ticks <= 256) {
+    TCCR2B = _BV(CS21);                  // clk/8
+  } else {
+    ticks /= 4;
+    TCCR2B = _BV(CS21) | _BV(CS20);      // clk/32, 2400 baud or less
+  }
+  OCR2A = ticks - 1;
+  TIMSK2 &= ~_BV(OCIE2A);
+  sei();
+#endif
+
   // send ctrl-r to reset to 9600 baud?
+
+  // don't know what's on the LCD, so the first update() sends it all
+  memset(_frame, ' ', sizeof(_frame));
+  memset(_shown, 0, sizeof(_shown));
+  _line = _pos = 0;
+  _cursorLine = 0xff;
+}
+
+// Sends what changed in the frame since the last call.  Returns the
+// bytes that took, commands included, about 1ms each at 9600 baud.
+uint8_t LCDSerial::update(void)
+{
+  unsigned long before = _bytesSent;
+  for (uint8_t line = 0; line < LCD_LINES; line++) {
+    uint8_t* frame = _frame[line];
+    uint8_t* shown = _shown[line];
+    uint8_t pos = 0;
+    while (pos < LCD_COLS) {
+      if (frame[pos] == shown[pos]) {
+        pos++;
+        continue;
+      }
+      // find the end of the run
+      uint8_t last = pos;
+      for (uint8_t p = pos + 1; p < LCD_COLS && p - last <= LCD_RUN_GAP + 1; p++) {
+        if (frame[p] != shown[p])
+          last = p;
+      }
+      if (_cursorLine != line || _cursorPos != pos)
+        gotoPosNow(line, pos);
+      for (; pos <= last; pos++) {
+        send(frame[pos]);
+        shown[pos] = frame[pos];
+      }
+      _cursorLine = line;
+      _cursorPos = pos;
+    }
+  }
+  return (uint8_t)(_bytesSent - before);
+}
+
+// Waits for the bytes sent so far to be out on the wire.
+void LCDSerial::flush(void)
+{
+#if !LCD_TX_BLOCKING
+  while (TIMSK2 & _BV(OCIE2A))
+    ;
+#endif
+}
+
+// Returns the bytes sent to the LCD since it was set up.
+unsigned long LCDSerial::bytesSent(void)
+{
+  return _bytesSent;
 }
 
 // command functions
@@ -104,14 +230,24 @@ void LCDSerial::clearScreen(void)
 {
     putc( LCD_CMD );
     putc( LCD_CMD_CLEAR_SCREEN );
+    memset(_frame, ' ', sizeof(_frame));
+    memset(_shown, ' ', sizeof(_shown));
+    _line = _pos = 0;
+    _cursorLine = _cursorPos = 0;
 }
 
+// these only say where the next print() draws, see update()
 void LCDSerial::gotoLine(uint8_t line)
 {
-    putc( LCD_CMD );
-    putc( (line) ? LCD_CMD_POS_LINE_TWO : LCD_CMD_POS_LINE_ONE);
+    gotoPos( line, 0 );
 }
 void LCDSerial::gotoPos(uint8_t line, uint8_t pos)
+{
+    _line = (line) ? 1 : 0;
+    _pos = pos;
+}
+
+void LCDSerial::gotoPosNow(uint8_t line, uint8_t pos)
 {
     putc( LCD_CMD );
     putc( (pos + ((line) ? LCD_CMD_POS_LINE_TWO : LCD_CMD_POS_LINE_ONE)));
@@ -129,14 +265,47 @@ void LCDSerial::backlightOff(void)
     putc( LCD_BACKLIGHT_MIN );
 }
 
+// draws a char into the frame, dropping any past the end of the line
+void LCDSerial::print(uint8_t b)
+{
+  if (_pos < LCD_COLS)
+    _frame[_line][_pos++] = b;
+}
+
+#if !LCD_TX_BLOCKING
+
+// queues a byte for the Timer2 interrupt, waiting for room if need be
+void LCDSerial::send(uint8_t b)
+{
+  if (_baudRate == 0)
+    return;
+  _bytesSent++;
+
+  while ((uint8_t)(_txHead - _txTail) == LCD_TX_QUEUE)
+    ;
+  _txQueue[_txHead % LCD_TX_QUEUE] = b;
+  cli();
+  _txHead++;
+  if (!(TIMSK2 & _BV(OCIE2A))) {
+    // idle: the start bit goes out a bit time from now
+    TCNT2 = 0;
+    TIFR2 = _BV(OCF2A);
+    TIMSK2 |= _BV(OCIE2A);
+  }
+  sei();
+}
+
+#else
+
 //
 // the main method that does it all
 //
-void LCDSerial::print(uint8_t b)
+void LCDSerial::send(uint8_t b)
 {
   if (_baudRate == 0)
     return;
   byte mask;
+  _bytesSent++;
 
   cli();  // turn off interrupts for a clean txmit
 
@@ -158,6 +327,8 @@ void LCDSerial::print(uint8_t b)
   LCDwhackDelay(_bitDelay*2);
 }
 
+#endif
+
 void LCDSerial::print(const char *s)
 {
   while (*s)
@@ -12,16 +12,48 @@
 #define BIN 2
 #define BYTE 0
 
+#define LCD_LINES 2
+#define LCD_COLS 16
+
+// 1 to send each byte by bit-banging with interrupts off, ~1ms a byte
+// at 9600 baud.  Otherwise bytes go into a queue of LCD_TX_QUEUE and the
+// Timer2 compare interrupt clocks them out a bit at a time, so sending
+// only waits if the queue is full.  That takes Timer2, so no PWM on
+// pins 3 and 11 and no tone().
+#ifndef LCD_TX_BLOCKING
+#define LCD_TX_BLOCKING 0
+#endif
+
+// bytes waiting to go out, a power of two
+#ifndef LCD_TX_QUEUE
+#define LCD_TX_QUEUE 32
+#endif
+
+// Nothing printed goes out right away: print() and friends draw into a
+// frame at the position set by gotoPos(), and update() sends only what
+// changed since the last update(), a cursor move (2 bytes) and a run of
+// chars for each stretch of changes.  clearScreen() and the backlight
+// commands go out at once.
 class LCDSerial
 {
   private:
     long _baudRate;
     uint8_t _transmitPin;
+    uint8_t _frame[LCD_LINES][LCD_COLS];   // what's been drawn
+    uint8_t _shown[LCD_LINES][LCD_COLS];   // what the LCD has
+    uint8_t _line, _pos;                   // where print() draws next
+    uint8_t _cursorLine, _cursorPos;       // where the LCD's cursor is
+    unsigned long _bytesSent;
+    void send(uint8_t);
+    void gotoPosNow(uint8_t line, uint8_t pos);
     void printNumber(unsigned long, uint8_t);
 
   public:
     LCDSerial(uint8_t lcdPin);
     void begin(long speed);
+    uint8_t update(void);
+    void flush(void);
+    unsigned long bytesSent(void);
     void clearScreen(void);
     void gotoLine(uint8_t line);
     void gotoPos(uint8_t line, uint8_t pos);
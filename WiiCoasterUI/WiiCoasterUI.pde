@@ -92,6 +92,7 @@ void setup()
     lcdSerial.begin(9600);       // this goes to the LCD, don't change baud!
     lcdSerial.clearScreen();
     lcdSerial.print("WiiCoasterUI");
+    lcdSerial.update();
 
     wiichuck_setpowerpins();
     delay(100);
@@ -249,6 +250,7 @@ void loop()
             lcdSerial.print( buff );
             if(i!=2) lcdSerial.print(',');
         }
+        lcdSerial.update();  // only sends what changed
     }
 
     
@@ -177,11 +177,20 @@ float convertToGs( int v ) {
     //return ((float)(v-127)*range)/127/2;  // centered around 127
     return map( v-127, -128, 127, -range/2, range/2);
 }
+// same for a 10-bit value
+float convert10ToGs( int v ) {
+    return map( v/4.0-127, -128, 127, -range/2, range/2);
+}
 
 //
 // Parse an open file for GPSWiiLogger data
 // format is: 
 // GPRMC line, '|'-separated XYZ hex-coded accelerometer data line, ...
+// or, from pods sending 10-bit samples, '!'-separated 5 char groups of
+// 6 bits each ('0'+0 to '0'+63), x<<20|y<<10|z, most significant first
+// or, delta coded, '#' and such a group every few samples and in between
+// each axis' zig-zagged change, 5 bits a char ('0'+0 to '0'+31) low bits
+// first, 32 added to all but a number's last char
 //
 ArrayList parseFile( File file ) {
     println("parseFile: "+file);
@@ -212,14 +221,44 @@ ArrayList parseFile( File file ) {
             if(debug) println("tmillis:"+tmillis);
             millistamp = tmillis;
         }
+        else if( l.indexOf('#') >= 0 ) {  // delta coded datapoints
+            ArrayList vs = decodeDelta( l.substring(l.indexOf('#')) );
+            if( vs.size() == 0 ) continue; // bad line
+            int millistep = 1000/vs.size();
+            for( int j=0; j< vs.size(); j++ ) {
+                int v = ((Integer)vs.get(j)).intValue();
+                DataPoint dp = new DataPoint( convert10ToGs((v >> 20) & 0x3ff),
+                                              convert10ToGs((v >> 10) & 0x3ff),
+                                              convert10ToGs(v & 0x3ff), millistamp);
+                ldp = dp;
+                millistamp += millistep;
+                dps.add( dp );
+            }
+        }
         else {          // otherwise line contains |-separated datapoints
-            String[] strs = split(l, '|');
+            boolean wide = l.indexOf('!') >= 0;
+            String[] strs = split(l, wide ? '!' : '|');
             if(debug) println("data strs len:"+strs.length);
             if( strs.length <= 1 ) continue; // bad line
             int millistep = 1000/(strs.length-1);
             for( int j=0; j< strs.length; j++  ) {
                 String xyzstr = strs[j];
-                if( xyzstr != null && xyzstr.length() == 6 ) {
+                if( wide && xyzstr != null && xyzstr.length() == 5 ) {
+                    int v = 0;
+                    for( int k=0; k<5; k++ )
+                        v = (v << 6) | (xyzstr.charAt(k) - '0');
+                    int x = (v >> 20) & 0x3ff;
+                    int y = (v >> 10) & 0x3ff;
+                    int z = v & 0x3ff;
+                    DataPoint dp = new DataPoint( convert10ToGs(x), convert10ToGs(y),
+                                                  convert10ToGs(z), millistamp);
+                    if( x == 0 && y == 0 && z == 0 ) // use last point if zero
+                        dp = ldp;
+                    ldp = dp;  // save this as last point
+                    millistamp += millistep;
+                    dps.add( dp );
+                }
+                else if( xyzstr != null && xyzstr.length() == 6 ) {
                     if(debug) print(" xyz:"+ xyzstr);
                     int x = Integer.parseInt( xyzstr.substring(0,2),16 );
                     int y = Integer.parseInt( xyzstr.substring(2,4),16 );
@@ -241,6 +280,42 @@ ArrayList parseFile( File file ) {
     return dps;
 }
 
+// decodes a delta coded line into x<<20|y<<10|z values, stopping at
+// the first char that doesn't belong
+ArrayList decodeDelta( String s ) {
+    ArrayList vs = new ArrayList();
+    int[] xyz = new int[3];
+    int k = 0;
+    while( k < s.length() ) {
+        if( s.charAt(k) == '#' ) {
+            if( k+6 > s.length() ) break;
+            int v = 0;
+            for( int j=1; j<6; j++ )
+                v = (v << 6) | (s.charAt(k+j) - '0');
+            for( int a=0; a<3; a++ )
+                xyz[a] = (v >> (20-10*a)) & 0x3ff;
+            k += 6;
+        } 
+        else if( vs.size() == 0 ) {
+            break;      // changes need a '#' group first
+        }
+        else {
+            for( int a=0; a<3; a++ ) {
+                int z = 0, shift = 0, c = 0;
+                do {
+                    if( k >= s.length() ) return vs;
+                    c = s.charAt(k++) - '0';
+                    if( c < 0 || c > 63 ) return vs;
+                    z |= (c & 31) << shift;
+                    shift += 5;
+                } while( c >= 32 );
+                xyz[a] += ((z & 1) != 0) ? -((z+1) >> 1) : (z >> 1);
+            }
+        }
+        vs.add( new Integer( (xyz[0] << 20) | (xyz[1] << 10) | xyz[2] ) );
+    }
+    return vs;
+}
 
 // simple class to hold timestamped data points
 class DataPoint {